@@ -0,0 +1,271 @@
+#include "decoded_image_cache.h"
+#include <cstring>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t mix64(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+    return x;
+}
+
+// Two independent 64-bit lanes over 8-byte words (not cryptographic:
+// accidental collisions between different JPEGs are what matters here)
+static void hash_content(const uint8_t* data, size_t size, uint64_t out[2]) {
+    uint64_t h1 = 0x9e3779b97f4a7c15ull ^ size;
+    uint64_t h2 = 0x6a09e667f3bcc909ull + size;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        h1 = rotl64(h1 ^ (word * 0x87c37b91114253d5ull), 31) * 0x4cf5ad432745937full;
+        h2 = rotl64(h2 + word, 27) * 0x52dce729ull + 0x38495ab5ull;
+    }
+    uint64_t tail = 0;
+    if (i < size) {
+        std::memcpy(&tail, data + i, size - i);
+    }
+    out[0] = mix64(h1 ^ tail);
+    out[1] = mix64(h2 + tail + h1);
+}
+
+DecodedImageKey::DecodedImageKey()
+    : stamp()
+    , content()
+    , pixel_format(0)
+    , variant(DECODED_FULL)
+    , x(0), y(0), width(0), height(0) {
+}
+
+bool DecodedImageKey::set_file(const std::string& filename) {
+    path = filename;
+    content[0] = content[1] = 0;
+    return stat_file(filename, stamp);
+}
+
+void DecodedImageKey::set_memory(const uint8_t* data, size_t size) {
+    path.clear();
+    stamp.mtime = 0;
+    stamp.size = size;
+    hash_content(data, size, content);
+}
+
+bool DecodedImageKey::operator==(const DecodedImageKey& other) const {
+    return stamp.mtime == other.stamp.mtime && stamp.size == other.stamp.size &&
+           content[0] == other.content[0] && content[1] == other.content[1] &&
+           pixel_format == other.pixel_format && variant == other.variant &&
+           x == other.x && y == other.y && width == other.width && height == other.height &&
+           path == other.path;
+}
+
+size_t DecodedImageKeyHash::operator()(const DecodedImageKey& key) const {
+    uint64_t hash = std::hash<std::string>()(key.path);
+    const uint64_t fields[] = {
+        static_cast<uint64_t>(key.stamp.mtime), key.stamp.size, key.content[0], key.content[1],
+        (static_cast<uint64_t>(key.pixel_format) << 32) | static_cast<uint32_t>(key.variant),
+        (static_cast<uint64_t>(key.x) << 32) | static_cast<uint32_t>(key.y),
+        (static_cast<uint64_t>(key.width) << 32) | static_cast<uint32_t>(key.height)
+    };
+    for (uint64_t field : fields) {
+        hash = mix64(hash ^ field) + 0x9e3779b97f4a7c15ull;
+    }
+    return static_cast<size_t>(hash);
+}
+
+CachedImage::CachedImage(ArenaBlock* block, int width, int height, int channels)
+    : block_(block), width_(width), height_(height), channels_(channels) {
+}
+
+CachedImage::~CachedImage() {
+    ArenaBlock::release(block_);
+}
+
+struct DecodedImageCache::Entry {
+    Entry(const DecodedImageKey& k, std::shared_ptr<const CachedImage> img)
+        : key(k), image(std::move(img)), referenced(false) {
+    }
+
+    DecodedImageKey key;
+    std::shared_ptr<const CachedImage> image;
+    std::atomic<bool> referenced;  // set by hits (under the shared lock), cleared by the hand
+};
+
+struct DecodedImageCache::Shard {
+    typedef std::list<Entry> Ring;
+
+    Shard() : hand(ring.end()) {}
+
+    // Advance the CLOCK hand over at most one full turn of the ring (exclusive
+    // lock held), clearing reference bits until an unreferenced entry is found.
+    // The image is moved to victim so it is freed after the lock is released.
+    // Returns its size, or 0 if every entry was referenced (or the shard is empty).
+    size_t evict_one(std::shared_ptr<const CachedImage>& victim) {
+        for (size_t steps = ring.size(); steps > 0; --steps) {
+            if (hand == ring.end()) {
+                hand = ring.begin();
+            }
+            if (hand->referenced.exchange(false, std::memory_order_relaxed)) {
+                ++hand;
+                continue;
+            }
+            Ring::iterator entry = hand++;
+            victim = std::move(entry->image);
+            index.erase(entry->key);
+            ring.erase(entry);
+            return victim->bytes();
+        }
+        return 0;
+    }
+
+    std::shared_timed_mutex mutex;
+    Ring ring;
+    Ring::iterator hand;  // next entry the CLOCK hand looks at
+    std::unordered_map<DecodedImageKey, Ring::iterator, DecodedImageKeyHash> index;
+};
+
+DecodedImageCache& DecodedImageCache::instance() {
+    // Leaked on purpose: cached arrays may be released during interpreter shutdown
+    static DecodedImageCache* cache = new DecodedImageCache();
+    return *cache;
+}
+
+DecodedImageCache::DecodedImageCache()
+    : shards_(new Shard[NUM_SHARDS])
+    , budget_(0)
+    , bytes_(0)
+    , entries_(0)
+    , hand_shard_(0)
+    , hits_(0)
+    , misses_(0)
+    , evictions_(0) {
+}
+
+DecodedImageCache::~DecodedImageCache() = default;
+
+DecodedImageCache::Shard& DecodedImageCache::shard_for(const DecodedImageKey& key) {
+    // High bits: the low ones pick the unordered_map bucket within the shard
+    const uint64_t hash = DecodedImageKeyHash()(key);
+    return shards_[(hash >> 56) % NUM_SHARDS];
+}
+
+void DecodedImageCache::set_budget(size_t bytes) {
+    budget_.store(bytes, std::memory_order_relaxed);
+    if (bytes == 0) {
+        clear();
+    } else {
+        evict_to_budget();
+    }
+}
+
+std::shared_ptr<const CachedImage> DecodedImageCache::find(const DecodedImageKey& key) {
+    Shard& shard = shard_for(key);
+    {
+        std::shared_lock<std::shared_timed_mutex> lock(shard.mutex);
+        auto it = shard.index.find(key);
+        if (it != shard.index.end()) {
+            it->second->referenced.store(true, std::memory_order_relaxed);
+            hits_.fetch_add(1, std::memory_order_relaxed);
+            return it->second->image;
+        }
+    }
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+}
+
+std::shared_ptr<const CachedImage> DecodedImageCache::insert(const DecodedImageKey& key, ArenaBlock* block,
+                                                             int width, int height, int channels) {
+    std::shared_ptr<const CachedImage> image =
+        std::make_shared<CachedImage>(block, width, height, channels);
+    if (image->bytes() > budget()) {
+        return image;
+    }
+
+    Shard& shard = shard_for(key);
+    {
+        std::unique_lock<std::shared_timed_mutex> lock(shard.mutex);
+        auto it = shard.index.find(key);
+        if (it != shard.index.end()) {
+            // Decoded concurrently by another thread: share its copy, drop ours
+            it->second->referenced.store(true, std::memory_order_relaxed);
+            std::shared_ptr<const CachedImage> existing = it->second->image;
+            lock.unlock();
+            return existing;
+        }
+        // Just behind the hand: the last entry the next sweep reaches
+        Shard::Ring::iterator entry = shard.ring.emplace(shard.hand, key, image);
+        shard.index.emplace(key, entry);
+        // Counted under the lock, before any eviction of the entry can subtract it
+        bytes_.fetch_add(image->bytes(), std::memory_order_relaxed);
+        entries_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    evict_to_budget();
+    return image;
+}
+
+void DecodedImageCache::evict_to_budget() {
+    while (bytes_.load(std::memory_order_relaxed) > budget()) {
+        // The hand visits the shards in turn, at most one eviction per visit;
+        // a shard whose entries were all referenced gets its bits cleared and
+        // is passed over until the next round
+        bool nonempty = false;
+        for (size_t n = 0; n < NUM_SHARDS && bytes_.load(std::memory_order_relaxed) > budget(); ++n) {
+            Shard& shard = shards_[hand_shard_.fetch_add(1, std::memory_order_relaxed) % NUM_SHARDS];
+            std::shared_ptr<const CachedImage> victim;
+            size_t freed;
+            {
+                std::unique_lock<std::shared_timed_mutex> lock(shard.mutex);
+                nonempty |= !shard.ring.empty();
+                freed = shard.evict_one(victim);
+            }
+            if (freed > 0) {
+                bytes_.fetch_sub(freed, std::memory_order_relaxed);
+                entries_.fetch_sub(1, std::memory_order_relaxed);
+                evictions_.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        if (!nonempty) {
+            break;  // every shard empty
+        }
+    }
+}
+
+void DecodedImageCache::clear() {
+    for (size_t i = 0; i < NUM_SHARDS; ++i) {
+        Shard& shard = shards_[i];
+        Shard::Ring dropped;
+        {
+            std::unique_lock<std::shared_timed_mutex> lock(shard.mutex);
+            dropped.swap(shard.ring);
+            shard.index.clear();
+            shard.hand = shard.ring.end();
+        }
+        // Images are freed here, outside the lock
+        for (const Entry& entry : dropped) {
+            bytes_.fetch_sub(entry.image->bytes(), std::memory_order_relaxed);
+            entries_.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+}
+
+DecodedImageCacheStats DecodedImageCache::stats() const {
+    DecodedImageCacheStats stats;
+    stats.budget = budget();
+    stats.bytes = bytes_.load(std::memory_order_relaxed);
+    stats.entries = entries_.load(std::memory_order_relaxed);
+    stats.hits = hits_.load(std::memory_order_relaxed);
+    stats.misses = misses_.load(std::memory_order_relaxed);
+    stats.evictions = evictions_.load(std::memory_order_relaxed);
+    return stats;
+}
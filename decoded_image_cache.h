@@ -0,0 +1,135 @@
+#ifndef DECODED_IMAGE_CACHE_H
+#define DECODED_IMAGE_CACHE_H
+
+#include "jpeg_info_index.h"
+#include "scratch_arena.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// How an image was decoded; part of its cache key
+enum DecodedVariant {
+    DECODED_FULL = 0,   // accurate DCT, full size
+    DECODED_FAST_DCT,   // fast DCT, full size
+    DECODED_SCALED,     // width x height = max_width x max_height of decode_scaled
+    DECODED_REGION      // the x, y, width, height window of decode_region
+};
+
+// Identity of a decoded image: its source and every parameter that changes the pixels.
+// Files are identified by path + stamp, so a rewritten file misses; in-memory
+// data by a 128-bit content hash + size.
+struct DecodedImageKey {
+    std::string path;        // empty for in-memory data
+    JpegFileStamp stamp;     // files: mtime and size; memory: mtime 0, data size
+    uint64_t content[2];     // memory: content hash; files: 0
+    int pixel_format;        // PixelFormat of the decoder
+    int variant;             // DecodedVariant
+    int x, y, width, height; // DECODED_SCALED / DECODED_REGION parameters, else 0
+
+    DecodedImageKey();
+
+    // Source identity of a file (stat only, the file is not read); false if missing
+    bool set_file(const std::string& filename);
+
+    // Source identity of in-memory JPEG data (one pass over the bytes)
+    void set_memory(const uint8_t* data, size_t size);
+
+    bool operator==(const DecodedImageKey& other) const;
+};
+
+struct DecodedImageKeyHash {
+    size_t operator()(const DecodedImageKey& key) const;
+};
+
+// Decoded pixels held by the cache, tightly packed (pitch = width * channels).
+// Owns its arena block: the memory is returned to the decoder arena when the
+// last reference (cache entry or numpy view) goes away.
+class CachedImage {
+public:
+    CachedImage(ArenaBlock* block, int width, int height, int channels);
+    ~CachedImage();
+
+    CachedImage(const CachedImage&) = delete;
+    CachedImage& operator=(const CachedImage&) = delete;
+
+    const uint8_t* data() const { return block_->data; }
+    int width() const { return width_; }
+    int height() const { return height_; }
+    int channels() const { return channels_; }
+    size_t bytes() const { return block_->capacity; }
+
+private:
+    ArenaBlock* block_;
+    int width_, height_, channels_;
+};
+
+struct DecodedImageCacheStats {
+    size_t budget;
+    size_t bytes;
+    size_t entries;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+};
+
+// Process-wide cache of decoded images under a byte budget.
+//
+// Entries are spread over shards by key hash; lookups take their shard's
+// lock shared, so concurrent readers do not serialize, and inserts take it
+// exclusively. Eviction is CLOCK: a hit sets the entry's reference bit,
+// the hand sweeping the shards in turn clears set bits and evicts the
+// first entry found without one, until the cache is back under budget.
+// Evicted images stay valid for whoever still holds them; their memory is
+// freed when the last holder lets go. All methods are thread-safe.
+class DecodedImageCache {
+public:
+    static DecodedImageCache& instance();
+
+    DecodedImageCache(const DecodedImageCache&) = delete;
+    DecodedImageCache& operator=(const DecodedImageCache&) = delete;
+
+    // Byte budget for cached pixels; 0 (the default) disables the cache and
+    // drops every entry, a smaller budget evicts down to it
+    void set_budget(size_t bytes);
+    size_t budget() const { return budget_.load(std::memory_order_relaxed); }
+    bool enabled() const { return budget() > 0; }
+
+    // Cached image for key (marked recently used), or nullptr
+    std::shared_ptr<const CachedImage> find(const DecodedImageKey& key);
+
+    // Cache a freshly decoded image, taking ownership of block. Returns the
+    // image to use: the existing entry if another thread cached key first,
+    // or an uncached image if it does not fit in the budget on its own.
+    std::shared_ptr<const CachedImage> insert(const DecodedImageKey& key, ArenaBlock* block,
+                                              int width, int height, int channels);
+
+    // Drop all entries (images still referenced elsewhere stay valid)
+    void clear();
+
+    DecodedImageCacheStats stats() const;
+
+private:
+    struct Entry;
+    struct Shard;
+
+    static const size_t NUM_SHARDS = 16;
+
+    DecodedImageCache();
+    ~DecodedImageCache();
+
+    Shard& shard_for(const DecodedImageKey& key);
+    void evict_to_budget();
+
+    std::unique_ptr<Shard[]> shards_;
+    std::atomic<size_t> budget_;
+    std::atomic<size_t> bytes_;
+    std::atomic<size_t> entries_;
+    std::atomic<size_t> hand_shard_;  // next shard the eviction hand visits
+    std::atomic<uint64_t> hits_;
+    std::atomic<uint64_t> misses_;
+    std::atomic<uint64_t> evictions_;
+};
+
+#endif // DECODED_IMAGE_CACHE_H
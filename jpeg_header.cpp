@@ -0,0 +1,205 @@
+#include "jpeg_header.h"
+#include <turbojpeg.h>
+#include <cstring>
+
+static inline int read_u16(const uint8_t* p) {
+    return (p[0] << 8) | p[1];
+}
+
+// Map luma sampling factors to TJSAMP_* (chroma components must be 1x1)
+static int classify_subsampling(const JpegHeader& header) {
+    if (header.components == 1) {
+        return TJSAMP_GRAY;
+    }
+    for (int i = 1; i < header.components && i < 4; ++i) {
+        if (header.h_samp[i] != 1 || header.v_samp[i] != 1) {
+            return TJSAMP_UNKNOWN;
+        }
+    }
+
+    const int h = header.h_samp[0];
+    const int v = header.v_samp[0];
+    if (h == 1 && v == 1) return TJSAMP_444;
+    if (h == 2 && v == 1) return TJSAMP_422;
+    if (h == 2 && v == 2) return TJSAMP_420;
+    if (h == 1 && v == 2) return TJSAMP_440;
+    if (h == 4 && v == 1) return TJSAMP_411;
+    if (h == 1 && v == 4) return TJSAMP_441;
+    return TJSAMP_UNKNOWN;
+}
+
+// EXIF orientation (tag 0x0112 in IFD0) from an APP1 segment, 0 if absent or malformed
+static int parse_exif_orientation(const uint8_t* seg, int length) {
+    if (length < 6 + 8 || std::memcmp(seg, "Exif\0\0", 6) != 0) {
+        return 0;
+    }
+    const uint8_t* tiff = seg + 6;
+    const size_t tiff_size = static_cast<size_t>(length - 6);
+
+    bool little_endian;
+    if (tiff[0] == 'I' && tiff[1] == 'I') {
+        little_endian = true;
+    } else if (tiff[0] == 'M' && tiff[1] == 'M') {
+        little_endian = false;
+    } else {
+        return 0;
+    }
+    auto u16 = [&](size_t offset) -> unsigned {
+        return little_endian ? tiff[offset] | (tiff[offset + 1] << 8)
+                             : (tiff[offset] << 8) | tiff[offset + 1];
+    };
+    auto u32 = [&](size_t offset) -> size_t {
+        return little_endian ? (static_cast<size_t>(u16(offset + 2)) << 16) | u16(offset)
+                             : (static_cast<size_t>(u16(offset)) << 16) | u16(offset + 2);
+    };
+
+    if (u16(2) != 42) {
+        return 0;
+    }
+    const size_t ifd = u32(4);
+    if (ifd > tiff_size || tiff_size - ifd < 2) {
+        return 0;
+    }
+    const unsigned entries = u16(ifd);
+    for (unsigned i = 0; i < entries; ++i) {
+        const size_t entry = ifd + 2 + 12 * static_cast<size_t>(i);
+        if (entry + 12 > tiff_size) {
+            break;
+        }
+        if (u16(entry) == 0x0112) {  // Orientation, SHORT
+            const unsigned value = u16(entry + 8);
+            return (u16(entry + 2) == 3 && value >= 1 && value <= 8) ? static_cast<int>(value) : 0;
+        }
+    }
+    return 0;
+}
+
+// TJCS_* the way libjpeg guesses it: Adobe APP14 transform, else YCbCr / CMYK
+static int classify_colorspace(int components, int adobe_transform) {
+    switch (components) {
+        case 1: return TJCS_GRAY;
+        case 3: return adobe_transform == 0 ? TJCS_RGB : TJCS_YCbCr;
+        case 4: return adobe_transform == 2 ? TJCS_YCCK : TJCS_CMYK;
+        default: return -1;
+    }
+}
+
+static bool parse_sof(const uint8_t* seg, int length, JpegHeader& header) {
+    // P(1) Y(2) X(2) Nf(1) then Nf * (C, HV, Tq)
+    if (length < 6) {
+        return false;
+    }
+    header.height = read_u16(seg + 1);
+    header.width = read_u16(seg + 3);
+    header.components = seg[5];
+    if (header.width == 0 || header.height == 0 ||   // height 0 = DNL, unsupported
+        header.components == 0 || length < 6 + 3 * header.components) {
+        return false;
+    }
+
+    header.max_h_samp = 1;
+    header.max_v_samp = 1;
+    for (int i = 0; i < header.components && i < 4; ++i) {
+        const uint8_t hv = seg[6 + 3 * i + 1];
+        header.h_samp[i] = hv >> 4;
+        header.v_samp[i] = hv & 0x0F;
+        if (header.h_samp[i] < 1 || header.v_samp[i] < 1) {
+            return false;
+        }
+        if (header.h_samp[i] > header.max_h_samp) header.max_h_samp = header.h_samp[i];
+        if (header.v_samp[i] > header.max_v_samp) header.max_v_samp = header.v_samp[i];
+    }
+    header.subsampling = classify_subsampling(header);
+    return true;
+}
+
+JpegHeaderStatus parse_jpeg_header(const uint8_t* data, size_t size,
+                                   JpegHeader& header, size_t& bytes_needed) {
+    std::memset(&header, 0, sizeof(header));
+    header.subsampling = TJSAMP_UNKNOWN;
+    header.colorspace = -1;
+    bytes_needed = 0;
+
+    if (size < 2) {
+        bytes_needed = 2;
+        return JPEG_HEADER_NEED_MORE;
+    }
+    if (data[0] != 0xFF || data[1] != 0xD8) {  // SOI
+        return JPEG_HEADER_INVALID;
+    }
+
+    bool have_frame = false;
+    int adobe_transform = -1;
+    size_t pos = 2;
+    while (true) {
+        // Every marker starts with 0xFF, optionally preceded by 0xFF fill bytes
+        if (pos + 2 > size) {
+            bytes_needed = pos + 2;
+            return JPEG_HEADER_NEED_MORE;
+        }
+        if (data[pos] != 0xFF) {
+            return JPEG_HEADER_INVALID;
+        }
+        const uint8_t marker = data[pos + 1];
+        if (marker == 0xFF) {
+            ++pos;
+            continue;
+        }
+
+        // Standalone markers without a length field
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD8)) {
+            pos += 2;
+            continue;
+        }
+        if (marker == 0xD9) {  // EOI before any scan
+            return JPEG_HEADER_INVALID;
+        }
+
+        if (pos + 4 > size) {
+            bytes_needed = pos + 4;
+            return JPEG_HEADER_NEED_MORE;
+        }
+        const int length = read_u16(data + pos + 2);
+        if (length < 2) {
+            return JPEG_HEADER_INVALID;
+        }
+        const size_t segment_end = pos + 2 + length;
+        if (segment_end > size) {
+            bytes_needed = segment_end;
+            return JPEG_HEADER_NEED_MORE;
+        }
+        const uint8_t* seg = data + pos + 4;
+        const int seg_len = length - 2;
+
+        if (marker >= 0xC0 && marker <= 0xCF &&
+            marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {  // SOFn (not DHT/JPG/DAC)
+            if (have_frame || !parse_sof(seg, seg_len, header)) {
+                return JPEG_HEADER_INVALID;
+            }
+            header.progressive = (marker & 0x03) == 0x02;
+            header.arithmetic = marker >= 0xC9;
+            header.sof_offset = pos;
+            have_frame = true;
+        } else if (marker == 0xDD) {  // DRI
+            if (seg_len < 2) {
+                return JPEG_HEADER_INVALID;
+            }
+            header.restart_interval = read_u16(seg);
+        } else if (marker == 0xE1 && header.orientation == 0) {  // APP1 (EXIF)
+            header.orientation = parse_exif_orientation(seg, seg_len);
+        } else if (marker == 0xEE && seg_len >= 12 && std::memcmp(seg, "Adobe", 5) == 0) {  // APP14
+            adobe_transform = seg[11];
+        } else if (marker == 0xDA) {  // SOS
+            if (!have_frame || seg_len < 1) {
+                return JPEG_HEADER_INVALID;
+            }
+            header.sos_offset = pos;
+            header.scan_components = seg[0];
+            header.scan_data_offset = segment_end;
+            header.colorspace = classify_colorspace(header.components, adobe_transform);
+            return JPEG_HEADER_OK;
+        }
+
+        pos = segment_end;
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef JPEG_HEADER_H
+#define JPEG_HEADER_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Lightweight JPEG marker parser.
+// Walks the marker segments from SOI up to the first SOS without touching
+// the entropy-coded data, so it only needs the first few KB of a file
+// (more when APPn segments such as EXIF thumbnails come first).
+
+enum JpegHeaderStatus {
+    JPEG_HEADER_OK = 0,
+    JPEG_HEADER_NEED_MORE,  // data ends inside the header, see bytes_needed
+    JPEG_HEADER_INVALID     // not a JPEG, or no frame before the first scan
+};
+
+struct JpegHeader {
+    int width;
+    int height;
+    int components;
+    int subsampling;          // TJSAMP_* value, TJSAMP_UNKNOWN (-1) if unusual
+    int h_samp[4];            // per-component sampling factors
+    int v_samp[4];
+    int max_h_samp;           // MCU is (8 * max_h_samp) x (8 * max_v_samp) pixels
+    int max_v_samp;
+    bool progressive;         // SOF2/6/10/14
+    bool arithmetic;          // SOF9..15
+    int restart_interval;     // MCUs between RST markers, 0 = none
+    int colorspace;           // TJCS_* value (from components and Adobe APP14), -1 if unknown
+    int orientation;          // EXIF orientation 1..8, 0 = no EXIF orientation tag
+    size_t sof_offset;        // offset of the SOF marker (0xFF byte)
+    size_t sos_offset;        // offset of the first SOS marker (0xFF byte)
+    size_t scan_data_offset;  // first byte of entropy-coded data
+    int scan_components;      // components in the first scan
+
+    // Channels the decoder produces by default (1 = gray, 3 = BGR)
+    int channels() const { return components == 1 ? 1 : 3; }
+};
+
+// Parse data[0, size). On JPEG_HEADER_NEED_MORE, bytes_needed is the
+// prefix length required to make progress (always > size).
+JpegHeaderStatus parse_jpeg_header(const uint8_t* data, size_t size,
+                                   JpegHeader& header, size_t& bytes_needed);
+
+#endif // JPEG_HEADER_H
@@ -0,0 +1,577 @@
+#include "jpeg_info_index.h"
+#include "jpeg_header.h"
+#include "native/WorkerPool.h"
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+#ifdef _WIN32
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#else
+    #include <dirent.h>
+    #include <sys/stat.h>
+#endif
+
+// File layout (native byte order):
+//   IndexHeader
+//   uint32_t buckets[bucket_count]      open addressing, linear probing
+//   IndexEntry entries[entry_count]
+//   char strings[strings_size]          paths, not NUL-terminated
+static const char INDEX_MAGIC[8] = { 'J', 'P', 'G', 'I', 'D', 'X', '0', '1' };
+static const uint32_t INDEX_VERSION = 1;
+static const uint32_t INDEX_BYTE_ORDER = 0x01020304;
+
+struct IndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t entry_count;
+    uint32_t bucket_count;   // power of two, at least twice entry_count
+    uint32_t reserved;
+    uint64_t strings_size;
+};
+
+struct IndexEntry {
+    uint64_t path_hash;
+    int64_t mtime;
+    uint64_t file_size;
+    uint64_t path_offset;
+    uint32_t path_length;
+    JpegInfo info;
+};
+
+static_assert(sizeof(JpegInfo) == 12, "JpegInfo is part of the index file format");
+static_assert(sizeof(IndexHeader) == 40, "IndexHeader is part of the index file format");
+static_assert(sizeof(IndexEntry) == 48, "IndexEntry is part of the index file format");
+
+static const size_t PROBE_CHUNK = 16 * 1024;
+
+// FNV-1a
+static uint64_t hash_path(const char* path, size_t length) {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= static_cast<uint8_t>(path[i]);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static bool has_jpeg_extension(const std::string& name) {
+    const size_t dot = name.rfind('.');
+    if (dot == std::string::npos) {
+        return false;
+    }
+    std::string ext = name.substr(dot + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(),
+                   [](char c) { return static_cast<char>(c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c); });
+    return ext == "jpg" || ext == "jpeg";
+}
+
+static std::string join_path(const std::string& dir, const std::string& name) {
+    if (!dir.empty() && (dir.back() == '/' || dir.back() == '\\')) {
+        return dir + name;
+    }
+    return dir + '/' + name;
+}
+
+bool stat_file(const std::string& path, JpegFileStamp& stamp) {
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &data) ||
+        (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+        return false;
+    }
+    stamp.mtime = static_cast<int64_t>((static_cast<uint64_t>(data.ftLastWriteTime.dwHighDateTime) << 32) |
+                                       data.ftLastWriteTime.dwLowDateTime);
+    stamp.size = (static_cast<uint64_t>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+#else
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+        return false;
+    }
+#if defined(__APPLE__)
+    stamp.mtime = static_cast<int64_t>(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    stamp.mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    stamp.size = static_cast<uint64_t>(st.st_size);
+#endif
+    return true;
+}
+
+static bool is_directory(const std::string& path) {
+#ifdef _WIN32
+    const DWORD attributes = GetFileAttributesA(path.c_str());
+    return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+#else
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+#endif
+}
+
+struct Candidate {
+    std::string path;
+    JpegFileStamp stamp;
+};
+
+// List one directory: JPEG files into files, subdirectories into dirs.
+// Symlinked / junction directories are not followed, so link cycles cannot
+// make the walk loop
+static void list_directory(const std::string& dir, std::vector<Candidate>& files,
+                           std::vector<std::string>& dirs) {
+#ifdef _WIN32
+    WIN32_FIND_DATAA entry;
+    HANDLE find = FindFirstFileA(join_path(dir, "*").c_str(), &entry);
+    if (find == INVALID_HANDLE_VALUE) {
+        std::cerr << "Failed to open directory: " << dir << std::endl;
+        return;
+    }
+    do {
+        const std::string name = entry.cFileName;
+        if (name == "." || name == "..") {
+            continue;
+        }
+        const std::string path = join_path(dir, name);
+        if (entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            if (!(entry.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)) {
+                dirs.push_back(path);
+            }
+        } else if (has_jpeg_extension(name)) {
+            Candidate candidate;
+            candidate.path = path;
+            candidate.stamp.mtime = static_cast<int64_t>(
+                (static_cast<uint64_t>(entry.ftLastWriteTime.dwHighDateTime) << 32) |
+                entry.ftLastWriteTime.dwLowDateTime);
+            candidate.stamp.size = (static_cast<uint64_t>(entry.nFileSizeHigh) << 32) | entry.nFileSizeLow;
+            files.push_back(std::move(candidate));
+        }
+    } while (FindNextFileA(find, &entry));
+    FindClose(find);
+#else
+    DIR* handle = opendir(dir.c_str());
+    if (!handle) {
+        std::cerr << "Failed to open directory: " << dir << std::endl;
+        return;
+    }
+    while (struct dirent* entry = readdir(handle)) {
+        const std::string name = entry->d_name;
+        if (name == "." || name == "..") {
+            continue;
+        }
+        const std::string path = join_path(dir, name);
+        bool directory;
+#ifdef DT_UNKNOWN
+        if (entry->d_type != DT_UNKNOWN) {
+            // File type from the directory entry itself: no lstat per entry
+            directory = entry->d_type == DT_DIR;
+        } else
+#endif
+        {
+            struct stat st;
+            if (lstat(path.c_str(), &st) != 0) {
+                continue;
+            }
+            directory = S_ISDIR(st.st_mode);
+        }
+        if (directory) {
+            dirs.push_back(path);
+            continue;
+        }
+        if (!has_jpeg_extension(name)) {
+            continue;
+        }
+        Candidate candidate;
+        candidate.path = path;
+        if (stat_file(path, candidate.stamp)) {  // follows file symlinks
+            files.push_back(std::move(candidate));
+        }
+    }
+    closedir(handle);
+#endif
+}
+
+// Collect the JPEG files below the given directories. The tree is walked one
+// level at a time, the directories of a level listed in parallel, so wide
+// trees (and slow, network-mounted ones) keep every thread busy
+static void walk_directories(std::vector<std::string> level, int num_threads,
+                             std::vector<Candidate>& out) {
+    while (!level.empty()) {
+        std::vector<std::vector<Candidate>> files(level.size());
+        std::vector<std::vector<std::string>> dirs(level.size());
+        for (size_t begin = 0; begin < level.size(); begin += INT_MAX) {
+            const int count = static_cast<int>(std::min<size_t>(level.size() - begin, INT_MAX));
+            parallelFor(count, num_threads, [&](int i) {
+                const size_t k = begin + static_cast<size_t>(i);
+                list_directory(level[k], files[k], dirs[k]);
+            });
+        }
+
+        std::vector<std::string> next;
+        for (size_t k = 0; k < level.size(); ++k) {
+            std::move(files[k].begin(), files[k].end(), std::back_inserter(out));
+            std::move(dirs[k].begin(), dirs[k].end(), std::back_inserter(next));
+        }
+        level.swap(next);
+    }
+}
+
+// Read just enough of the file to parse its header (quietly: scans meet
+// plenty of broken or mislabelled files)
+static bool read_info(const std::string& path, JpegInfo& info) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+        return false;
+    }
+    const size_t file_size = static_cast<size_t>(file.tellg());
+    file.seekg(0, std::ios::beg);
+
+    thread_local std::vector<uint8_t> buffer;
+    JpegHeader header;
+    size_t have = 0;
+    size_t want = std::min(file_size, PROBE_CHUNK);
+    while (true) {
+        buffer.resize(want);
+        if (!file.read(reinterpret_cast<char*>(buffer.data() + have),
+                       static_cast<std::streamsize>(want - have))) {
+            return false;
+        }
+        have = want;
+
+        size_t needed = 0;
+        JpegHeaderStatus status = parse_jpeg_header(buffer.data(), have, header, needed);
+        if (status == JPEG_HEADER_OK) {
+            break;
+        }
+        if (status == JPEG_HEADER_INVALID || have == file_size) {
+            return false;
+        }
+        want = std::min(file_size, std::max(needed, have * 2));
+    }
+
+    std::memset(&info, 0, sizeof(info));
+    info.width = static_cast<uint16_t>(header.width);
+    info.height = static_cast<uint16_t>(header.height);
+    info.restart_interval = static_cast<uint16_t>(header.restart_interval);
+    info.components = static_cast<uint8_t>(header.components);
+    info.subsampling = static_cast<int8_t>(header.subsampling);
+    info.colorspace = static_cast<int8_t>(header.colorspace);
+    info.orientation = static_cast<uint8_t>(header.orientation);
+    info.progressive = header.progressive ? 1 : 0;
+    info.arithmetic = header.arithmetic ? 1 : 0;
+    return true;
+}
+
+JpegInfoIndex::JpegInfoIndex()
+    : buckets_(nullptr)
+    , entries_(nullptr)
+    , strings_(nullptr)
+    , bucket_mask_(0)
+    , mapped_count_(0)
+    , strings_size_(0)
+    , shadowed_(0) {
+}
+
+size_t JpegInfoIndex::scan(const std::vector<std::string>& roots, int num_threads) {
+    std::vector<Candidate> candidates;
+    std::vector<std::string> directories;
+    for (const auto& root : roots) {
+        Candidate candidate;
+        if (stat_file(root, candidate.stamp)) {
+            candidate.path = root;
+            candidates.push_back(std::move(candidate));
+        } else if (is_directory(root)) {
+            directories.push_back(root);
+        } else {
+            std::cerr << "Failed to open file: " << root << std::endl;
+        }
+    }
+    walk_directories(std::move(directories), num_threads, candidates);
+
+    // Overlapping roots list a file more than once
+    std::sort(candidates.begin(), candidates.end(),
+              [](const Candidate& a, const Candidate& b) { return a.path < b.path; });
+    candidates.erase(std::unique(candidates.begin(), candidates.end(),
+                                 [](const Candidate& a, const Candidate& b) { return a.path == b.path; }),
+                     candidates.end());
+
+    // Only new or changed files need their headers read
+    std::vector<const Candidate*> changed;
+    for (const auto& candidate : candidates) {
+        JpegInfo info;
+        JpegFileStamp stamp;
+        if (!find(candidate.path, info, stamp) ||
+            stamp.mtime != candidate.stamp.mtime || stamp.size != candidate.stamp.size) {
+            changed.push_back(&candidate);
+        }
+    }
+
+    std::vector<Record> records(changed.size());
+    std::vector<uint8_t> parsed(changed.size(), 0);
+    for (size_t begin = 0; begin < changed.size(); begin += INT_MAX) {
+        const int count = static_cast<int>(std::min<size_t>(changed.size() - begin, INT_MAX));
+        parallelFor(count, num_threads, [&](int i) {
+            const size_t k = begin + static_cast<size_t>(i);
+            records[k].stamp = changed[k]->stamp;
+            parsed[k] = read_info(changed[k]->path, records[k].info) ? 1 : 0;
+        });
+    }
+
+    size_t added = 0;
+    for (size_t k = 0; k < changed.size(); ++k) {
+        if (parsed[k]) {
+            put(changed[k]->path, records[k]);
+            ++added;
+        }
+    }
+    return added;
+}
+
+bool JpegInfoIndex::add(const std::string& path) {
+    Record record;
+    if (!stat_file(path, record.stamp)) {
+        std::cerr << "Failed to open file: " << path << std::endl;
+        return false;
+    }
+    if (!read_info(path, record.info)) {
+        std::cerr << "Failed to read JPEG header: " << path << std::endl;
+        return false;
+    }
+    put(path, record);
+    return true;
+}
+
+void JpegInfoIndex::put(const std::string& path, const Record& record) {
+    auto it = added_.find(path);
+    if (it != added_.end()) {
+        it->second = record;
+        return;
+    }
+    if (find_mapped(path)) {
+        ++shadowed_;
+    }
+    added_.emplace(path, record);
+}
+
+const void* JpegInfoIndex::find_mapped(const std::string& path) const {
+    if (!buckets_) {
+        return nullptr;
+    }
+
+    const IndexEntry* entries = static_cast<const IndexEntry*>(entries_);
+    const uint64_t hash = hash_path(path.data(), path.size());
+    uint32_t slot = static_cast<uint32_t>(hash) & bucket_mask_;
+    for (uint32_t probes = 0; probes <= bucket_mask_; ++probes) {
+        const uint32_t bucket = buckets_[slot];
+        if (bucket == 0 || bucket > mapped_count_) {
+            return nullptr;
+        }
+        // Bounds checked here rather than at load(), which would touch every entry
+        const IndexEntry& entry = entries[bucket - 1];
+        if (entry.path_hash == hash && entry.path_length == path.size() &&
+            entry.path_offset <= strings_size_ && path.size() <= strings_size_ - entry.path_offset &&
+            std::memcmp(strings_ + entry.path_offset, path.data(), path.size()) == 0) {
+            return &entry;
+        }
+        slot = (slot + 1) & bucket_mask_;
+    }
+    return nullptr;
+}
+
+bool JpegInfoIndex::find(const std::string& path, JpegInfo& info) const {
+    JpegFileStamp stamp;
+    return find(path, info, stamp);
+}
+
+bool JpegInfoIndex::find(const std::string& path, JpegInfo& info, JpegFileStamp& stamp) const {
+    auto it = added_.find(path);
+    if (it != added_.end()) {
+        info = it->second.info;
+        stamp = it->second.stamp;
+        return true;
+    }
+
+    const IndexEntry* entry = static_cast<const IndexEntry*>(find_mapped(path));
+    if (!entry) {
+        return false;
+    }
+    info = entry->info;
+    stamp.mtime = entry->mtime;
+    stamp.size = entry->file_size;
+    return true;
+}
+
+size_t JpegInfoIndex::size() const {
+    return mapped_count_ - shadowed_ + added_.size();
+}
+
+bool JpegInfoIndex::save(const std::string& filename) {
+    // Merge both layers; sorted so the same records always give the same file
+    std::vector<std::pair<std::string, Record>> records;
+    records.reserve(size());
+    const IndexEntry* entries = static_cast<const IndexEntry*>(entries_);
+    for (size_t i = 0; i < mapped_count_; ++i) {
+        if (entries[i].path_offset > strings_size_ ||
+            entries[i].path_length > strings_size_ - entries[i].path_offset) {
+            continue;
+        }
+        std::string path(strings_ + entries[i].path_offset, entries[i].path_length);
+        if (added_.count(path) == 0) {
+            Record record;
+            record.stamp.mtime = entries[i].mtime;
+            record.stamp.size = entries[i].file_size;
+            record.info = entries[i].info;
+            records.emplace_back(std::move(path), record);
+        }
+    }
+    for (const auto& item : added_) {
+        records.push_back(item);
+    }
+    std::sort(records.begin(), records.end(),
+              [](const std::pair<std::string, Record>& a, const std::pair<std::string, Record>& b) {
+                  return a.first < b.first;
+              });
+
+    uint32_t bucket_count = 2;
+    while (bucket_count < records.size() * 2) {
+        if (bucket_count > UINT32_MAX / 2) {
+            std::cerr << "Too many records for one index" << std::endl;
+            return false;
+        }
+        bucket_count <<= 1;
+    }
+
+    std::vector<uint32_t> buckets(bucket_count, 0);
+    std::vector<IndexEntry> out(records.size());
+    uint64_t strings_size = 0;
+    for (size_t i = 0; i < records.size(); ++i) {
+        const std::string& path = records[i].first;
+        IndexEntry& entry = out[i];
+        std::memset(&entry, 0, sizeof(entry));
+        entry.path_hash = hash_path(path.data(), path.size());
+        entry.mtime = records[i].second.stamp.mtime;
+        entry.file_size = records[i].second.stamp.size;
+        entry.path_offset = strings_size;
+        entry.path_length = static_cast<uint32_t>(path.size());
+        entry.info = records[i].second.info;
+        strings_size += path.size();
+
+        uint32_t slot = static_cast<uint32_t>(entry.path_hash) & (bucket_count - 1);
+        while (buckets[slot] != 0) {
+            slot = (slot + 1) & (bucket_count - 1);
+        }
+        buckets[slot] = static_cast<uint32_t>(i + 1);
+    }
+
+    IndexHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header.version = INDEX_VERSION;
+    header.byte_order = INDEX_BYTE_ORDER;
+    header.entry_count = out.size();
+    header.bucket_count = bucket_count;
+    header.strings_size = strings_size;
+
+    const std::string temp = filename + ".tmp";
+    {
+        std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            std::cerr << "Failed to create file: " << temp << std::endl;
+            return false;
+        }
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(buckets.data()),
+                   static_cast<std::streamsize>(buckets.size() * sizeof(uint32_t)));
+        file.write(reinterpret_cast<const char*>(out.data()),
+                   static_cast<std::streamsize>(out.size() * sizeof(IndexEntry)));
+        for (const auto& record : records) {
+            file.write(record.first.data(), static_cast<std::streamsize>(record.first.size()));
+        }
+        if (!file.flush()) {
+            std::cerr << "Failed to write file: " << temp << std::endl;
+            file.close();
+            std::remove(temp.c_str());
+            return false;
+        }
+    }
+
+    // Windows cannot replace a mapped file, so drop the mapping first
+    // (every record is held in records at this point)
+    clear();
+#ifdef _WIN32
+    const bool replaced = MoveFileExA(temp.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    const bool replaced = std::rename(temp.c_str(), filename.c_str()) == 0;
+#endif
+    if (!replaced || !load(filename)) {
+        if (!replaced) {
+            std::cerr << "Failed to replace file: " << filename << std::endl;
+            std::remove(temp.c_str());
+        }
+        for (auto& record : records) {
+            put(record.first, record.second);
+        }
+        return false;
+    }
+    return true;
+}
+
+bool JpegInfoIndex::load(const std::string& filename) {
+    clear();
+    if (!file_.open(filename)) {
+        return false;
+    }
+
+    const uint8_t* data = file_.data();
+    const size_t size = file_.size();
+    IndexHeader header;
+    bool valid = size >= sizeof(header);
+    if (valid) {
+        std::memcpy(&header, data, sizeof(header));
+        valid = std::memcmp(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) == 0 &&
+                header.version == INDEX_VERSION && header.byte_order == INDEX_BYTE_ORDER &&
+                header.bucket_count >= 2 && (header.bucket_count & (header.bucket_count - 1)) == 0 &&
+                header.entry_count < header.bucket_count;
+    }
+    if (valid) {
+        const uint64_t expected = sizeof(header) + uint64_t(header.bucket_count) * sizeof(uint32_t) +
+                                  header.entry_count * sizeof(IndexEntry) + header.strings_size;
+        valid = expected == size;
+    }
+    if (!valid) {
+        std::cerr << "Invalid JPEG info index: " << filename << std::endl;
+        file_.close();
+        return false;
+    }
+
+    buckets_ = reinterpret_cast<const uint32_t*>(data + sizeof(header));
+    const IndexEntry* entries =
+        reinterpret_cast<const IndexEntry*>(buckets_ + header.bucket_count);
+    strings_ = reinterpret_cast<const char*>(entries + header.entry_count);
+    entries_ = entries;
+    bucket_mask_ = header.bucket_count - 1;
+    mapped_count_ = static_cast<size_t>(header.entry_count);
+    strings_size_ = header.strings_size;
+    return true;
+}
+
+void JpegInfoIndex::clear() {
+    file_.close();
+    buckets_ = nullptr;
+    entries_ = nullptr;
+    strings_ = nullptr;
+    bucket_mask_ = 0;
+    mapped_count_ = 0;
+    strings_size_ = 0;
+    shadowed_ = 0;
+    added_.clear();
+}
@@ -0,0 +1,103 @@
+#ifndef JPEG_INFO_INDEX_H
+#define JPEG_INFO_INDEX_H
+
+#include "mapped_file.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Header fields of one JPEG, packed for the on-disk index (12 bytes)
+struct JpegInfo {
+    uint16_t width;
+    uint16_t height;
+    uint16_t restart_interval;  // MCUs between RST markers, 0 = none
+    uint8_t components;
+    int8_t subsampling;         // TJSAMP_* value, -1 if unusual
+    int8_t colorspace;          // TJCS_* value, -1 if unknown
+    uint8_t orientation;        // EXIF orientation 1..8, 0 = none
+    uint8_t progressive;
+    uint8_t arithmetic;
+};
+
+// File identity an index record was built from: a record is stale once
+// either value changes. mtime is in the platform's native file time units
+// (ns since the epoch on POSIX, 100 ns FILETIME ticks on Windows)
+struct JpegFileStamp {
+    int64_t mtime;
+    uint64_t size;
+};
+
+// Stamp of a regular file; false for directories, missing files, etc.
+bool stat_file(const std::string& path, JpegFileStamp& stamp);
+
+// Header metadata cache for large image corpora.
+//
+// scan() walks directories and reads only the marker segments up to the
+// first SOS of each new or changed JPEG (both in parallel on the shared native
+// thread pool), keeping the results keyed by path. save() writes them as a compact
+// binary hash table that load() memory-maps, so a saved index is usable
+// immediately, costs no parsing, and find() is an O(1) lookup without any
+// file I/O. Records added after load() live in memory on top of the mapped
+// file until the next save().
+//
+// Paths are matched byte for byte as they were scanned (root + '/' + name).
+// const methods may run concurrently; the others need exclusive access.
+class JpegInfoIndex {
+public:
+    JpegInfoIndex();
+
+    JpegInfoIndex(const JpegInfoIndex&) = delete;
+    JpegInfoIndex& operator=(const JpegInfoIndex&) = delete;
+
+    // Index every .jpg / .jpeg below each root (roots may also name single
+    // files, indexed whatever their extension). Files whose stamp matches
+    // their record are skipped; unreadable or invalid JPEGs are left out.
+    // num_threads as in parallelFor (0 = whole pool). Returns the number of
+    // files parsed.
+    size_t scan(const std::vector<std::string>& roots, int num_threads);
+
+    // Parse a single file into the index
+    bool add(const std::string& path);
+
+    // Record for path, without touching the file system
+    bool find(const std::string& path, JpegInfo& info) const;
+
+    // Record and the stamp it was taken from
+    bool find(const std::string& path, JpegInfo& info, JpegFileStamp& stamp) const;
+
+    size_t size() const;
+
+    // Write all records to filename (via a temporary file, so readers of the
+    // previous version are unaffected), then map the new file
+    bool save(const std::string& filename);
+
+    // Map an index written by save(), dropping all current records
+    bool load(const std::string& filename);
+
+    // Drop all records and the mapping
+    void clear();
+
+private:
+    struct Record {
+        JpegFileStamp stamp;
+        JpegInfo info;
+    };
+
+    const void* find_mapped(const std::string& path) const;
+    void put(const std::string& path, const Record& record);
+
+    MappedFile file_;
+    const uint32_t* buckets_;  // entry index + 1 per slot, 0 = empty
+    const void* entries_;
+    const char* strings_;
+    uint32_t bucket_mask_;
+    size_t mapped_count_;
+    uint64_t strings_size_;
+    size_t shadowed_;          // mapped entries replaced by a record in added_
+
+    std::unordered_map<std::string, Record> added_;
+};
+
+#endif // JPEG_INFO_INDEX_H
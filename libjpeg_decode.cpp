@@ -0,0 +1,222 @@
+#include "libjpeg_decode.h"
+#include "native/EncoderStats.h"
+#include <cstdio>
+#include <csetjmp>
+#include <cstring>
+#include <iostream>
+#include <jpeglib.h>
+
+namespace {
+
+// libjpeg reports fatal errors through error_exit, which must not return;
+// jump back to the setjmp in the decode function instead of exiting
+struct ErrorManager {
+    jpeg_error_mgr pub;
+    jmp_buf jump;
+    char message[JMSG_LENGTH_MAX];
+};
+
+void error_exit(j_common_ptr cinfo) {
+    ErrorManager* err = reinterpret_cast<ErrorManager*>(cinfo->err);
+    (*cinfo->err->format_message)(cinfo, err->message);
+    longjmp(err->jump, 1);
+}
+
+void output_message(j_common_ptr) {
+    // Warnings (e.g. corrupt data that was recovered) are not fatal
+}
+
+// libjpeg-turbo colorspace for each TJPF_* value (same order as turbojpeg.h)
+const J_COLOR_SPACE PIXEL_FORMAT_COLOR_SPACE[] = {
+    JCS_EXT_RGB, JCS_EXT_BGR, JCS_EXT_RGBX, JCS_EXT_BGRX, JCS_EXT_XBGR, JCS_EXT_XRGB,
+    JCS_GRAYSCALE, JCS_EXT_RGBA, JCS_EXT_BGRA, JCS_EXT_ABGR, JCS_EXT_ARGB, JCS_CMYK
+};
+
+} // namespace
+
+bool libjpeg_decode_region(const uint8_t* jpeg_data, size_t jpeg_size,
+                           int x, int y, int width, int height,
+                           int pixel_format, uint8_t* output, size_t pitch,
+                           std::vector<uint8_t>& scratch) {
+    if (!jpeg_data || jpeg_size == 0) {
+        std::cerr << "JPEG data is empty" << std::endl;
+        return false;
+    }
+
+    const int num_formats = static_cast<int>(sizeof(PIXEL_FORMAT_COLOR_SPACE) / sizeof(PIXEL_FORMAT_COLOR_SPACE[0]));
+    if (pixel_format < 0 || pixel_format >= num_formats) {
+        std::cerr << "Unsupported pixel format: " << pixel_format << std::endl;
+        return false;
+    }
+
+    jpeg_decompress_struct cinfo;
+    ErrorManager err;
+    cinfo.err = jpeg_std_error(&err.pub);
+    err.pub.error_exit = error_exit;
+    err.pub.output_message = output_message;
+
+    const long long start = statsClock();
+
+    // No automatic objects with destructors below this point: longjmp skips them
+    if (setjmp(err.jump)) {
+        std::cerr << "Failed to decode JPEG region: " << err.message << std::endl;
+        recordError();
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, jpeg_data, static_cast<unsigned long>(jpeg_size));
+    jpeg_read_header(&cinfo, TRUE);
+
+    if (x < 0 || y < 0 || width <= 0 || height <= 0 ||
+        static_cast<JDIMENSION>(x + width) > cinfo.image_width ||
+        static_cast<JDIMENSION>(y + height) > cinfo.image_height) {
+        std::cerr << "Region " << width << "x" << height << "+" << x << "+" << y
+                  << " is outside the " << cinfo.image_width << "x" << cinfo.image_height
+                  << " image" << std::endl;
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+
+    cinfo.out_color_space = PIXEL_FORMAT_COLOR_SPACE[pixel_format];
+    cinfo.dct_method = JDCT_ISLOW;
+    jpeg_start_decompress(&cinfo);
+
+    // Cropping widens the window to iMCU boundaries; keep the offset into it.
+    // Ask for max_h_samp_factor extra pixels on each side so the fancy
+    // upsampler sees the neighbouring chroma samples, as in a full decode
+    const int pad = cinfo.max_h_samp_factor;
+    const int left = x > pad ? x - pad : 0;
+    const int right = x + width + pad < static_cast<int>(cinfo.output_width)
+                          ? x + width + pad : static_cast<int>(cinfo.output_width);
+    JDIMENSION crop_x = static_cast<JDIMENSION>(left);
+    JDIMENSION crop_width = static_cast<JDIMENSION>(right - left);
+    jpeg_crop_scanline(&cinfo, &crop_x, &crop_width);
+
+    const size_t channels = static_cast<size_t>(cinfo.output_components);
+    const size_t row_bytes = static_cast<size_t>(width) * channels;
+    const size_t skip_bytes = static_cast<size_t>(x - static_cast<int>(crop_x)) * channels;
+    const size_t scratch_row = static_cast<size_t>(cinfo.output_width) * channels;
+    const int batch_rows = cinfo.rec_outbuf_height > 0 ? cinfo.rec_outbuf_height : 1;
+    if (scratch.size() < scratch_row * batch_rows) {
+        scratch.resize(scratch_row * batch_rows);
+    }
+
+    JSAMPROW rows[16];
+    const int max_rows = batch_rows < 16 ? batch_rows : 16;
+    for (int i = 0; i < max_rows; ++i) {
+        rows[i] = scratch.data() + i * scratch_row;
+    }
+
+    if (y > 0) {
+        jpeg_skip_scanlines(&cinfo, static_cast<JDIMENSION>(y));
+    }
+
+    int done = 0;
+    while (done < height) {
+        const int want = height - done < max_rows ? height - done : max_rows;
+        const JDIMENSION got = jpeg_read_scanlines(&cinfo, rows, static_cast<JDIMENSION>(want));
+        if (got == 0) {
+            std::cerr << "Failed to decode JPEG region: truncated data" << std::endl;
+            recordError();
+            jpeg_destroy_decompress(&cinfo);
+            return false;
+        }
+        for (JDIMENSION i = 0; i < got; ++i) {
+            std::memcpy(output + static_cast<size_t>(done + i) * pitch, rows[i] + skip_bytes, row_bytes);
+        }
+        done += static_cast<int>(got);
+    }
+
+    // Rows below the window are never decoded
+    jpeg_abort_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    recordStage(STATS_CODING, start, static_cast<long long>(jpeg_size));
+    return true;
+}
+
+bool libjpeg_decode_rows(const uint8_t* jpeg_data, size_t jpeg_size,
+                         int skip_rows, int rows,
+                         int pixel_format, uint8_t* output, size_t pitch,
+                         std::vector<uint8_t>& scratch) {
+    if (!jpeg_data || jpeg_size == 0) {
+        std::cerr << "JPEG data is empty" << std::endl;
+        return false;
+    }
+
+    const int num_formats = static_cast<int>(sizeof(PIXEL_FORMAT_COLOR_SPACE) / sizeof(PIXEL_FORMAT_COLOR_SPACE[0]));
+    if (pixel_format < 0 || pixel_format >= num_formats) {
+        std::cerr << "Unsupported pixel format: " << pixel_format << std::endl;
+        return false;
+    }
+
+    jpeg_decompress_struct cinfo;
+    ErrorManager err;
+    cinfo.err = jpeg_std_error(&err.pub);
+    err.pub.error_exit = error_exit;
+    err.pub.output_message = output_message;
+
+    const long long start = statsClock();
+
+    // No automatic objects with destructors below this point: longjmp skips them
+    if (setjmp(err.jump)) {
+        std::cerr << "Failed to decode JPEG rows: " << err.message << std::endl;
+        recordError();
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, jpeg_data, static_cast<unsigned long>(jpeg_size));
+    jpeg_read_header(&cinfo, TRUE);
+
+    if (skip_rows < 0 || rows <= 0 ||
+        static_cast<JDIMENSION>(skip_rows + rows) > cinfo.image_height) {
+        std::cerr << "Rows " << skip_rows << ".." << skip_rows + rows
+                  << " are outside the " << cinfo.image_height << "-row image" << std::endl;
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+
+    cinfo.out_color_space = PIXEL_FORMAT_COLOR_SPACE[pixel_format];
+    cinfo.dct_method = JDCT_ISLOW;
+    jpeg_start_decompress(&cinfo);
+
+    const size_t row_bytes = static_cast<size_t>(cinfo.output_width) * cinfo.output_components;
+    if (skip_rows > 0 && scratch.size() < row_bytes) {
+        scratch.resize(row_bytes);
+    }
+
+    JSAMPROW row = scratch.data();
+    for (int i = 0; i < skip_rows; ++i) {
+        if (jpeg_read_scanlines(&cinfo, &row, 1) != 1) {
+            std::cerr << "Failed to decode JPEG rows: truncated data" << std::endl;
+            recordError();
+            jpeg_destroy_decompress(&cinfo);
+            return false;
+        }
+    }
+
+    JSAMPROW rows_out[16];
+    int done = 0;
+    while (done < rows) {
+        int want = rows - done < 16 ? rows - done : 16;
+        for (int i = 0; i < want; ++i) {
+            rows_out[i] = output + static_cast<size_t>(done + i) * pitch;
+        }
+        const JDIMENSION got = jpeg_read_scanlines(&cinfo, rows_out, static_cast<JDIMENSION>(want));
+        if (got == 0) {
+            std::cerr << "Failed to decode JPEG rows: truncated data" << std::endl;
+            recordError();
+            jpeg_destroy_decompress(&cinfo);
+            return false;
+        }
+        done += static_cast<int>(got);
+    }
+
+    jpeg_abort_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    recordStage(STATS_CODING, start, static_cast<long long>(jpeg_size));
+    return true;
+}
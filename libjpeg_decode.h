@@ -0,0 +1,31 @@
+#ifndef LIBJPEG_DECODE_H
+#define LIBJPEG_DECODE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Decode paths that the TurboJPEG tj* API does not expose, implemented on
+// the underlying libjpeg API (same library, jpeglib.h).
+// Errors are reported on std::cerr and the functions return false.
+
+// Decode the width x height window at (x, y) into output (rows pitch bytes
+// apart, in TJPF_* pixel_format). Only the iMCU columns covering
+// the window are decoded (jpeg_crop_scanline) and rows above it are skipped
+// (jpeg_skip_scanlines); decoding stops after the last window row.
+// scratch is grow-only storage for the few cropped rows in flight.
+bool libjpeg_decode_region(const uint8_t* jpeg_data, size_t jpeg_size,
+                           int x, int y, int width, int height,
+                           int pixel_format, uint8_t* output, size_t pitch,
+                           std::vector<uint8_t>& scratch);
+
+// Decode jpeg_data from the top and keep rows [skip_rows, skip_rows + rows),
+// written straight into output pitch bytes apart. The skipped rows are still
+// decoded (into scratch) because they feed the upsampler of the kept rows;
+// decoding stops after the last kept row.
+bool libjpeg_decode_rows(const uint8_t* jpeg_data, size_t jpeg_size,
+                         int skip_rows, int rows,
+                         int pixel_format, uint8_t* output, size_t pitch,
+                         std::vector<uint8_t>& scratch);
+
+#endif // LIBJPEG_DECODE_H
@@ -0,0 +1,118 @@
+#include "mapped_file.h"
+#include "native/EncoderStats.h"
+#include <iostream>
+
+#ifdef _WIN32
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+MappedFile::MappedFile()
+    : data_(nullptr)
+    , size_(0) {
+}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(const std::string& filename) {
+    close();
+    StatsTimer timer(STATS_IO);
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                              nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        std::cerr << "Failed to open file: " << filename << std::endl;
+        recordError();
+        return false;
+    }
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+        std::cerr << "Failed to map empty or unreadable file: " << filename << std::endl;
+        recordError();
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (!mapping) {
+        std::cerr << "Failed to map file: " << filename << std::endl;
+        recordError();
+        return false;
+    }
+
+    // The view keeps the mapping object alive, so both handles can be closed now
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (!view) {
+        std::cerr << "Failed to map file: " << filename << std::endl;
+        recordError();
+        return false;
+    }
+
+    data_ = static_cast<const uint8_t*>(view);
+    size_ = static_cast<size_t>(file_size.QuadPart);
+#else
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Failed to open file: " << filename << std::endl;
+        recordError();
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        std::cerr << "Failed to map empty or unreadable file: " << filename << std::endl;
+        recordError();
+        ::close(fd);
+        return false;
+    }
+
+    // The mapping stays valid after the descriptor is closed
+    void* view = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (view == MAP_FAILED) {
+        std::cerr << "Failed to map file: " << filename << std::endl;
+        recordError();
+        return false;
+    }
+
+    // JPEG data is consumed front to back: let the kernel read ahead aggressively
+    madvise(view, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+
+    data_ = static_cast<const uint8_t*>(view);
+    size_ = static_cast<size_t>(st.st_size);
+#endif
+
+    timer.setBytes(static_cast<long long>(size_));
+    return true;
+}
+
+void MappedFile::close() {
+    if (!data_) {
+        return;
+    }
+
+#ifdef _WIN32
+    UnmapViewOfFile(data_);
+#else
+    munmap(const_cast<uint8_t*>(data_), size_);
+#endif
+
+    data_ = nullptr;
+    size_ = 0;
+}
@@ -0,0 +1,34 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Read-only memory mapping of a whole file
+// (mmap on POSIX, MapViewOfFile on Windows). Pages are read lazily on first
+// access, so mapping a file and touching only its header costs a few KB of I/O
+class MappedFile {
+public:
+    MappedFile();
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Map filename, replacing any previous mapping
+    bool open(const std::string& filename);
+
+    // Unmap (also done by the destructor)
+    void close();
+
+    bool is_open() const { return data_ != nullptr; }
+    const uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    const uint8_t* data_;
+    size_t size_;
+};
+
+#endif // MAPPED_FILE_H
@@ -0,0 +1,93 @@
+#include "BatchEncoder.h"
+#include "StripParallelEncoder.h"
+#include "WorkerPool.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace {
+
+const int DEFAULT_SPLIT_PIXELS = 1 << 20;
+
+// An image encoded in strips; the thread finishing the last one stitches it
+struct SplitImage {
+    StripEncodeJob job;
+    std::atomic<int> remaining;
+};
+
+struct Task {
+    int image;
+    int strip;      // -1 = whole image
+    long long cost; // pixels
+};
+
+} // namespace
+
+int encodeBatch(const BatchImage* images, int count, const EncodeParams& params,
+                int splitPixels, int numThreads, BatchOutput* results) {
+    if (!images || !results || count <= 0 || !validEncodeParams(params)) {
+        return 0;
+    }
+    if (splitPixels == 0) {
+        splitPixels = DEFAULT_SPLIT_PIXELS;
+    }
+
+    std::vector<std::unique_ptr<SplitImage>> splits(count);
+    std::vector<Task> tasks;
+    tasks.reserve(count);
+    for (int i = 0; i < count; i++) {
+        results[i].data = nullptr;
+        results[i].size = 0;
+
+        const BatchImage& image = images[i];
+        const long long pixels = (long long)std::max(image.width, 0) * std::max(image.height, 0);
+        if (splitPixels > 0 && pixels >= splitPixels) {
+            // Strips of about splitPixels pixels: each costs as much as the largest whole image
+            const int stripRows = std::max(encodeMcuHeight(params, image.pixelFormat),
+                                           splitPixels / image.width);
+            std::unique_ptr<SplitImage> split(new SplitImage());
+            if (split->job.init(image.pixels, image.width, image.height, image.pitch,
+                                image.pixelFormat, params, stripRows, 0) &&
+                split->job.stripCount() > 1) {
+                const int strips = split->job.stripCount();
+                split->remaining.store(strips);
+                for (int s = 0; s < strips; s++) {
+                    tasks.push_back(Task{ i, s, (long long)image.width * stripRows });
+                }
+                splits[i] = std::move(split);
+                continue;
+            }
+        }
+        tasks.push_back(Task{ i, -1, pixels });
+    }
+
+    std::stable_sort(tasks.begin(), tasks.end(),
+                     [](const Task& a, const Task& b) { return a.cost > b.cost; });
+
+    std::atomic<int> encoded(0);
+    parallelFor((int)tasks.size(), numThreads, [&](int t) {
+        const Task& task = tasks[t];
+        BatchOutput* out = &results[task.image];
+        if (task.strip < 0) {
+            const BatchImage& image = images[task.image];
+            out->data = encodeWithParams(image.pixels, image.width, image.height, image.pitch,
+                                         image.pixelFormat, params, nullptr, 0, &out->size);
+            if (out->data) {
+                encoded++;
+            }
+            return;
+        }
+
+        SplitImage* split = splits[task.image].get();
+        split->job.compressStrip(task.strip);
+        if (split->remaining.fetch_sub(1) == 1) {
+            out->data = split->job.stitch(&out->size);
+            if (out->data) {
+                encoded++;
+            }
+            splits[task.image].reset();  // free the strip buffers now, not after the batch
+        }
+    });
+    return encoded.load();
+}
@@ -0,0 +1,52 @@
+/**
+ * Multi-image JPEG encoding as one job on the shared worker pool
+ *
+ * Every image below the split size is one task (TurboJPEG on the running
+ * thread's cached compressor); larger images are planned as strips
+ * (StripEncodeJob) whose strips are tasks of their own, and whichever
+ * thread compresses an image's last strip stitches it. Tasks are handed out
+ * largest first, so the big ones start immediately and the small images
+ * fill in the tail: a mixed-size batch keeps every thread busy until the
+ * whole batch is done.
+ */
+
+#ifndef BATCH_ENCODER_H
+#define BATCH_ENCODER_H
+
+#include "EncodeParams.h"
+#include <cstddef>
+
+/**
+ * One input image
+ */
+struct BatchImage {
+    const unsigned char* pixels;
+    int width;
+    int height;
+    int pitch;        // bytes between rows, 0 = packed
+    int pixelFormat;  // TJPF_*
+};
+
+/**
+ * One output JPEG, in a buffer rented from JpegBufferPool (nullptr on failure)
+ */
+struct BatchOutput {
+    unsigned char* data;
+    size_t size;
+};
+
+/**
+ * Encode count images with params, results in input order. Split images
+ * carry a restart marker after every MCU row (or every params.restartRows);
+ * progressive and optimizeCoding encodes are never split.
+ *
+ * @param splitPixels Images with at least this many pixels are encoded in
+ *                    strips of about this many pixels (0 = default, 1 MP;
+ *                    negative = never split)
+ * @param numThreads Threads on the job, caller included (0 = whole pool)
+ * @return Number of images encoded
+ */
+int encodeBatch(const BatchImage* images, int count, const EncodeParams& params,
+                int splitPixels, int numThreads, BatchOutput* results);
+
+#endif // BATCH_ENCODER_H
@@ -0,0 +1,277 @@
+#include "EncodeParams.h"
+#include "EncoderStats.h"
+#include "JpegBufferPool.h"
+#include "TjHandleCache.h"
+#include <algorithm>
+#include <climits>
+#include <csetjmp>
+#include <cstdio>
+#include <cstring>
+#include "include/jpeglib.h"
+#include "include/jerror.h"
+#include "include/turbojpeg.h"
+
+namespace {
+
+// libjpeg-turbo colorspace for each TJPF_* value (same order as turbojpeg.h)
+const J_COLOR_SPACE PIXEL_FORMAT_COLOR_SPACE[] = {
+    JCS_EXT_RGB, JCS_EXT_BGR, JCS_EXT_RGBX, JCS_EXT_BGRX, JCS_EXT_XBGR, JCS_EXT_XRGB,
+    JCS_GRAYSCALE, JCS_EXT_RGBA, JCS_EXT_BGRA, JCS_EXT_ABGR, JCS_EXT_ARGB, JCS_CMYK
+};
+
+// Luma sampling factors for TJSAMP_444, 422, 420, GRAY, 440, 411 (chroma is 1x1)
+const int NUM_SUBSAMPLING = 6;
+const int LUMA_H_SAMP[NUM_SUBSAMPLING] = { 1, 2, 2, 1, 1, 4 };
+const int LUMA_V_SAMP[NUM_SUBSAMPLING] = { 1, 1, 2, 1, 2, 1 };
+
+// error_exit must not return: jump back to the setjmp in compressLibjpeg
+struct ErrorManager {
+    jpeg_error_mgr pub;
+    jmp_buf jump;
+};
+
+void errorExit(j_common_ptr cinfo) {
+    longjmp(reinterpret_cast<ErrorManager*>(cinfo->err)->jump, 1);
+}
+
+void outputMessage(j_common_ptr) {
+}
+
+// Output into a caller's fixed buffer, or a pooled one that moves up a size class when full
+struct BufferDestination {
+    jpeg_destination_mgr pub;
+    unsigned char* data;
+    size_t capacity;
+    size_t size;
+    bool pooled;
+};
+
+void initDestination(j_compress_ptr cinfo) {
+    BufferDestination* dest = reinterpret_cast<BufferDestination*>(cinfo->dest);
+    dest->pub.next_output_byte = dest->data;
+    dest->pub.free_in_buffer = dest->capacity;
+}
+
+boolean emptyOutputBuffer(j_compress_ptr cinfo) {
+    BufferDestination* dest = reinterpret_cast<BufferDestination*>(cinfo->dest);
+    if (!dest->pooled) {
+        ERREXIT(cinfo, JERR_BUFFER_SIZE);
+    }
+    size_t newCapacity = 0;
+    unsigned char* grown = rentJpegBuffer(dest->capacity * 2, &newCapacity);
+    if (!grown) {
+        ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 10);
+    }
+    std::memcpy(grown, dest->data, dest->capacity);
+    releaseJpegBuffer(dest->data);
+    dest->data = grown;
+    dest->pub.next_output_byte = grown + dest->capacity;
+    dest->pub.free_in_buffer = newCapacity - dest->capacity;
+    dest->capacity = newCapacity;
+    return TRUE;
+}
+
+void termDestination(j_compress_ptr cinfo) {
+    BufferDestination* dest = reinterpret_cast<BufferDestination*>(cinfo->dest);
+    dest->size = dest->capacity - dest->pub.free_in_buffer;
+}
+
+// Only POD state lives here: longjmp skips destructors
+bool compressLibjpeg(const unsigned char* pixels, size_t pitch, int width, int height,
+                     int pixelFormat, const EncodeParams& params, BufferDestination* dest) {
+    jpeg_compress_struct cinfo;
+    ErrorManager err;
+    cinfo.err = jpeg_std_error(&err.pub);
+    err.pub.error_exit = errorExit;
+    err.pub.output_message = outputMessage;
+
+    if (setjmp(err.jump)) {
+        jpeg_destroy_compress(&cinfo);
+        return false;
+    }
+
+    jpeg_create_compress(&cinfo);
+    dest->pub.init_destination = initDestination;
+    dest->pub.empty_output_buffer = emptyOutputBuffer;
+    dest->pub.term_destination = termDestination;
+    cinfo.dest = &dest->pub;
+
+    setupCompressor(&cinfo, width, height, pixelFormat, params);
+    jpeg_start_compress(&cinfo, TRUE);
+
+    JSAMPROW rows[16];
+    while (cinfo.next_scanline < cinfo.image_height) {
+        JDIMENSION count = cinfo.image_height - cinfo.next_scanline;
+        if (count > 16) count = 16;
+        for (JDIMENSION i = 0; i < count; i++) {
+            rows[i] = const_cast<JSAMPROW>(pixels + (cinfo.next_scanline + i) * pitch);
+        }
+        jpeg_write_scanlines(&cinfo, rows, count);
+    }
+
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    return true;
+}
+
+} // namespace
+
+EncodeParams defaultEncodeParams(int quality) {
+    EncodeParams params;
+    params.quality = quality;
+    params.subsampling = TJSAMP_420;
+    params.fastDct = 1;
+    params.progressive = 0;
+    params.optimizeCoding = 0;
+    params.restartRows = 0;
+    params.quantTable = nullptr;
+    return params;
+}
+
+bool validEncodeParams(const EncodeParams& params) {
+    return params.subsampling >= 0 && params.subsampling < NUM_SUBSAMPLING &&
+           params.restartRows >= 0 && params.restartRows <= 65535;
+}
+
+int encodeSubsampling(const EncodeParams& params, int pixelFormat) {
+    return pixelFormat == TJPF_GRAY ? TJSAMP_GRAY : params.subsampling;
+}
+
+int encodeMcuHeight(const EncodeParams& params, int pixelFormat) {
+    const int subsampling = encodeSubsampling(params, pixelFormat);
+    return subsampling >= 0 && subsampling < NUM_SUBSAMPLING ? 8 * LUMA_V_SAMP[subsampling] : 8;
+}
+
+size_t encodeBufferSize(int width, int height, const EncodeParams& params, int pixelFormat) {
+    const unsigned long size = tjBufSize(width, height, encodeSubsampling(params, pixelFormat));
+    return size == (unsigned long)-1 ? 0 : (size_t)size;
+}
+
+void setupCompressor(jpeg_compress_struct* cinfo, int width, int height, int pixelFormat,
+                     const EncodeParams& params) {
+    cinfo->image_width = (JDIMENSION)width;
+    cinfo->image_height = (JDIMENSION)height;
+    cinfo->input_components = tjPixelSize[pixelFormat];
+    cinfo->in_color_space = PIXEL_FORMAT_COLOR_SPACE[pixelFormat];
+    jpeg_set_defaults(cinfo);
+
+    // Same colorspace and sampling choices as tjCompress2
+    const int subsampling = encodeSubsampling(params, pixelFormat);
+    if (subsampling == TJSAMP_GRAY && cinfo->jpeg_color_space != JCS_GRAYSCALE) {
+        jpeg_set_colorspace(cinfo, JCS_GRAYSCALE);
+    } else if (cinfo->jpeg_color_space == JCS_YCbCr) {
+        cinfo->comp_info[0].h_samp_factor = LUMA_H_SAMP[subsampling];
+        cinfo->comp_info[0].v_samp_factor = LUMA_V_SAMP[subsampling];
+    }
+    applyEncodeParams(cinfo, params);
+}
+
+void setupYuvCompressor(jpeg_compress_struct* cinfo, int width, int height, int subsampling,
+                        const EncodeParams& params) {
+    const bool gray = subsampling == TJSAMP_GRAY;
+    cinfo->image_width = (JDIMENSION)width;
+    cinfo->image_height = (JDIMENSION)height;
+    cinfo->input_components = gray ? 1 : 3;
+    cinfo->in_color_space = gray ? JCS_GRAYSCALE : JCS_YCbCr;
+    jpeg_set_defaults(cinfo);
+
+    // jpeg_set_defaults leaves the chroma components at 1x1
+    if (!gray) {
+        cinfo->comp_info[0].h_samp_factor = LUMA_H_SAMP[subsampling];
+        cinfo->comp_info[0].v_samp_factor = LUMA_V_SAMP[subsampling];
+    }
+    cinfo->raw_data_in = TRUE;
+    applyEncodeParams(cinfo, params);
+}
+
+void applyEncodeParams(jpeg_compress_struct* cinfo, const EncodeParams& params) {
+    if (params.quantTable) {
+        unsigned int table[DCTSIZE2];
+        for (int t = 0; t < 2; t++) {
+            for (int i = 0; i < DCTSIZE2; i++) {
+                table[i] = params.quantTable[t * DCTSIZE2 + i];
+            }
+            jpeg_add_quant_table(cinfo, t, table, 100, TRUE);  // as given, 8-bit (baseline)
+        }
+    } else {
+        int quality = params.quality;
+        if (quality < 1) quality = 1;
+        if (quality > 100) quality = 100;
+        jpeg_set_quality(cinfo, quality, TRUE);
+    }
+
+    cinfo->dct_method = params.fastDct ? JDCT_IFAST : JDCT_ISLOW;
+    cinfo->optimize_coding = params.optimizeCoding ? TRUE : FALSE;
+    cinfo->restart_in_rows = params.restartRows;
+    if (params.progressive) {
+        jpeg_simple_progression(cinfo);
+    }
+}
+
+bool encodeNeedsLibjpeg(const EncodeParams& params) {
+    return params.optimizeCoding || params.restartRows > 0 || params.quantTable;
+}
+
+int encodeTjFlags(const EncodeParams& params) {
+    int flags = TJFLAG_NOREALLOC | (params.fastDct ? TJFLAG_FASTDCT : TJFLAG_ACCURATEDCT);
+    if (params.progressive) {
+        flags |= TJFLAG_PROGRESSIVE;
+    }
+    return flags;
+}
+
+unsigned char* encodeWithParams(const unsigned char* pixels, int width, int height, int pitch,
+                                int pixelFormat, const EncodeParams& params,
+                                unsigned char* outBuffer, size_t outCapacity, size_t* jpegSize) {
+    if (!pixels || !jpegSize || width <= 0 || height <= 0 ||
+        pixelFormat < 0 || pixelFormat >= TJ_NUMPF || !validEncodeParams(params) ||
+        (outBuffer && outCapacity == 0)) {
+        return nullptr;
+    }
+    if (pitch <= 0) {
+        pitch = width * tjPixelSize[pixelFormat];
+    }
+
+    // Without a caller buffer, compress into a pooled worst-case-size one: no second copy
+    BufferDestination dest;
+    dest.data = outBuffer;
+    dest.capacity = outCapacity;
+    dest.size = 0;
+    dest.pooled = !outBuffer;
+    if (dest.pooled) {
+        const size_t maxSize = encodeBufferSize(width, height, params, pixelFormat);
+        dest.data = maxSize ? rentJpegBuffer(maxSize, &dest.capacity) : nullptr;
+        if (!dest.data) {
+            return nullptr;
+        }
+    }
+
+    const long long start = statsClock();
+    tjhandle tj = encodeNeedsLibjpeg(params) ? nullptr : threadCompressor();
+    bool ok = false;
+    if (tj) {
+        int quality = params.quality;
+        if (quality < 1) quality = 1;
+        if (quality > 100) quality = 100;
+        unsigned char* jpegBuf = dest.data;
+        unsigned long size = (unsigned long)std::min<size_t>(dest.capacity, ULONG_MAX);
+        ok = tjCompress2(tj, pixels, width, pitch, height, pixelFormat, &jpegBuf, &size,
+                         encodeSubsampling(params, pixelFormat), quality, encodeTjFlags(params)) == 0;
+        dest.size = size;
+    }
+    // libjpeg covers the settings TurboJPEG lacks, and a pooled encode TurboJPEG could not do
+    if (!ok && (!tj || dest.pooled)) {
+        ok = compressLibjpeg(pixels, (size_t)pitch, width, height, pixelFormat, params, &dest);
+    }
+    recordStage(STATS_CODING, start, (long long)height * pitch);
+
+    if (!ok) {
+        recordError();
+        if (dest.pooled) {
+            releaseJpegBuffer(dest.data);
+        }
+        return nullptr;
+    }
+    *jpegSize = dest.size;
+    return dest.data;
+}
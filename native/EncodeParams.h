@@ -0,0 +1,105 @@
+/**
+ * Encoder settings shared by every encode entry point
+ *
+ * Settings TurboJPEG's tjCompress2 can express (subsampling, DCT mode,
+ * progressive) are compressed by it; optimized Huffman tables, restart
+ * markers and custom quantization tables need the libjpeg API, which
+ * encodeWithParams switches to on its own. Both produce the same output for
+ * the same settings.
+ */
+
+#ifndef ENCODE_PARAMS_H
+#define ENCODE_PARAMS_H
+
+#include <cstddef>
+
+struct jpeg_compress_struct;
+
+/**
+ * Plain C layout, also passed by JNA callers
+ */
+struct EncodeParams {
+    int quality;            // 1-100 (ignored with a custom quantTable)
+    int subsampling;        // TJSAMP_444, TJSAMP_422, TJSAMP_420, TJSAMP_440, TJSAMP_411 or TJSAMP_GRAY
+                            // (grayscale input is always TJSAMP_GRAY)
+    int fastDct;            // nonzero: fast integer DCT, 0: accurate DCT
+    int progressive;        // nonzero: progressive JPEG
+    int optimizeCoding;     // nonzero: optimized Huffman tables (smaller, slower)
+    int restartRows;        // MCU rows between restart markers, 0 = none
+                            // (restart markers let decoders work on strips in parallel)
+    const unsigned short* quantTable;  // nullptr for the standard tables scaled by quality,
+                                       // else 128 values 1-255: luminance then chrominance,
+                                       // each in natural (row-major) order
+};
+
+/**
+ * The settings the encoders have always used: 4:2:0, fast DCT, baseline,
+ * standard Huffman and quantization tables, no restart markers
+ */
+EncodeParams defaultEncodeParams(int quality);
+
+/**
+ * false for out-of-range values
+ */
+bool validEncodeParams(const EncodeParams& params);
+
+/**
+ * Subsampling actually used for pixelFormat (TJSAMP_GRAY for grayscale input)
+ */
+int encodeSubsampling(const EncodeParams& params, int pixelFormat);
+
+/**
+ * Height of one MCU row in pixels
+ */
+int encodeMcuHeight(const EncodeParams& params, int pixelFormat);
+
+/**
+ * Worst-case JPEG size for these settings (tjBufSize), 0 if too large
+ */
+size_t encodeBufferSize(int width, int height, const EncodeParams& params, int pixelFormat);
+
+/**
+ * Configure a created libjpeg compressor for width x height pixels of
+ * pixelFormat (TJPF_*), including jpeg_set_defaults. May raise a libjpeg error.
+ */
+void setupCompressor(jpeg_compress_struct* cinfo, int width, int height, int pixelFormat,
+                     const EncodeParams& params);
+
+/**
+ * Configure a created libjpeg compressor for raw Y / Cb / Cr planes
+ * (raw_data_in) sampled as subsampling, a TJSAMP_* value other than
+ * TJSAMP_441; params.subsampling is not used. May raise a libjpeg error.
+ */
+void setupYuvCompressor(jpeg_compress_struct* cinfo, int width, int height, int subsampling,
+                        const EncodeParams& params);
+
+/**
+ * The quantization, DCT, Huffman, restart and progression part of
+ * setupCompressor, for a compressor whose colorspace and sampling are set
+ */
+void applyEncodeParams(jpeg_compress_struct* cinfo, const EncodeParams& params);
+
+/**
+ * true if params need the libjpeg API (TurboJPEG cannot express them)
+ */
+bool encodeNeedsLibjpeg(const EncodeParams& params);
+
+/**
+ * tjCompress* flags for params, TJFLAG_NOREALLOC included
+ */
+int encodeTjFlags(const EncodeParams& params);
+
+/**
+ * Compress pixels (rows pitch bytes apart, 0 = packed) with params.
+ * With outBuffer the JPEG is written there and fails if it outgrows
+ * outCapacity; otherwise it goes into a buffer rented from JpegBufferPool.
+ *
+ * @param jpegSize Receives the JPEG size
+ * @return outBuffer or the rented buffer (release with releaseJpegBuffer /
+ *         FreeJPEGData), nullptr on failure
+ */
+unsigned char* encodeWithParams(const unsigned char* pixels, int width, int height, int pitch,
+                                int pixelFormat, const EncodeParams& params,
+                                unsigned char* outBuffer, size_t outCapacity, size_t* jpegSize);
+
+#endif // ENCODE_PARAMS_H
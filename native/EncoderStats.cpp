@@ -0,0 +1,168 @@
+#include "EncoderStats.h"
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+std::atomic<bool> g_statsEnabled(false);
+
+namespace {
+
+// Counters as one flat array: per stage count, nanos, bytes and the histogram,
+// then allocated bytes, allocations and errors
+const int STAGE_VALUES = 3 + STATS_NUM_BUCKETS;
+const int ALLOCATED_BYTES = STATS_NUM_STAGES * STAGE_VALUES;
+const int ALLOCATIONS = ALLOCATED_BYTES + 1;
+const int ERRORS = ALLOCATED_BYTES + 2;
+const int NUM_VALUES = ALLOCATED_BYTES + 3;
+
+// Written only by the owning thread; others read them for getStats()
+struct Counters {
+    std::atomic<long long> values[NUM_VALUES];
+
+    Counters() {
+        for (int i = 0; i < NUM_VALUES; i++) {
+            values[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void add(int index, long long value) {
+        values[index].store(values[index].load(std::memory_order_relaxed) + value,
+                            std::memory_order_relaxed);
+    }
+};
+
+struct Registry {
+    std::mutex mutex;
+    std::vector<Counters*> threads;
+    long long retired[NUM_VALUES] = {};   // totals of exited threads
+    long long baseline[NUM_VALUES] = {};  // totals at the last reset
+};
+
+// Leaked on purpose: threads may exit during static destruction
+Registry& registry() {
+    static Registry* instance = new Registry();
+    return *instance;
+}
+
+// Registers the thread's counters on first use and folds them into the
+// retired totals when the thread exits
+struct ThreadSlot {
+    Counters* counters;
+
+    ThreadSlot() : counters(new Counters()) {
+        Registry& r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        r.threads.push_back(counters);
+    }
+
+    ~ThreadSlot() {
+        Registry& r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        for (int i = 0; i < NUM_VALUES; i++) {
+            r.retired[i] += counters->values[i].load(std::memory_order_relaxed);
+        }
+        for (size_t i = 0; i < r.threads.size(); i++) {
+            if (r.threads[i] == counters) {
+                r.threads[i] = r.threads.back();
+                r.threads.pop_back();
+                break;
+            }
+        }
+        delete counters;
+    }
+};
+
+Counters& threadCounters() {
+    thread_local ThreadSlot slot;
+    return *slot.counters;
+}
+
+int bucketFor(long long nanos) {
+    long long micros = nanos / 1000;
+    int bucket = 0;
+    while (micros > 0 && bucket < STATS_NUM_BUCKETS - 1) {
+        micros >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+// Current totals of all threads, live and exited (caller holds the registry lock)
+void sumValues(Registry& r, long long* values) {
+    std::memcpy(values, r.retired, sizeof(r.retired));
+    for (size_t t = 0; t < r.threads.size(); t++) {
+        for (int i = 0; i < NUM_VALUES; i++) {
+            values[i] += r.threads[t]->values[i].load(std::memory_order_relaxed);
+        }
+    }
+}
+
+} // namespace
+
+void setStatsEnabled(bool enabled) {
+    g_statsEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+long long statsNowNanos() {
+    const long long now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    return now ? now : 1;  // 0 means "not timed"
+}
+
+void addStageSample(int stage, long long nanos, long long bytes) {
+    if (stage < 0 || stage >= STATS_NUM_STAGES) {
+        return;
+    }
+    Counters& c = threadCounters();
+    const int base = stage * STAGE_VALUES;
+    c.add(base, 1);
+    c.add(base + 1, nanos);
+    c.add(base + 2, bytes);
+    c.add(base + 3 + bucketFor(nanos), 1);
+}
+
+void addAllocationSample(size_t bytes) {
+    Counters& c = threadCounters();
+    c.add(ALLOCATED_BYTES, (long long)bytes);
+    c.add(ALLOCATIONS, 1);
+}
+
+void addErrorSample() {
+    threadCounters().add(ERRORS, 1);
+}
+
+void getStats(EncoderStats* stats) {
+    if (!stats) {
+        return;
+    }
+    long long values[NUM_VALUES];
+    Registry& r = registry();
+    {
+        std::lock_guard<std::mutex> lock(r.mutex);
+        sumValues(r, values);
+        for (int i = 0; i < NUM_VALUES; i++) {
+            values[i] -= r.baseline[i];
+        }
+    }
+
+    for (int s = 0; s < STATS_NUM_STAGES; s++) {
+        const long long* v = values + s * STAGE_VALUES;
+        StageStats& stage = stats->stages[s];
+        stage.count = v[0];
+        stage.totalNanos = v[1];
+        stage.bytes = v[2];
+        for (int b = 0; b < STATS_NUM_BUCKETS; b++) {
+            stage.histogram[b] = v[3 + b];
+        }
+    }
+    stats->allocatedBytes = values[ALLOCATED_BYTES];
+    stats->allocations = values[ALLOCATIONS];
+    stats->errors = values[ERRORS];
+}
+
+void resetStats() {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    sumValues(r, r.baseline);
+}
@@ -0,0 +1,119 @@
+/**
+ * Opt-in timing and allocation counters for the encoders and the decoder core
+ *
+ * Disabled (the default), every probe is one relaxed atomic load. Enabled,
+ * each thread adds to its own counters, so the hot paths never share a cache
+ * line; getStats() sums all threads, including ones that have exited.
+ * Each stage keeps a call count, total time, bytes processed and a log2
+ * histogram of call durations. resetStats() moves the zero point rather
+ * than clearing other threads' counters, so it is safe at any time.
+ * Stages may nest: a streaming encode's coding time includes the I/O of
+ * the chunks libjpeg flushes while compressing.
+ */
+
+#ifndef ENCODER_STATS_H
+#define ENCODER_STATS_H
+
+#include <atomic>
+#include <cstddef>
+
+enum StatsStage {
+    STATS_IO = 0,     // file reads / writes, OutputStream and sink callbacks
+    STATS_HEADER,     // JPEG header parsing
+    STATS_CODING,     // TurboJPEG / libjpeg compress, decompress and transform calls
+                      // (DCT and entropy coding, with the colour conversion done inside them)
+    STATS_COPY_OUT,   // copying results to the caller (Java arrays, strip stitching)
+    STATS_NUM_STAGES
+};
+
+// Histogram bucket i counts calls shorter than 2^i microseconds (and at least
+// 2^(i-1)); the last bucket counts everything longer
+const int STATS_NUM_BUCKETS = 24;
+
+/**
+ * Totals of one stage. Plain C layout, also read by JNA callers.
+ */
+struct StageStats {
+    long long count;
+    long long totalNanos;
+    long long bytes;
+    long long histogram[STATS_NUM_BUCKETS];
+};
+
+struct EncoderStats {
+    StageStats stages[STATS_NUM_STAGES];
+    long long allocatedBytes;  // fresh JpegBufferPool buffers and decoder arena blocks
+    long long allocations;
+    long long errors;          // failed encodes and decodes
+};
+
+extern std::atomic<bool> g_statsEnabled;
+
+inline bool statsEnabled() {
+    return g_statsEnabled.load(std::memory_order_relaxed);
+}
+
+void setStatsEnabled(bool enabled);
+
+long long statsNowNanos();
+
+/**
+ * Start of a timed stage: a timestamp, or 0 while disabled
+ */
+inline long long statsClock() {
+    return statsEnabled() ? statsNowNanos() : 0;
+}
+
+void addStageSample(int stage, long long nanos, long long bytes);
+void addAllocationSample(size_t bytes);
+void addErrorSample();
+
+/**
+ * End of a stage started with statsClock() (nothing if it returned 0).
+ * Plain calls, so they can be used in functions that setjmp.
+ */
+inline void recordStage(int stage, long long start, long long bytes) {
+    if (start) {
+        addStageSample(stage, statsNowNanos() - start, bytes);
+    }
+}
+
+inline void recordAllocation(size_t bytes) {
+    if (statsEnabled()) {
+        addAllocationSample(bytes);
+    }
+}
+
+inline void recordError() {
+    if (statsEnabled()) {
+        addErrorSample();
+    }
+}
+
+/**
+ * Times its scope as one call of a stage
+ */
+class StatsTimer {
+public:
+    explicit StatsTimer(int stage) : stage_(stage), start_(statsClock()), bytes_(0) {}
+    ~StatsTimer() { recordStage(stage_, start_, bytes_); }
+
+    void setBytes(long long bytes) { bytes_ = bytes; }
+
+private:
+    StatsTimer(const StatsTimer&) = delete;
+    StatsTimer& operator=(const StatsTimer&) = delete;
+
+    int stage_;
+    long long start_;
+    long long bytes_;
+};
+
+/**
+ * Totals since the last resetStats()
+ */
+void getStats(EncoderStats* stats);
+
+void resetStats();
+
+#endif // ENCODER_STATS_H
@@ -1,272 +1,160 @@
 #include <jni.h>
 #include "include/turbojpeg.h"
-#include <cstring>
-#include <thread>
-#include <vector>
-#include <algorithm>
+#include "JniJpegStream.h"
+#include "EncodeParams.h"
+#include "JpegBufferPool.h"
+#include "TjHandleCache.h"
+#include <climits>
 
 extern "C" {
 
 /**
- * 多线程版本：并行转换ARGB到RGB
- * 
- * @param numThreads 线程数（1=单线程，0=自动检测CPU核心数）
+ * 单线程版本（兼容保留）
  */
-JNIEXPORT jint JNICALL Java_com_yourpackage_TurboJpegEncoder_encodeToStreamMT
+JNIEXPORT jint JNICALL Java_com_yourpackage_TurboJpegEncoder_encodeToStream
   (JNIEnv *env, jobject obj, jintArray pixels, jint width, jint height, 
-   jfloat quality, jobject outputStream, jint numThreads) {
-    
-    // 自动检测CPU核心数
-    if (numThreads <= 0) {
-        numThreads = std::thread::hardware_concurrency();
-        if (numThreads <= 0) numThreads = 4; // 默认4线程
-    }
-    
-    // 初始化TurboJPEG压缩器
-    tjhandle tjInstance = tjInitCompress();
-    if (!tjInstance) {
-        return -1;
-    }
-    
-    // 获取Java像素数组
-    jint* pixelData = env->GetIntArrayElements(pixels, nullptr);
-    if (!pixelData) {
-        tjDestroy(tjInstance);
-        return -1;
-    }
-    
-    long long pixelCount = (long long)width * height;
-    unsigned char* rgbBuffer = new unsigned char[pixelCount * 3];
-    
-    // ========== 多线程转换ARGB到RGB ==========
-    auto convertChunk = [pixelData, rgbBuffer](long long start, long long end) {
-        for (long long i = start; i < end; i++) {
-            int argb = pixelData[i];
-            rgbBuffer[i * 3 + 0] = (argb >> 16) & 0xFF; // R
-            rgbBuffer[i * 3 + 1] = (argb >> 8) & 0xFF;  // G
-            rgbBuffer[i * 3 + 2] = argb & 0xFF;         // B
-        }
-    };
-    
-    if (numThreads == 1) {
-        // 单线程模式
-        convertChunk(0, pixelCount);
-    } else {
-        // 多线程模式
-        std::vector<std::thread> threads;
-        long long chunkSize = pixelCount / numThreads;
-        
-        for (int t = 0; t < numThreads; t++) {
-            long long start = t * chunkSize;
-            long long end = (t == numThreads - 1) ? pixelCount : (t + 1) * chunkSize;
-            threads.emplace_back(convertChunk, start, end);
-        }
-        
-        // 等待所有线程完成
-        for (auto& thread : threads) {
-            thread.join();
-        }
-    }
-    
-    env->ReleaseIntArrayElements(pixels, pixelData, JNI_ABORT);
+   jfloat quality, jobject outputStream) {
     
-    // ========== TurboJPEG编码（单线程，已通过SIMD优化） ==========
-    unsigned char* jpegBuf = nullptr;
-    unsigned long jpegSize = 0;
     int qualityInt = (int)(quality * 100);
     if (qualityInt < 1) qualityInt = 1;
     if (qualityInt > 100) qualityInt = 100;
     
-    int ret = tjCompress2(
-        tjInstance, 
-        rgbBuffer,
-        width,
-        0,
-        height,
-        TJPF_RGB,
-        &jpegBuf,
-        &jpegSize,
-        TJSAMP_420,
-        qualityInt,
-        TJFLAG_FASTDCT
-    );
-    
-    delete[] rgbBuffer;
-    
-    if (ret != 0) {
-        tjDestroy(tjInstance);
-        return -1;
-    }
-    
-    // 写入Java OutputStream
-    jclass streamClass = env->GetObjectClass(outputStream);
-    jmethodID writeMethod = env->GetMethodID(streamClass, "write", "([BII)V");
-    
-    if (!writeMethod) {
-        tjFree(jpegBuf);
-        tjDestroy(tjInstance);
-        return -1;
-    }
-    
-    jbyteArray javaArray = env->NewByteArray(jpegSize);
-    env->SetByteArrayRegion(javaArray, 0, jpegSize, (jbyte*)jpegBuf);
-    env->CallVoidMethod(outputStream, writeMethod, javaArray, 0, jpegSize);
-    
-    env->DeleteLocalRef(javaArray);
-    tjFree(jpegBuf);
-    tjDestroy(tjInstance);
+    // 边编码边按块写入，不分配整张JPEG大小的Java数组
+    return (jint)compressArgbArrayToOutputStream(env, outputStream, pixels, width, height, qualityInt);
+}
+
+/**
+ * 多线程版本（接口兼容保留）
+ * 
+ * 像素不再转换为RGB：int[] 按本机字节序即 BGRX，每16行在一个很短的临界区内
+ * 拷贝出来直接压缩，不分配整帧缓冲，也不会长时间阻塞GC
+ * 
+ * @param numThreads 线程数（已不再使用：没有需要并行的转换步骤）
+ */
+JNIEXPORT jint JNICALL Java_com_yourpackage_TurboJpegEncoder_encodeToStreamMT
+  (JNIEnv *env, jobject obj, jintArray pixels, jint width, jint height, 
+   jfloat quality, jobject outputStream, jint /*numThreads*/) {
     
-    return (jint)jpegSize;
+    return Java_com_yourpackage_TurboJpegEncoder_encodeToStream(env, obj, pixels, width, height,
+                                                                quality, outputStream);
 }
 
 /**
- * 单线程版本（兼容保留）
+ * 直接返回字节数组（多线程版本）
  */
-JNIEXPORT jint JNICALL Java_com_yourpackage_TurboJpegEncoder_encodeToStream
+JNIEXPORT jbyteArray JNICALL Java_com_yourpackage_TurboJpegEncoder_encodeToBytesMT
   (JNIEnv *env, jobject obj, jintArray pixels, jint width, jint height, 
-   jfloat quality, jobject outputStream) {
+   jfloat quality, jint /*numThreads*/) {
+    
+    // numThreads 仅为接口兼容保留：像素直接压缩，没有需要并行的转换步骤
     
-    tjhandle tjInstance = tjInitCompress();
+    // 复用本线程缓存的压缩器句柄（不再每次tjInitCompress）
+    tjhandle tjInstance = threadCompressor();
     if (!tjInstance) {
-        return -1;
+        return nullptr;
     }
     
+    // tjCompress2 需要整帧数据，不能放在临界区内；GetIntArrayElements 可能复制数组，但不阻塞GC
     jint* pixelData = env->GetIntArrayElements(pixels, nullptr);
     if (!pixelData) {
-        tjDestroy(tjInstance);
-        return -1;
-    }
-    
-    long long pixelCount = (long long)width * height;
-    unsigned char* rgbBuffer = new unsigned char[pixelCount * 3];
-    
-    // 单线程转换
-    for (long long i = 0; i < pixelCount; i++) {
-        int argb = pixelData[i];
-        rgbBuffer[i * 3 + 0] = (argb >> 16) & 0xFF;
-        rgbBuffer[i * 3 + 1] = (argb >> 8) & 0xFF;
-        rgbBuffer[i * 3 + 2] = argb & 0xFF;
+        return nullptr;
     }
     
-    env->ReleaseIntArrayElements(pixels, pixelData, JNI_ABORT);
-    
     unsigned char* jpegBuf = nullptr;
     unsigned long jpegSize = 0;
     int qualityInt = (int)(quality * 100);
     if (qualityInt < 1) qualityInt = 1;
     if (qualityInt > 100) qualityInt = 100;
     
-    int ret = tjCompress2(tjInstance, rgbBuffer, width, 0, height, 
-                          TJPF_RGB, &jpegBuf, &jpegSize, 
+    // int[] 按本机字节序即 BGRX（小端机器），直接压缩，不再转换为RGB
+    int ret = tjCompress2(tjInstance, (const unsigned char*)pixelData, width, 0, height, 
+                          nativeArgbPixelFormat(), &jpegBuf, &jpegSize, 
                           TJSAMP_420, qualityInt, TJFLAG_FASTDCT);
     
-    delete[] rgbBuffer;
+    env->ReleaseIntArrayElements(pixels, pixelData, JNI_ABORT);
     
     if (ret != 0) {
-        tjDestroy(tjInstance);
-        return -1;
-    }
-    
-    jclass streamClass = env->GetObjectClass(outputStream);
-    jmethodID writeMethod = env->GetMethodID(streamClass, "write", "([BII)V");
-    
-    if (!writeMethod) {
         tjFree(jpegBuf);
-        tjDestroy(tjInstance);
-        return -1;
+        return nullptr;
     }
     
-    jbyteArray javaArray = env->NewByteArray(jpegSize);
-    env->SetByteArrayRegion(javaArray, 0, jpegSize, (jbyte*)jpegBuf);
-    env->CallVoidMethod(outputStream, writeMethod, javaArray, 0, jpegSize);
+    jbyteArray result = env->NewByteArray(jpegSize);
+    env->SetByteArrayRegion(result, 0, jpegSize, (jbyte*)jpegBuf);
     
-    env->DeleteLocalRef(javaArray);
     tjFree(jpegBuf);
-    tjDestroy(tjInstance);
     
-    return (jint)jpegSize;
+    return result;
 }
 
 /**
- * 直接返回字节数组（多线程版本）
+ * encodeToStream 的显式编码参数版本
+ * params = {quality, subsampling, fastDct, progressive, optimizeCoding, restartRows}，
+ * quantTable 为 null 或 64 / 128 个 1-255 的值（格式见 JniJpegStream.h 的 readEncodeParams）
  */
-JNIEXPORT jbyteArray JNICALL Java_com_yourpackage_TurboJpegEncoder_encodeToBytesMT
+JNIEXPORT jint JNICALL Java_com_yourpackage_TurboJpegEncoder_encodeToStreamWithParams
   (JNIEnv *env, jobject obj, jintArray pixels, jint width, jint height, 
-   jfloat quality, jint numThreads) {
+   jintArray params, jintArray quantTable, jobject outputStream) {
     
-    if (numThreads <= 0) {
-        numThreads = std::thread::hardware_concurrency();
-        if (numThreads <= 0) numThreads = 4;
+    EncodeParams encodeParams;
+    unsigned short quant[128];
+    if (!readEncodeParams(env, params, quantTable, &encodeParams, quant)) {
+        return -1;
     }
     
-    tjhandle tjInstance = tjInitCompress();
-    if (!tjInstance) {
+    return (jint)compressArgbArrayToOutputStream(env, outputStream, pixels, width, height, encodeParams);
+}
+
+/**
+ * encodeToBytes 的显式编码参数版本（params / quantTable 同 encodeToStreamWithParams）
+ */
+JNIEXPORT jbyteArray JNICALL Java_com_yourpackage_TurboJpegEncoder_encodeToBytesWithParams
+  (JNIEnv *env, jobject obj, jintArray pixels, jint width, jint height, 
+   jintArray params, jintArray quantTable) {
+    
+    EncodeParams encodeParams;
+    unsigned short quant[128];
+    if (!pixels || !readEncodeParams(env, params, quantTable, &encodeParams, quant) ||
+        width <= 0 || height <= 0 || env->GetArrayLength(pixels) < (jlong)width * height) {
         return nullptr;
     }
     
     jint* pixelData = env->GetIntArrayElements(pixels, nullptr);
     if (!pixelData) {
-        tjDestroy(tjInstance);
         return nullptr;
     }
     
-    long long pixelCount = (long long)width * height;
-    unsigned char* rgbBuffer = new unsigned char[pixelCount * 3];
-    
-    // 多线程转换
-    auto convertChunk = [pixelData, rgbBuffer](long long start, long long end) {
-        for (long long i = start; i < end; i++) {
-            int argb = pixelData[i];
-            rgbBuffer[i * 3 + 0] = (argb >> 16) & 0xFF;
-            rgbBuffer[i * 3 + 1] = (argb >> 8) & 0xFF;
-            rgbBuffer[i * 3 + 2] = argb & 0xFF;
-        }
-    };
-    
-    if (numThreads == 1) {
-        convertChunk(0, pixelCount);
-    } else {
-        std::vector<std::thread> threads;
-        long long chunkSize = pixelCount / numThreads;
-        
-        for (int t = 0; t < numThreads; t++) {
-            long long start = t * chunkSize;
-            long long end = (t == numThreads - 1) ? pixelCount : (t + 1) * chunkSize;
-            threads.emplace_back(convertChunk, start, end);
-        }
-        
-        for (auto& thread : threads) {
-            thread.join();
-        }
-    }
+    // 需要 libjpeg 的参数（优化Huffman表、restart marker、自定义量化表）由 encodeWithParams 自动切换
+    size_t jpegSize = 0;
+    unsigned char* jpegBuf = encodeWithParams((const unsigned char*)pixelData, width, height, 0,
+                                              nativeArgbPixelFormat(), encodeParams,
+                                              nullptr, 0, &jpegSize);
     
     env->ReleaseIntArrayElements(pixels, pixelData, JNI_ABORT);
     
-    unsigned char* jpegBuf = nullptr;
-    unsigned long jpegSize = 0;
-    int qualityInt = (int)(quality * 100);
-    if (qualityInt < 1) qualityInt = 1;
-    if (qualityInt > 100) qualityInt = 100;
-    
-    int ret = tjCompress2(tjInstance, rgbBuffer, width, 0, height, 
-                          TJPF_RGB, &jpegBuf, &jpegSize, 
-                          TJSAMP_420, qualityInt, TJFLAG_FASTDCT);
-    
-    delete[] rgbBuffer;
-    
-    if (ret != 0) {
-        tjDestroy(tjInstance);
+    if (!jpegBuf) {
         return nullptr;
     }
     
-    jbyteArray result = env->NewByteArray(jpegSize);
-    env->SetByteArrayRegion(result, 0, jpegSize, (jbyte*)jpegBuf);
+    jbyteArray result = nullptr;
+    if (jpegSize <= (size_t)INT_MAX) {
+        result = env->NewByteArray((jsize)jpegSize);
+        if (result) {
+            env->SetByteArrayRegion(result, 0, (jsize)jpegSize, (jbyte*)jpegBuf);
+        }
+    }
     
-    tjFree(jpegBuf);
-    tjDestroy(tjInstance);
+    releaseJpegBuffer(jpegBuf);
     
     return result;
 }
 
+/**
+ * 加载时缓存OutputStream.write方法ID
+ */
+JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM* vm, void* reserved) {
+    cacheStreamMethods(vm);
+    return JNI_VERSION_1_8;
+}
+
 } // extern "C"
 
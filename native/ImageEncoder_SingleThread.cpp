@@ -1,5 +1,10 @@
 #include <jni.h>
 #include "include/turbojpeg.h"
+#include "JniJpegStream.h"
+#include "EncodeParams.h"
+#include "JpegBufferPool.h"
+#include "TjHandleCache.h"
+#include <climits>
 #include <cstring>
 
 extern "C" {
@@ -18,139 +23,128 @@ JNIEXPORT jint JNICALL Java_com_yourpackage_TurboJpegEncoder_encodeToStream
   (JNIEnv *env, jobject obj, jintArray pixels, jint width, jint height, 
    jfloat quality, jobject outputStream) {
     
-    // 初始化TurboJPEG压缩器
-    tjhandle tjInstance = tjInitCompress();
+    int qualityInt = (int)(quality * 100);
+    if (qualityInt < 1) qualityInt = 1;
+    if (qualityInt > 100) qualityInt = 100;
+    
+    // int[] 按本机字节序即 BGRX：每16行在一个很短的临界区内拷贝出来直接压缩，
+    // 边编码边按块写入OutputStream（4:2:0采样、快速DCT），不分配整帧RGB缓冲
+    return (jint)compressArgbArrayToOutputStream(env, outputStream, pixels, width, height, qualityInt);
+}
+
+/**
+ * 直接返回编码后的字节数组（适用于内存处理）
+ */
+JNIEXPORT jbyteArray JNICALL Java_com_yourpackage_TurboJpegEncoder_encodeToBytes
+  (JNIEnv *env, jobject obj, jintArray pixels, jint width, jint height, jfloat quality) {
+    
+    // 复用本线程缓存的压缩器句柄（不再每次tjInitCompress）
+    tjhandle tjInstance = threadCompressor();
     if (!tjInstance) {
-        return -1;
+        return nullptr;
     }
     
-    // 获取Java像素数组
+    // tjCompress2 需要整帧数据，不能放在临界区内；GetIntArrayElements 可能复制数组，但不阻塞GC
     jint* pixelData = env->GetIntArrayElements(pixels, nullptr);
     if (!pixelData) {
-        tjDestroy(tjInstance);
-        return -1;
-    }
-    
-    // 转换ARGB到RGB (去掉Alpha通道)
-    long long pixelCount = (long long)width * height;
-    unsigned char* rgbBuffer = new unsigned char[pixelCount * 3];
-    
-    // 优化：直接转换，避免额外拷贝
-    for (long long i = 0; i < pixelCount; i++) {
-        int argb = pixelData[i];
-        rgbBuffer[i * 3 + 0] = (argb >> 16) & 0xFF; // R
-        rgbBuffer[i * 3 + 1] = (argb >> 8) & 0xFF;  // G
-        rgbBuffer[i * 3 + 2] = argb & 0xFF;         // B
+        return nullptr;
     }
     
-    env->ReleaseIntArrayElements(pixels, pixelData, JNI_ABORT);
-    
-    // TurboJPEG编码
     unsigned char* jpegBuf = nullptr;
     unsigned long jpegSize = 0;
     int qualityInt = (int)(quality * 100);
     if (qualityInt < 1) qualityInt = 1;
     if (qualityInt > 100) qualityInt = 100;
     
-    // 使用4:2:0采样和快速DCT以获得最佳性能
-    int ret = tjCompress2(
-        tjInstance, 
-        rgbBuffer,          // 源图像数据
-        width,              // 宽度
-        0,                  // pitch (0=自动)
-        height,             // 高度
-        TJPF_RGB,           // 像素格式
-        &jpegBuf,           // 输出缓冲区（自动分配）
-        &jpegSize,          // 输出大小
-        TJSAMP_420,         // 色度采样 (4:2:0最快)
-        qualityInt,         // 质量
-        TJFLAG_FASTDCT      // 使用快速DCT
-    );
-    
-    delete[] rgbBuffer;
-    
-    if (ret != 0) {
-        tjDestroy(tjInstance);
-        return -1;
-    }
+    // int[] 按本机字节序即 BGRX（小端机器），直接压缩，不再转换为RGB
+    int ret = tjCompress2(tjInstance, (const unsigned char*)pixelData, width, 0, height, 
+                          nativeArgbPixelFormat(), &jpegBuf, &jpegSize, 
+                          TJSAMP_420, qualityInt, TJFLAG_FASTDCT);
     
-    // 写入Java OutputStream
-    jclass streamClass = env->GetObjectClass(outputStream);
-    jmethodID writeMethod = env->GetMethodID(streamClass, "write", "([BII)V");
+    env->ReleaseIntArrayElements(pixels, pixelData, JNI_ABORT);
     
-    if (!writeMethod) {
+    if (ret != 0) {
         tjFree(jpegBuf);
-        tjDestroy(tjInstance);
-        return -1;
+        return nullptr;
     }
     
-    // 创建Java字节数组并传输数据
-    jbyteArray javaArray = env->NewByteArray(jpegSize);
-    env->SetByteArrayRegion(javaArray, 0, jpegSize, (jbyte*)jpegBuf);
-    env->CallVoidMethod(outputStream, writeMethod, javaArray, 0, jpegSize);
+    jbyteArray result = env->NewByteArray(jpegSize);
+    env->SetByteArrayRegion(result, 0, jpegSize, (jbyte*)jpegBuf);
     
-    // 清理资源
-    env->DeleteLocalRef(javaArray);
     tjFree(jpegBuf);
-    tjDestroy(tjInstance);
     
-    return (jint)jpegSize;
+    return result;
 }
 
 /**
- * 直接返回编码后的字节数组（适用于内存处理）
+ * encodeToStream 的显式编码参数版本
+ * params = {quality, subsampling, fastDct, progressive, optimizeCoding, restartRows}，
+ * quantTable 为 null 或 64 / 128 个 1-255 的值（格式见 JniJpegStream.h 的 readEncodeParams）
  */
-JNIEXPORT jbyteArray JNICALL Java_com_yourpackage_TurboJpegEncoder_encodeToBytes
-  (JNIEnv *env, jobject obj, jintArray pixels, jint width, jint height, jfloat quality) {
+JNIEXPORT jint JNICALL Java_com_yourpackage_TurboJpegEncoder_encodeToStreamWithParams
+  (JNIEnv *env, jobject obj, jintArray pixels, jint width, jint height, 
+   jintArray params, jintArray quantTable, jobject outputStream) {
     
-    tjhandle tjInstance = tjInitCompress();
-    if (!tjInstance) {
+    EncodeParams encodeParams;
+    unsigned short quant[128];
+    if (!readEncodeParams(env, params, quantTable, &encodeParams, quant)) {
+        return -1;
+    }
+    
+    return (jint)compressArgbArrayToOutputStream(env, outputStream, pixels, width, height, encodeParams);
+}
+
+/**
+ * encodeToBytes 的显式编码参数版本（params / quantTable 同 encodeToStreamWithParams）
+ */
+JNIEXPORT jbyteArray JNICALL Java_com_yourpackage_TurboJpegEncoder_encodeToBytesWithParams
+  (JNIEnv *env, jobject obj, jintArray pixels, jint width, jint height, 
+   jintArray params, jintArray quantTable) {
+    
+    EncodeParams encodeParams;
+    unsigned short quant[128];
+    if (!pixels || !readEncodeParams(env, params, quantTable, &encodeParams, quant) ||
+        width <= 0 || height <= 0 || env->GetArrayLength(pixels) < (jlong)width * height) {
         return nullptr;
     }
     
     jint* pixelData = env->GetIntArrayElements(pixels, nullptr);
     if (!pixelData) {
-        tjDestroy(tjInstance);
         return nullptr;
     }
     
-    long long pixelCount = (long long)width * height;
-    unsigned char* rgbBuffer = new unsigned char[pixelCount * 3];
-    
-    for (long long i = 0; i < pixelCount; i++) {
-        int argb = pixelData[i];
-        rgbBuffer[i * 3 + 0] = (argb >> 16) & 0xFF;
-        rgbBuffer[i * 3 + 1] = (argb >> 8) & 0xFF;
-        rgbBuffer[i * 3 + 2] = argb & 0xFF;
-    }
+    // 需要 libjpeg 的参数（优化Huffman表、restart marker、自定义量化表）由 encodeWithParams 自动切换
+    size_t jpegSize = 0;
+    unsigned char* jpegBuf = encodeWithParams((const unsigned char*)pixelData, width, height, 0,
+                                              nativeArgbPixelFormat(), encodeParams,
+                                              nullptr, 0, &jpegSize);
     
     env->ReleaseIntArrayElements(pixels, pixelData, JNI_ABORT);
     
-    unsigned char* jpegBuf = nullptr;
-    unsigned long jpegSize = 0;
-    int qualityInt = (int)(quality * 100);
-    if (qualityInt < 1) qualityInt = 1;
-    if (qualityInt > 100) qualityInt = 100;
-    
-    int ret = tjCompress2(tjInstance, rgbBuffer, width, 0, height, 
-                          TJPF_RGB, &jpegBuf, &jpegSize, 
-                          TJSAMP_420, qualityInt, TJFLAG_FASTDCT);
-    
-    delete[] rgbBuffer;
-    
-    if (ret != 0) {
-        tjDestroy(tjInstance);
+    if (!jpegBuf) {
         return nullptr;
     }
     
-    jbyteArray result = env->NewByteArray(jpegSize);
-    env->SetByteArrayRegion(result, 0, jpegSize, (jbyte*)jpegBuf);
+    jbyteArray result = nullptr;
+    if (jpegSize <= (size_t)INT_MAX) {
+        result = env->NewByteArray((jsize)jpegSize);
+        if (result) {
+            env->SetByteArrayRegion(result, 0, (jsize)jpegSize, (jbyte*)jpegBuf);
+        }
+    }
     
-    tjFree(jpegBuf);
-    tjDestroy(tjInstance);
+    releaseJpegBuffer(jpegBuf);
     
     return result;
 }
 
+/**
+ * 加载时缓存OutputStream.write方法ID
+ */
+JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM* vm, void* reserved) {
+    cacheStreamMethods(vm);
+    return JNI_VERSION_1_8;
+}
+
 } // extern "C"
 
@@ -0,0 +1,342 @@
+#include "JniJpegStream.h"
+#include "EncodeParams.h"
+#include "EncoderStats.h"
+#include <cstdio>
+#include <csetjmp>
+#include <cstdlib>
+#include <cstring>
+#include "include/jpeglib.h"
+#include "include/jerror.h"
+#include "include/turbojpeg.h"
+
+namespace {
+
+// OutputStream.write(byte[], int, int), resolved once per process
+jclass g_outputStreamClass = nullptr;
+jmethodID g_writeMethod = nullptr;
+
+// error_exit must not return: jump back to the setjmp in compressRows
+struct ErrorManager {
+    jpeg_error_mgr pub;
+    jmp_buf jump;
+};
+
+void errorExit(j_common_ptr cinfo) {
+    longjmp(reinterpret_cast<ErrorManager*>(cinfo->err)->jump, 1);
+}
+
+void outputMessage(j_common_ptr) {
+}
+
+// Destination that hands each full staging buffer to OutputStream.write
+struct StreamDestination {
+    jpeg_destination_mgr pub;
+    JNIEnv* env;
+    jobject stream;
+    jmethodID write;
+    jbyteArray chunk;       // reused for every write call
+    JOCTET* buffer;         // JNI_STREAM_CHUNK_SIZE bytes of staging
+    long long written;
+};
+
+bool flushChunk(StreamDestination* dest, int size) {
+    if (size <= 0) {
+        return true;
+    }
+    JNIEnv* env = dest->env;
+    long long start = statsClock();
+    env->SetByteArrayRegion(dest->chunk, 0, size, reinterpret_cast<const jbyte*>(dest->buffer));
+    recordStage(STATS_COPY_OUT, start, size);
+    start = statsClock();
+    env->CallVoidMethod(dest->stream, dest->write, dest->chunk, 0, size);
+    recordStage(STATS_IO, start, size);
+    if (env->ExceptionCheck()) {
+        return false;
+    }
+    dest->written += size;
+    return true;
+}
+
+void initDestination(j_compress_ptr cinfo) {
+    StreamDestination* dest = reinterpret_cast<StreamDestination*>(cinfo->dest);
+    dest->pub.next_output_byte = dest->buffer;
+    dest->pub.free_in_buffer = JNI_STREAM_CHUNK_SIZE;
+}
+
+boolean emptyOutputBuffer(j_compress_ptr cinfo) {
+    // libjpeg calls this only when the whole buffer is full
+    StreamDestination* dest = reinterpret_cast<StreamDestination*>(cinfo->dest);
+    if (!flushChunk(dest, JNI_STREAM_CHUNK_SIZE)) {
+        ERREXIT(cinfo, JERR_FILE_WRITE);
+    }
+    dest->pub.next_output_byte = dest->buffer;
+    dest->pub.free_in_buffer = JNI_STREAM_CHUNK_SIZE;
+    return TRUE;
+}
+
+void termDestination(j_compress_ptr cinfo) {
+    StreamDestination* dest = reinterpret_cast<StreamDestination*>(cinfo->dest);
+    const int remaining = JNI_STREAM_CHUNK_SIZE - static_cast<int>(dest->pub.free_in_buffer);
+    if (!flushChunk(dest, remaining)) {
+        ERREXIT(cinfo, JERR_FILE_WRITE);
+    }
+}
+
+bool resolveWriteMethod(JNIEnv* env) {
+    if (g_writeMethod) {
+        return true;
+    }
+    jclass streamClass = env->FindClass("java/io/OutputStream");
+    if (!streamClass) {
+        env->ExceptionClear();
+        return false;
+    }
+    g_writeMethod = env->GetMethodID(streamClass, "write", "([BII)V");
+    if (g_writeMethod) {
+        g_outputStreamClass = static_cast<jclass>(env->NewGlobalRef(streamClass));
+    } else {
+        env->ExceptionClear();
+    }
+    env->DeleteLocalRef(streamClass);
+    return g_writeMethod != nullptr;
+}
+
+// Where compressRows takes its scanlines from: the caller's pixel rows, or
+// bands of up to 16 rows produced by fill into band
+struct RowInput {
+    const unsigned char* pixels;
+    size_t pitch;
+    FillRowsFn fill;
+    void* context;
+    unsigned char* band;
+};
+
+// Only POD state lives here: longjmp skips destructors
+bool compressRows(jpeg_compress_struct* cinfo, ErrorManager* err, StreamDestination* dest,
+                  const RowInput* input, int width, int height, int pixelFormat,
+                  const EncodeParams* params) {
+    if (setjmp(err->jump)) {
+        jpeg_destroy_compress(cinfo);
+        return false;
+    }
+
+    jpeg_create_compress(cinfo);
+    dest->pub.init_destination = initDestination;
+    dest->pub.empty_output_buffer = emptyOutputBuffer;
+    dest->pub.term_destination = termDestination;
+    cinfo->dest = &dest->pub;
+
+    setupCompressor(cinfo, width, height, pixelFormat, *params);
+    jpeg_start_compress(cinfo, TRUE);
+
+    JSAMPROW rows[16];
+    while (cinfo->next_scanline < cinfo->image_height) {
+        JDIMENSION count = cinfo->image_height - cinfo->next_scanline;
+        if (count > 16) count = 16;
+        if (input->fill) {
+            if (!input->fill(input->context, static_cast<int>(cinfo->next_scanline),
+                             static_cast<int>(count), input->band, input->pitch)) {
+                jpeg_destroy_compress(cinfo);
+                return false;
+            }
+            for (JDIMENSION i = 0; i < count; i++) {
+                rows[i] = input->band + i * input->pitch;
+            }
+        } else {
+            for (JDIMENSION i = 0; i < count; i++) {
+                rows[i] = const_cast<JSAMPROW>(input->pixels + (cinfo->next_scanline + i) * input->pitch);
+            }
+        }
+        const long long start = statsClock();
+        jpeg_write_scanlines(cinfo, rows, count);
+        recordStage(STATS_CODING, start, (long long)count * input->pitch);
+    }
+
+    jpeg_finish_compress(cinfo);
+    jpeg_destroy_compress(cinfo);
+    return true;
+}
+
+// Shared by both public entry points; input->band is allocated here
+long long compressInput(JNIEnv* env, jobject outputStream, RowInput* input,
+                        int width, int height, int pixelFormat, const EncodeParams& params) {
+    // The cached ID covers every OutputStream; anything else only needs a
+    // compatible write method, looked up on its own class
+    jmethodID writeMethod = nullptr;
+    if (resolveWriteMethod(env) && env->IsInstanceOf(outputStream, g_outputStreamClass)) {
+        writeMethod = g_writeMethod;
+    } else {
+        jclass streamClass = env->GetObjectClass(outputStream);
+        writeMethod = env->GetMethodID(streamClass, "write", "([BII)V");
+        env->DeleteLocalRef(streamClass);
+        if (!writeMethod) {
+            return -1;
+        }
+    }
+
+    jbyteArray chunk = env->NewByteArray(JNI_STREAM_CHUNK_SIZE);
+    if (!chunk) {
+        return -1;
+    }
+    JOCTET* buffer = static_cast<JOCTET*>(std::malloc(JNI_STREAM_CHUNK_SIZE));
+    input->band = input->fill ? static_cast<unsigned char*>(std::malloc(input->pitch * 16)) : nullptr;
+    if (!buffer || (input->fill && !input->band)) {
+        std::free(buffer);
+        std::free(input->band);
+        env->DeleteLocalRef(chunk);
+        return -1;
+    }
+
+    jpeg_compress_struct cinfo;
+    ErrorManager err;
+    cinfo.err = jpeg_std_error(&err.pub);
+    err.pub.error_exit = errorExit;
+    err.pub.output_message = outputMessage;
+
+    StreamDestination dest;
+    dest.env = env;
+    dest.stream = outputStream;
+    dest.write = writeMethod;
+    dest.chunk = chunk;
+    dest.buffer = buffer;
+    dest.written = 0;
+
+    bool ok = compressRows(&cinfo, &err, &dest, input, width, height, pixelFormat, &params);
+
+    std::free(input->band);
+    std::free(buffer);
+    env->DeleteLocalRef(chunk);
+    return ok ? dest.written : -1;
+}
+
+} // namespace
+
+bool cacheStreamMethods(JavaVM* vm) {
+    JNIEnv* env = nullptr;
+    if (vm->GetEnv(reinterpret_cast<void**>(&env), JNI_VERSION_1_8) != JNI_OK) {
+        return false;
+    }
+    return resolveWriteMethod(env);
+}
+
+int nativeArgbPixelFormat() {
+    const unsigned int probe = 1;
+    return *reinterpret_cast<const unsigned char*>(&probe) == 1 ? TJPF_BGRX : TJPF_XRGB;
+}
+
+long long compressToOutputStream(JNIEnv* env, jobject outputStream,
+                                 const unsigned char* pixels, int width, int height,
+                                 int pitch, int pixelFormat, int quality) {
+    return compressToOutputStream(env, outputStream, pixels, width, height, pitch, pixelFormat,
+                                  defaultEncodeParams(quality));
+}
+
+long long compressToOutputStream(JNIEnv* env, jobject outputStream,
+                                 const unsigned char* pixels, int width, int height,
+                                 int pitch, int pixelFormat, const EncodeParams& params) {
+    if (!pixels || !outputStream || width <= 0 || height <= 0 ||
+        pixelFormat < 0 || pixelFormat >= TJ_NUMPF || !validEncodeParams(params)) {
+        return -1;
+    }
+    if (pitch <= 0) {
+        pitch = width * tjPixelSize[pixelFormat];
+    }
+
+    RowInput input;
+    input.pixels = pixels;
+    input.pitch = static_cast<size_t>(pitch);
+    input.fill = nullptr;
+    input.context = nullptr;
+    input.band = nullptr;
+    return compressInput(env, outputStream, &input, width, height, pixelFormat, params);
+}
+
+long long compressRowsToOutputStream(JNIEnv* env, jobject outputStream,
+                                     FillRowsFn fill, void* context, int width, int height,
+                                     int pixelFormat, int quality) {
+    return compressRowsToOutputStream(env, outputStream, fill, context, width, height, pixelFormat,
+                                      defaultEncodeParams(quality));
+}
+
+long long compressRowsToOutputStream(JNIEnv* env, jobject outputStream,
+                                     FillRowsFn fill, void* context, int width, int height,
+                                     int pixelFormat, const EncodeParams& params) {
+    if (!fill || !outputStream || width <= 0 || height <= 0 ||
+        pixelFormat < 0 || pixelFormat >= TJ_NUMPF || !validEncodeParams(params)) {
+        return -1;
+    }
+
+    RowInput input;
+    input.pixels = nullptr;
+    input.pitch = static_cast<size_t>(width) * tjPixelSize[pixelFormat];
+    input.fill = fill;
+    input.context = context;
+    input.band = nullptr;
+    return compressInput(env, outputStream, &input, width, height, pixelFormat, params);
+}
+
+bool fillFromCriticalArray(void* context, int firstRow, int rows,
+                           unsigned char* out, size_t pitch) {
+    CriticalArraySource* source = static_cast<CriticalArraySource*>(context);
+    unsigned char* data = static_cast<unsigned char*>(
+        source->env->GetPrimitiveArrayCritical(source->array, nullptr));
+    if (!data) {
+        return false;
+    }
+    for (int i = 0; i < rows; i++) {
+        std::memcpy(out + i * pitch, data + static_cast<size_t>(firstRow + i) * source->rowBytes,
+                    source->rowBytes);
+    }
+    source->env->ReleasePrimitiveArrayCritical(source->array, data, JNI_ABORT);
+    return true;
+}
+
+long long compressArgbArrayToOutputStream(JNIEnv* env, jobject outputStream, jintArray pixels,
+                                          int width, int height, int quality) {
+    return compressArgbArrayToOutputStream(env, outputStream, pixels, width, height,
+                                           defaultEncodeParams(quality));
+}
+
+long long compressArgbArrayToOutputStream(JNIEnv* env, jobject outputStream, jintArray pixels,
+                                          int width, int height, const EncodeParams& params) {
+    if (!pixels || width <= 0 || height <= 0 ||
+        env->GetArrayLength(pixels) < static_cast<long long>(width) * height) {
+        return -1;
+    }
+    CriticalArraySource source = { env, pixels, static_cast<size_t>(width) * 4 };
+    return compressRowsToOutputStream(env, outputStream, fillFromCriticalArray, &source,
+                                      width, height, nativeArgbPixelFormat(), params);
+}
+
+bool readEncodeParams(JNIEnv* env, jintArray params, jintArray quantTable,
+                      EncodeParams* out, unsigned short* quant) {
+    if (!params || env->GetArrayLength(params) < JNI_PARAM_COUNT) {
+        return false;
+    }
+    jint values[JNI_PARAM_COUNT];
+    env->GetIntArrayRegion(params, 0, JNI_PARAM_COUNT, values);
+    *out = defaultEncodeParams(values[0]);
+    out->subsampling = values[1];
+    out->fastDct = values[2];
+    out->progressive = values[3];
+    out->optimizeCoding = values[4];
+    out->restartRows = values[5];
+
+    if (quantTable) {
+        const jsize length = env->GetArrayLength(quantTable);
+        if (length != 64 && length != 128) {
+            return false;
+        }
+        jint table[128];
+        env->GetIntArrayRegion(quantTable, 0, length, table);
+        for (int i = 0; i < 128; i++) {
+            const jint value = table[i % length];
+            if (value < 1 || value > 255) {
+                return false;
+            }
+            quant[i] = static_cast<unsigned short>(value);
+        }
+        out->quantTable = quant;
+    }
+    return validEncodeParams(*out);
+}
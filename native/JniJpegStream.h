@@ -0,0 +1,128 @@
+/**
+ * Streaming JPEG output to a java.io.OutputStream
+ *
+ * Compresses with the libjpeg API through a custom jpeg_destination_mgr that
+ * flushes fixed-size chunks from one reused byte[] into the stream while
+ * compression runs. No Java array as large as the JPEG is ever allocated and
+ * the compressed data is never held in native memory as a whole.
+ */
+
+#ifndef JNI_JPEG_STREAM_H
+#define JNI_JPEG_STREAM_H
+
+#include <jni.h>
+#include <cstddef>
+
+struct EncodeParams;
+
+// Size of the reused byte[] passed to OutputStream.write(byte[], int, int)
+static const int JNI_STREAM_CHUNK_SIZE = 256 * 1024;
+
+/**
+ * Cache the OutputStream.write([BII)V method ID.
+ * Call from JNI_OnLoad; compressToOutputStream() also caches it lazily.
+ * @return true on success
+ */
+bool cacheStreamMethods(JavaVM* vm);
+
+/**
+ * Compress an interleaved 8-bit image and stream it to outputStream.
+ * Settings match tjCompress2(..., TJSAMP_420, quality, TJFLAG_FASTDCT).
+ *
+ * @param pixels Pixel rows, pitch bytes apart (0 = width * pixel size)
+ * @param pixelFormat TJPF_* value (RGB, BGR, RGBX, BGRX, ..., GRAY)
+ * @param quality JPEG quality 1-100
+ * @return Bytes written, or -1 on failure. If OutputStream.write throws, the
+ *         Java exception is left pending for the caller to rethrow.
+ */
+long long compressToOutputStream(JNIEnv* env, jobject outputStream,
+                                 const unsigned char* pixels, int width, int height,
+                                 int pitch, int pixelFormat, int quality);
+
+/**
+ * compressToOutputStream with explicit settings (see EncodeParams.h)
+ */
+long long compressToOutputStream(JNIEnv* env, jobject outputStream,
+                                 const unsigned char* pixels, int width, int height,
+                                 int pitch, int pixelFormat, const EncodeParams& params);
+
+/**
+ * Row supplier for compressRowsToOutputStream: write rows
+ * [firstRow, firstRow + rows) (at most 16) into out, pitch bytes apart.
+ * It runs between libjpeg calls, never while OutputStream.write is active,
+ * so it may hold a GetPrimitiveArrayCritical region for its own duration.
+ * @return false to abort compression
+ */
+typedef bool (*FillRowsFn)(void* context, int firstRow, int rows,
+                           unsigned char* out, size_t pitch);
+
+/**
+ * Same as compressToOutputStream, but pixels are pulled from fill in bands
+ * of 16 rows, so only one band is held in native memory.
+ */
+long long compressRowsToOutputStream(JNIEnv* env, jobject outputStream,
+                                     FillRowsFn fill, void* context, int width, int height,
+                                     int pixelFormat, int quality);
+
+/**
+ * compressRowsToOutputStream with explicit settings (see EncodeParams.h)
+ */
+long long compressRowsToOutputStream(JNIEnv* env, jobject outputStream,
+                                     FillRowsFn fill, void* context, int width, int height,
+                                     int pixelFormat, const EncodeParams& params);
+
+/**
+ * Java primitive array read by fillFromCriticalArray: rows of rowBytes bytes,
+ * back to back
+ */
+struct CriticalArraySource {
+    JNIEnv* env;
+    jarray array;
+    size_t rowBytes;
+};
+
+/**
+ * FillRowsFn copying one band out of a CriticalArraySource inside its own
+ * short GetPrimitiveArrayCritical section, so the GC is held off for one
+ * band at a time and the JVM never duplicates the whole array.
+ */
+bool fillFromCriticalArray(void* context, int firstRow, int rows,
+                           unsigned char* out, size_t pitch);
+
+/**
+ * Stream a Java ARGB int[] (width * height pixels) to outputStream, copying
+ * 16 rows at a time through fillFromCriticalArray. The ints are compressed
+ * as nativeArgbPixelFormat() bytes: no ARGB to RGB pass, no full-frame copy.
+ * @return Bytes written, or -1 on failure (including a too short array)
+ */
+long long compressArgbArrayToOutputStream(JNIEnv* env, jobject outputStream, jintArray pixels,
+                                          int width, int height, int quality);
+
+/**
+ * compressArgbArrayToOutputStream with explicit settings (see EncodeParams.h)
+ */
+long long compressArgbArrayToOutputStream(JNIEnv* env, jobject outputStream, jintArray pixels,
+                                          int width, int height, const EncodeParams& params);
+
+// int[] params entries of the *WithParams JNI methods, in EncodeParams field order
+static const int JNI_PARAM_COUNT = 6;
+
+/**
+ * Read the params / quantTable arguments of the *WithParams JNI methods
+ * params = {quality 1-100, subsampling (TJSAMP_*), fastDct, progressive, optimizeCoding,
+ * restartRows (MCU rows, 0 = none)}; quantTable is null, or 64 (luminance, also used for
+ * chrominance) or 128 values 1-255 in natural (not zigzag) order.
+ * @param quant Storage (128 entries) that out->quantTable points into
+ * @return false on malformed arguments
+ */
+bool readEncodeParams(JNIEnv* env, jintArray params, jintArray quantTable,
+                      EncodeParams* out, unsigned short* quant);
+
+/**
+ * TJPF_* value matching a Java ARGB int viewed as bytes in native order
+ * (TJPF_BGRX on little-endian hosts), so int[] and native-order IntBuffer
+ * pixels can be compressed without a swizzle pass.
+ */
+int nativeArgbPixelFormat();
+
+#endif // JNI_JPEG_STREAM_H
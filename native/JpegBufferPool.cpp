@@ -0,0 +1,118 @@
+#include "JpegBufferPool.h"
+#include "EncoderStats.h"
+#include <cstdlib>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+const int MIN_CLASS_SHIFT = 16;                           // 64KB
+const int NUM_CLASSES = (int)(sizeof(size_t) * 8) - 1 - MIN_CLASS_SHIFT;
+const size_t MAX_IDLE_PER_CLASS = 16;
+const size_t MAX_IDLE_BYTES = (size_t)512 * 1024 * 1024;  // idle memory kept across all classes
+
+struct BufferPool {
+    std::mutex mutex;
+    std::unordered_map<unsigned char*, int> rented;       // buffer -> size class
+    std::vector<unsigned char*> idle[NUM_CLASSES];
+    size_t idleBytes = 0;
+};
+
+// Leaked on purpose: FreeJPEGData may run during static destruction
+BufferPool& pool() {
+    static BufferPool* instance = new BufferPool();
+    return *instance;
+}
+
+size_t classSize(int sizeClass) {
+    return (size_t)1 << (sizeClass + MIN_CLASS_SHIFT);
+}
+
+int sizeClassFor(size_t size) {
+    int sizeClass = 0;
+    while (sizeClass < NUM_CLASSES - 1 && classSize(sizeClass) < size) {
+        sizeClass++;
+    }
+    return classSize(sizeClass) >= size ? sizeClass : -1;
+}
+
+} // namespace
+
+unsigned char* rentJpegBuffer(size_t minSize, size_t* capacity) {
+    const int sizeClass = sizeClassFor(minSize);
+    if (sizeClass < 0) {
+        return nullptr;
+    }
+
+    BufferPool& p = pool();
+    unsigned char* data = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(p.mutex);
+        std::vector<unsigned char*>& idle = p.idle[sizeClass];
+        if (!idle.empty()) {
+            data = idle.back();
+            idle.pop_back();
+            p.idleBytes -= classSize(sizeClass);
+            p.rented[data] = sizeClass;
+        }
+    }
+
+    if (!data) {
+        data = (unsigned char*)std::malloc(classSize(sizeClass));
+        if (!data) {
+            return nullptr;
+        }
+        recordAllocation(classSize(sizeClass));
+        std::lock_guard<std::mutex> lock(p.mutex);
+        p.rented[data] = sizeClass;
+    }
+
+    if (capacity) {
+        *capacity = classSize(sizeClass);
+    }
+    return data;
+}
+
+bool releaseJpegBuffer(unsigned char* data) {
+    if (!data) {
+        return false;
+    }
+
+    BufferPool& p = pool();
+    std::lock_guard<std::mutex> lock(p.mutex);
+    auto it = p.rented.find(data);
+    if (it == p.rented.end()) {
+        return false;
+    }
+    const int sizeClass = it->second;
+    p.rented.erase(it);
+
+    const size_t size = classSize(sizeClass);
+    if (p.idle[sizeClass].size() < MAX_IDLE_PER_CLASS && p.idleBytes + size <= MAX_IDLE_BYTES) {
+        p.idle[sizeClass].push_back(data);
+        p.idleBytes += size;
+    } else {
+        std::free(data);
+    }
+    return true;
+}
+
+size_t jpegBufferCapacity(const unsigned char* data) {
+    BufferPool& p = pool();
+    std::lock_guard<std::mutex> lock(p.mutex);
+    auto it = p.rented.find(const_cast<unsigned char*>(data));
+    return it == p.rented.end() ? 0 : classSize(it->second);
+}
+
+void trimJpegBufferPool() {
+    BufferPool& p = pool();
+    std::lock_guard<std::mutex> lock(p.mutex);
+    for (int i = 0; i < NUM_CLASSES; i++) {
+        for (unsigned char* data : p.idle[i]) {
+            std::free(data);
+        }
+        p.idle[i].clear();
+    }
+    p.idleBytes = 0;
+}
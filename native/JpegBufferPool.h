@@ -0,0 +1,38 @@
+/**
+ * Pool of output buffers for compressed JPEG data
+ *
+ * Buffers come in power-of-two size classes (64KB and up) and are recycled
+ * across threads, so encoders can compress straight into a rented buffer
+ * (TJFLAG_NOREALLOC) and hand it to the caller without a malloc + memcpy.
+ * Every rented buffer is registered; FreeJPEGData returns it to the pool.
+ */
+
+#ifndef JPEG_BUFFER_POOL_H
+#define JPEG_BUFFER_POOL_H
+
+#include <cstddef>
+
+/**
+ * Rent a buffer of at least minSize bytes
+ * @param capacity Receives the usable size of the buffer (its size class)
+ * @return Buffer, or nullptr when out of memory
+ */
+unsigned char* rentJpegBuffer(size_t minSize, size_t* capacity);
+
+/**
+ * Give a rented buffer back to the pool
+ * @return false if data was not rented from the pool (the caller frees it)
+ */
+bool releaseJpegBuffer(unsigned char* data);
+
+/**
+ * Size class of a rented buffer, or 0 if data was not rented from the pool
+ */
+size_t jpegBufferCapacity(const unsigned char* data);
+
+/**
+ * Free every idle pooled buffer
+ */
+void trimJpegBufferPool();
+
+#endif // JPEG_BUFFER_POOL_H
@@ -0,0 +1,58 @@
+#include "JpegTransform.h"
+#include "EncoderStats.h"
+#include "JpegBufferPool.h"
+#include "TjHandleCache.h"
+#include <climits>
+#include <cstring>
+
+unsigned char* transformJpeg(const unsigned char* jpeg, size_t size,
+                             const JpegTransformOp* ops, int numOps, size_t* jpegSize) {
+    if (!jpeg || size == 0 || size > ULONG_MAX || !jpegSize || numOps < 0 || (numOps > 0 && !ops)) {
+        return nullptr;
+    }
+    tjhandle tj = threadTransformer();
+    if (!tj) {
+        return nullptr;
+    }
+
+    // Each step reads the previous step's TurboJPEG-allocated output
+    const unsigned char* src = jpeg;
+    unsigned long srcSize = (unsigned long)size;
+    unsigned char* stepBuf = nullptr;
+
+    for (int i = 0; i < numOps; i++) {
+        tjtransform xform;
+        std::memset(&xform, 0, sizeof(xform));
+        xform.op = ops[i].op;
+        xform.options = ops[i].options;
+        xform.r.x = ops[i].x;
+        xform.r.y = ops[i].y;
+        xform.r.w = ops[i].width;
+        xform.r.h = ops[i].height;
+
+        unsigned char* outBuf = nullptr;
+        unsigned long outSize = 0;
+        const long long start = statsClock();
+        int ret = tjTransform(tj, src, srcSize, 1, &outBuf, &outSize, &xform, 0);
+        recordStage(STATS_CODING, start, (long long)srcSize);
+        tjFree(stepBuf);
+        stepBuf = nullptr;
+        if (ret != 0) {
+            recordError();
+            tjFree(outBuf);
+            return nullptr;
+        }
+        stepBuf = outBuf;
+        src = outBuf;
+        srcSize = outSize;
+    }
+
+    // Copy into a pooled buffer: TurboJPEG's allocation may belong to another CRT
+    unsigned char* result = rentJpegBuffer(srcSize, nullptr);
+    if (result) {
+        std::memcpy(result, src, srcSize);
+        *jpegSize = srcSize;
+    }
+    tjFree(stepBuf);
+    return result;
+}
@@ -0,0 +1,36 @@
+/**
+ * Lossless JPEG transforms (rotate, flip, transpose, crop) in the DCT domain
+ *
+ * Steps run through tjTransform one after another on the calling thread's
+ * cached transformer handle, so the image is never decoded to pixels and
+ * never re-quantized. Each step sees the previous step's output: a crop
+ * after a rotation is given in rotated coordinates.
+ */
+
+#ifndef JPEG_TRANSFORM_H
+#define JPEG_TRANSFORM_H
+
+#include <cstddef>
+
+/**
+ * One transform step, mirroring tjtransform
+ */
+struct JpegTransformOp {
+    int op;       // TJXOP_* (TJXOP_NONE for a plain crop)
+    int options;  // TJXOPT_* flags (TJXOPT_CROP uses the region below)
+    int x;        // Crop region; x and y must be multiples of the iMCU size
+    int y;
+    int width;    // 0 = to the right / bottom edge
+    int height;
+};
+
+/**
+ * Apply numOps steps to a JPEG (numOps == 0 copies it unchanged)
+ * @param jpegSize Receives the result size
+ * @return Result in a buffer rented from JpegBufferPool (release it with
+ *         releaseJpegBuffer / FreeJPEGData), nullptr on failure
+ */
+unsigned char* transformJpeg(const unsigned char* jpeg, size_t size,
+                             const JpegTransformOp* ops, int numOps, size_t* jpegSize);
+
+#endif // JPEG_TRANSFORM_H
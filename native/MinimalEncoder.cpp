@@ -1,5 +1,7 @@
 #include <jni.h>
 #include "include/turbojpeg.h"
+#include "JniJpegStream.h"
+#include "EncodeParams.h"
 #include <thread>
 #include <vector>
 
@@ -7,109 +9,20 @@ extern "C" {
 
 /**
  * 为 MinimalTest 类的 JNI 方法（无包名）
+ * 
+ * int[] 按本机字节序即 BGRX，每16行在一个很短的临界区内拷贝出来直接压缩，
+ * 不做ARGB到RGB转换，也不分配整帧缓冲；numThreads 仅为接口兼容保留
  */
 JNIEXPORT jint JNICALL Java_MinimalTest_encodeToStreamMT
   (JNIEnv *env, jobject obj, jintArray pixels, jint width, jint height, 
    jfloat quality, jobject outputStream, jint numThreads) {
     
-    // 自动检测CPU核心数
-    if (numThreads <= 0) {
-        numThreads = std::thread::hardware_concurrency();
-        if (numThreads <= 0) numThreads = 4;
-    }
-    
-    // 初始化TurboJPEG压缩器
-    tjhandle tjInstance = tjInitCompress();
-    if (!tjInstance) {
-        return -1;
-    }
-    
-    // 获取Java像素数组
-    jint* pixelData = env->GetIntArrayElements(pixels, nullptr);
-    if (!pixelData) {
-        tjDestroy(tjInstance);
-        return -1;
-    }
-    
-    long long pixelCount = (long long)width * height;
-    unsigned char* rgbBuffer = new unsigned char[pixelCount * 3];
-    
-    // 多线程转换ARGB到RGB
-    auto convertChunk = [pixelData, rgbBuffer](long long start, long long end) {
-        for (long long i = start; i < end; i++) {
-            int argb = pixelData[i];
-            rgbBuffer[i * 3 + 0] = (argb >> 16) & 0xFF; // R
-            rgbBuffer[i * 3 + 1] = (argb >> 8) & 0xFF;  // G
-            rgbBuffer[i * 3 + 2] = argb & 0xFF;         // B
-        }
-    };
-    
-    if (numThreads == 1) {
-        convertChunk(0, pixelCount);
-    } else {
-        std::vector<std::thread> threads;
-        long long chunkSize = pixelCount / numThreads;
-        
-        for (int t = 0; t < numThreads; t++) {
-            long long start = t * chunkSize;
-            long long end = (t == numThreads - 1) ? pixelCount : (t + 1) * chunkSize;
-            threads.emplace_back(convertChunk, start, end);
-        }
-        
-        for (auto& thread : threads) {
-            thread.join();
-        }
-    }
-    
-    env->ReleaseIntArrayElements(pixels, pixelData, JNI_ABORT);
-    
-    // TurboJPEG编码
-    unsigned char* jpegBuf = nullptr;
-    unsigned long jpegSize = 0;
     int qualityInt = (int)(quality * 100);
     if (qualityInt < 1) qualityInt = 1;
     if (qualityInt > 100) qualityInt = 100;
     
-    int ret = tjCompress2(
-        tjInstance, 
-        rgbBuffer,
-        width,
-        0,
-        height,
-        TJPF_RGB,
-        &jpegBuf,
-        &jpegSize,
-        TJSAMP_420,
-        qualityInt,
-        TJFLAG_FASTDCT
-    );
-    
-    delete[] rgbBuffer;
-    
-    if (ret != 0) {
-        tjDestroy(tjInstance);
-        return -1;
-    }
-    
-    // 写入Java OutputStream
-    jclass streamClass = env->GetObjectClass(outputStream);
-    jmethodID writeMethod = env->GetMethodID(streamClass, "write", "([BII)V");
-    
-    if (!writeMethod) {
-        tjFree(jpegBuf);
-        tjDestroy(tjInstance);
-        return -1;
-    }
-    
-    jbyteArray javaArray = env->NewByteArray(jpegSize);
-    env->SetByteArrayRegion(javaArray, 0, jpegSize, (jbyte*)jpegBuf);
-    env->CallVoidMethod(outputStream, writeMethod, javaArray, 0, jpegSize);
-    
-    env->DeleteLocalRef(javaArray);
-    tjFree(jpegBuf);
-    tjDestroy(tjInstance);
-    
-    return (jint)jpegSize;
+    // 编码并分块写入OutputStream
+    return (jint)compressArgbArrayToOutputStream(env, outputStream, pixels, width, height, qualityInt);
 }
 
 /**
@@ -139,16 +52,9 @@ JNIEXPORT jint JNICALL Java_MinimalTest_encodeFromBGR
         if (numThreads <= 0) numThreads = 4;
     }
     
-    // 初始化TurboJPEG压缩器
-    tjhandle tjInstance = tjInitCompress();
-    if (!tjInstance) {
-        return -1;
-    }
-    
     // 获取Java字节数组
     jbyte* bgrBytes = env->GetByteArrayElements(bgrData, nullptr);
     if (!bgrBytes) {
-        tjDestroy(tjInstance);
         return -1;
     }
     
@@ -156,53 +62,63 @@ JNIEXPORT jint JNICALL Java_MinimalTest_encodeFromBGR
     // TurboJPEG支持BGR格式，无需转换
     unsigned char* imageData = (unsigned char*)bgrBytes;
     
-    unsigned char* jpegBuf = nullptr;
-    unsigned long jpegSize = 0;
     int qualityInt = (int)(quality * 100);
     if (qualityInt < 1) qualityInt = 1;
     if (qualityInt > 100) qualityInt = 100;
     
-    // 直接编码BGR数据（TJPF_BGR表示BGR格式）
-    int ret = tjCompress2(
-        tjInstance, 
-        imageData,
-        width,
-        0,  // pitch (0=自动计算: width * 3)
-        height,
-        TJPF_BGR,  // ← 直接使用BGR格式，无需转换！
-        &jpegBuf,
-        &jpegSize,
-        TJSAMP_420,
-        qualityInt,
-        TJFLAG_FASTDCT
-    );
+    // 直接编码BGR数据（TJPF_BGR表示BGR格式），边编码边写入OutputStream
+    long long jpegSize = compressToOutputStream(env, outputStream, imageData,
+                                                width, height, 0, TJPF_BGR, qualityInt);
     
     env->ReleaseByteArrayElements(bgrData, bgrBytes, JNI_ABORT);
     
-    if (ret != 0) {
-        tjDestroy(tjInstance);
+    return (jint)jpegSize;
+}
+
+/**
+ * encodeToStream 的显式编码参数版本
+ * params = {quality, subsampling, fastDct, progressive, optimizeCoding, restartRows}，
+ * quantTable 为 null 或 64 / 128 个 1-255 的值（格式见 JniJpegStream.h 的 readEncodeParams）
+ */
+JNIEXPORT jint JNICALL Java_MinimalTest_encodeToStreamWithParams
+  (JNIEnv *env, jobject obj, jintArray pixels, jint width, jint height, 
+   jintArray params, jintArray quantTable, jobject outputStream) {
+    
+    EncodeParams encodeParams;
+    unsigned short quant[128];
+    if (!readEncodeParams(env, params, quantTable, &encodeParams, quant)) {
         return -1;
     }
     
-    // 写入Java OutputStream
-    jclass streamClass = env->GetObjectClass(outputStream);
-    jmethodID writeMethod = env->GetMethodID(streamClass, "write", "([BII)V");
+    return (jint)compressArgbArrayToOutputStream(env, outputStream, pixels, width, height, encodeParams);
+}
+
+/**
+ * encodeFromBGR 的显式编码参数版本（params / quantTable 同 encodeToStreamWithParams）
+ * 每16行在一个很短的临界区内拷贝出来压缩，JVM 不会复制整个数组
+ */
+JNIEXPORT jint JNICALL Java_MinimalTest_encodeFromBGRWithParams
+  (JNIEnv *env, jobject obj, jbyteArray bgrData, jint width, jint height, 
+   jintArray params, jintArray quantTable, jobject outputStream) {
     
-    if (!writeMethod) {
-        tjFree(jpegBuf);
-        tjDestroy(tjInstance);
+    EncodeParams encodeParams;
+    unsigned short quant[128];
+    if (!bgrData || !readEncodeParams(env, params, quantTable, &encodeParams, quant) ||
+        width <= 0 || height <= 0 || env->GetArrayLength(bgrData) < (jlong)width * height * 3) {
         return -1;
     }
     
-    jbyteArray javaArray = env->NewByteArray(jpegSize);
-    env->SetByteArrayRegion(javaArray, 0, jpegSize, (jbyte*)jpegBuf);
-    env->CallVoidMethod(outputStream, writeMethod, javaArray, 0, jpegSize);
-    
-    env->DeleteLocalRef(javaArray);
-    tjFree(jpegBuf);
-    tjDestroy(tjInstance);
-    
-    return (jint)jpegSize;
+    CriticalArraySource source = { env, bgrData, (size_t)width * 3 };
+    return (jint)compressRowsToOutputStream(env, outputStream, fillFromCriticalArray, &source,
+                                            width, height, TJPF_BGR, encodeParams);
+}
+
+/**
+ * 加载时缓存OutputStream.write方法ID
+ */
+JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM* vm, void* reserved) {
+    cacheStreamMethods(vm);
+    return JNI_VERSION_1_8;
 }
 
 } // extern "C"
@@ -4,8 +4,11 @@
  */
 
 #include <turbojpeg.h>
+#include "EncodeParams.h"
+#include "JniJpegStream.h"
+#include "JpegBufferPool.h"
+#include "WorkerPool.h"
 #include <cstring>
-#include <vector>
 #include <thread>
 #include <algorithm>
 
@@ -28,55 +31,23 @@ struct TileJPEG {
 /**
  * Encode a single tile in parallel
  */
-void encodeTile(const int* rgbData, int imageWidth, int imageHeight,
+void encodeTile(const int* rgbData, int imageWidth,
                 int tileX, int tileY, int tileWidth, int tileHeight,
-                int quality, TileJPEG* output) {
+                const EncodeParams& params, TileJPEG* output) {
     
-    // Allocate BGR buffer for this tile
-    int tilePixels = tileWidth * tileHeight;
-    unsigned char* bgrTile = new unsigned char[tilePixels * 3];
+    // INT_RGB ints viewed as bytes are nativeArgbPixelFormat() (BGRX on
+    // little-endian hosts): compress the tile in place (pitch = image row),
+    // no per-tile conversion buffer
+    const unsigned char* tilePixels = (const unsigned char*)(rgbData + (size_t)tileY * imageWidth + tileX);
     
-    // Convert INT_RGB to BGR for this tile
-    for (int ty = 0; ty < tileHeight; ty++) {
-        int srcY = tileY + ty;
-        if (srcY >= imageHeight) break;
-        
-        for (int tx = 0; tx < tileWidth; tx++) {
-            int srcX = tileX + tx;
-            if (srcX >= imageWidth) break;
-            
-            int srcIdx = srcY * imageWidth + srcX;
-            int dstIdx = ty * tileWidth + tx;
-            
-            int argb = rgbData[srcIdx];
-            bgrTile[dstIdx * 3 + 0] = (unsigned char)((argb) & 0xFF);        // B
-            bgrTile[dstIdx * 3 + 1] = (unsigned char)((argb >> 8) & 0xFF);   // G
-            bgrTile[dstIdx * 3 + 2] = (unsigned char)((argb >> 16) & 0xFF);  // R
-        }
-    }
-    
-    // Compress tile
-    tjhandle tj = tjInitCompress();
-    unsigned char* jpegBuf = nullptr;
-    unsigned long jpegSize = 0;
-    
-    int ret = tjCompress2(
-        tj,
-        bgrTile,
-        tileWidth,
-        0,  // pitch
-        tileHeight,
-        TJPF_BGR,
-        &jpegBuf,
-        &jpegSize,
-        TJSAMP_420,
-        quality,
-        TJFLAG_FASTDCT
-    );
+    // Compress tile on this worker's cached handle (reused across its tiles),
+    // into a pooled buffer
+    size_t jpegSize = 0;
+    unsigned char* jpegBuf = encodeWithParams(tilePixels, tileWidth, tileHeight,
+                                              imageWidth * 4,  // pitch
+                                              nativeArgbPixelFormat(), params, nullptr, 0, &jpegSize);
     
-    delete[] bgrTile;
-    
-    if (ret == 0) {
+    if (jpegBuf) {
         output->data = jpegBuf;
         output->size = jpegSize;
         output->tileX = tileX;
@@ -84,27 +55,27 @@ void encodeTile(const int* rgbData, int imageWidth, int imageHeight,
     } else {
         output->data = nullptr;
         output->size = 0;
-        tjDestroy(tj);
     }
 }
 
 /**
- * Parallel tile encoding with automatic thread management
+ * EncodeParallelTiles with explicit settings (see EncodeParams.h)
  * @param rgbData INT_RGB pixel data (4 bytes per pixel)
  * @param width Image width
  * @param height Image height
- * @param quality JPEG quality (1-100)
  * @param tileSize Tile size (e.g., 4096x4096)
+ * @param params Encoder settings for every tile
  * @param numTiles Output: number of tiles generated
- * @return Array of TileJPEG (caller must free)
+ * @return Array of TileJPEG (caller must free with FreeTileArray)
  */
-DLL_EXPORT TileJPEG* EncodeParallelTiles(const int* rgbData, 
-                                         int width, 
-                                         int height,
-                                         int quality,
-                                         int tileSize,
-                                         int* numTiles) {
-    if (!rgbData || width <= 0 || height <= 0 || tileSize <= 0) {
+DLL_EXPORT TileJPEG* EncodeParallelTilesWithParams(const int* rgbData,
+                                                   int width,
+                                                   int height,
+                                                   int tileSize,
+                                                   const EncodeParams* params,
+                                                   int* numTiles) {
+    if (!rgbData || width <= 0 || height <= 0 || tileSize <= 0 ||
+        !params || !validEncodeParams(*params)) {
         *numTiles = 0;
         return nullptr;
     }
@@ -119,40 +90,42 @@ DLL_EXPORT TileJPEG* EncodeParallelTiles(const int* rgbData,
     // Allocate output array
     TileJPEG* tiles = new TileJPEG[totalTiles];
     
-    // Parallel encoding
+    // Parallel encoding on the shared worker pool
     int numThreads = std::thread::hardware_concurrency();
     if (numThreads <= 0) numThreads = 8;
     
-    std::vector<std::thread> threads;
-    std::atomic<int> tileIndex(0);
-    
-    auto workerFunc = [&]() {
-        while (true) {
-            int idx = tileIndex.fetch_add(1);
-            if (idx >= totalTiles) break;
-            
-            int tx = (idx % tilesX) * tileSize;
-            int ty = (idx / tilesX) * tileSize;
-            int tw = std::min(tileSize, width - tx);
-            int th = std::min(tileSize, height - ty);
-            
-            encodeTile(rgbData, width, height, tx, ty, tw, th, quality, &tiles[idx]);
-        }
-    };
-    
-    // Launch worker threads
-    for (int i = 0; i < numThreads; i++) {
-        threads.emplace_back(workerFunc);
-    }
-    
-    // Wait for completion
-    for (auto& t : threads) {
-        t.join();
-    }
+    parallelFor(totalTiles, numThreads, [&](int idx) {
+        int tx = (idx % tilesX) * tileSize;
+        int ty = (idx / tilesX) * tileSize;
+        int tw = std::min(tileSize, width - tx);
+        int th = std::min(tileSize, height - ty);
+        
+        encodeTile(rgbData, width, tx, ty, tw, th, *params, &tiles[idx]);
+    });
     
     return tiles;
 }
 
+/**
+ * Parallel tile encoding with automatic thread management
+ * @param rgbData INT_RGB pixel data (4 bytes per pixel)
+ * @param width Image width
+ * @param height Image height
+ * @param quality JPEG quality (1-100)
+ * @param tileSize Tile size (e.g., 4096x4096)
+ * @param numTiles Output: number of tiles generated
+ * @return Array of TileJPEG (caller must free)
+ */
+DLL_EXPORT TileJPEG* EncodeParallelTiles(const int* rgbData, 
+                                         int width, 
+                                         int height,
+                                         int quality,
+                                         int tileSize,
+                                         int* numTiles) {
+    const EncodeParams params = defaultEncodeParams(quality);
+    return EncodeParallelTilesWithParams(rgbData, width, height, tileSize, &params, numTiles);
+}
+
 /**
  * Free tile array
  */
@@ -161,7 +134,7 @@ DLL_EXPORT void FreeTileArray(TileJPEG* tiles, int numTiles) {
     
     for (int i = 0; i < numTiles; i++) {
         if (tiles[i].data) {
-            tjFree(tiles[i].data);
+            releaseJpegBuffer(tiles[i].data);
         }
     }
     
@@ -0,0 +1,316 @@
+#include "StripParallelEncoder.h"
+#include "EncoderStats.h"
+#include "JpegBufferPool.h"
+#include "WorkerPool.h"
+#include <cstdio>
+#include <cstdlib>
+#include <csetjmp>
+#include <cstring>
+#include <new>
+#include <thread>
+#include <vector>
+#include "include/jpeglib.h"
+#include "include/jerror.h"
+#include "include/turbojpeg.h"
+
+namespace {
+
+// Most pixel rows in one MCU row (4:2:0 and 4:4:0)
+const int MAX_MCU_HEIGHT = 16;
+
+// error_exit must not return: jump back to the setjmp in compressStrip
+struct ErrorManager {
+    jpeg_error_mgr pub;
+    jmp_buf jump;
+};
+
+void errorExit(j_common_ptr cinfo) {
+    longjmp(reinterpret_cast<ErrorManager*>(cinfo->err)->jump, 1);
+}
+
+void outputMessage(j_common_ptr) {
+}
+
+// One strip's compressed output, in a malloc'd buffer that doubles as needed
+struct StripOutput {
+    jpeg_destination_mgr pub;
+    unsigned char* data;
+    size_t capacity;
+    size_t size;
+    bool ok;
+};
+
+void initDestination(j_compress_ptr cinfo) {
+    StripOutput* out = reinterpret_cast<StripOutput*>(cinfo->dest);
+    out->pub.next_output_byte = out->data;
+    out->pub.free_in_buffer = out->capacity;
+}
+
+boolean emptyOutputBuffer(j_compress_ptr cinfo) {
+    StripOutput* out = reinterpret_cast<StripOutput*>(cinfo->dest);
+    unsigned char* grown = static_cast<unsigned char*>(std::realloc(out->data, out->capacity * 2));
+    if (!grown) {
+        ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 10);
+    }
+    out->data = grown;
+    out->pub.next_output_byte = grown + out->capacity;
+    out->pub.free_in_buffer = out->capacity;
+    out->capacity *= 2;
+    return TRUE;
+}
+
+void termDestination(j_compress_ptr cinfo) {
+    StripOutput* out = reinterpret_cast<StripOutput*>(cinfo->dest);
+    out->size = out->capacity - out->pub.free_in_buffer;
+}
+
+// Compress rows as a standalone JPEG with a restart marker after every
+// restartRows MCU rows. Only POD state lives here: longjmp skips destructors
+bool compressStrip(const unsigned char* pixels, size_t pitch, int width, int rows,
+                   int pixelFormat, const EncodeParams* params, StripOutput* out) {
+    jpeg_compress_struct cinfo;
+    ErrorManager err;
+    cinfo.err = jpeg_std_error(&err.pub);
+    err.pub.error_exit = errorExit;
+    err.pub.output_message = outputMessage;
+
+    if (setjmp(err.jump)) {
+        jpeg_destroy_compress(&cinfo);
+        return false;
+    }
+
+    jpeg_create_compress(&cinfo);
+    out->pub.init_destination = initDestination;
+    out->pub.empty_output_buffer = emptyOutputBuffer;
+    out->pub.term_destination = termDestination;
+    cinfo.dest = &out->pub;
+
+    // Standard Huffman tables (no optimize_coding) keep the tables identical
+    // across strips, so one header serves the stitched image
+    setupCompressor(&cinfo, width, rows, pixelFormat, *params);
+    cinfo.restart_in_rows = params->restartRows > 0 ? params->restartRows : 1;
+
+    jpeg_start_compress(&cinfo, TRUE);
+
+    JSAMPROW rowPointers[MAX_MCU_HEIGHT];
+    while (cinfo.next_scanline < cinfo.image_height) {
+        JDIMENSION count = cinfo.image_height - cinfo.next_scanline;
+        if (count > MAX_MCU_HEIGHT) count = MAX_MCU_HEIGHT;
+        for (JDIMENSION i = 0; i < count; i++) {
+            rowPointers[i] = const_cast<JSAMPROW>(pixels + (cinfo.next_scanline + i) * pitch);
+        }
+        jpeg_write_scanlines(&cinfo, rowPointers, count);
+    }
+
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    return true;
+}
+
+// Rows in strip i of numStrips (the last one takes the remainder)
+int stripHeight(int i, int height, int stripRows, int numStrips) {
+    return i + 1 == numStrips ? height - i * stripRows : stripRows;
+}
+
+// Locate the SOF height field and the first entropy-coded byte of a
+// libjpeg-written JPEG (which ends in EOI right after its scan)
+bool findScan(const unsigned char* data, size_t size, size_t* sofHeight, size_t* scanStart) {
+    if (size < 4 || data[size - 2] != 0xFF || data[size - 1] != 0xD9) {
+        return false;
+    }
+    *sofHeight = 0;
+    size_t pos = 2;  // after SOI
+    while (pos + 4 <= size && data[pos] == 0xFF) {
+        const unsigned char marker = data[pos + 1];
+        const size_t length = (static_cast<size_t>(data[pos + 2]) << 8) | data[pos + 3];
+        if (marker == 0xC0 || marker == 0xC1) {
+            *sofHeight = pos + 5;  // FF Cn Lh Ll P [Yh Yl]
+        } else if (marker == 0xDA) {
+            *scanStart = pos + 2 + length;
+            return *sofHeight != 0 && *scanStart <= size - 2;
+        }
+        pos += 2 + length;
+    }
+    return false;
+}
+
+// Rewrite the RSTn markers in entropy-coded data to continue the sequence at restartIndex
+void renumberRestarts(unsigned char* begin, unsigned char* end, unsigned* restartIndex) {
+    unsigned char* p = begin;
+    while (end - p >= 2) {
+        unsigned char* hit = static_cast<unsigned char*>(std::memchr(p, 0xFF, end - p - 1));
+        if (!hit) {
+            break;
+        }
+        if (hit[1] >= 0xD0 && hit[1] <= 0xD7) {
+            hit[1] = static_cast<unsigned char>(0xD0 + (*restartIndex & 7));
+            ++*restartIndex;
+        }
+        p = hit + 2;  // the byte after 0xFF is 0x00 (stuffing) or a marker code
+    }
+}
+
+} // namespace
+
+// Opaque in the header, which does not see libjpeg
+struct StripEncodeJob::Strip {
+    StripOutput out;
+};
+
+StripEncodeJob::StripEncodeJob()
+    : pixels_(nullptr), width_(0), height_(0), pitch_(0), pixelFormat_(0),
+      params_(defaultEncodeParams(0)), stripRows_(0), numStrips_(0), strips_(nullptr) {
+}
+
+StripEncodeJob::~StripEncodeJob() {
+    for (int i = 0; i < numStrips_; i++) {
+        std::free(strips_[i].out.data);
+    }
+    delete[] strips_;
+}
+
+bool StripEncodeJob::init(const unsigned char* pixels, int width, int height, int pitch,
+                          int pixelFormat, const EncodeParams& params, int stripRows,
+                          int numThreads) {
+    if (strips_ || !pixels || width <= 0 || height <= 0 || width > 65535 || height > 65535 ||
+        pixelFormat < 0 || pixelFormat >= TJ_NUMPF || pixelFormat == TJPF_CMYK ||
+        !validEncodeParams(params) || params.progressive || params.optimizeCoding) {
+        return false;
+    }
+    if (pitch <= 0) {
+        pitch = width * tjPixelSize[pixelFormat];
+    }
+
+    if (stripRows <= 0) {
+        if (numThreads <= 0) {
+            numThreads = std::thread::hardware_concurrency();
+            if (numThreads <= 0) numThreads = 4;
+        }
+        // About four strips per thread balances uneven strip costs
+        stripRows = (height + numThreads * 4 - 1) / (numThreads * 4);
+        if (stripRows < 64) stripRows = 64;
+    }
+    // Strips end on restart boundaries
+    const int restartHeight = encodeMcuHeight(params, pixelFormat) *
+                              (params.restartRows > 0 ? params.restartRows : 1);
+    if (stripRows > height) stripRows = height;
+    stripRows = (stripRows + restartHeight - 1) / restartHeight * restartHeight;
+
+    const int numStrips = (height + stripRows - 1) / stripRows;
+    strips_ = new (std::nothrow) Strip[numStrips];
+    if (!strips_) {
+        return false;
+    }
+    numStrips_ = numStrips;
+    for (int i = 0; i < numStrips; i++) {
+        StripOutput& out = strips_[i].out;
+        out.capacity = static_cast<size_t>(width) * stripHeight(i, height, stripRows, numStrips) / 4 + 4096;
+        out.data = static_cast<unsigned char*>(std::malloc(out.capacity));
+        out.size = 0;
+        out.ok = false;
+    }
+
+    pixels_ = pixels;
+    width_ = width;
+    height_ = height;
+    pitch_ = pitch;
+    pixelFormat_ = pixelFormat;
+    params_ = params;
+    stripRows_ = stripRows;
+    return true;
+}
+
+void StripEncodeJob::compressStrip(int i) {
+    StripOutput& out = strips_[i].out;
+    const int rows = stripHeight(i, height_, stripRows_, numStrips_);
+    StatsTimer timer(STATS_CODING);
+    timer.setBytes(static_cast<long long>(rows) * pitch_);
+    out.ok = out.data && ::compressStrip(pixels_ + static_cast<size_t>(i) * stripRows_ * pitch_,
+                                         static_cast<size_t>(pitch_), width_, rows,
+                                         pixelFormat_, &params_, &out);
+    if (!out.ok) {
+        recordError();
+    }
+}
+
+unsigned char* StripEncodeJob::stitch(size_t* jpegSize) {
+    if (!strips_ || !jpegSize) {
+        return nullptr;
+    }
+
+    // First strip's header, every strip's scan, one EOI
+    unsigned char* result = nullptr;
+    size_t sofHeight = 0;
+    size_t headerSize = 0;
+    size_t total = 0;
+    bool ok = true;
+    std::vector<size_t> scanStarts(numStrips_);
+    for (int i = 0; i < numStrips_ && ok; i++) {
+        const StripOutput& out = strips_[i].out;
+        size_t stripSofHeight = 0;
+        ok = out.ok && findScan(out.data, out.size, &stripSofHeight, &scanStarts[i]);
+        if (ok && i == 0) {
+            sofHeight = stripSofHeight;
+            headerSize = scanStarts[0];
+            total = headerSize + 2;  // + EOI
+        }
+        if (ok) {
+            total += out.size - scanStarts[i] - 2 + (i > 0 ? 2 : 0);  // scan + RST before it
+        }
+    }
+
+    if (ok) {
+        result = rentJpegBuffer(total, nullptr);
+    }
+    if (result) {
+        StatsTimer timer(STATS_COPY_OUT);
+        timer.setBytes(static_cast<long long>(total));
+        unsigned char* dst = result;
+        std::memcpy(dst, strips_[0].out.data, headerSize);
+        dst[sofHeight] = static_cast<unsigned char>(height_ >> 8);
+        dst[sofHeight + 1] = static_cast<unsigned char>(height_ & 0xFF);
+        dst += headerSize;
+
+        unsigned restartIndex = 0;
+        for (int i = 0; i < numStrips_; i++) {
+            if (i > 0) {
+                // The interval ending the previous strip is followed by a restart
+                *dst++ = 0xFF;
+                *dst++ = static_cast<unsigned char>(0xD0 + (restartIndex & 7));
+                restartIndex++;
+            }
+            const StripOutput& out = strips_[i].out;
+            const size_t scanSize = out.size - scanStarts[i] - 2;
+            std::memcpy(dst, out.data + scanStarts[i], scanSize);
+            renumberRestarts(dst, dst + scanSize, &restartIndex);
+            dst += scanSize;
+        }
+        *dst++ = 0xFF;
+        *dst++ = 0xD9;
+        *jpegSize = total;
+    }
+    return result;
+}
+
+unsigned char* encodeStripsParallel(const unsigned char* pixels, int width, int height, int pitch,
+                                    int pixelFormat, const EncodeParams& params, int stripRows,
+                                    int numThreads, size_t* jpegSize) {
+    if (!jpegSize) {
+        return nullptr;
+    }
+    if (numThreads <= 0) {
+        numThreads = std::thread::hardware_concurrency();
+        if (numThreads <= 0) numThreads = 4;
+    }
+
+    StripEncodeJob job;
+    if (!job.init(pixels, width, height, pitch, pixelFormat, params, stripRows, numThreads)) {
+        return nullptr;
+    }
+
+    // Pool workers take strips in order
+    parallelFor(job.stripCount(), numThreads, [&](int i) {
+        job.compressStrip(i);
+    });
+    return job.stitch(jpegSize);
+}
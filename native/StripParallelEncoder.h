@@ -0,0 +1,84 @@
+/**
+ * Parallel baseline JPEG encoding in horizontal strips
+ *
+ * The image is cut into strips of whole MCU rows, each compressed on its own
+ * thread by libjpeg with identical settings (same quantization and standard
+ * Huffman tables) and a restart marker after every MCU row (or every
+ * EncodeParams::restartRows MCU rows). A restart
+ * interval resets the DC predictors, so every strip's entropy-coded data is
+ * exactly what a serial encode would produce for those rows. The strips are
+ * joined into one standards-compliant JPEG: the first strip's header with the
+ * full image height, then the strips' scans with their RSTn markers
+ * renumbered into one sequence, then EOI.
+ */
+
+#ifndef STRIP_PARALLEL_ENCODER_H
+#define STRIP_PARALLEL_ENCODER_H
+
+#include "EncodeParams.h"
+#include <cstddef>
+
+/**
+ * Encode pixels (rows pitch bytes apart, TJPF_* pixelFormat) with params,
+ * compressing strips of stripRows rows on numThreads threads. Progressive
+ * and optimizeCoding need whole-image passes and are refused (nullptr).
+ *
+ * @param stripRows Rows per strip, rounded up to a multiple of the restart
+ *                  interval in rows; 0 picks about four strips per thread
+ * @param numThreads Threads on the job, from the shared WorkerPool (0 = CPU core count)
+ * @param jpegSize Receives the JPEG size
+ * @return JPEG in a buffer rented from JpegBufferPool (release it with
+ *         releaseJpegBuffer / FreeJPEGData), nullptr on failure
+ */
+unsigned char* encodeStripsParallel(const unsigned char* pixels, int width, int height, int pitch,
+                                    int pixelFormat, const EncodeParams& params, int stripRows,
+                                    int numThreads, size_t* jpegSize);
+
+/**
+ * One image planned as strips, for callers that schedule the strips
+ * themselves (batch encoding runs them next to other images' work).
+ * init(), then compressStrip() for every strip in any order and on any
+ * threads, then stitch().
+ */
+class StripEncodeJob {
+public:
+    StripEncodeJob();
+    ~StripEncodeJob();
+
+    /**
+     * Validate the image and plan its strips; arguments as for
+     * encodeStripsParallel (numThreads only sizes automatic strips)
+     */
+    bool init(const unsigned char* pixels, int width, int height, int pitch,
+              int pixelFormat, const EncodeParams& params, int stripRows, int numThreads);
+
+    int stripCount() const { return numStrips_; }
+
+    /**
+     * Compress strip i; different strips may be compressed concurrently
+     */
+    void compressStrip(int i);
+
+    /**
+     * Join the compressed strips, as returned by encodeStripsParallel
+     */
+    unsigned char* stitch(size_t* jpegSize);
+
+private:
+    struct Strip;
+
+    StripEncodeJob(const StripEncodeJob&) = delete;
+    StripEncodeJob& operator=(const StripEncodeJob&) = delete;
+
+    const unsigned char* pixels_;
+    int width_;
+    int height_;
+    int pitch_;
+    int pixelFormat_;
+    EncodeParams params_;
+    int stripRows_;
+    int numStrips_;
+    Strip* strips_;
+};
+
+#endif // STRIP_PARALLEL_ENCODER_H
@@ -0,0 +1,450 @@
+#include "TilePyramid.h"
+#include "EncoderStats.h"
+#include "JpegBufferPool.h"
+#include "WorkerPool.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csetjmp>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+#include "include/jpeglib.h"
+#include "include/turbojpeg.h"
+
+namespace {
+
+bool makeDirectory(const std::string& path) {
+#ifdef _WIN32
+    const int result = _mkdir(path.c_str());
+#else
+    const int result = mkdir(path.c_str(), 0755);
+#endif
+    return result == 0 || errno == EEXIST;
+}
+
+bool writeFile(const std::string& path, const unsigned char* data, size_t size) {
+    StatsTimer timer(STATS_IO);
+    timer.setBytes((long long)size);
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+    const bool ok = std::fwrite(data, 1, size, file) == size;
+    return std::fclose(file) == 0 && ok;
+}
+
+// 2x2 box average of rows a and b (b = nullptr: a alone, the odd last row).
+// An odd last column averages with itself.
+void halveRows(const unsigned char* a, const unsigned char* b, int width, int bytesPerPixel,
+               unsigned char* out) {
+    const int outWidth = (width + 1) / 2;
+    for (int x = 0; x < outWidth; x++) {
+        const int right = 2 * x + 1 < width ? bytesPerPixel : 0;
+        const unsigned char* p = a + (size_t)(2 * x) * bytesPerPixel;
+        if (b) {
+            const unsigned char* q = b + (size_t)(2 * x) * bytesPerPixel;
+            for (int i = 0; i < bytesPerPixel; i++) {
+                out[i] = (unsigned char)((p[i] + p[i + right] + q[i] + q[i + right] + 2) >> 2);
+            }
+        } else {
+            for (int i = 0; i < bytesPerPixel; i++) {
+                out[i] = (unsigned char)((p[i] + p[i + right] + 1) >> 1);
+            }
+        }
+        out += bytesPerPixel;
+    }
+}
+
+// error_exit must not return: jump back to the setjmp in decodeIntoPyramid
+struct ErrorManager {
+    jpeg_error_mgr pub;
+    jmp_buf jump;
+};
+
+void errorExit(j_common_ptr cinfo) {
+    longjmp(reinterpret_cast<ErrorManager*>(cinfo->err)->jump, 1);
+}
+
+void outputMessage(j_common_ptr) {
+}
+
+struct PyramidSettings {
+    int tileSize;
+    int overlap;
+    const EncodeParams* params;
+    int numThreads;
+    const char* basePath;
+    PyramidTileFn sink;
+    void* context;
+};
+
+const int DECODE_BAND_ROWS = 16;
+
+// Only POD state lives here (the pyramid is the caller's): longjmp skips destructors
+bool decodeIntoPyramid(const unsigned char* jpeg, size_t jpegSize, const PyramidSettings& settings,
+                       TilePyramid& pyramid) {
+    jpeg_decompress_struct cinfo;
+    ErrorManager err;
+    cinfo.err = jpeg_std_error(&err.pub);
+    err.pub.error_exit = errorExit;
+    err.pub.output_message = outputMessage;
+
+    if (setjmp(err.jump)) {
+        recordError();
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, jpeg, (unsigned long)jpegSize);
+    const long long headerStart = statsClock();
+    jpeg_read_header(&cinfo, TRUE);
+    recordStage(STATS_HEADER, headerStart, (long long)jpegSize);
+    const bool gray = cinfo.num_components == 1;
+    cinfo.out_color_space = gray ? JCS_GRAYSCALE : JCS_EXT_BGR;
+    cinfo.dct_method = JDCT_ISLOW;
+
+    const bool planned = settings.basePath
+        ? pyramid.initDirectory((int)cinfo.image_width, (int)cinfo.image_height, settings.tileSize,
+                                settings.overlap, *settings.params, settings.numThreads,
+                                settings.basePath)
+        : pyramid.init((int)cinfo.image_width, (int)cinfo.image_height, settings.tileSize,
+                       settings.overlap, *settings.params, settings.numThreads,
+                       settings.sink, settings.context);
+    if (!planned) {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+
+    jpeg_start_decompress(&cinfo);
+    const size_t rowBytes = (size_t)cinfo.output_width * cinfo.output_components;
+    // One contiguous band, so it goes to writeRows in one call
+    JSAMPROW rows[DECODE_BAND_ROWS];
+    unsigned char* pixels = (unsigned char*)(*cinfo.mem->alloc_large)(
+        (j_common_ptr)&cinfo, JPOOL_IMAGE, rowBytes * DECODE_BAND_ROWS);
+    for (int i = 0; i < DECODE_BAND_ROWS; i++) {
+        rows[i] = pixels + (size_t)i * rowBytes;
+    }
+
+    bool ok = true;
+    while (ok && cinfo.output_scanline < cinfo.output_height) {
+        int count = 0;
+        const long long start = statsClock();
+        while (count < DECODE_BAND_ROWS && cinfo.output_scanline < cinfo.output_height) {
+            count += (int)jpeg_read_scanlines(&cinfo, rows + count,
+                                              (JDIMENSION)(DECODE_BAND_ROWS - count));
+        }
+        recordStage(STATS_CODING, start, (long long)count * rowBytes);
+        ok = pyramid.writeRows(pixels, count, rowBytes, gray ? TJPF_GRAY : TJPF_BGR);
+    }
+
+    if (ok) {
+        jpeg_finish_decompress(&cinfo);
+    }
+    jpeg_destroy_decompress(&cinfo);
+    return ok;
+}
+
+} // namespace
+
+struct TilePyramid::Level {
+    int index;        // DeepZoom level number
+    int width;
+    int height;
+    int columns;      // tiles across
+    int tileRows;     // tiles down
+    int nextTileRow;  // next tile row to emit
+    int bandTop;      // level row held in band row 0
+    int received;     // rows pushed so far
+    bool hasPending;
+    std::vector<unsigned char> band;     // rows of the tile row being filled, packed
+    std::vector<unsigned char> pending;  // even row waiting for its pair
+    std::vector<unsigned char> halved;   // row passed down to the next level
+};
+
+TilePyramid::TilePyramid()
+    : width_(0), height_(0), tileSize_(0), overlap_(0), params_(defaultEncodeParams(90)),
+      numThreads_(0), pixelFormat_(-1), bytesPerPixel_(0), rowsWritten_(0), tiles_(0),
+      failed_(true), finished_(false), sink_(nullptr), context_(nullptr) {
+}
+
+TilePyramid::~TilePyramid() {
+}
+
+bool TilePyramid::plan(int width, int height, int tileSize, int overlap, const EncodeParams& params,
+                       int numThreads) {
+    failed_ = true;
+    levels_.clear();
+    if (width <= 0 || height <= 0 || tileSize <= 0 || overlap < 0 || overlap >= tileSize ||
+        tileSize + 2 * overlap > 65535 || !validEncodeParams(params)) {
+        return false;
+    }
+    if (numThreads <= 0) {
+        numThreads = (int)std::thread::hardware_concurrency();
+        if (numThreads <= 0) numThreads = 4;
+    }
+
+    width_ = width;
+    height_ = height;
+    tileSize_ = tileSize;
+    overlap_ = overlap;
+    params_ = params;
+    numThreads_ = numThreads;
+    pixelFormat_ = -1;
+    bytesPerPixel_ = 0;
+    rowsWritten_ = 0;
+    tiles_ = 0;
+    finished_ = false;
+
+    // Halve down to 1x1; the full-resolution level has the highest number
+    int levelWidth = width;
+    int levelHeight = height;
+    while (true) {
+        Level level;
+        level.index = 0;
+        level.width = levelWidth;
+        level.height = levelHeight;
+        level.columns = (levelWidth + tileSize - 1) / tileSize;
+        level.tileRows = (levelHeight + tileSize - 1) / tileSize;
+        level.nextTileRow = 0;
+        level.bandTop = 0;
+        level.received = 0;
+        level.hasPending = false;
+        levels_.push_back(level);
+        if (levelWidth == 1 && levelHeight == 1) {
+            break;
+        }
+        levelWidth = (levelWidth + 1) / 2;
+        levelHeight = (levelHeight + 1) / 2;
+    }
+    for (size_t i = 0; i < levels_.size(); i++) {
+        levels_[i].index = (int)(levels_.size() - 1 - i);
+    }
+
+    failed_ = false;
+    return true;
+}
+
+bool TilePyramid::init(int width, int height, int tileSize, int overlap, const EncodeParams& params,
+                       int numThreads, PyramidTileFn sink, void* context) {
+    basePath_.clear();
+    sink_ = sink;
+    context_ = context;
+    return sink && plan(width, height, tileSize, overlap, params, numThreads);
+}
+
+bool TilePyramid::initDirectory(int width, int height, int tileSize, int overlap,
+                                const EncodeParams& params, int numThreads, const char* basePath) {
+    sink_ = nullptr;
+    context_ = nullptr;
+    if (!basePath || !*basePath || !plan(width, height, tileSize, overlap, params, numThreads)) {
+        failed_ = true;
+        return false;
+    }
+    basePath_ = basePath;
+
+    const std::string files = basePath_ + "_files";
+    bool ok = makeDirectory(files);
+    for (size_t i = 0; ok && i < levels_.size(); i++) {
+        ok = makeDirectory(files + "/" + std::to_string(levels_[i].index));
+    }
+    failed_ = !ok;
+    return ok;
+}
+
+int TilePyramid::levelCount() const {
+    return (int)levels_.size();
+}
+
+bool TilePyramid::writeRows(const unsigned char* rows, int rowCount, size_t pitch, int pixelFormat) {
+    if (failed_ || finished_ || !rows || rowCount <= 0 || rowCount > height_ - rowsWritten_ ||
+        pixelFormat < 0 || pixelFormat >= TJ_NUMPF ||
+        (pixelFormat_ >= 0 && pixelFormat != pixelFormat_)) {
+        return false;
+    }
+
+    if (pixelFormat_ < 0) {
+        // Buffers are sized once the pixel size is known
+        pixelFormat_ = pixelFormat;
+        bytesPerPixel_ = tjPixelSize[pixelFormat];
+        for (size_t i = 0; i < levels_.size(); i++) {
+            Level& level = levels_[i];
+            const size_t rowBytes = (size_t)level.width * bytesPerPixel_;
+            const int bandRows = std::min(level.height, tileSize_ + 2 * overlap_);
+            level.band.resize(rowBytes * bandRows);
+            if (i + 1 < levels_.size()) {
+                level.pending.resize(rowBytes);
+                level.halved.resize((size_t)levels_[i + 1].width * bytesPerPixel_);
+            }
+        }
+    }
+    if (pitch == 0) {
+        pitch = (size_t)width_ * bytesPerPixel_;
+    }
+
+    for (int i = 0; i < rowCount; i++) {
+        if (!pushRow(0, rows + (size_t)i * pitch)) {
+            failed_ = true;
+            return false;
+        }
+    }
+    rowsWritten_ += rowCount;
+    return true;
+}
+
+bool TilePyramid::pushRow(size_t index, const unsigned char* row) {
+    Level& level = levels_[index];
+    const size_t rowBytes = (size_t)level.width * bytesPerPixel_;
+    std::memcpy(&level.band[(size_t)(level.received - level.bandTop) * rowBytes], row, rowBytes);
+    level.received++;
+
+    const int tileBottom = std::min(level.height, (level.nextTileRow + 1) * tileSize_ + overlap_);
+    if (level.received == tileBottom && !emitTileRow(level)) {
+        return false;
+    }
+
+    if (index + 1 == levels_.size()) {
+        return true;
+    }
+    if (!level.hasPending) {
+        std::memcpy(level.pending.data(), row, rowBytes);
+        level.hasPending = true;
+        return true;
+    }
+    halveRows(level.pending.data(), row, level.width, bytesPerPixel_, level.halved.data());
+    level.hasPending = false;
+    return pushRow(index + 1, level.halved.data());
+}
+
+bool TilePyramid::emitTileRow(Level& level) {
+    const int tileRow = level.nextTileRow;
+    const int top = std::max(0, tileRow * tileSize_ - overlap_);
+    const int bottom = std::min(level.height, (tileRow + 1) * tileSize_ + overlap_);
+    const size_t rowBytes = (size_t)level.width * bytesPerPixel_;
+    const unsigned char* bandTop = &level.band[(size_t)(top - level.bandTop) * rowBytes];
+
+    struct Tile {
+        unsigned char* data;
+        size_t size;
+    };
+    std::vector<Tile> tiles(level.columns);
+    std::atomic<bool> ok(true);
+
+    parallelFor(level.columns, numThreads_, [&](int column) {
+        const int left = std::max(0, column * tileSize_ - overlap_);
+        const int right = std::min(level.width, (column + 1) * tileSize_ + overlap_);
+        Tile& tile = tiles[column];
+        tile.size = 0;
+        tile.data = encodeWithParams(bandTop + (size_t)left * bytesPerPixel_, right - left,
+                                     bottom - top, (int)rowBytes, pixelFormat_, params_,
+                                     nullptr, 0, &tile.size);
+        if (!tile.data) {
+            ok = false;
+        } else if (!basePath_.empty()) {
+            // Directory output is written here, off the thread feeding rows
+            const std::string path = basePath_ + "_files/" + std::to_string(level.index) + "/" +
+                                     std::to_string(column) + "_" + std::to_string(tileRow) + ".jpg";
+            if (!writeFile(path, tile.data, tile.size)) {
+                ok = false;
+            }
+            releaseJpegBuffer(tile.data);
+            tile.data = nullptr;
+        }
+    });
+
+    for (int column = 0; column < level.columns; column++) {
+        Tile& tile = tiles[column];
+        if (tile.data) {
+            if (ok) {
+                StatsTimer timer(STATS_IO);
+                timer.setBytes((long long)tile.size);
+                if (sink_(context_, level.index, column, tileRow, tile.data, tile.size) != 0) {
+                    ok = false;
+                }
+            }
+            releaseJpegBuffer(tile.data);
+        }
+    }
+    if (!ok) {
+        return false;
+    }
+    tiles_ += level.columns;
+
+    // Keep the overlap rows the next tile row shares with this one
+    level.nextTileRow++;
+    if (level.nextTileRow < level.tileRows) {
+        const int nextTop = level.nextTileRow * tileSize_ - overlap_;
+        std::memmove(level.band.data(), &level.band[(size_t)(nextTop - level.bandTop) * rowBytes],
+                     (size_t)(level.received - nextTop) * rowBytes);
+        level.bandTop = nextTop;
+    }
+    return true;
+}
+
+long long TilePyramid::finish() {
+    if (failed_ || finished_ || rowsWritten_ != height_) {
+        return -1;
+    }
+
+    // An odd last row of a level goes down on its own, top level first so
+    // each flush can complete the next level's pair
+    for (size_t i = 0; i + 1 < levels_.size(); i++) {
+        Level& level = levels_[i];
+        if (level.hasPending) {
+            halveRows(level.pending.data(), nullptr, level.width, bytesPerPixel_,
+                      level.halved.data());
+            level.hasPending = false;
+            if (!pushRow(i + 1, level.halved.data())) {
+                failed_ = true;
+                return -1;
+            }
+        }
+    }
+    finished_ = true;
+
+    if (!basePath_.empty()) {
+        char dzi[512];
+        const int length = std::snprintf(
+            dzi, sizeof(dzi),
+            "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+            "<Image xmlns=\"http://schemas.microsoft.com/deepzoom/2008\" Format=\"jpg\" "
+            "Overlap=\"%d\" TileSize=\"%d\">\n"
+            "  <Size Width=\"%d\" Height=\"%d\"/>\n"
+            "</Image>\n",
+            overlap_, tileSize_, width_, height_);
+        if (!writeFile(basePath_ + ".dzi", (const unsigned char*)dzi, (size_t)length)) {
+            failed_ = true;
+            return -1;
+        }
+    }
+    return tiles_;
+}
+
+long long buildJpegPyramid(const unsigned char* jpeg, size_t jpegSize, int tileSize, int overlap,
+                           const EncodeParams& params, int numThreads, const char* basePath,
+                           PyramidTileFn sink, void* context) {
+    if (!jpeg || jpegSize == 0 || (!basePath && !sink)) {
+        return -1;
+    }
+
+    PyramidSettings settings;
+    settings.tileSize = tileSize;
+    settings.overlap = overlap;
+    settings.params = &params;
+    settings.numThreads = numThreads;
+    settings.basePath = basePath;
+    settings.sink = sink;
+    settings.context = context;
+
+    TilePyramid pyramid;
+    if (!decodeIntoPyramid(jpeg, jpegSize, settings, pyramid)) {
+        return -1;
+    }
+    return pyramid.finish();
+}
@@ -0,0 +1,115 @@
+/**
+ * DeepZoom tile pyramids built from rows in one streaming pass
+ *
+ * Rows go into the full-resolution level; every second row of a level is
+ * averaged 2x2 with the one before it into a row of the next level down,
+ * cascading to 1x1. Each level only holds one band of tile rows (tileSize
+ * plus twice the overlap), so memory is O(width x tileSize) whatever the
+ * image height. As soon as a band is complete its tiles are compressed in
+ * parallel on the shared WorkerPool, then the band slides down.
+ *
+ * Levels and tiles follow the DeepZoom layout: level maxLevel is the image
+ * itself, where 2^maxLevel >= max(width, height), and level k - 1 is level k
+ * halved (rounded up). Tile (col, row) covers tileSize pixels plus overlap
+ * pixels on each side that has a neighbour.
+ */
+
+#ifndef TILE_PYRAMID_H
+#define TILE_PYRAMID_H
+
+#include "EncodeParams.h"
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/**
+ * Receives each tile, on the thread that writes rows. Within a level, tiles
+ * arrive row by row, left to right; levels interleave.
+ * @return 0 to continue, nonzero to abort (the write in progress fails)
+ */
+typedef int (*PyramidTileFn)(void* context, int level, int column, int row,
+                             const unsigned char* jpeg, size_t size);
+
+class TilePyramid {
+public:
+    TilePyramid();
+    ~TilePyramid();
+
+    /**
+     * Plan a width x height pyramid whose tiles go to sink
+     *
+     * @param params Tile settings (see EncodeParams.h); quantTable must stay valid
+     * @param numThreads Threads compressing tiles, from the shared WorkerPool (0 = CPU core count)
+     */
+    bool init(int width, int height, int tileSize, int overlap, const EncodeParams& params,
+              int numThreads, PyramidTileFn sink, void* context);
+
+    /**
+     * Plan a pyramid written as basePath + ".dzi" and the tiles
+     * basePath + "_files/<level>/<col>_<row>.jpg". The level directories are
+     * created here; the pool threads write the tiles as they are compressed,
+     * and finish() writes the .dzi descriptor.
+     */
+    bool initDirectory(int width, int height, int tileSize, int overlap, const EncodeParams& params,
+                       int numThreads, const char* basePath);
+
+    int levelCount() const;
+
+    /**
+     * Add rowCount full-resolution rows, pitch bytes apart (0 = packed).
+     * The first write fixes the TJPF_* pixel format.
+     */
+    bool writeRows(const unsigned char* rows, int rowCount, size_t pitch, int pixelFormat);
+
+    /**
+     * Flush the lower levels once every row has been written
+     * @return Tiles emitted, -1 on failure
+     */
+    long long finish();
+
+    int rowsWritten() const { return rowsWritten_; }
+
+    long long tileCount() const { return tiles_; }
+
+private:
+    struct Level;
+
+    TilePyramid(const TilePyramid&) = delete;
+    TilePyramid& operator=(const TilePyramid&) = delete;
+
+    bool plan(int width, int height, int tileSize, int overlap, const EncodeParams& params,
+              int numThreads);
+    bool pushRow(size_t level, const unsigned char* row);
+    bool emitTileRow(Level& level);
+
+    int width_;
+    int height_;
+    int tileSize_;
+    int overlap_;
+    EncodeParams params_;
+    int numThreads_;
+    int pixelFormat_;   // -1 until the first write
+    int bytesPerPixel_;
+    int rowsWritten_;
+    long long tiles_;
+    bool failed_;
+    bool finished_;
+    PyramidTileFn sink_;
+    void* context_;
+    std::string basePath_;       // directory output when not empty
+    std::vector<Level> levels_;  // full resolution first
+};
+
+/**
+ * Build a whole pyramid from a JPEG, decoding it band by band straight into
+ * the full-resolution level (BGR, or gray for grayscale JPEGs) so the image
+ * is never in memory at once
+ *
+ * @param basePath Directory output as for initDirectory, or nullptr to use sink
+ * @return Tiles emitted, -1 on failure
+ */
+long long buildJpegPyramid(const unsigned char* jpeg, size_t jpegSize, int tileSize, int overlap,
+                           const EncodeParams& params, int numThreads, const char* basePath,
+                           PyramidTileFn sink, void* context);
+
+#endif // TILE_PYRAMID_H
@@ -0,0 +1,39 @@
+#include "TjHandleCache.h"
+
+namespace {
+
+struct ThreadHandle {
+    tjhandle handle = nullptr;
+
+    ~ThreadHandle() {
+        if (handle) {
+            tjDestroy(handle);
+        }
+    }
+};
+
+thread_local ThreadHandle t_compressor;
+thread_local ThreadHandle t_transformer;
+
+} // namespace
+
+tjhandle threadCompressor() {
+    if (!t_compressor.handle) {
+        t_compressor.handle = tjInitCompress();
+    }
+    return t_compressor.handle;
+}
+
+void releaseThreadCompressor() {
+    if (t_compressor.handle) {
+        tjDestroy(t_compressor.handle);
+        t_compressor.handle = nullptr;
+    }
+}
+
+tjhandle threadTransformer() {
+    if (!t_transformer.handle) {
+        t_transformer.handle = tjInitTransform();
+    }
+    return t_transformer.handle;
+}
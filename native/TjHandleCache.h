@@ -0,0 +1,34 @@
+/**
+ * Per-thread TurboJPEG compressor and transformer handles
+ *
+ * tjInitCompress allocates a compressor with its tables every time; caching
+ * one handle per thread removes that setup from each encode. tjCompress2
+ * (and tjTransform) set every parameter they use on each call, so a reused
+ * handle behaves like a fresh one. Handles are destroyed when their thread
+ * exits.
+ */
+
+#ifndef TJ_HANDLE_CACHE_H
+#define TJ_HANDLE_CACHE_H
+
+#include "include/turbojpeg.h"
+
+/**
+ * The calling thread's compressor, created on first use
+ * @return Handle owned by the cache (do not tjDestroy), nullptr on failure
+ */
+tjhandle threadCompressor();
+
+/**
+ * Destroy the calling thread's compressor now instead of at thread exit
+ * (for long-lived threads that are done encoding)
+ */
+void releaseThreadCompressor();
+
+/**
+ * The calling thread's lossless transformer (tjInitTransform), created on first use
+ * @return Handle owned by the cache (do not tjDestroy), nullptr on failure
+ */
+tjhandle threadTransformer();
+
+#endif // TJ_HANDLE_CACHE_H
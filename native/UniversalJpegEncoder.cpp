@@ -12,16 +12,46 @@
  *       
  *       private native int encodeJPEG(byte[] bgrData, int width, int height,
  *                                     float quality, OutputStream os, int threads);
+ *       // Zero-copy input: direct buffers are compressed in place
+ *       private native int encodeJPEGFromBuffer(ByteBuffer bgrData, int width, int height,
+ *                                               float quality, OutputStream os, int threads);
+ *       // Many images as one job on the worker pool, JPEGs returned in input order
+ *       private native byte[][] encodeJPEGBatch(byte[][] bgrImages, int[] widths, int[] heights,
+ *                                               float quality, int threads);
+ *       // Explicit settings: params = {quality, subsampling, fastDct, progressive,
+ *       // optimizeCoding, restartRows}, quantTable = null or 64 / 128 values
+ *       private native int encodeJPEGWithParams(byte[] bgrData, int width, int height,
+ *                                               int[] params, int[] quantTable, OutputStream os);
+ *       // Opt-in per-stage timings and allocation counts (layout at getEncoderStats_universal)
+ *       private native void setEncoderStatsEnabled(boolean enabled);
+ *       private native long[] getEncoderStats();
+ *       private native void resetEncoderStats();
  *   }
  */
 
 #include <jni.h>
 #include <turbojpeg.h>
+#include <cstdio>
+#include <cstdlib>
+#include <csetjmp>
+#include <new>
+#include <climits>
 #include <jpeglib.h>
+#include <jerror.h>
+#include "JniJpegStream.h"
+#include "EncodeParams.h"
+#include "EncoderStats.h"
+#include "JpegBufferPool.h"
+#include "TjHandleCache.h"
+#include "WorkerPool.h"
+#include "JpegTransform.h"
+#include "BatchEncoder.h"
+#include "YuvEncoder.h"
+#include "TilePyramid.h"
 #include <cstring>
-#include <thread>
 #include <vector>
 #include <algorithm>
+#include <atomic>
 
 // DLL export macro
 #ifdef _WIN32
@@ -38,71 +68,25 @@
  */
 jint encodeFromBGR_universal(JNIEnv *env, jobject obj, 
                              jbyteArray bgrData, jint width, jint height,
-                             jfloat quality, jobject outputStream, jint numThreads) {
-    
-    if (numThreads <= 0) {
-        numThreads = std::thread::hardware_concurrency();
-        if (numThreads <= 0) numThreads = 4;
-    }
-    
-    tjhandle tjInstance = tjInitCompress();
-    if (!tjInstance) {
-        return -1;
-    }
+                             jfloat quality, jobject outputStream, jint /*numThreads*/) {
     
     jbyte* bgrBytes = env->GetByteArrayElements(bgrData, nullptr);
     if (!bgrBytes) {
-        tjDestroy(tjInstance);
         return -1;
     }
     
     unsigned char* imageData = (unsigned char*)bgrBytes;
-    unsigned char* jpegBuf = nullptr;
-    unsigned long jpegSize = 0;
     
     int qualityInt = (int)(quality * 100);
     if (qualityInt < 1) qualityInt = 1;
     if (qualityInt > 100) qualityInt = 100;
     
-    int ret = tjCompress2(
-        tjInstance,
-        imageData,
-        width,
-        0,  // pitch
-        height,
-        TJPF_BGR,
-        &jpegBuf,
-        &jpegSize,
-        TJSAMP_420,
-        qualityInt,
-        TJFLAG_FASTDCT
-    );
+    // Compress straight into the OutputStream in fixed-size chunks
+    long long jpegSize = compressToOutputStream(env, outputStream, imageData,
+                                                width, height, 0, TJPF_BGR, qualityInt);
     
     env->ReleaseByteArrayElements(bgrData, bgrBytes, JNI_ABORT);
     
-    if (ret != 0) {
-        tjDestroy(tjInstance);
-        return -1;
-    }
-    
-    // Write to OutputStream
-    jclass streamClass = env->GetObjectClass(outputStream);
-    jmethodID writeMethod = env->GetMethodID(streamClass, "write", "([BII)V");
-    
-    if (!writeMethod) {
-        tjFree(jpegBuf);
-        tjDestroy(tjInstance);
-        return -1;
-    }
-    
-    jbyteArray javaArray = env->NewByteArray(jpegSize);
-    env->SetByteArrayRegion(javaArray, 0, jpegSize, (jbyte*)jpegBuf);
-    env->CallVoidMethod(outputStream, writeMethod, javaArray, 0, jpegSize);
-    
-    env->DeleteLocalRef(javaArray);
-    tjFree(jpegBuf);
-    tjDestroy(tjInstance);
-    
     return (jint)jpegSize;
 }
 
@@ -111,84 +95,304 @@ jint encodeFromBGR_universal(JNIEnv *env, jobject obj,
  */
 jint encodeFromARGB_universal(JNIEnv *env, jobject obj,
                               jintArray pixels, jint width, jint height,
-                              jfloat quality, jobject outputStream, jint numThreads) {
+                              jfloat quality, jobject outputStream, jint /*numThreads*/) {
     
-    if (numThreads <= 0) {
-        numThreads = std::thread::hardware_concurrency();
-        if (numThreads <= 0) numThreads = 4;
-    }
+    int qualityInt = (int)(quality * 100);
+    if (qualityInt < 1) qualityInt = 1;
+    if (qualityInt > 100) qualityInt = 100;
     
-    tjhandle tjInstance = tjInitCompress();
-    if (!tjInstance) {
-        return -1;
+    // Copied 16 rows at a time in short critical sections and compressed as
+    // native-order BGRX: no full-frame RGB buffer, no long GC pause
+    return (jint)compressArgbArrayToOutputStream(env, outputStream, pixels, width, height, qualityInt);
+}
+
+// ========== Zero-copy input variants ==========
+
+/**
+ * Encode a direct ByteBuffer of BGR bytes to JPEG
+ * The buffer memory is compressed in place: no copy of the frame is made.
+ */
+jint encodeFromBGRBuffer_universal(JNIEnv *env, jobject obj,
+                                   jobject bgrBuffer, jint width, jint height,
+                                   jfloat quality, jobject outputStream, jint numThreads) {
+    
+    unsigned char* imageData = (unsigned char*)env->GetDirectBufferAddress(bgrBuffer);
+    jlong capacity = env->GetDirectBufferCapacity(bgrBuffer);
+    if (!imageData || width <= 0 || height <= 0 || capacity < (jlong)width * height * 3) {
+        return -1;  // Not a direct buffer, or too small for the image
     }
     
-    jint* pixelData = env->GetIntArrayElements(pixels, nullptr);
-    if (!pixelData) {
-        tjDestroy(tjInstance);
+    int qualityInt = (int)(quality * 100);
+    if (qualityInt < 1) qualityInt = 1;
+    if (qualityInt > 100) qualityInt = 100;
+    
+    return (jint)compressToOutputStream(env, outputStream, imageData,
+                                        width, height, 0, TJPF_BGR, qualityInt);
+}
+
+/**
+ * Encode a direct IntBuffer of ARGB pixels to JPEG
+ * The buffer must be in native byte order (ByteBuffer.order(ByteOrder.nativeOrder())),
+ * which lets its ints be compressed as BGRX bytes without any conversion.
+ */
+jint encodeFromARGBBuffer_universal(JNIEnv *env, jobject obj,
+                                    jobject pixelBuffer, jint width, jint height,
+                                    jfloat quality, jobject outputStream, jint numThreads) {
+    
+    unsigned char* imageData = (unsigned char*)env->GetDirectBufferAddress(pixelBuffer);
+    jlong capacity = env->GetDirectBufferCapacity(pixelBuffer);  // in ints
+    if (!imageData || width <= 0 || height <= 0 || capacity < (jlong)width * height) {
         return -1;
     }
     
-    // Convert ARGB to RGB
-    int pixelCount = width * height;
-    unsigned char* rgbData = new unsigned char[pixelCount * 3];
+    int qualityInt = (int)(quality * 100);
+    if (qualityInt < 1) qualityInt = 1;
+    if (qualityInt > 100) qualityInt = 100;
+    
+    return (jint)compressToOutputStream(env, outputStream, imageData,
+                                        width, height, 0, nativeArgbPixelFormat(), qualityInt);
+}
+
+/**
+ * Encode BGR byte array to JPEG, copying at most 16 rows at a time
+ * Each band is copied inside a short GetPrimitiveArrayCritical section, so
+ * the JVM never duplicates the whole array.
+ */
+jint encodeFromBGRCritical_universal(JNIEnv *env, jobject obj,
+                                     jbyteArray bgrData, jint width, jint height,
+                                     jfloat quality, jobject outputStream, jint numThreads) {
     
-    for (int i = 0; i < pixelCount; i++) {
-        int argb = pixelData[i];
-        rgbData[i * 3 + 0] = (argb >> 16) & 0xFF;  // R
-        rgbData[i * 3 + 1] = (argb >> 8) & 0xFF;   // G
-        rgbData[i * 3 + 2] = argb & 0xFF;          // B
+    if (width <= 0 || height <= 0 || env->GetArrayLength(bgrData) < (jlong)width * height * 3) {
+        return -1;
     }
     
-    env->ReleaseIntArrayElements(pixels, pixelData, JNI_ABORT);
+    int qualityInt = (int)(quality * 100);
+    if (qualityInt < 1) qualityInt = 1;
+    if (qualityInt > 100) qualityInt = 100;
     
-    unsigned char* jpegBuf = nullptr;
-    unsigned long jpegSize = 0;
+    CriticalArraySource source = { env, bgrData, (size_t)width * 3 };
+    return (jint)compressRowsToOutputStream(env, outputStream, fillFromCriticalArray, &source,
+                                            width, height, TJPF_BGR, qualityInt);
+}
+
+/**
+ * Encode ARGB int array to JPEG, copying at most 16 rows at a time
+ * The ints are compressed as native-order BGRX bytes, so there is no
+ * separate ARGB to RGB pass.
+ */
+jint encodeFromARGBCritical_universal(JNIEnv *env, jobject obj,
+                                      jintArray pixels, jint width, jint height,
+                                      jfloat quality, jobject outputStream, jint numThreads) {
     
     int qualityInt = (int)(quality * 100);
     if (qualityInt < 1) qualityInt = 1;
     if (qualityInt > 100) qualityInt = 100;
     
-    int ret = tjCompress2(
-        tjInstance,
-        rgbData,
-        width,
-        0,
-        height,
-        TJPF_RGB,
-        &jpegBuf,
-        &jpegSize,
-        TJSAMP_420,
-        qualityInt,
-        TJFLAG_FASTDCT
-    );
-    
-    delete[] rgbData;
+    return (jint)compressArgbArrayToOutputStream(env, outputStream, pixels, width, height, qualityInt);
+}
+
+// ========== Batch encoding ==========
+
+/**
+ * Shared body of the batch methods: pin every array, encode the whole batch
+ * on the worker pool, then copy each JPEG into its own byte[]
+ * @param intPixels true for int[] ARGB images, false for byte[] BGR
+ * @return byte[][] in input order (null entries for images that failed), null on bad arguments
+ */
+static jobjectArray encodeBatch_universal(JNIEnv *env, jobjectArray images,
+                                          jintArray widths, jintArray heights,
+                                          const EncodeParams& params, jint numThreads,
+                                          bool intPixels) {
+    if (!images || !widths || !heights) {
+        return nullptr;
+    }
+    const jsize count = env->GetArrayLength(images);
+    if (env->GetArrayLength(widths) < count || env->GetArrayLength(heights) < count ||
+        env->EnsureLocalCapacity(count + 16) != 0) {
+        return nullptr;
+    }
     
-    if (ret != 0) {
-        tjDestroy(tjInstance);
-        return -1;
+    std::vector<jint> w(count), h(count);
+    env->GetIntArrayRegion(widths, 0, count, w.data());
+    env->GetIntArrayRegion(heights, 0, count, h.data());
+    
+    // Elements (not critical sections): the batch runs far too long to hold off the GC
+    std::vector<jarray> arrays(count, nullptr);
+    std::vector<void*> elements(count, nullptr);
+    std::vector<BatchImage> batch(count);
+    std::vector<BatchOutput> outputs(count);
+    for (jsize i = 0; i < count; i++) {
+        batch[i].pixels = nullptr;
+        batch[i].width = w[i];
+        batch[i].height = h[i];
+        batch[i].pitch = 0;
+        batch[i].pixelFormat = intPixels ? nativeArgbPixelFormat() : TJPF_BGR;
+        
+        arrays[i] = (jarray)env->GetObjectArrayElement(images, i);
+        const jlong needed = (jlong)w[i] * h[i] * (intPixels ? 1 : 3);
+        if (!arrays[i] || w[i] <= 0 || h[i] <= 0 || env->GetArrayLength(arrays[i]) < needed) {
+            continue;  // fails on its own; the rest of the batch still encodes
+        }
+        elements[i] = intPixels ? (void*)env->GetIntArrayElements((jintArray)arrays[i], nullptr)
+                                : (void*)env->GetByteArrayElements((jbyteArray)arrays[i], nullptr);
+        batch[i].pixels = (const unsigned char*)elements[i];
     }
     
-    // Write to OutputStream
-    jclass streamClass = env->GetObjectClass(outputStream);
-    jmethodID writeMethod = env->GetMethodID(streamClass, "write", "([BII)V");
+    encodeBatch(batch.data(), count, params, 0, numThreads, outputs.data());
     
-    if (!writeMethod) {
-        tjFree(jpegBuf);
-        tjDestroy(tjInstance);
-        return -1;
+    for (jsize i = 0; i < count; i++) {
+        if (elements[i]) {
+            if (intPixels) {
+                env->ReleaseIntArrayElements((jintArray)arrays[i], (jint*)elements[i], JNI_ABORT);
+            } else {
+                env->ReleaseByteArrayElements((jbyteArray)arrays[i], (jbyte*)elements[i], JNI_ABORT);
+            }
+        }
+        if (arrays[i]) {
+            env->DeleteLocalRef(arrays[i]);
+        }
     }
     
-    jbyteArray javaArray = env->NewByteArray(jpegSize);
-    env->SetByteArrayRegion(javaArray, 0, jpegSize, (jbyte*)jpegBuf);
-    env->CallVoidMethod(outputStream, writeMethod, javaArray, 0, jpegSize);
+    jclass byteArrayClass = env->FindClass("[B");
+    jobjectArray result = byteArrayClass ? env->NewObjectArray(count, byteArrayClass, nullptr) : nullptr;
+    for (jsize i = 0; i < count; i++) {
+        BatchOutput& out = outputs[i];
+        if (result && out.data && out.size <= (size_t)INT_MAX) {
+            jbyteArray jpeg = env->NewByteArray((jsize)out.size);
+            if (jpeg) {
+                StatsTimer timer(STATS_COPY_OUT);
+                timer.setBytes((long long)out.size);
+                env->SetByteArrayRegion(jpeg, 0, (jsize)out.size, (const jbyte*)out.data);
+                env->SetObjectArrayElement(result, i, jpeg);
+                env->DeleteLocalRef(jpeg);
+            } else {
+                env->DeleteLocalRef(result);  // OutOfMemoryError pending
+                result = nullptr;
+            }
+        }
+        releaseJpegBuffer(out.data);
+    }
+    return result;
+}
+
+// Float quality of the batch methods as EncodeParams
+static EncodeParams batchParams(jfloat quality) {
+    int qualityInt = (int)(quality * 100);
+    if (qualityInt < 1) qualityInt = 1;
+    if (qualityInt > 100) qualityInt = 100;
+    return defaultEncodeParams(qualityInt);
+}
+
+/**
+ * Encode many BGR byte arrays as one job across the worker pool
+ * Small images are encoded whole and large ones in strips, so mixed sizes keep every core busy.
+ */
+jobjectArray encodeBatchFromBGR_universal(JNIEnv *env, jobject obj,
+                                          jobjectArray bgrImages, jintArray widths, jintArray heights,
+                                          jfloat quality, jint numThreads) {
+    return encodeBatch_universal(env, bgrImages, widths, heights, batchParams(quality),
+                                 numThreads, false);
+}
+
+/**
+ * Encode many ARGB int arrays as one job across the worker pool
+ */
+jobjectArray encodeBatchFromARGB_universal(JNIEnv *env, jobject obj,
+                                           jobjectArray pixelImages, jintArray widths, jintArray heights,
+                                           jfloat quality, jint numThreads) {
+    return encodeBatch_universal(env, pixelImages, widths, heights, batchParams(quality),
+                                 numThreads, true);
+}
+
+// ========== Explicit encoder settings ==========
+
+/**
+ * Encode BGR byte array to JPEG with explicit settings
+ * Rows are copied 16 at a time under short critical sections, as encodeJPEGCritical.
+ */
+jint encodeFromBGRWithParams_universal(JNIEnv *env, jobject obj,
+                                       jbyteArray bgrData, jint width, jint height,
+                                       jintArray params, jintArray quantTable, jobject outputStream) {
+    EncodeParams encodeParams;
+    unsigned short quant[128];
+    if (!bgrData || !readEncodeParams(env, params, quantTable, &encodeParams, quant) ||
+        width <= 0 || height <= 0 || env->GetArrayLength(bgrData) < (jlong)width * height * 3) {
+        return -1;
+    }
     
-    env->DeleteLocalRef(javaArray);
-    tjFree(jpegBuf);
-    tjDestroy(tjInstance);
+    CriticalArraySource source = { env, bgrData, (size_t)width * 3 };
+    return (jint)compressRowsToOutputStream(env, outputStream, fillFromCriticalArray, &source,
+                                            width, height, TJPF_BGR, encodeParams);
+}
+
+/**
+ * Encode ARGB int array to JPEG with explicit settings
+ */
+jint encodeFromARGBWithParams_universal(JNIEnv *env, jobject obj,
+                                        jintArray pixels, jint width, jint height,
+                                        jintArray params, jintArray quantTable, jobject outputStream) {
+    EncodeParams encodeParams;
+    unsigned short quant[128];
+    if (!readEncodeParams(env, params, quantTable, &encodeParams, quant)) {
+        return -1;
+    }
     
-    return (jint)jpegSize;
+    return (jint)compressArgbArrayToOutputStream(env, outputStream, pixels, width, height, encodeParams);
+}
+
+/**
+ * encodeJPEGBatch with explicit settings for every image
+ */
+jobjectArray encodeBatchFromBGRWithParams_universal(JNIEnv *env, jobject obj,
+                                                    jobjectArray bgrImages, jintArray widths,
+                                                    jintArray heights, jintArray params,
+                                                    jintArray quantTable, jint numThreads) {
+    EncodeParams encodeParams;
+    unsigned short quant[128];
+    if (!readEncodeParams(env, params, quantTable, &encodeParams, quant)) {
+        return nullptr;
+    }
+    return encodeBatch_universal(env, bgrImages, widths, heights, encodeParams, numThreads, false);
+}
+
+/**
+ * encodeJPEGBatchFromPixels with explicit settings for every image
+ */
+jobjectArray encodeBatchFromARGBWithParams_universal(JNIEnv *env, jobject obj,
+                                                     jobjectArray pixelImages, jintArray widths,
+                                                     jintArray heights, jintArray params,
+                                                     jintArray quantTable, jint numThreads) {
+    EncodeParams encodeParams;
+    unsigned short quant[128];
+    if (!readEncodeParams(env, params, quantTable, &encodeParams, quant)) {
+        return nullptr;
+    }
+    return encodeBatch_universal(env, pixelImages, widths, heights, encodeParams, numThreads, true);
+}
+
+/**
+ * Totals of the opt-in stats (EncoderStats.h) as one long[], EncoderStats in
+ * declaration order: per stage (io, header, coding, copyOut) count,
+ * totalNanos, bytes and 24 histogram buckets, then allocatedBytes,
+ * allocations and errors
+ */
+jlongArray getEncoderStats_universal(JNIEnv *env, jobject obj) {
+    EncoderStats stats;
+    getStats(&stats);
+    const jsize length = (jsize)(sizeof(stats) / sizeof(long long));
+    jlongArray result = env->NewLongArray(length);
+    if (result) {
+        env->SetLongArrayRegion(result, 0, length, (const jlong*)&stats);
+    }
+    return result;
+}
+
+void setEncoderStatsEnabled_universal(JNIEnv *env, jobject obj, jboolean enabled) {
+    setStatsEnabled(enabled == JNI_TRUE);
+}
+
+void resetEncoderStats_universal(JNIEnv *env, jobject obj) {
+    resetStats();
 }
 
 // ========== JNI Dynamic Registration ==========
@@ -205,6 +409,71 @@ static JNINativeMethod methods[] = {
         (char*)"encodeJPEGFromPixels",
         (char*)"([IIIFLjava/io/OutputStream;I)I",
         (void*)encodeFromARGB_universal
+    },
+    {
+        (char*)"encodeJPEGFromBuffer",
+        (char*)"(Ljava/nio/ByteBuffer;IIFLjava/io/OutputStream;I)I",
+        (void*)encodeFromBGRBuffer_universal
+    },
+    {
+        (char*)"encodeJPEGFromPixelBuffer",
+        (char*)"(Ljava/nio/IntBuffer;IIFLjava/io/OutputStream;I)I",
+        (void*)encodeFromARGBBuffer_universal
+    },
+    {
+        (char*)"encodeJPEGCritical",
+        (char*)"([BIIFLjava/io/OutputStream;I)I",
+        (void*)encodeFromBGRCritical_universal
+    },
+    {
+        (char*)"encodeJPEGFromPixelsCritical",
+        (char*)"([IIIFLjava/io/OutputStream;I)I",
+        (void*)encodeFromARGBCritical_universal
+    },
+    {
+        (char*)"encodeJPEGBatch",
+        (char*)"([[B[I[IFI)[[B",
+        (void*)encodeBatchFromBGR_universal
+    },
+    {
+        (char*)"encodeJPEGBatchFromPixels",
+        (char*)"([[I[I[IFI)[[B",
+        (void*)encodeBatchFromARGB_universal
+    },
+    {
+        (char*)"encodeJPEGWithParams",
+        (char*)"([BII[I[ILjava/io/OutputStream;)I",
+        (void*)encodeFromBGRWithParams_universal
+    },
+    {
+        (char*)"encodeJPEGFromPixelsWithParams",
+        (char*)"([III[I[ILjava/io/OutputStream;)I",
+        (void*)encodeFromARGBWithParams_universal
+    },
+    {
+        (char*)"encodeJPEGBatchWithParams",
+        (char*)"([[B[I[I[I[II)[[B",
+        (void*)encodeBatchFromBGRWithParams_universal
+    },
+    {
+        (char*)"encodeJPEGBatchFromPixelsWithParams",
+        (char*)"([[I[I[I[I[II)[[B",
+        (void*)encodeBatchFromARGBWithParams_universal
+    },
+    {
+        (char*)"getEncoderStats",
+        (char*)"()[J",
+        (void*)getEncoderStats_universal
+    },
+    {
+        (char*)"setEncoderStatsEnabled",
+        (char*)"(Z)V",
+        (void*)setEncoderStatsEnabled_universal
+    },
+    {
+        (char*)"resetEncoderStats",
+        (char*)"()V",
+        (void*)resetEncoderStats_universal
     }
 };
 
@@ -214,6 +483,7 @@ static JNINativeMethod methods[] = {
  */
 JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM *vm, void *reserved) {
     // We don't register here - let the Java code register to its own class
+    cacheStreamMethods(vm);
     return JNI_VERSION_1_8;
 }
 
@@ -284,26 +554,25 @@ struct JPEGData {
     int size;
 };
 
-/**
- * Encode pixel data to JPEG (replaces ImageIO.write)
- * 
- * @param pixels RGB or BGR pixel data (interleaved, 3 bytes per pixel)
- * @param width Image width
- * @param height Image height
- * @param quality JPEG quality 1-100 (85 recommended)
- * @param pixelFormat 0=RGB, 1=BGR, 2=BGRA, 3=RGBA (auto-detect from Java BufferedImage type)
- * @return JPEGData with allocated buffer (must call FreeJPEGData when done)
- */
-DLL_EXPORT struct JPEGData EncodeJPEG(unsigned char* pixels,
-                                      int width,
-                                      int height,
-                                      int quality,
-                                      int pixelFormat) {
+// Map the JNA pixelFormat argument to a TurboJPEG format
+static int legacyPixelFormat(int pixelFormat) {
+    switch (pixelFormat) {
+        case 0: return TJPF_RGB;
+        case 1: return TJPF_BGR;
+        case 2: return TJPF_BGRA;
+        case 3: return TJPF_RGBA;
+        default: return TJPF_BGR; // Java BufferedImage default is often BGR
+    }
+}
+
+// EncodeJPEG body on a given compressor handle
+static JPEGData encodeJPEGWith(tjhandle tjInstance, unsigned char* pixels,
+                               int width, int height, int quality, int pixelFormat) {
     JPEGData result{};
     result.data = nullptr;
     result.size = 0;
 
-    if (!pixels || width <= 0 || height <= 0) {
+    if (!tjInstance || !pixels || width <= 0 || height <= 0) {
         return result;
     }
 
@@ -311,131 +580,853 @@ DLL_EXPORT struct JPEGData EncodeJPEG(unsigned char* pixels,
     if (quality < 1) quality = 1;
     if (quality > 100) quality = 100;
 
-    tjhandle tjInstance = tjInitCompress();
-    if (!tjInstance) {
+    // Compress straight into a pooled buffer of worst-case size: no second copy
+    unsigned long maxSize = tjBufSize(width, height, TJSAMP_420);
+    size_t capacity = 0;
+    unsigned char* jpegBuf = maxSize == (unsigned long)-1 ? nullptr : rentJpegBuffer(maxSize, &capacity);
+    unsigned long jpegSize = maxSize;
+    if (!jpegBuf) {
         return result;
     }
 
-    unsigned char* jpegBuf = nullptr;
-    unsigned long jpegSize = 0;
-
-    // Map pixelFormat to TurboJPEG format
-    int tjFormat = TJPF_RGB;
-    switch (pixelFormat) {
-        case 0: tjFormat = TJPF_RGB; break;
-        case 1: tjFormat = TJPF_BGR; break;
-        case 2: tjFormat = TJPF_BGRA; break;
-        case 3: tjFormat = TJPF_RGBA; break;
-        default: tjFormat = TJPF_BGR; break; // Java BufferedImage default is often BGR
-    }
-
+    StatsTimer timer(STATS_CODING);
+    timer.setBytes((long long)width * height * tjPixelSize[legacyPixelFormat(pixelFormat)]);
     int ret = tjCompress2(
         tjInstance,
         pixels,
         width,
         0,  // pitch (auto)
         height,
-        tjFormat,
+        legacyPixelFormat(pixelFormat),
         &jpegBuf,
         &jpegSize,
         TJSAMP_420,
         quality,
-        TJFLAG_FASTDCT
+        TJFLAG_FASTDCT | TJFLAG_NOREALLOC
     );
 
     if (ret != 0) {
-        tjDestroy(tjInstance);
+        recordError();
+        releaseJpegBuffer(jpegBuf);
         return result;
     }
 
-    // Allocate output buffer (use malloc for cross-boundary safety)
-    unsigned char* outBuf = (unsigned char*)std::malloc(jpegSize);
-    if (!outBuf) {
-        tjFree(jpegBuf);
-        tjDestroy(tjInstance);
-        return result;
-    }
-    std::memcpy(outBuf, jpegBuf, jpegSize);
-
-    result.data = outBuf;
+    result.data = jpegBuf;
     result.size = (int)jpegSize;
-
-    tjFree(jpegBuf);
-    tjDestroy(tjInstance);
     return result;
 }
 
-/**
- * Free JPEG data returned by EncodeJPEG
- */
-DLL_EXPORT void FreeJPEGData(struct JPEGData* jpeg) {
-    if (!jpeg) return;
-    if (jpeg->data) {
-        std::free(jpeg->data);
-        jpeg->data = nullptr;
-        jpeg->size = 0;
+// EncodeJPEGInto body on a given compressor handle
+static long long encodeJPEGIntoWith(tjhandle tjInstance, unsigned char* pixels,
+                                    int width, int height, int quality, int pixelFormat,
+                                    unsigned char* outBuffer, long long outCapacity) {
+    if (!tjInstance || !pixels || !outBuffer || width <= 0 || height <= 0 || outCapacity <= 0) {
+        return -1;
     }
-}
 
-// ========================= Streaming/Chunked Encoding API =========================
-// Supports chunked encoding for arbitrarily large images without loading entire image into memory
+    if (quality < 1) quality = 1;
+    if (quality > 100) quality = 100;
 
-/**
- * Streaming encoder context
- */
-struct StreamEncoder {
-    tjhandle tjInstance;
-    unsigned char* jpegBuf;
-    unsigned long jpegSize;
-    int width;
-    int height;
-    int quality;
-    int pixelFormat;
-    int currentRow;
-    unsigned char** rowBuffer;  // Accumulated scanline buffer
-    int rowBufferCount;
-};
+    unsigned char* jpegBuf = outBuffer;
+    unsigned long jpegSize = (unsigned long)std::min<long long>(outCapacity, ULONG_MAX);
+    StatsTimer timer(STATS_CODING);
+    timer.setBytes((long long)width * height * tjPixelSize[legacyPixelFormat(pixelFormat)]);
+    int ret = tjCompress2(tjInstance, pixels, width, 0, height, legacyPixelFormat(pixelFormat),
+                          &jpegBuf, &jpegSize, TJSAMP_420, quality,
+                          TJFLAG_FASTDCT | TJFLAG_NOREALLOC);
+    if (ret != 0) {
+        recordError();
+    }
+
+    return ret == 0 ? (long long)jpegSize : -1;
+}
 
 /**
- * Create streaming JPEG encoder
+ * Encode pixel data to JPEG (replaces ImageIO.write)
+ * Uses the calling thread's cached compressor (no per-call tjInitCompress).
+ * 
+ * @param pixels RGB or BGR pixel data (interleaved, 3 bytes per pixel)
  * @param width Image width
  * @param height Image height
- * @param quality JPEG quality 1-100
- * @param pixelFormat 0=RGB, 1=BGR, 2=BGRA, 3=RGBA
- * @return Encoder handle (must call DestroyStreamEncoder to free)
+ * @param quality JPEG quality 1-100 (85 recommended)
+ * @param pixelFormat 0=RGB, 1=BGR, 2=BGRA, 3=RGBA (auto-detect from Java BufferedImage type)
+ * @return JPEGData with a pooled buffer (must call FreeJPEGData when done)
  */
-DLL_EXPORT void* CreateStreamEncoder(int width, int height, int quality, int pixelFormat) {
-    if (width <= 0 || height <= 0) {
-        return nullptr;
+DLL_EXPORT struct JPEGData EncodeJPEG(unsigned char* pixels,
+                                      int width,
+                                      int height,
+                                      int quality,
+                                      int pixelFormat) {
+    return encodeJPEGWith(threadCompressor(), pixels, width, height, quality, pixelFormat);
+}
+
+/**
+ * Encode pixel data to JPEG with explicit settings (see EncodeParams.h)
+ * TurboJPEG on the calling thread's cached compressor, or libjpeg for
+ * optimized Huffman tables, restart intervals and custom quantization tables.
+ *
+ * @param pixelFormat Same values as EncodeJPEG
+ * @return JPEGData with a pooled buffer (must call FreeJPEGData when done)
+ */
+DLL_EXPORT struct JPEGData EncodeJPEGWithParams(unsigned char* pixels,
+                                                int width,
+                                                int height,
+                                                int pixelFormat,
+                                                const struct EncodeParams* params) {
+    JPEGData result{};
+    if (!params) {
+        return result;
     }
-    
-    StreamEncoder* encoder = new StreamEncoder();
-    encoder->tjInstance = tjInitCompress();
-    if (!encoder->tjInstance) {
-        delete encoder;
+    size_t jpegSize = 0;
+    unsigned char* jpeg = encodeWithParams(pixels, width, height, 0, legacyPixelFormat(pixelFormat),
+                                           *params, nullptr, 0, &jpegSize);
+    if (jpeg && jpegSize > (size_t)INT_MAX) {
+        releaseJpegBuffer(jpeg);
+        jpeg = nullptr;
+    }
+    if (jpeg) {
+        result.data = jpeg;
+        result.size = (int)jpegSize;
+    }
+    return result;
+}
+
+/**
+ * EncodeJPEGFromYUV with explicit settings (params->subsampling is not used)
+ */
+DLL_EXPORT struct JPEGData EncodeJPEGFromYUVWithParams(const struct YuvImage* image,
+                                                       const struct EncodeParams* params) {
+    JPEGData result{};
+    if (!image || !params) {
+        return result;
+    }
+    size_t jpegSize = 0;
+    unsigned char* jpeg = encodeYuv(*image, *params, &jpegSize);
+    if (jpeg && jpegSize > (size_t)INT_MAX) {
+        releaseJpegBuffer(jpeg);
+        jpeg = nullptr;
+    }
+    if (jpeg) {
+        result.data = jpeg;
+        result.size = (int)jpegSize;
+    }
+    return result;
+}
+
+/**
+ * Encode a planar (I420 / YV12 / 4:2:2 / 4:4:4 / gray) or semi-planar
+ * (NV12 / NV21) frame without converting it to RGB first
+ * The planes become the JPEG's Y, Cb and Cr components as they are, so the
+ * JPEG keeps the frame's chroma sampling. Strides may exceed the row size.
+ *
+ * @param image Planes, strides, size and layout (see YuvEncoder.h)
+ * @param quality JPEG quality 1-100
+ * @return JPEGData with a pooled buffer (must call FreeJPEGData when done)
+ */
+DLL_EXPORT struct JPEGData EncodeJPEGFromYUV(const struct YuvImage* image, int quality) {
+    const EncodeParams params = defaultEncodeParams(quality);
+    return EncodeJPEGFromYUVWithParams(image, &params);
+}
+
+/**
+ * One image for EncodeJPEGBatch
+ */
+struct JPEGImage {
+    unsigned char* pixels;
+    int width;
+    int height;
+    int pitch;        // bytes between rows, 0 = packed
+    int pixelFormat;  // same values as EncodeJPEG
+};
+
+/**
+ * Settings for EncodeJPEGBatch (the output is 4:2:0 with the fast DCT, as
+ * EncodeJPEG, unless EncodeJPEGBatchWithParams is given EncodeParams)
+ */
+struct JPEGBatchParams {
+    int quality;      // 1-100
+    int numThreads;   // threads on the batch, 0 = whole worker pool
+    int splitPixels;  // images this large are encoded in strips of about this many pixels,
+                      // 0 = default (1 MP), negative = never split
+};
+
+// EncodeJPEGBatch body
+static int encodeJPEGBatchWith(const struct JPEGImage* images, int count,
+                               const struct JPEGBatchParams* batchParams,
+                               const EncodeParams& params, struct JPEGData* results) {
+    std::vector<BatchImage> batch(count);
+    std::vector<BatchOutput> outputs(count);
+    for (int i = 0; i < count; i++) {
+        batch[i].pixels = images[i].pixels;
+        batch[i].width = images[i].width;
+        batch[i].height = images[i].height;
+        batch[i].pitch = images[i].pitch;
+        batch[i].pixelFormat = legacyPixelFormat(images[i].pixelFormat);
+    }
+    encodeBatch(batch.data(), count, params, batchParams->splitPixels, batchParams->numThreads,
+                outputs.data());
+    
+    int encoded = 0;
+    for (int i = 0; i < count; i++) {
+        results[i].data = nullptr;
+        results[i].size = 0;
+        if (outputs[i].data && outputs[i].size > (size_t)INT_MAX) {
+            releaseJpegBuffer(outputs[i].data);  // does not fit JPEGData
+        } else if (outputs[i].data) {
+            results[i].data = outputs[i].data;
+            results[i].size = (int)outputs[i].size;
+            encoded++;
+        }
+    }
+    return encoded;
+}
+
+/**
+ * Encode many images as one job on the shared worker pool
+ * Small images are one task each and large ones are split into strips,
+ * all scheduled together, so a mixed-size batch keeps every thread busy.
+ * Split images carry a restart marker after every MCU row.
+ *
+ * @param results Receives count JPEGData in input order (empty for images that
+ *                failed; free each with FreeJPEGData)
+ * @return Number of images encoded
+ */
+DLL_EXPORT int EncodeJPEGBatch(const struct JPEGImage* images,
+                               int count,
+                               const struct JPEGBatchParams* params,
+                               struct JPEGData* results) {
+    if (!images || !params || !results || count <= 0) {
+        return 0;
+    }
+    int quality = params->quality;
+    if (quality < 1) quality = 1;
+    if (quality > 100) quality = 100;
+    return encodeJPEGBatchWith(images, count, params, defaultEncodeParams(quality), results);
+}
+
+/**
+ * EncodeJPEGBatch with explicit settings for every image (its quality field is ignored)
+ * Progressive and optimized-Huffman images are encoded whole, never in strips.
+ */
+DLL_EXPORT int EncodeJPEGBatchWithParams(const struct JPEGImage* images,
+                                         int count,
+                                         const struct JPEGBatchParams* params,
+                                         const struct EncodeParams* encodeParams,
+                                         struct JPEGData* results) {
+    if (!images || !params || !encodeParams || !results || count <= 0) {
+        return 0;
+    }
+    return encodeJPEGBatchWith(images, count, params, *encodeParams, results);
+}
+
+/**
+ * Worst-case compressed size for EncodeJPEGInto (tjBufSize with 4:2:0)
+ * @return Size in bytes, -1 for invalid dimensions
+ */
+DLL_EXPORT long long GetJPEGBufferSize(int width, int height) {
+    if (width <= 0 || height <= 0) {
+        return -1;
+    }
+    unsigned long size = tjBufSize(width, height, TJSAMP_420);
+    return size == (unsigned long)-1 ? -1 : (long long)size;
+}
+
+/**
+ * Worst-case compressed size for EncodeJPEGIntoWithParams
+ * @return Size in bytes, -1 for invalid arguments
+ */
+DLL_EXPORT long long GetJPEGBufferSizeWithParams(int width, int height,
+                                                 const struct EncodeParams* params) {
+    if (width <= 0 || height <= 0 || !params || !validEncodeParams(*params)) {
+        return -1;
+    }
+    size_t size = encodeBufferSize(width, height, *params, TJPF_BGR);
+    return size == 0 ? -1 : (long long)size;
+}
+
+/**
+ * Encode pixel data into a caller-provided buffer (TJFLAG_NOREALLOC)
+ * Nothing is allocated for the output. A buffer of GetJPEGBufferSize bytes
+ * always fits; a smaller one fails once the JPEG outgrows it.
+ *
+ * @param pixelFormat Same values as EncodeJPEG
+ * @param outBuffer Destination for the JPEG
+ * @param outCapacity Size of outBuffer in bytes
+ * @return JPEG size in bytes, -1 on failure (including a too-small buffer)
+ */
+DLL_EXPORT long long EncodeJPEGInto(unsigned char* pixels,
+                                    int width,
+                                    int height,
+                                    int quality,
+                                    int pixelFormat,
+                                    unsigned char* outBuffer,
+                                    long long outCapacity) {
+    return encodeJPEGIntoWith(threadCompressor(), pixels, width, height, quality, pixelFormat,
+                              outBuffer, outCapacity);
+}
+
+/**
+ * EncodeJPEGInto with explicit settings (see EncodeParams.h)
+ * A buffer of GetJPEGBufferSizeWithParams bytes always fits.
+ * @return JPEG size in bytes, -1 on failure (including a too-small buffer)
+ */
+DLL_EXPORT long long EncodeJPEGIntoWithParams(unsigned char* pixels,
+                                              int width,
+                                              int height,
+                                              int pixelFormat,
+                                              const struct EncodeParams* params,
+                                              unsigned char* outBuffer,
+                                              long long outCapacity) {
+    if (!params || !outBuffer || outCapacity <= 0) {
+        return -1;
+    }
+    size_t jpegSize = 0;
+    unsigned char* jpeg = encodeWithParams(pixels, width, height, 0, legacyPixelFormat(pixelFormat),
+                                           *params, outBuffer, (size_t)outCapacity, &jpegSize);
+    return jpeg ? (long long)jpegSize : -1;
+}
+
+/**
+ * Encoder context with an explicit lifetime
+ * Owns one compressor handle; use it from one thread at a time.
+ */
+struct EncoderContext {
+    tjhandle tjInstance;
+};
+
+/**
+ * Create an encoder context (for callers that manage handle lifetime themselves)
+ * @return Context handle (must call DestroyEncoderContext to free), nullptr on failure
+ */
+DLL_EXPORT void* CreateEncoderContext() {
+    tjhandle tjInstance = tjInitCompress();
+    if (!tjInstance) {
+        return nullptr;
+    }
+    EncoderContext* context = new (std::nothrow) EncoderContext();
+    if (!context) {
+        tjDestroy(tjInstance);
+        return nullptr;
+    }
+    context->tjInstance = tjInstance;
+    return context;
+}
+
+/**
+ * Destroy an encoder context and its compressor handle
+ */
+DLL_EXPORT void DestroyEncoderContext(void* contextHandle) {
+    if (!contextHandle) return;
+    EncoderContext* context = (EncoderContext*)contextHandle;
+    tjDestroy(context->tjInstance);
+    delete context;
+}
+
+/**
+ * EncodeJPEG on an explicit context
+ */
+DLL_EXPORT struct JPEGData EncodeJPEGWithContext(void* contextHandle,
+                                                 unsigned char* pixels,
+                                                 int width,
+                                                 int height,
+                                                 int quality,
+                                                 int pixelFormat) {
+    tjhandle tjInstance = contextHandle ? ((EncoderContext*)contextHandle)->tjInstance : nullptr;
+    return encodeJPEGWith(tjInstance, pixels, width, height, quality, pixelFormat);
+}
+
+/**
+ * EncodeJPEGInto on an explicit context
+ */
+DLL_EXPORT long long EncodeJPEGIntoWithContext(void* contextHandle,
+                                               unsigned char* pixels,
+                                               int width,
+                                               int height,
+                                               int quality,
+                                               int pixelFormat,
+                                               unsigned char* outBuffer,
+                                               long long outCapacity) {
+    tjhandle tjInstance = contextHandle ? ((EncoderContext*)contextHandle)->tjInstance : nullptr;
+    return encodeJPEGIntoWith(tjInstance, pixels, width, height, quality, pixelFormat,
+                              outBuffer, outCapacity);
+}
+
+/**
+ * Destroy the calling thread's cached compressor
+ * Optional: cached handles are also destroyed when their thread exits.
+ */
+DLL_EXPORT void ReleaseThreadEncoder() {
+    releaseThreadCompressor();
+}
+
+/**
+ * Free JPEG data returned by EncodeJPEG
+ * Pooled buffers go back to the pool; anything else was malloc'd.
+ */
+DLL_EXPORT void FreeJPEGData(struct JPEGData* jpeg) {
+    if (!jpeg) return;
+    if (jpeg->data) {
+        if (!releaseJpegBuffer(jpeg->data)) {
+            std::free(jpeg->data);
+        }
+        jpeg->data = nullptr;
+        jpeg->size = 0;
+    }
+}
+
+/**
+ * Release the idle buffers kept by the JPEG output pool
+ * Buffers still held in JPEGData are unaffected.
+ */
+DLL_EXPORT void TrimJPEGBufferPool() {
+    trimJpegBufferPool();
+}
+
+/**
+ * Set the size of the worker pool shared by all parallel encode paths
+ * @param numThreads Worker threads, 0 = CPU core count - 1 (callers work too)
+ */
+DLL_EXPORT void SetWorkerThreads(int numThreads) {
+    setWorkerThreadCount(numThreads);
+}
+
+/**
+ * Current size of the shared worker pool
+ */
+DLL_EXPORT int GetWorkerThreads() {
+    return workerThreadCount();
+}
+
+/**
+ * Turn the per-stage timing and allocation counters on (1) or off (0)
+ * Off by default; while off each probe costs one relaxed atomic load.
+ */
+DLL_EXPORT void EnableEncoderStats(int enabled) {
+    setStatsEnabled(enabled != 0);
+}
+
+/**
+ * Totals since the last ResetEncoderStats, summed over all threads
+ * @param stats Filled in (see EncoderStats.h for the layout)
+ */
+DLL_EXPORT void GetEncoderStats(struct EncoderStats* stats) {
+    getStats(stats);
+}
+
+/**
+ * Restart the totals from zero; counters keep running if enabled
+ */
+DLL_EXPORT void ResetEncoderStats() {
+    resetStats();
+}
+
+// TransformJPEG body; results over 2 GB do not fit JPEGData
+static JPEGData transformJPEGData(const unsigned char* jpeg, int size,
+                                  const struct JpegTransformOp* ops, int numOps) {
+    JPEGData result{};
+    if (!jpeg || size <= 0) {
+        return result;
+    }
+    size_t outSize = 0;
+    unsigned char* out = transformJpeg(jpeg, (size_t)size, ops, numOps, &outSize);
+    if (out && outSize > (size_t)INT_MAX) {
+        releaseJpegBuffer(out);
+        out = nullptr;
+    }
+    if (out) {
+        result.data = out;
+        result.size = (int)outSize;
+    }
+    return result;
+}
+
+/**
+ * Losslessly rotate / flip / transpose / crop a JPEG in the DCT domain (no decode)
+ * @param ops Steps applied in order; each is {TJXOP_*, TJXOPT_* flags, crop x, y, width, height}
+ * @return JPEGData with a pooled buffer (must call FreeJPEGData), empty on failure
+ */
+DLL_EXPORT struct JPEGData TransformJPEG(const unsigned char* jpeg,
+                                         int size,
+                                         const struct JpegTransformOp* ops,
+                                         int numOps) {
+    return transformJPEGData(jpeg, size, ops, numOps);
+}
+
+/**
+ * Apply one list of steps to many JPEGs on the shared worker pool
+ * @param results Receives count JPEGData (empty for inputs that failed; free each with FreeJPEGData)
+ * @param numThreads Threads working on the batch, 0 = whole pool
+ * @return Number of inputs transformed
+ */
+DLL_EXPORT int TransformJPEGBatch(const unsigned char* const* jpegs,
+                                  const int* sizes,
+                                  int count,
+                                  const struct JpegTransformOp* ops,
+                                  int numOps,
+                                  struct JPEGData* results,
+                                  int numThreads) {
+    if (!jpegs || !sizes || !results || count <= 0) {
+        return 0;
+    }
+    std::atomic<int> transformed(0);
+    parallelFor(count, numThreads, [&](int i) {
+        results[i] = transformJPEGData(jpegs[i], sizes[i], ops, numOps);
+        if (results[i].data) {
+            transformed++;
+        }
+    });
+    return transformed.load();
+}
+
+// ========================= Streaming/Chunked Encoding API =========================
+// Supports chunked encoding for arbitrarily large images without loading entire image into memory:
+// rows are compressed by jpeg_write_scanlines as they arrive, so only libjpeg's
+// one-MCU-row window of pixels is held, plus the compressed output
+
+/**
+ * Growable output for the stream encoder, rented from the JPEG buffer pool
+ * The buffer is handed to the caller as-is (FreeJPEGData returns it): no final copy.
+ */
+struct MemoryDestination {
+    struct jpeg_destination_mgr pub;
+    unsigned char* data;
+    size_t capacity;
+    size_t size;
+};
+
+static void memoryInitDestination(j_compress_ptr cinfo) {
+    MemoryDestination* dest = (MemoryDestination*)cinfo->dest;
+    dest->pub.next_output_byte = dest->data;
+    dest->pub.free_in_buffer = dest->capacity;
+}
+
+static boolean memoryEmptyOutputBuffer(j_compress_ptr cinfo) {
+    // Called with the whole buffer full: move to the next size class up
+    MemoryDestination* dest = (MemoryDestination*)cinfo->dest;
+    size_t newCapacity = 0;
+    unsigned char* grown = rentJpegBuffer(dest->capacity * 2, &newCapacity);
+    if (!grown) {
+        ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 10);
+    }
+    std::memcpy(grown, dest->data, dest->capacity);
+    releaseJpegBuffer(dest->data);
+    dest->data = grown;
+    dest->pub.next_output_byte = grown + dest->capacity;
+    dest->pub.free_in_buffer = newCapacity - dest->capacity;
+    dest->capacity = newCapacity;
+    return TRUE;
+}
+
+static void memoryTermDestination(j_compress_ptr cinfo) {
+    MemoryDestination* dest = (MemoryDestination*)cinfo->dest;
+    dest->size = dest->capacity - dest->pub.free_in_buffer;
+}
+
+/**
+ * Called with each chunk of compressed output, in order
+ * @return 0 to continue, nonzero to abort the encode
+ */
+typedef int (*JpegWriteCallback)(const unsigned char* data, int size, void* userData);
+
+static const int SINK_CHUNK_SIZE = 256 * 1024;
+
+/**
+ * Output that flushes fixed-size chunks to a callback while compression runs
+ */
+struct SinkDestination {
+    struct jpeg_destination_mgr pub;
+    JpegWriteCallback callback;
+    void* userData;
+    unsigned char* buffer;   // SINK_CHUNK_SIZE bytes of staging
+    long long written;
+};
+
+static void sinkInitDestination(j_compress_ptr cinfo) {
+    SinkDestination* sink = (SinkDestination*)cinfo->dest;
+    sink->pub.next_output_byte = sink->buffer;
+    sink->pub.free_in_buffer = SINK_CHUNK_SIZE;
+}
+
+static void sinkFlush(j_compress_ptr cinfo, int size) {
+    SinkDestination* sink = (SinkDestination*)cinfo->dest;
+    if (size > 0) {
+        const long long start = statsClock();
+        const int ret = sink->callback(sink->buffer, size, sink->userData);
+        recordStage(STATS_IO, start, size);
+        if (ret != 0) {
+            ERREXIT(cinfo, JERR_FILE_WRITE);
+        }
+        sink->written += size;
+    }
+    sink->pub.next_output_byte = sink->buffer;
+    sink->pub.free_in_buffer = SINK_CHUNK_SIZE;
+}
+
+static boolean sinkEmptyOutputBuffer(j_compress_ptr cinfo) {
+    sinkFlush(cinfo, SINK_CHUNK_SIZE);
+    return TRUE;
+}
+
+static void sinkTermDestination(j_compress_ptr cinfo) {
+    SinkDestination* sink = (SinkDestination*)cinfo->dest;
+    sinkFlush(cinfo, SINK_CHUNK_SIZE - (int)sink->pub.free_in_buffer);
+}
+
+// Sink callback used by CreateStreamEncoderToFile
+static int writeToFile(const unsigned char* data, int size, void* userData) {
+    return std::fwrite(data, 1, (size_t)size, (FILE*)userData) == (size_t)size ? 0 : -1;
+}
+
+/**
+ * libjpeg error handler: jump back into the API call that failed
+ */
+struct StreamErrorManager {
+    struct jpeg_error_mgr pub;
+    jmp_buf jump;
+};
+
+static void streamErrorExit(j_common_ptr cinfo) {
+    longjmp(((StreamErrorManager*)cinfo->err)->jump, 1);
+}
+
+/**
+ * Streaming encoder context
+ */
+struct StreamEncoder {
+    struct jpeg_compress_struct cinfo;
+    StreamErrorManager err;
+    MemoryDestination dest;  // output for CreateStreamEncoder
+    SinkDestination sink;    // output for CreateStreamEncoderToSink/ToFile
+    bool toSink;
+    FILE* file;              // owned by encoders created with CreateStreamEncoderToFile
+    int width;
+    int height;
+    EncodeParams params;
+    unsigned short quantTable[128];  // params.quantTable points here when set
+    int pixelFormat;
+    int currentRow;
+    int inputFormat;   // TJPF_* of the rows being written (STREAM_INPUT_YUV for WriteYUVRows);
+                       // -1 until the first write
+    int yuvSubsampling;   // TJSAMP_* of YUV rows
+    YuvBand* yuvBand;     // raw-data band buffers, owned by cinfo
+    bool failed;       // a libjpeg error aborted compression
+};
+
+// inputFormat of an encoder fed YUV planes (past the last TJPF_* value)
+static const int STREAM_INPUT_YUV = TJ_NUMPF;
+
+// Byte-row TJPF_* value for CreateStreamEncoder's pixelFormat argument
+static int streamPixelFormat(int pixelFormat) {
+    switch (pixelFormat) {
+        case 0: return TJPF_RGB;
+        case 2: return TJPF_BGRX;   // alpha is ignored by the encoder
+        case 3: return TJPF_RGBX;
+        default: return TJPF_BGR;
+    }
+}
+
+/**
+ * Push rowCount rows (rowBytes apart) into the compressor, starting it on the first call.
+ * The input format is fixed by the first write; mixing byte and int rows fails.
+ */
+static int streamWriteRows(StreamEncoder* encoder, const unsigned char* rowData, int rowCount,
+                           int tjFormat) {
+    if (encoder->failed || encoder->currentRow + rowCount > encoder->height) {
+        return -1;  // Earlier failure, or exceeds image height
+    }
+    if (encoder->inputFormat >= 0 && encoder->inputFormat != tjFormat) {
+        return -1;
+    }
+    
+    size_t rowBytes = (size_t)encoder->width * tjPixelSize[tjFormat];
+    struct jpeg_compress_struct* cinfo = &encoder->cinfo;
+    
+    if (setjmp(encoder->err.jump)) {
+        encoder->failed = true;
+        recordError();
+        jpeg_abort_compress(cinfo);
+        return -1;
+    }
+    
+    if (encoder->inputFormat < 0) {
+        setupCompressor(cinfo, encoder->width, encoder->height, tjFormat, encoder->params);
+        jpeg_start_compress(cinfo, TRUE);
+        encoder->inputFormat = tjFormat;
+    }
+    
+    JSAMPROW rows[16];
+    int done = 0;
+    while (done < rowCount) {
+        int count = std::min(16, rowCount - done);
+        for (int i = 0; i < count; i++) {
+            rows[i] = (JSAMPROW)(rowData + (size_t)(done + i) * rowBytes);
+        }
+        const long long start = statsClock();
+        jpeg_write_scanlines(cinfo, rows, (JDIMENSION)count);
+        recordStage(STATS_CODING, start, (long long)count * rowBytes);
+        done += count;
+    }
+    
+    encoder->currentRow += rowCount;
+    return encoder->currentRow;
+}
+
+DLL_EXPORT void DestroyStreamEncoder(void* encoderHandle);
+
+// Allocate an encoder with its compressor created; the caller attaches a destination
+static StreamEncoder* newStreamEncoder(int width, int height, int quality, int pixelFormat) {
+    if (width <= 0 || height <= 0) {
+        return nullptr;
+    }
+    
+    StreamEncoder* encoder = new (std::nothrow) StreamEncoder();
+    if (!encoder) {
         return nullptr;
     }
     
     encoder->width = width;
     encoder->height = height;
-    encoder->quality = (quality < 1) ? 1 : (quality > 100) ? 100 : quality;
+    encoder->params = defaultEncodeParams((quality < 1) ? 1 : (quality > 100) ? 100 : quality);
     encoder->pixelFormat = pixelFormat;
     encoder->currentRow = 0;
-    encoder->jpegBuf = nullptr;
-    encoder->jpegSize = 0;
+    encoder->inputFormat = -1;
+    encoder->yuvSubsampling = -1;
+    encoder->yuvBand = nullptr;
+    encoder->failed = false;
+    encoder->toSink = false;
+    encoder->file = nullptr;
+    encoder->dest.data = nullptr;
+    encoder->sink.buffer = nullptr;
+    
+    encoder->cinfo.err = jpeg_std_error(&encoder->err.pub);
+    encoder->err.pub.error_exit = streamErrorExit;
+    if (setjmp(encoder->err.jump)) {
+        delete encoder;
+        return nullptr;
+    }
+    jpeg_create_compress(&encoder->cinfo);
+    return encoder;
+}
+
+/**
+ * Create streaming JPEG encoder
+ * @param width Image width
+ * @param height Image height
+ * @param quality JPEG quality 1-100
+ * @param pixelFormat 0=RGB, 1=BGR, 2=BGRA, 3=RGBA
+ * @return Encoder handle (must call DestroyStreamEncoder to free)
+ */
+DLL_EXPORT void* CreateStreamEncoder(int width, int height, int quality, int pixelFormat) {
+    StreamEncoder* encoder = newStreamEncoder(width, height, quality, pixelFormat);
+    if (!encoder) {
+        return nullptr;
+    }
     
-    // Allocate row buffer (stores all scanline pointers)
-    encoder->rowBuffer = new unsigned char*[height];
-    for (int i = 0; i < height; i++) {
-        encoder->rowBuffer[i] = nullptr;
+    // Start the output at ~1 bit per pixel, capped at 16MB; it doubles as needed
+    encoder->dest.size = 0;
+    encoder->dest.data = rentJpegBuffer(
+        (size_t)std::min<long long>((long long)width * height / 8 + 4096, 16 << 20),
+        &encoder->dest.capacity);
+    if (!encoder->dest.data) {
+        DestroyStreamEncoder(encoder);
+        return nullptr;
     }
-    encoder->rowBufferCount = 0;
+    
+    encoder->dest.pub.init_destination = memoryInitDestination;
+    encoder->dest.pub.empty_output_buffer = memoryEmptyOutputBuffer;
+    encoder->dest.pub.term_destination = memoryTermDestination;
+    encoder->cinfo.dest = &encoder->dest.pub;
     
     return encoder;
 }
 
+/**
+ * Create streaming JPEG encoder that emits compressed bytes to a callback
+ * as they are produced (256KB chunks), so the JPEG is never held in memory.
+ * Finish with FinalizeStreamEncoderToSink.
+ * @param writeCallback Receives each chunk; return nonzero to abort
+ * @param userData Passed through to writeCallback
+ * @return Encoder handle (must call DestroyStreamEncoder to free)
+ */
+DLL_EXPORT void* CreateStreamEncoderToSink(int width, int height, int quality, int pixelFormat,
+                                           JpegWriteCallback writeCallback, void* userData) {
+    if (!writeCallback) {
+        return nullptr;
+    }
+    StreamEncoder* encoder = newStreamEncoder(width, height, quality, pixelFormat);
+    if (!encoder) {
+        return nullptr;
+    }
+    
+    encoder->sink.buffer = (unsigned char*)std::malloc(SINK_CHUNK_SIZE);
+    if (!encoder->sink.buffer) {
+        DestroyStreamEncoder(encoder);
+        return nullptr;
+    }
+    encoder->sink.callback = writeCallback;
+    encoder->sink.userData = userData;
+    encoder->sink.written = 0;
+    encoder->sink.pub.init_destination = sinkInitDestination;
+    encoder->sink.pub.empty_output_buffer = sinkEmptyOutputBuffer;
+    encoder->sink.pub.term_destination = sinkTermDestination;
+    encoder->cinfo.dest = &encoder->sink.pub;
+    encoder->toSink = true;
+    
+    return encoder;
+}
+
+/**
+ * Create streaming JPEG encoder that writes straight to a file
+ * The file is created (truncated) now and closed by Finalize/Destroy.
+ * @param path Output file path
+ * @return Encoder handle (must call DestroyStreamEncoder to free)
+ */
+DLL_EXPORT void* CreateStreamEncoderToFile(int width, int height, int quality, int pixelFormat,
+                                           const char* path) {
+    if (!path) {
+        return nullptr;
+    }
+    FILE* file = std::fopen(path, "wb");
+    if (!file) {
+        return nullptr;
+    }
+    
+    StreamEncoder* encoder = (StreamEncoder*)CreateStreamEncoderToSink(
+        width, height, quality, pixelFormat, writeToFile, file);
+    if (!encoder) {
+        std::fclose(file);
+        return nullptr;
+    }
+    encoder->file = file;
+    return encoder;
+}
+
+/**
+ * Replace the encoder's settings (see EncodeParams.h); only before the first row is written
+ * Progressive and optimized-Huffman output make libjpeg hold the whole image's
+ * DCT coefficients in memory, and no output is produced until Finalize.
+ * @param params Copied, including the quantization table
+ * @return 0 on success, -1 after the first write or for invalid settings
+ */
+DLL_EXPORT int SetStreamEncoderParams(void* encoderHandle, const struct EncodeParams* params) {
+    if (!encoderHandle || !params || !validEncodeParams(*params)) {
+        return -1;
+    }
+    StreamEncoder* encoder = (StreamEncoder*)encoderHandle;
+    if (encoder->inputFormat >= 0 || encoder->failed) {
+        return -1;
+    }
+    encoder->params = *params;
+    if (params->quantTable) {
+        std::memcpy(encoder->quantTable, params->quantTable, sizeof(encoder->quantTable));
+        encoder->params.quantTable = encoder->quantTable;
+    }
+    return 0;
+}
+
 /**
  * Write image row data (batch input) - for byte[] data (BGR/RGB)
+ * The rows are compressed immediately; rowData is not referenced after the call.
  * @param encoderHandle Handle returned by CreateStreamEncoder
  * @param rowData Row data (BGR/RGB format, rowCount rows of continuous data)
  * @param rowCount Number of rows in this batch
@@ -447,30 +1438,12 @@ DLL_EXPORT int WriteImageRows(void* encoderHandle, unsigned char* rowData, int r
     }
     
     StreamEncoder* encoder = (StreamEncoder*)encoderHandle;
-    
-    if (encoder->currentRow + rowCount > encoder->height) {
-        return -1;  // Exceeds image height
-    }
-    
-    int bytesPerPixel = (encoder->pixelFormat == 2 || encoder->pixelFormat == 3) ? 4 : 3;
-    int rowBytes = encoder->width * bytesPerPixel;
-    
-    // Copy row data to internal buffer
-    for (int i = 0; i < rowCount; i++) {
-        unsigned char* row = new unsigned char[rowBytes];
-        std::memcpy(row, rowData + i * rowBytes, rowBytes);
-        encoder->rowBuffer[encoder->currentRow + i] = row;
-    }
-    
-    encoder->currentRow += rowCount;
-    encoder->rowBufferCount += rowCount;
-    
-    return encoder->currentRow;
+    return streamWriteRows(encoder, rowData, rowCount, streamPixelFormat(encoder->pixelFormat));
 }
 
 /**
  * Write image row data from int[] array (TYPE_INT_RGB/TYPE_INT_ARGB)
- * Multi-threaded conversion for maximum speed!
+ * The ints are fed to libjpeg as native-order BGRX bytes, so no conversion pass is needed.
  * @param encoderHandle Handle returned by CreateStreamEncoder
  * @param rowData Row data as int[] (4 bytes per pixel: 0xAARRGGBB)
  * @param rowCount Number of rows in this batch
@@ -482,63 +1455,79 @@ DLL_EXPORT int WriteImageRowsInt(void* encoderHandle, int* rowData, int rowCount
     }
     
     StreamEncoder* encoder = (StreamEncoder*)encoderHandle;
-    
-    if (encoder->currentRow + rowCount > encoder->height) {
-        return -1;  // Exceeds image height
+    return streamWriteRows(encoder, (const unsigned char*)rowData, rowCount, nativeArgbPixelFormat());
+}
+
+/**
+ * Write a band of YUV rows (planar or NV12 / NV21, see YuvEncoder.h) with no colour conversion
+ * The planes are compressed as the JPEG's Y, Cb and Cr components, so the
+ * first call fixes the JPEG's chroma sampling; an encoder takes either YUV
+ * rows or pixel rows, not both.
+ * @param encoderHandle Handle returned by CreateStreamEncoder*
+ * @param rows The band: planes point at its first row, rows->height rows; the
+ *             height must be a multiple of the MCU height (16 at 4:2:0, 8 at
+ *             4:4:4 / 4:2:2 / 4:1:1 / gray) except in the last band
+ * @return Total rows written on success, -1 on failure
+ */
+DLL_EXPORT int WriteYUVRows(void* encoderHandle, const struct YuvImage* rows) {
+    if (!encoderHandle || !rows || !validYuvImage(*rows)) {
+        return -1;
     }
     
-    int bytesPerRow = encoder->width * 3;  // BGR: 3 bytes per pixel
-    
-    // MULTI-THREADED conversion (8x faster on 8-core CPU)
-    int numThreads = std::thread::hardware_concurrency();
-    if (numThreads <= 0) numThreads = 4;
-    if (numThreads > rowCount) numThreads = rowCount;
-    
-    std::vector<std::thread> threads;
-    
-    auto convertRows = [&](int startRow, int endRow) {
-        for (int row = startRow; row < endRow; row++) {
-            unsigned char* bgrRow = new unsigned char[bytesPerRow];
-            int* srcRow = rowData + row * encoder->width;
-            
-            // Optimized conversion loop
-            for (int x = 0; x < encoder->width; x++) {
-                unsigned int argb = (unsigned int)srcRow[x];
-                unsigned char* dst = &bgrRow[x * 3];
-                dst[0] = (unsigned char)(argb);         // B
-                dst[1] = (unsigned char)(argb >> 8);    // G
-                dst[2] = (unsigned char)(argb >> 16);   // R
-            }
-            
-            encoder->rowBuffer[encoder->currentRow + row] = bgrRow;
-        }
-    };
-    
-    // Launch parallel conversion
-    int rowsPerThread = (rowCount + numThreads - 1) / numThreads;
-    for (int t = 0; t < numThreads; t++) {
-        int startRow = t * rowsPerThread;
-        int endRow = std::min(startRow + rowsPerThread, rowCount);
-        if (startRow < endRow) {
-            threads.emplace_back(convertRows, startRow, endRow);
-        }
+    StreamEncoder* encoder = (StreamEncoder*)encoderHandle;
+    const int subsampling = yuvSubsampling(*rows);
+    if (encoder->failed || rows->width != encoder->width ||
+        encoder->currentRow + rows->height > encoder->height) {
+        return -1;
+    }
+    if (encoder->inputFormat >= 0 &&
+        (encoder->inputFormat != STREAM_INPUT_YUV || encoder->yuvSubsampling != subsampling)) {
+        return -1;
+    }
+    if (encoder->currentRow + rows->height < encoder->height &&
+        rows->height % tjMCUHeight[subsampling] != 0) {
+        return -1;  // only the last band may end inside an MCU row
     }
     
-    // Wait for all threads
-    for (auto& thread : threads) {
-        thread.join();
+    struct jpeg_compress_struct* cinfo = &encoder->cinfo;
+    if (setjmp(encoder->err.jump)) {
+        encoder->failed = true;
+        recordError();
+        jpeg_abort_compress(cinfo);
+        return -1;
     }
     
-    encoder->currentRow += rowCount;
-    encoder->rowBufferCount += rowCount;
+    if (encoder->inputFormat < 0) {
+        encoder->yuvBand = startYuvCompress(cinfo, encoder->width, encoder->height, subsampling,
+                                            encoder->params);
+        encoder->inputFormat = STREAM_INPUT_YUV;
+        encoder->yuvSubsampling = subsampling;
+    }
+    writeYuvRows(cinfo, encoder->yuvBand, *rows);
     
+    encoder->currentRow += rows->height;
     return encoder->currentRow;
 }
 
+// Flush the last rows and the EOI into the destination; false on any failure
+static bool streamFinish(StreamEncoder* encoder) {
+    if (encoder->failed || encoder->inputFormat < 0 || encoder->currentRow != encoder->height) {
+        return false;  // Not all rows collected
+    }
+    
+    if (setjmp(encoder->err.jump)) {
+        encoder->failed = true;
+        recordError();
+        jpeg_abort_compress(&encoder->cinfo);
+        return false;
+    }
+    jpeg_finish_compress(&encoder->cinfo);
+    return true;
+}
+
 /**
  * Complete encoding and get JPEG data
- * For small images (<2GB): use fast turbojpeg batch compression
- * For large images (>=2GB): use libjpeg scanline API without full buffer allocation
+ * Ownership of the compressed buffer moves to the returned JPEGData.
  * @param encoderHandle Encoder handle
  * @return JPEGData structure (must call FreeJPEGData to free)
  */
@@ -553,184 +1542,65 @@ DLL_EXPORT struct JPEGData FinalizeStreamEncoder(void* encoderHandle) {
     
     StreamEncoder* encoder = (StreamEncoder*)encoderHandle;
     
-    if (encoder->currentRow != encoder->height) {
-        return result;  // Not all rows collected
+    if (encoder->toSink) {
+        return result;  // Use FinalizeStreamEncoderToSink
+    }
+    if (!streamFinish(encoder)) {
+        return result;
+    }
+    encoder->failed = true;  // finished: further writes are rejected
+    if (encoder->dest.size > (size_t)INT_MAX) {
+        return result;  // JPEGData.size cannot hold >2GB: use a sink encoder
     }
     
-    int bytesPerPixel = (encoder->pixelFormat == 2 || encoder->pixelFormat == 3) ? 4 : 3;
-    int rowBytes = encoder->width * bytesPerPixel;
-    long long totalBytes = (long long)encoder->height * rowBytes;
+    result.data = encoder->dest.data;
+    result.size = (int)encoder->dest.size;
+    encoder->dest.data = nullptr;
+    encoder->dest.capacity = 0;
+    return result;
+}
+
+/**
+ * Complete an encoder created with CreateStreamEncoderToSink/ToFile
+ * The last chunk is flushed to the sink; a file is closed.
+ * @param encoderHandle Encoder handle
+ * @return Total compressed bytes emitted (64-bit), -1 on failure
+ */
+DLL_EXPORT long long FinalizeStreamEncoderToSink(void* encoderHandle) {
+    if (!encoderHandle) {
+        return -1;
+    }
     
-    // Threshold for switching to scanline encoding (1.5GB)
-    const long long MAX_BATCH = 1500000000LL;
+    StreamEncoder* encoder = (StreamEncoder*)encoderHandle;
+    if (!encoder->toSink) {
+        return -1;
+    }
     
-    // Fast single-JPEG compression with optimizations
-    if (totalBytes < MAX_BATCH) {
-        // Allocate image buffer
-        unsigned char* imageData = new (std::nothrow) unsigned char[totalBytes];
-        
-        if (!imageData) {
-            return result;  // Out of memory
-        }
-        
-        // Multi-threaded row copy for speed
-        int numThreads = std::thread::hardware_concurrency();
-        if (numThreads <= 0) numThreads = 4;
-        
-        std::vector<std::thread> threads;
-        int rowsPerThread = (encoder->height + numThreads - 1) / numThreads;
-        
-        auto copyRows = [&](int startRow, int endRow) {
-            for (int i = startRow; i < endRow && i < encoder->height; i++) {
-                std::memcpy(imageData + (long long)i * rowBytes, encoder->rowBuffer[i], rowBytes);
-            }
-        };
-        
-        for (int t = 0; t < numThreads; t++) {
-            int start = t * rowsPerThread;
-            int end = std::min(start + rowsPerThread, encoder->height);
-            if (start < end) {
-                threads.emplace_back(copyRows, start, end);
-            }
-        }
-        
-        for (auto& thread : threads) {
-            thread.join();
-        }
-        
-        // Use turbojpeg with all speed optimizations
-        unsigned char* jpegBuf = nullptr;
-        unsigned long jpegSize = 0;
-        
-        int ret = tjCompress2(
-            encoder->tjInstance,
-            imageData,
-            encoder->width,
-            0,  // pitch (auto)
-            encoder->height,
-            TJPF_BGR,
-            &jpegBuf,
-            &jpegSize,
-            TJSAMP_420,
-            encoder->quality,
-            TJFLAG_FASTDCT | TJFLAG_FASTUPSAMPLE  // Maximum speed
-        );
-        
-        delete[] imageData;
-        
-        if (ret != 0) {
-            tjFree(jpegBuf);
-            return result;
-        }
-        
-        // Copy result
-        unsigned char* outBuf = (unsigned char*)std::malloc(jpegSize);
-        if (!outBuf) {
-            tjFree(jpegBuf);
-            return result;
-        }
-        std::memcpy(outBuf, jpegBuf, jpegSize);
-        
-        result.data = outBuf;
-        result.size = (int)jpegSize;
-        
-        tjFree(jpegBuf);
-        return result;
+    bool ok = streamFinish(encoder);
+    encoder->failed = true;  // finished: further writes are rejected
+    if (encoder->file) {
+        ok = std::fclose(encoder->file) == 0 && ok;
+        encoder->file = nullptr;
     }
-    else {
-        // SLOW PATH: Use libjpeg scanline API for huge images (avoids large allocation)
-        struct jpeg_compress_struct cinfo;
-        struct jpeg_error_mgr jerr;
-        
-        cinfo.err = jpeg_std_error(&jerr);
-        jpeg_create_compress(&cinfo);
-        
-        // Output to memory buffer
-        unsigned char* outbuffer = nullptr;
-        unsigned long outsize = 0;
-        jpeg_mem_dest(&cinfo, &outbuffer, &outsize);
-        
-        // Set image parameters
-        cinfo.image_width = encoder->width;
-        cinfo.image_height = encoder->height;
-        cinfo.input_components = 3;  // RGB/BGR
-        cinfo.in_color_space = JCS_RGB;
-        
-        jpeg_set_defaults(&cinfo);
-        jpeg_set_quality(&cinfo, encoder->quality, TRUE);
-        
-        // Start compression
-        jpeg_start_compress(&cinfo, TRUE);
-        
-        bool needConversion = (encoder->pixelFormat == 1); // BGR needs conversion
-        
-        // Write scanlines in large batches for much better performance
-        const int SCANLINE_BATCH = 5000;  // Write 5000 rows at a time (huge speedup)
-        JSAMPROW* row_pointers = new JSAMPROW[SCANLINE_BATCH];
-        
-        // Allocate batch conversion buffer if needed
-        unsigned char** batchConvertBuffers = nullptr;
-        if (needConversion) {
-            batchConvertBuffers = new unsigned char*[SCANLINE_BATCH];
-            for (int i = 0; i < SCANLINE_BATCH; i++) {
-                batchConvertBuffers[i] = new unsigned char[encoder->width * 3];
-            }
-        }
-        
-        while (cinfo.next_scanline < cinfo.image_height) {
-            int rowsToWrite = std::min(SCANLINE_BATCH, (int)(cinfo.image_height - cinfo.next_scanline));
-            
-            for (int i = 0; i < rowsToWrite; i++) {
-                unsigned char* srcRow = encoder->rowBuffer[cinfo.next_scanline + i];
-                
-                if (needConversion) {
-                    // Convert BGR to RGB for this row
-                    unsigned char* dstRow = batchConvertBuffers[i];
-                    for (int x = 0; x < encoder->width; x++) {
-                        dstRow[x * 3 + 0] = srcRow[x * 3 + 2]; // R
-                        dstRow[x * 3 + 1] = srcRow[x * 3 + 1]; // G
-                        dstRow[x * 3 + 2] = srcRow[x * 3 + 0]; // B
-                    }
-                    row_pointers[i] = dstRow;
-                } else {
-                    row_pointers[i] = srcRow;
-                }
-            }
-            
-            // Write batch of scanlines
-            jpeg_write_scanlines(&cinfo, row_pointers, rowsToWrite);
-        }
-        
-        // Cleanup batch buffers
-        if (batchConvertBuffers) {
-            for (int i = 0; i < SCANLINE_BATCH; i++) {
-                delete[] batchConvertBuffers[i];
-            }
-            delete[] batchConvertBuffers;
-        }
-        delete[] row_pointers;
-        
-        // Finish compression
-        jpeg_finish_compress(&cinfo);
-        
-        // Copy to malloc buffer (for compatibility with FreeJPEGData)
-        unsigned char* finalBuf = (unsigned char*)std::malloc(outsize);
-        if (!finalBuf) {
-            free(outbuffer);
-            jpeg_destroy_compress(&cinfo);
-            return result;
-        }
-        std::memcpy(finalBuf, outbuffer, outsize);
-        
-        result.data = finalBuf;
-        result.size = (int)outsize;
-        
-        // Clean up
-        free(outbuffer);
-        jpeg_destroy_compress(&cinfo);
-        
-        return result;
+    return ok ? encoder->sink.written : -1;
+}
+
+/**
+ * Compressed bytes produced so far (64-bit; complete after Finalize)
+ * For memory encoders this also gives the size of outputs over 2GB.
+ */
+DLL_EXPORT long long GetStreamEncoderBytesWritten(void* encoderHandle) {
+    if (!encoderHandle) {
+        return -1;
+    }
+    StreamEncoder* encoder = (StreamEncoder*)encoderHandle;
+    if (encoder->toSink) {
+        return encoder->sink.written;
     }
+    if (encoder->inputFormat < 0 || encoder->dest.size > 0) {
+        return (long long)encoder->dest.size;
+    }
+    return (long long)(encoder->dest.capacity - encoder->dest.pub.free_in_buffer);
 }
 
 /**
@@ -742,21 +1612,193 @@ DLL_EXPORT void DestroyStreamEncoder(void* encoderHandle) {
     
     StreamEncoder* encoder = (StreamEncoder*)encoderHandle;
     
-    // Free row buffers
-    for (int i = 0; i < encoder->height; i++) {
-        if (encoder->rowBuffer[i]) {
-            delete[] encoder->rowBuffer[i];
-        }
-    }
-    delete[] encoder->rowBuffer;
-    
-    // Free tjhandle
-    if (encoder->tjInstance) {
-        tjDestroy(encoder->tjInstance);
+    jpeg_destroy_compress(&encoder->cinfo);
+    releaseJpegBuffer(encoder->dest.data);
+    std::free(encoder->sink.buffer);
+    if (encoder->file) {
+        std::fclose(encoder->file);  // Not finalized: the file is left incomplete
     }
     
     delete encoder;
 }
 
+// ==================== Tile pyramids ====================
+
+/**
+ * Called with each compressed DeepZoom tile, on the thread writing rows
+ * @return 0 to continue, nonzero to abort
+ */
+typedef int (*PyramidTileCallback)(int level, int column, int row, const unsigned char* data,
+                                   int size, void* userData);
+
+struct PyramidCallback {
+    PyramidTileCallback callback;
+    void* userData;
+};
+
+static int forwardTile(void* context, int level, int column, int row, const unsigned char* jpeg,
+                       size_t size) {
+    PyramidCallback* sink = (PyramidCallback*)context;
+    return size > (size_t)INT_MAX ? -1
+                                  : sink->callback(level, column, row, jpeg, (int)size, sink->userData);
+}
+
+/**
+ * Tile pyramid builder context
+ */
+struct PyramidBuilder {
+    TilePyramid pyramid;
+    PyramidCallback sink;
+    unsigned short quantTable[128];  // copy of the params' table when set
+    int pixelFormat;                 // 0=RGB, 1=BGR, 2=BGRA, 3=RGBA
+};
+
+// Settings a builder keeps: the defaults at quality 90, or a copy of params
+static EncodeParams pyramidParams(const struct EncodeParams* params, unsigned short* quantTable) {
+    if (!params) {
+        return defaultEncodeParams(90);
+    }
+    EncodeParams copy = *params;
+    if (params->quantTable) {
+        std::memcpy(quantTable, params->quantTable, 128 * sizeof(unsigned short));
+        copy.quantTable = quantTable;
+    }
+    return copy;
+}
+
+/**
+ * Create a DeepZoom pyramid builder that hands every tile to a callback
+ * Rows are written top to bottom with WriteTilePyramidRows*; only one band
+ * of tile rows per level is held, and each band's tiles are compressed in parallel.
+ * @param tileSize Tile edge without overlap (DeepZoom viewers commonly use 254 or 256)
+ * @param overlap Pixels shared with each neighbouring tile (0 .. tileSize - 1)
+ * @param pixelFormat 0=RGB, 1=BGR, 2=BGRA, 3=RGBA rows for WriteTilePyramidRows
+ * @param params Tile settings (see EncodeParams.h), copied; nullptr = quality 90
+ * @param numThreads Threads compressing tiles (0 = CPU core count)
+ * @return Builder handle (must call DestroyTilePyramid to free)
+ */
+DLL_EXPORT void* CreateTilePyramid(int width, int height, int tileSize, int overlap,
+                                   int pixelFormat, const struct EncodeParams* params,
+                                   int numThreads, PyramidTileCallback callback, void* userData) {
+    if (!callback) {
+        return nullptr;
+    }
+    PyramidBuilder* builder = new (std::nothrow) PyramidBuilder();
+    if (!builder) {
+        return nullptr;
+    }
+    builder->sink.callback = callback;
+    builder->sink.userData = userData;
+    builder->pixelFormat = pixelFormat;
+    if (!builder->pyramid.init(width, height, tileSize, overlap,
+                               pyramidParams(params, builder->quantTable), numThreads,
+                               forwardTile, &builder->sink)) {
+        delete builder;
+        return nullptr;
+    }
+    return builder;
+}
+
+/**
+ * Create a DeepZoom pyramid builder that writes basePath.dzi and
+ * basePath_files/<level>/<col>_<row>.jpg (directories are created)
+ * Arguments as for CreateTilePyramid; tiles are written by the threads compressing them.
+ * @return Builder handle (must call DestroyTilePyramid to free)
+ */
+DLL_EXPORT void* CreateTilePyramidToDirectory(int width, int height, int tileSize, int overlap,
+                                              int pixelFormat, const struct EncodeParams* params,
+                                              int numThreads, const char* basePath) {
+    PyramidBuilder* builder = new (std::nothrow) PyramidBuilder();
+    if (!builder) {
+        return nullptr;
+    }
+    builder->sink.callback = nullptr;
+    builder->sink.userData = nullptr;
+    builder->pixelFormat = pixelFormat;
+    if (!builder->pyramid.initDirectory(width, height, tileSize, overlap,
+                                        pyramidParams(params, builder->quantTable), numThreads,
+                                        basePath)) {
+        delete builder;
+        return nullptr;
+    }
+    return builder;
+}
+
+/**
+ * Write rows of the full-resolution image (pixelFormat given at creation, continuous data)
+ * Tiles completed by these rows, on every level, are emitted before the call returns.
+ * @return Total rows written on success, -1 on failure
+ */
+DLL_EXPORT int WriteTilePyramidRows(void* pyramidHandle, unsigned char* rowData, int rowCount) {
+    if (!pyramidHandle || !rowData || rowCount <= 0) {
+        return -1;
+    }
+    PyramidBuilder* builder = (PyramidBuilder*)pyramidHandle;
+    if (!builder->pyramid.writeRows(rowData, rowCount, 0, streamPixelFormat(builder->pixelFormat))) {
+        return -1;
+    }
+    return builder->pyramid.rowsWritten();
+}
+
+/**
+ * Write rows from int[] data (TYPE_INT_RGB/TYPE_INT_ARGB), read in place as BGRX bytes
+ * A builder takes either byte rows or int rows, fixed by the first write.
+ * @return Total rows written on success, -1 on failure
+ */
+DLL_EXPORT int WriteTilePyramidRowsInt(void* pyramidHandle, int* rowData, int rowCount) {
+    if (!pyramidHandle || !rowData || rowCount <= 0) {
+        return -1;
+    }
+    PyramidBuilder* builder = (PyramidBuilder*)pyramidHandle;
+    if (!builder->pyramid.writeRows((const unsigned char*)rowData, rowCount, 0,
+                                    nativeArgbPixelFormat())) {
+        return -1;
+    }
+    return builder->pyramid.rowsWritten();
+}
+
+/**
+ * Emit the remaining tiles of the lower levels once all rows are written
+ * (and write the .dzi descriptor for directory output)
+ * @return Total tiles emitted (64-bit), -1 on failure
+ */
+DLL_EXPORT long long FinishTilePyramid(void* pyramidHandle) {
+    if (!pyramidHandle) {
+        return -1;
+    }
+    return ((PyramidBuilder*)pyramidHandle)->pyramid.finish();
+}
+
+/**
+ * Destroy a pyramid builder (an unfinished directory pyramid is left incomplete)
+ */
+DLL_EXPORT void DestroyTilePyramid(void* pyramidHandle) {
+    delete (PyramidBuilder*)pyramidHandle;
+}
+
+/**
+ * Build a whole pyramid from a JPEG, decoding it band by band (BGR tiles,
+ * gray for grayscale JPEGs) so the decoded image is never held in memory
+ * @param basePath Directory output as for CreateTilePyramidToDirectory, or
+ *                 nullptr to hand tiles to callback
+ * @return Total tiles emitted (64-bit), -1 on failure
+ */
+DLL_EXPORT long long BuildTilePyramidFromJPEG(const unsigned char* jpeg, int jpegSize,
+                                              int tileSize, int overlap,
+                                              const struct EncodeParams* params, int numThreads,
+                                              const char* basePath, PyramidTileCallback callback,
+                                              void* userData) {
+    if (!jpeg || jpegSize <= 0 || (!basePath && !callback)) {
+        return -1;
+    }
+    unsigned short quantTable[128];
+    PyramidCallback sink;
+    sink.callback = callback;
+    sink.userData = userData;
+    return buildJpegPyramid(jpeg, (size_t)jpegSize, tileSize, overlap,
+                            pyramidParams(params, quantTable), numThreads, basePath,
+                            basePath ? nullptr : forwardTile, &sink);
+}
+
 } // extern "C" (JNA API)
 
@@ -0,0 +1,187 @@
+#include "WorkerPool.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Job {
+    const std::function<void(int)>* task = nullptr;
+    int count = 0;
+    int maxHelpers = 0;                 // pool workers allowed on this job
+    int helpers = 0;                    // pool workers that joined (guarded by the pool mutex)
+    std::atomic<int> next{0};           // next unclaimed task index
+    std::atomic<int> finished{0};
+    std::mutex mutex;
+    std::condition_variable done;
+};
+
+struct Pool {
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<std::shared_ptr<Job>> queue;   // jobs still accepting helpers
+    std::vector<std::thread> workers;
+    int size = 0;                             // 0 until configured or first used
+    bool stopping = false;
+    std::mutex resizeMutex;
+};
+
+// Leaked on purpose: workers may still be blocked in wait() during static destruction
+Pool& pool() {
+    static Pool* instance = new Pool();
+    return *instance;
+}
+
+int defaultWorkerCount() {
+    int numThreads = std::thread::hardware_concurrency();
+    if (numThreads <= 0) numThreads = 4;
+    return numThreads > 1 ? numThreads - 1 : 1;
+}
+
+// Claim and run tasks until the job has none left
+void runTasks(Job& job) {
+    int ran = 0;
+    for (int i = job.next.fetch_add(1); i < job.count; i = job.next.fetch_add(1)) {
+        (*job.task)(i);
+        ran++;
+    }
+    if (ran > 0 && job.finished.fetch_add(ran) + ran == job.count) {
+        std::lock_guard<std::mutex> lock(job.mutex);
+        job.done.notify_all();
+    }
+}
+
+void removeJob(Pool& p, const std::shared_ptr<Job>& job) {
+    auto it = std::find(p.queue.begin(), p.queue.end(), job);
+    if (it != p.queue.end()) {
+        p.queue.erase(it);
+    }
+}
+
+void workerLoop(Pool& p) {
+    std::unique_lock<std::mutex> lock(p.mutex);
+    while (true) {
+        p.wake.wait(lock, [&p] { return p.stopping || !p.queue.empty(); });
+        if (p.stopping) {
+            return;
+        }
+
+        std::shared_ptr<Job> job = p.queue.front();
+        if (job->next.load() >= job->count) {
+            p.queue.pop_front();
+            continue;
+        }
+        if (++job->helpers >= job->maxHelpers) {
+            p.queue.pop_front();
+        }
+
+        lock.unlock();
+        runTasks(*job);
+        lock.lock();
+        removeJob(p, job);
+    }
+}
+
+// Caller holds p.mutex
+void ensureStarted(Pool& p) {
+    if (!p.workers.empty() || p.stopping) {
+        return;
+    }
+    if (p.size <= 0) {
+        p.size = defaultWorkerCount();
+    }
+    for (int i = 0; i < p.size; i++) {
+        p.workers.emplace_back(workerLoop, std::ref(p));
+    }
+}
+
+} // namespace
+
+void parallelFor(int count, int maxThreads, const std::function<void(int)>& task) {
+    if (count <= 0) {
+        return;
+    }
+    if (maxThreads == 1 || count == 1) {
+        for (int i = 0; i < count; i++) {
+            task(i);
+        }
+        return;
+    }
+
+    Pool& p = pool();
+    std::shared_ptr<Job> job = std::make_shared<Job>();
+    job->task = &task;
+    job->count = count;
+
+    int workers = 0;
+    {
+        std::lock_guard<std::mutex> lock(p.mutex);
+        ensureStarted(p);
+        workers = (int)p.workers.size();
+        int helpers = maxThreads <= 0 ? workers : maxThreads - 1;
+        helpers = std::min(std::min(helpers, workers), count - 1);
+        job->maxHelpers = helpers;
+        if (helpers > 0) {
+            p.queue.push_back(job);
+        }
+    }
+    if (job->maxHelpers >= workers) {
+        p.wake.notify_all();
+    } else {
+        for (int i = 0; i < job->maxHelpers; i++) {
+            p.wake.notify_one();
+        }
+    }
+
+    // Work on our own job rather than block: progress never depends on a free worker
+    runTasks(*job);
+    {
+        std::unique_lock<std::mutex> lock(job->mutex);
+        job->done.wait(lock, [&job, count] { return job->finished.load() == count; });
+    }
+
+    std::lock_guard<std::mutex> lock(p.mutex);
+    removeJob(p, job);
+}
+
+void setWorkerThreadCount(int numThreads) {
+    if (numThreads <= 0) {
+        numThreads = defaultWorkerCount();
+    }
+
+    Pool& p = pool();
+    std::lock_guard<std::mutex> resize(p.resizeMutex);
+    std::vector<std::thread> old;
+    {
+        std::lock_guard<std::mutex> lock(p.mutex);
+        if (p.size == numThreads && !p.workers.empty()) {
+            return;
+        }
+        p.stopping = true;
+        old.swap(p.workers);
+    }
+    p.wake.notify_all();
+    for (auto& thread : old) {
+        thread.join();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(p.mutex);
+        p.stopping = false;
+        p.size = numThreads;
+        ensureStarted(p);
+    }
+    p.wake.notify_all();
+}
+
+int workerThreadCount() {
+    Pool& p = pool();
+    std::lock_guard<std::mutex> lock(p.mutex);
+    ensureStarted(p);
+    return p.size;
+}
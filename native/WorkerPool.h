@@ -0,0 +1,38 @@
+/**
+ * Library-wide pool of worker threads for pixel conversion and encoding
+ *
+ * Every parallel path submits its work here instead of spawning threads per
+ * call. A job is a range of task indices; workers and the submitting thread
+ * all claim indices from the job until it runs dry, so uneven tasks balance
+ * themselves. Concurrent callers share the same workers, which keeps the
+ * total thread count bounded when several Java threads encode at once.
+ */
+
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <functional>
+
+/**
+ * Run task(0) .. task(count - 1) and return once all have finished.
+ * The calling thread runs tasks too, so nested calls cannot deadlock.
+ *
+ * @param maxThreads Threads working on this job, caller included
+ *                   (1 = run inline on the caller, 0 = pool size + 1)
+ * @param task Must not throw
+ */
+void parallelFor(int count, int maxThreads, const std::function<void(int)>& task);
+
+/**
+ * Resize the pool (0 = CPU core count - 1, since submitting threads work as
+ * well). Waits for the old workers to finish their current job; queued jobs
+ * are picked up by the new ones. Do not call from inside a task.
+ */
+void setWorkerThreadCount(int numThreads);
+
+/**
+ * Number of worker threads (excluding callers), starting the pool if needed
+ */
+int workerThreadCount();
+
+#endif // WORKER_POOL_H
@@ -0,0 +1,233 @@
+#include "YuvEncoder.h"
+#include "EncoderStats.h"
+#include "JpegBufferPool.h"
+#include "TjHandleCache.h"
+#include <climits>
+#include <csetjmp>
+#include <cstdio>
+#include <cstring>
+#include "include/jpeglib.h"
+#include "include/jerror.h"
+#include "include/turbojpeg.h"
+
+namespace {
+
+// Samples per row of plane c (0 = Y), as tjPlaneWidth
+int planeWidth(int c, int width, int subsampling) {
+    if (c == 0) return width;
+    const int factor = tjMCUWidth[subsampling] / 8;  // luma samples per chroma sample
+    return (width + factor - 1) / factor;
+}
+
+// error_exit must not return: jump back to the setjmp in compressRaw
+struct ErrorManager {
+    jpeg_error_mgr pub;
+    jmp_buf jump;
+};
+
+void errorExit(j_common_ptr cinfo) {
+    longjmp(reinterpret_cast<ErrorManager*>(cinfo->err)->jump, 1);
+}
+
+void outputMessage(j_common_ptr) {
+}
+
+// Pooled output that moves up a size class when full
+struct PooledDestination {
+    jpeg_destination_mgr pub;
+    unsigned char* data;
+    size_t capacity;
+    size_t size;
+};
+
+void initDestination(j_compress_ptr cinfo) {
+    PooledDestination* dest = reinterpret_cast<PooledDestination*>(cinfo->dest);
+    dest->pub.next_output_byte = dest->data;
+    dest->pub.free_in_buffer = dest->capacity;
+}
+
+boolean emptyOutputBuffer(j_compress_ptr cinfo) {
+    PooledDestination* dest = reinterpret_cast<PooledDestination*>(cinfo->dest);
+    size_t newCapacity = 0;
+    unsigned char* grown = rentJpegBuffer(dest->capacity * 2, &newCapacity);
+    if (!grown) {
+        ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 10);
+    }
+    std::memcpy(grown, dest->data, dest->capacity);
+    releaseJpegBuffer(dest->data);
+    dest->data = grown;
+    dest->pub.next_output_byte = grown + dest->capacity;
+    dest->pub.free_in_buffer = newCapacity - dest->capacity;
+    dest->capacity = newCapacity;
+    return TRUE;
+}
+
+void termDestination(j_compress_ptr cinfo) {
+    PooledDestination* dest = reinterpret_cast<PooledDestination*>(cinfo->dest);
+    dest->size = dest->capacity - dest->pub.free_in_buffer;
+}
+
+// Whole frame through libjpeg's raw-data interface.
+// Only POD state lives here: longjmp skips destructors
+bool compressRaw(const YuvImage& image, const EncodeParams& params, PooledDestination* dest) {
+    jpeg_compress_struct cinfo;
+    ErrorManager err;
+    cinfo.err = jpeg_std_error(&err.pub);
+    err.pub.error_exit = errorExit;
+    err.pub.output_message = outputMessage;
+
+    if (setjmp(err.jump)) {
+        jpeg_destroy_compress(&cinfo);
+        return false;
+    }
+
+    jpeg_create_compress(&cinfo);
+    dest->pub.init_destination = initDestination;
+    dest->pub.empty_output_buffer = emptyOutputBuffer;
+    dest->pub.term_destination = termDestination;
+    cinfo.dest = &dest->pub;
+
+    YuvBand* band = startYuvCompress(&cinfo, image.width, image.height, yuvSubsampling(image), params);
+    writeYuvRows(&cinfo, band, image);
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    return true;
+}
+
+} // namespace
+
+// One MCU row of every component, padded to whole blocks (jpeg_write_raw_data input)
+struct YuvBand {
+    JSAMPARRAY rows[3];
+};
+
+bool validYuvImage(const YuvImage& image) {
+    if (image.width <= 0 || image.height <= 0 || image.width > 65535 || image.height > 65535 ||
+        !image.planes[0] || image.layout < YUV_PLANAR || image.layout > YUV_NV21) {
+        return false;
+    }
+    const int subsampling = yuvSubsampling(image);
+    if (subsampling < 0 || subsampling >= TJ_NUMSAMP || subsampling == TJSAMP_441) {
+        return false;
+    }
+    const int planes = subsampling == TJSAMP_GRAY ? 1 : (image.layout == YUV_PLANAR ? 3 : 2);
+    for (int c = 0; c < planes; c++) {
+        const long long rowBytes = (long long)planeWidth(c, image.width, subsampling) *
+                                   (image.layout != YUV_PLANAR && c == 1 ? 2 : 1);
+        if (!image.planes[c] || image.strides[c] < 0 ||
+            (image.strides[c] > 0 && image.strides[c] < rowBytes) || rowBytes > INT_MAX) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int yuvSubsampling(const YuvImage& image) {
+    return image.layout == YUV_PLANAR ? image.subsampling : TJSAMP_420;
+}
+
+unsigned char* encodeYuv(const YuvImage& image, const EncodeParams& params, size_t* jpegSize) {
+    if (!jpegSize || !validYuvImage(image) || !validEncodeParams(params)) {
+        return nullptr;
+    }
+    const int subsampling = yuvSubsampling(image);
+
+    // Compress into a pooled worst-case-size buffer: no second copy
+    PooledDestination dest;
+    const unsigned long maxSize = tjBufSize(image.width, image.height, subsampling);
+    dest.data = maxSize == (unsigned long)-1 ? nullptr : rentJpegBuffer(maxSize, &dest.capacity);
+    dest.size = 0;
+    if (!dest.data) {
+        return nullptr;
+    }
+
+    // TurboJPEG reads planar frames as they are; semi-planar chroma and the
+    // settings it lacks need the raw-data path
+    const long long start = statsClock();
+    tjhandle tj = image.layout != YUV_PLANAR || encodeNeedsLibjpeg(params) ? nullptr : threadCompressor();
+    bool ok = false;
+    if (tj) {
+        int quality = params.quality;
+        if (quality < 1) quality = 1;
+        if (quality > 100) quality = 100;
+
+        const unsigned char* planes[3] = { image.planes[0], image.planes[1], image.planes[2] };
+        unsigned char* jpegBuf = dest.data;
+        unsigned long size = maxSize;
+        ok = tjCompressFromYUVPlanes(tj, planes, image.width, image.strides, image.height,
+                                     subsampling, &jpegBuf, &size, quality,
+                                     encodeTjFlags(params)) == 0;
+        dest.size = size;
+    }
+    if (!ok) {
+        ok = compressRaw(image, params, &dest);
+    }
+    recordStage(STATS_CODING, start, (long long)image.width * image.height);  // luma samples
+
+    if (!ok) {
+        recordError();
+        releaseJpegBuffer(dest.data);
+        return nullptr;
+    }
+    *jpegSize = dest.size;
+    return dest.data;
+}
+
+YuvBand* startYuvCompress(jpeg_compress_struct* cinfo, int width, int height, int subsampling,
+                          const EncodeParams& params) {
+    setupYuvCompressor(cinfo, width, height, subsampling, params);
+    jpeg_start_compress(cinfo, TRUE);
+
+    // The component geometry is known once compression has started
+    YuvBand* band = (YuvBand*)(*cinfo->mem->alloc_small)((j_common_ptr)cinfo, JPOOL_IMAGE,
+                                                          sizeof(YuvBand));
+    for (int c = 0; c < cinfo->num_components; c++) {
+        const jpeg_component_info& comp = cinfo->comp_info[c];
+        band->rows[c] = (*cinfo->mem->alloc_sarray)((j_common_ptr)cinfo, JPOOL_IMAGE,
+                                                    comp.width_in_blocks * DCTSIZE,
+                                                    (JDIMENSION)(comp.v_samp_factor * DCTSIZE));
+    }
+    return band;
+}
+
+void writeYuvRows(jpeg_compress_struct* cinfo, YuvBand* band, const YuvImage& rows) {
+    const int mcuRows = cinfo->max_v_samp_factor * DCTSIZE;
+    const int numMcus = (rows.height + mcuRows - 1) / mcuRows;
+
+    for (int mcu = 0; mcu < numMcus; mcu++) {
+        for (int c = 0; c < cinfo->num_components; c++) {
+            const jpeg_component_info& comp = cinfo->comp_info[c];
+            const int bandRows = comp.v_samp_factor * DCTSIZE;
+            const int width = (int)comp.downsampled_width;
+            const int paddedWidth = (int)comp.width_in_blocks * DCTSIZE;
+            // Rows of this component in the band of luma rows passed in
+            const int height = (int)(((long long)rows.height * comp.v_samp_factor +
+                                      cinfo->max_v_samp_factor - 1) / cinfo->max_v_samp_factor);
+
+            // Interleaved chroma: U of NV12 and V of NV21 come first in each pair
+            const bool interleaved = rows.layout != YUV_PLANAR && c > 0;
+            const int plane = interleaved ? 1 : c;
+            const int offset = interleaved ? ((c == 1) == (rows.layout == YUV_NV12) ? 0 : 1) : 0;
+            const int step = interleaved ? 2 : 1;
+            const size_t stride = rows.strides[plane] > 0 ? (size_t)rows.strides[plane]
+                                                          : (size_t)width * step;
+
+            for (int i = 0; i < bandRows; i++) {
+                // Past the last row, repeat it (only at the bottom of the image)
+                int y = mcu * bandRows + i;
+                if (y >= height) y = height - 1;
+                const unsigned char* src = rows.planes[plane] + (size_t)y * stride + offset;
+                JSAMPROW dst = band->rows[c][i];
+                if (step == 1) {
+                    std::memcpy(dst, src, (size_t)width);
+                } else {
+                    for (int x = 0; x < width; x++) {
+                        dst[x] = src[2 * x];
+                    }
+                }
+                std::memset(dst + width, dst[width - 1], (size_t)(paddedWidth - width));
+            }
+        }
+        jpeg_write_raw_data(cinfo, band->rows, (JDIMENSION)mcuRows);
+    }
+}
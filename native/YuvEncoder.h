@@ -0,0 +1,82 @@
+/**
+ * JPEG encoding straight from YUV frames (camera and video decoder output)
+ *
+ * The planes are compressed as the JPEG's Y, Cb and Cr components with no
+ * colour conversion, reading 1.5 bytes per pixel at 4:2:0 instead of 3 for
+ * BGR. Planar frames go through tjCompressFromYUVPlanes. Semi-planar
+ * NV12 / NV21 frames, and settings TurboJPEG lacks, go through libjpeg's
+ * raw-data interface one MCU row at a time; the stream encoder uses the
+ * same path for YUV row bands.
+ */
+
+#ifndef YUV_ENCODER_H
+#define YUV_ENCODER_H
+
+#include "EncodeParams.h"
+#include <cstddef>
+
+struct jpeg_compress_struct;
+
+enum YuvLayout {
+    YUV_PLANAR = 0,  // separate Y, U and V planes (I420 / YV12 when 4:2:0)
+    YUV_NV12 = 1,    // Y plane, then one plane of interleaved U,V pairs (4:2:0)
+    YUV_NV21 = 2     // Y plane, then one plane of interleaved V,U pairs (4:2:0)
+};
+
+/**
+ * One YUV frame, or a band of its rows. Plain C layout, also passed by JNA callers.
+ * Chroma planes are tjPlaneWidth x tjPlaneHeight samples (half the luma size,
+ * rounded up, at 4:2:0).
+ */
+struct YuvImage {
+    const unsigned char* planes[3];  // Y, U, V; semi-planar: Y, interleaved chroma, unused
+    int strides[3];                  // bytes between rows of each plane, 0 = packed
+    int width;
+    int height;
+    int layout;                      // YUV_*
+    int subsampling;                 // TJSAMP_* of planar input other than TJSAMP_441
+                                     // (TJSAMP_GRAY: Y only); semi-planar input is 4:2:0
+};
+
+/**
+ * false for missing planes, strides shorter than a row, or out-of-range values
+ */
+bool validYuvImage(const YuvImage& image);
+
+/**
+ * The image's chroma subsampling (TJSAMP_420 for semi-planar layouts)
+ */
+int yuvSubsampling(const YuvImage& image);
+
+/**
+ * Compress a whole frame. The JPEG keeps the planes' sampling, so
+ * params.subsampling is not used.
+ *
+ * @param jpegSize Receives the JPEG size
+ * @return JPEG in a buffer rented from JpegBufferPool (release it with
+ *         releaseJpegBuffer / FreeJPEGData), nullptr on failure
+ */
+unsigned char* encodeYuv(const YuvImage& image, const EncodeParams& params, size_t* jpegSize);
+
+/**
+ * Band buffers of a raw-data compression, allocated from the compressor's
+ * image pool and freed with it (jpeg_finish_compress / jpeg_abort_compress)
+ */
+struct YuvBand;
+
+/**
+ * Set up a created compressor (destination attached) for width x height
+ * YUV input and start it. May raise a libjpeg error.
+ */
+YuvBand* startYuvCompress(jpeg_compress_struct* cinfo, int width, int height, int subsampling,
+                          const EncodeParams& params);
+
+/**
+ * Compress rows.height rows (rows.width must be the image width, and the
+ * sampling the one started with). The band must begin on an MCU row and,
+ * unless it is the last one, cover whole MCU rows (tjMCUHeight). May raise
+ * a libjpeg error.
+ */
+void writeYuvRows(jpeg_compress_struct* cinfo, YuvBand* band, const YuvImage& rows);
+
+#endif // YUV_ENCODER_H
@@ -0,0 +1,1205 @@
+/**
+ * Native benchmark suite for the encoder library and the decoder core
+ *
+ * Runs every public entry point (JNA encode, batch, strip and tile encoders,
+ * YUV input, the stream encoder's memory and sink outputs, tile pyramids,
+ * lossless transforms and TurboJpegDecoder) on synthetic images from VGA up
+ * to 400 MP, across chroma subsamplings and thread counts. Results are printed as Google Benchmark style JSON, one
+ * entry per run with real time, MP/s, bytes per second, bytes allocated per
+ * iteration and the peak RSS of the run, so two builds can be compared with
+ * the usual tooling.
+ *
+ * Usage: EncoderBenchmark [--filter=SUBSTRING] [--max_mp=100] [--min_time=0.5]
+ *                         [--threads=1,8] [--out=FILE] [--list] [--verify]
+ *
+ * Inputs for one size are generated, benchmarked and dropped before the next
+ * size, so the 400 MP sweep (--max_mp=400) needs roughly 4 GB.
+ *
+ * --verify runs no benchmarks; it checks the output equivalences the fast
+ * paths promise, on small odd-sized images, and exits nonzero on a mismatch:
+ * strip-parallel encodes against a serial libjpeg encode with the same
+ * restart interval, decode_parallel against tjDecompress2 (row-aligned and
+ * unaligned restart intervals), and NV12/NV21 input against the same frame
+ * as planar I420.
+ */
+
+#include "../EncodeParams.h"
+#include "../JpegBufferPool.h"
+#include "../StripParallelEncoder.h"
+#include "../WorkerPool.h"
+#include "../YuvEncoder.h"
+#include "turbojpeg_decoder.h"
+#include "scratch_arena.h"
+#include <turbojpeg.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csetjmp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#elif defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+#include <jpeglib.h>  // after <cstdio>: the verifier encodes unaligned restart intervals itself
+
+// ==================== JNA API under test ====================
+// Same declarations a JNA binding maps (the structs live in the encoder sources)
+
+extern "C" {
+
+struct JPEGData {
+    unsigned char* data;
+    int size;
+};
+
+struct JPEGImage {
+    unsigned char* pixels;
+    int width;
+    int height;
+    int pitch;
+    int pixelFormat;
+};
+
+struct JPEGBatchParams {
+    int quality;
+    int numThreads;
+    int splitPixels;
+};
+
+struct TileJPEG {
+    unsigned char* data;
+    unsigned long size;
+    int tileX;
+    int tileY;
+};
+
+struct JpegTransformOp {
+    int op;
+    int options;
+    int x;
+    int y;
+    int width;
+    int height;
+};
+
+typedef int (*JpegWriteCallback)(const unsigned char* data, int size, void* userData);
+typedef int (*PyramidTileCallback)(int level, int column, int row, const unsigned char* data,
+                                   int size, void* userData);
+
+JPEGData EncodeJPEG(unsigned char* pixels, int width, int height, int quality, int pixelFormat);
+JPEGData EncodeJPEGWithParams(unsigned char* pixels, int width, int height, int pixelFormat,
+                              const EncodeParams* params);
+long long GetJPEGBufferSize(int width, int height);
+long long EncodeJPEGInto(unsigned char* pixels, int width, int height, int quality,
+                         int pixelFormat, unsigned char* outBuffer, long long outCapacity);
+JPEGData EncodeJPEGFromYUV(const YuvImage* image, int quality);
+int EncodeJPEGBatch(const JPEGImage* images, int count, const JPEGBatchParams* params,
+                    JPEGData* results);
+JPEGData EncodeParallelJPEG(const int* rgbData, int width, int height, int quality, int tileSize);
+TileJPEG* EncodeParallelTiles(const int* rgbData, int width, int height, int quality,
+                              int tileSize, int* numTiles);
+void FreeTileArray(TileJPEG* tiles, int numTiles);
+JPEGData TransformJPEG(const unsigned char* jpeg, int size, const JpegTransformOp* ops, int numOps);
+void FreeJPEGData(JPEGData* jpeg);
+
+void* CreateStreamEncoder(int width, int height, int quality, int pixelFormat);
+void* CreateStreamEncoderToSink(int width, int height, int quality, int pixelFormat,
+                                JpegWriteCallback writeCallback, void* userData);
+int WriteImageRows(void* encoderHandle, unsigned char* rowData, int rowCount);
+int WriteImageRowsInt(void* encoderHandle, int* rowData, int rowCount);
+int WriteYUVRows(void* encoderHandle, const YuvImage* rows);
+JPEGData FinalizeStreamEncoder(void* encoderHandle);
+long long FinalizeStreamEncoderToSink(void* encoderHandle);
+void DestroyStreamEncoder(void* encoderHandle);
+
+void* CreateTilePyramid(int width, int height, int tileSize, int overlap, int pixelFormat,
+                        const EncodeParams* params, int numThreads,
+                        PyramidTileCallback callback, void* userData);
+int WriteTilePyramidRows(void* pyramidHandle, unsigned char* rowData, int rowCount);
+long long FinishTilePyramid(void* pyramidHandle);
+void DestroyTilePyramid(void* pyramidHandle);
+
+} // extern "C"
+
+// ==================== Allocation counting ====================
+
+static std::atomic<long long> g_allocatedBytes(0);
+static std::atomic<long long> g_allocations(0);
+
+#if defined(__GLIBC__)
+// Interpose malloc so TurboJPEG's and libjpeg's buffers are counted as well
+// (operator new ends up here too)
+static const char* const ALLOC_COUNTER = "malloc";
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+
+void* malloc(size_t size) {
+    g_allocatedBytes.fetch_add((long long)size, std::memory_order_relaxed);
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    g_allocatedBytes.fetch_add((long long)(count * size), std::memory_order_relaxed);
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    g_allocatedBytes.fetch_add((long long)size, std::memory_order_relaxed);
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+}
+#else
+// Elsewhere only C++ allocations are seen
+static const char* const ALLOC_COUNTER = "operator new";
+
+void* operator new(size_t size) {
+    g_allocatedBytes.fetch_add((long long)size, std::memory_order_relaxed);
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    void* ptr = std::malloc(size ? size : 1);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+#endif
+
+namespace {
+
+// ==================== Process memory ====================
+
+// Peak resident set size in bytes, 0 if unknown
+long long peakRss() {
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))
+               ? (long long)counters.PeakWorkingSetSize : 0;
+#elif defined(__APPLE__)
+    struct rusage usage;
+    return getrusage(RUSAGE_SELF, &usage) == 0 ? (long long)usage.ru_maxrss : 0;
+#else
+    FILE* status = std::fopen("/proc/self/status", "r");
+    if (!status) {
+        return 0;
+    }
+    char line[256];
+    long long kb = 0;
+    while (std::fgets(line, sizeof(line), status)) {
+        if (std::sscanf(line, "VmHWM: %lld kB", &kb) == 1) {
+            break;
+        }
+    }
+    std::fclose(status);
+    return kb * 1024;
+#endif
+}
+
+// Restart the peak at the current RSS so each run reports its own (Linux only)
+bool resetPeakRss() {
+#if defined(__linux__)
+    FILE* refs = std::fopen("/proc/self/clear_refs", "w");
+    if (!refs) {
+        return false;
+    }
+    const bool ok = std::fputs("5", refs) >= 0;
+    return std::fclose(refs) == 0 && ok;
+#else
+    return false;
+#endif
+}
+
+// ==================== Synthetic inputs ====================
+
+struct ImageSize {
+    const char* name;
+    int width;
+    int height;
+};
+
+const ImageSize SIZES[] = {
+    { "VGA", 640, 480 },
+    { "FHD", 1920, 1080 },
+    { "4K", 3840, 2160 },
+    { "24MP", 6000, 4000 },
+    { "100MP", 12000, 8400 },
+    { "400MP", 20000, 20000 },
+};
+
+const int SUBSAMPLINGS[] = { TJSAMP_444, TJSAMP_422, TJSAMP_420 };
+
+const char* subsamplingName(int subsampling) {
+    switch (subsampling) {
+        case TJSAMP_444: return "444";
+        case TJSAMP_422: return "422";
+        case TJSAMP_420: return "420";
+        case TJSAMP_GRAY: return "gray";
+        default: return "other";
+    }
+}
+
+// Smooth gradients under fine noise, so the entropy coder sees photo-like
+// detail rather than flat blocks
+void fillBgr(unsigned char* pixels, int width, int height) {
+    parallelFor(height, 0, [&](int y) {
+        unsigned int seed = 2654435761u * (unsigned int)(y + 1);
+        unsigned char* row = pixels + (size_t)y * width * 3;
+        for (int x = 0; x < width; x++) {
+            seed = seed * 1664525u + 1013904223u;
+            const int noise = (int)(seed >> 28) - 8;
+            const int b = (int)((long long)x * 255 / width) + noise;
+            const int g = (int)((long long)y * 255 / height) + noise;
+            const int r = (int)((long long)(x + y) * 255 / (width + height)) + noise;
+            row[3 * x] = (unsigned char)std::min(255, std::max(0, b));
+            row[3 * x + 1] = (unsigned char)std::min(255, std::max(0, g));
+            row[3 * x + 2] = (unsigned char)std::min(255, std::max(0, r));
+        }
+    });
+}
+
+// One image size's inputs, each built on first use
+class Inputs {
+public:
+    Inputs(int width, int height) : width_(width), height_(height) {}
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    double megapixels() const { return (double)width_ * height_ / 1e6; }
+
+    unsigned char* bgr() {
+        if (bgr_.empty()) {
+            bgr_.resize((size_t)width_ * height_ * 3);
+            fillBgr(bgr_.data(), width_, height_);
+        }
+        return bgr_.data();
+    }
+
+    // TYPE_INT_RGB pixels (0xFFRRGGBB)
+    int* argb() {
+        if (argb_.empty()) {
+            const unsigned char* src = bgr();
+            argb_.resize((size_t)width_ * height_);
+            parallelFor(height_, 0, [&](int y) {
+                for (size_t i = (size_t)y * width_; i < (size_t)(y + 1) * width_; i++) {
+                    argb_[i] = (int)(0xFF000000u | (unsigned int)src[3 * i + 2] << 16 |
+                                     (unsigned int)src[3 * i + 1] << 8 | src[3 * i]);
+                }
+            });
+        }
+        return argb_.data();
+    }
+
+    // Planar YCbCr (BT.601 full range, as JPEG stores it)
+    YuvImage yuv(int subsampling) {
+        std::vector<unsigned char>& planes = yuv_[subsamplingIndex(subsampling)];
+        const int cw = tjPlaneWidth(1, width_, subsampling);
+        const int ch = tjPlaneHeight(1, height_, subsampling);
+        const size_t lumaSize = (size_t)width_ * height_;
+        const size_t chromaSize = (size_t)cw * ch;
+        if (planes.empty()) {
+            const unsigned char* src = bgr();
+            planes.resize(lumaSize + 2 * chromaSize);
+            unsigned char* yPlane = planes.data();
+            unsigned char* uPlane = yPlane + lumaSize;
+            unsigned char* vPlane = uPlane + chromaSize;
+            const int sx = (width_ + cw - 1) / cw;
+            const int sy = (height_ + ch - 1) / ch;
+            parallelFor(height_, 0, [&](int y) {
+                for (int x = 0; x < width_; x++) {
+                    const unsigned char* p = src + ((size_t)y * width_ + x) * 3;
+                    yPlane[(size_t)y * width_ + x] =
+                        (unsigned char)((19595 * p[2] + 38470 * p[1] + 7471 * p[0] + 32768) >> 16);
+                }
+            });
+            parallelFor(ch, 0, [&](int cy) {
+                for (int cx = 0; cx < cw; cx++) {
+                    const int x = std::min(cx * sx, width_ - 1);
+                    const int y = std::min(cy * sy, height_ - 1);
+                    const unsigned char* p = src + ((size_t)y * width_ + x) * 3;
+                    const int u = (-11059 * p[2] - 21709 * p[1] + 32768 * p[0]) / 65536 + 128;
+                    const int v = (32768 * p[2] - 27439 * p[1] - 5329 * p[0]) / 65536 + 128;
+                    uPlane[(size_t)cy * cw + cx] = (unsigned char)std::min(255, std::max(0, u));
+                    vPlane[(size_t)cy * cw + cx] = (unsigned char)std::min(255, std::max(0, v));
+                }
+            });
+        }
+        YuvImage image;
+        image.planes[0] = planes.data();
+        image.planes[1] = planes.data() + lumaSize;
+        image.planes[2] = planes.data() + lumaSize + chromaSize;
+        image.strides[0] = 0;
+        image.strides[1] = 0;
+        image.strides[2] = 0;
+        image.width = width_;
+        image.height = height_;
+        image.layout = YUV_PLANAR;
+        image.subsampling = subsampling;
+        return image;
+    }
+
+    // Semi-planar 4:2:0 made from the planar frame
+    YuvImage nv12() {
+        const YuvImage planar = yuv(TJSAMP_420);
+        const size_t lumaSize = (size_t)width_ * height_;
+        const size_t chromaSize = (size_t)tjPlaneWidth(1, width_, TJSAMP_420) *
+                                  tjPlaneHeight(1, height_, TJSAMP_420);
+        if (nv12_.empty()) {
+            nv12_.resize(lumaSize + 2 * chromaSize);
+            std::memcpy(nv12_.data(), planar.planes[0], lumaSize);
+            for (size_t i = 0; i < chromaSize; i++) {
+                nv12_[lumaSize + 2 * i] = planar.planes[1][i];
+                nv12_[lumaSize + 2 * i + 1] = planar.planes[2][i];
+            }
+        }
+        YuvImage image = planar;
+        image.planes[0] = nv12_.data();
+        image.planes[1] = nv12_.data() + lumaSize;
+        image.planes[2] = nullptr;
+        image.layout = YUV_NV12;
+        image.subsampling = TJSAMP_420;
+        return image;
+    }
+
+    // Quality 90 JPEG with a restart marker every MCU row, so the parallel
+    // decoder can split it
+    const std::vector<unsigned char>& jpeg(int subsampling) {
+        std::vector<unsigned char>& jpeg = jpeg_[subsamplingIndex(subsampling)];
+        if (jpeg.empty()) {
+            EncodeParams params = defaultEncodeParams(90);
+            params.subsampling = subsampling;
+            params.restartRows = 1;
+            size_t size = 0;
+            unsigned char* data = encodeStripsParallel(bgr(), width_, height_, 0, TJPF_BGR, params,
+                                                       0, 0, &size);
+            if (data) {
+                jpeg.assign(data, data + size);
+                releaseJpegBuffer(data);
+            }
+        }
+        return jpeg;
+    }
+
+private:
+    static int subsamplingIndex(int subsampling) {
+        return subsampling == TJSAMP_444 ? 0 : subsampling == TJSAMP_422 ? 1 : 2;
+    }
+
+    int width_;
+    int height_;
+    std::vector<unsigned char> bgr_;
+    std::vector<int> argb_;
+    std::vector<unsigned char> yuv_[3];
+    std::vector<unsigned char> nv12_;
+    std::vector<unsigned char> jpeg_[3];
+};
+
+// ==================== Runner ====================
+
+struct Options {
+    std::string filter;
+    double maxMegapixels;
+    double minTime;
+    std::vector<int> threads;
+    std::string out;
+    bool list;
+    bool verify;
+};
+
+// Bytes one iteration read and produced
+struct Counters {
+    long long inputBytes;   // only counted by runs whose input size is not fixed
+    long long outputBytes;
+};
+
+/**
+ * One benchmark: run() performs a single iteration and returns false on failure
+ */
+struct Benchmark {
+    std::string name;
+    double megapixels;   // pixels processed per iteration
+    double inputBytes;   // bytes consumed per iteration, 0 = as counted by run()
+    std::function<bool(Counters* counters)> run;
+};
+
+struct Result {
+    std::string name;
+    long long iterations;
+    double realTimeMs;     // per iteration
+    double megapixels;
+    double inputBytes;
+    long long outputBytes; // per iteration
+    long long allocatedBytes;
+    long long allocations;
+    long long peakRss;
+    bool failed;
+};
+
+Result runBenchmark(const Benchmark& benchmark, const Options& options) {
+    Result result;
+    result.name = benchmark.name;
+    result.iterations = 0;
+    result.realTimeMs = 0;
+    result.megapixels = benchmark.megapixels;
+    result.inputBytes = benchmark.inputBytes;
+    result.outputBytes = 0;
+    result.allocatedBytes = 0;
+    result.allocations = 0;
+    result.failed = false;
+
+    resetPeakRss();
+
+    // Warm-up: fills the buffer pool, the thread-local handles and the page tables
+    Counters counters = { 0, 0 };
+    if (!benchmark.run(&counters)) {
+        result.failed = true;
+        result.peakRss = peakRss();
+        return result;
+    }
+
+    typedef std::chrono::steady_clock Clock;
+    const long long bytesBefore = g_allocatedBytes.load();
+    const long long countBefore = g_allocations.load();
+    const Clock::time_point start = Clock::now();
+    double elapsed = 0;
+    counters.inputBytes = 0;
+    counters.outputBytes = 0;
+    do {
+        if (!benchmark.run(&counters)) {
+            result.failed = true;
+            break;
+        }
+        result.iterations++;
+        elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    } while (elapsed < options.minTime);
+
+    if (result.iterations > 0) {
+        result.realTimeMs = elapsed * 1000.0 / result.iterations;
+        result.outputBytes = counters.outputBytes / result.iterations;
+        if (result.inputBytes == 0) {
+            result.inputBytes = (double)counters.inputBytes / result.iterations;
+        }
+        result.allocatedBytes = (g_allocatedBytes.load() - bytesBefore) / result.iterations;
+        result.allocations = (g_allocations.load() - countBefore) / result.iterations;
+    }
+    result.peakRss = peakRss();
+    return result;
+}
+
+void writeJson(FILE* out, const std::vector<Result>& results, const Options& options) {
+    char date[64];
+    const std::time_t now = std::time(nullptr);
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", std::localtime(&now));
+
+    std::fprintf(out, "{\n  \"context\": {\n");
+    std::fprintf(out, "    \"date\": \"%s\",\n", date);
+    std::fprintf(out, "    \"executable\": \"EncoderBenchmark\",\n");
+    std::fprintf(out, "    \"num_cpus\": %u,\n", std::thread::hardware_concurrency());
+    std::fprintf(out, "    \"worker_threads\": %d,\n", workerThreadCount());
+#ifdef NDEBUG
+    std::fprintf(out, "    \"library_build_type\": \"release\",\n");
+#else
+    std::fprintf(out, "    \"library_build_type\": \"debug\",\n");
+#endif
+    std::fprintf(out, "    \"allocation_counter\": \"%s\",\n", ALLOC_COUNTER);
+    std::fprintf(out, "    \"min_time\": %.3f\n", options.minTime);
+    std::fprintf(out, "  },\n  \"benchmarks\": [");
+
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        const double seconds = r.realTimeMs / 1000.0;
+        std::fprintf(out, "%s\n    {\n", i ? "," : "");
+        std::fprintf(out, "      \"name\": \"%s\",\n", r.name.c_str());
+        std::fprintf(out, "      \"run_name\": \"%s\",\n", r.name.c_str());
+        std::fprintf(out, "      \"run_type\": \"iteration\",\n");
+        if (r.failed) {
+            std::fprintf(out, "      \"error_occurred\": true,\n");
+            std::fprintf(out, "      \"error_message\": \"entry point failed\",\n");
+        }
+        std::fprintf(out, "      \"iterations\": %lld,\n", r.iterations);
+        std::fprintf(out, "      \"real_time\": %.6f,\n", r.realTimeMs);
+        std::fprintf(out, "      \"time_unit\": \"ms\",\n");
+        std::fprintf(out, "      \"megapixels\": %.3f,\n", r.megapixels);
+        std::fprintf(out, "      \"mp_per_second\": %.3f,\n", seconds > 0 ? r.megapixels / seconds : 0.0);
+        std::fprintf(out, "      \"bytes_per_second\": %.0f,\n", seconds > 0 ? r.inputBytes / seconds : 0.0);
+        std::fprintf(out, "      \"output_bytes\": %lld,\n", r.outputBytes);
+        std::fprintf(out, "      \"allocated_bytes\": %lld,\n", r.allocatedBytes);
+        std::fprintf(out, "      \"allocations\": %lld,\n", r.allocations);
+        std::fprintf(out, "      \"peak_rss_bytes\": %lld\n", r.peakRss);
+        std::fprintf(out, "    }");
+    }
+    std::fprintf(out, "\n  ]\n}\n");
+}
+
+// ==================== Benchmarks ====================
+
+int countBytes(const unsigned char*, int size, void* userData) {
+    *(long long*)userData += size;
+    return 0;
+}
+
+int countTileBytes(int, int, int, const unsigned char*, int size, void* userData) {
+    *(long long*)userData += size;
+    return 0;
+}
+
+// Hand a JPEGData's size to the counter and free it
+bool consume(JPEGData& jpeg, Counters* counters) {
+    if (!jpeg.data) {
+        return false;
+    }
+    counters->outputBytes += jpeg.size;
+    FreeJPEGData(&jpeg);
+    return true;
+}
+
+// Rows handed to the stream encoder and the pyramid per call
+const int STREAM_BATCH_ROWS = 64;
+
+// Every benchmark for one size, in run order (inputs are built lazily, when first run)
+std::vector<Benchmark> sizeBenchmarks(const ImageSize& size, Inputs& in, TurboJpegDecoder& decoder,
+                                      const Options& options) {
+    std::vector<Benchmark> list;
+    const int w = size.width;
+    const int h = size.height;
+    const double mp = in.megapixels();
+    const double pixels = (double)w * h;
+    const std::string suffix = std::string("/") + size.name;
+
+    // Single-image encoders
+    list.push_back({ "encode/EncodeJPEG" + suffix, mp, pixels * 3, [&in, w, h](Counters* c) {
+        JPEGData jpeg = EncodeJPEG(in.bgr(), w, h, 90, 1);
+        return consume(jpeg, c);
+    } });
+    for (int subsampling : SUBSAMPLINGS) {
+        list.push_back({ "encode/EncodeJPEGWithParams" + suffix + "/" + subsamplingName(subsampling),
+                         mp, pixels * 3, [&in, w, h, subsampling](Counters* c) {
+            EncodeParams params = defaultEncodeParams(90);
+            params.subsampling = subsampling;
+            JPEGData jpeg = EncodeJPEGWithParams(in.bgr(), w, h, 1, &params);
+            return consume(jpeg, c);
+        } });
+    }
+    list.push_back({ "encode/EncodeJPEGWithParams" + suffix + "/420/optimize", mp, pixels * 3,
+                     [&in, w, h](Counters* c) {
+        EncodeParams params = defaultEncodeParams(90);
+        params.optimizeCoding = 1;  // libjpeg path
+        JPEGData jpeg = EncodeJPEGWithParams(in.bgr(), w, h, 1, &params);
+        return consume(jpeg, c);
+    } });
+    {
+        std::shared_ptr<std::vector<unsigned char> > buffer(new std::vector<unsigned char>());
+        list.push_back({ "encode/EncodeJPEGInto" + suffix, mp, pixels * 3, [&in, w, h, buffer](Counters* c) {
+            buffer->resize((size_t)GetJPEGBufferSize(w, h));
+            const long long size = EncodeJPEGInto(in.bgr(), w, h, 90, 1, buffer->data(),
+                                                  (long long)buffer->size());
+            c->outputBytes += size;
+            return size > 0;
+        } });
+    }
+    for (int subsampling : SUBSAMPLINGS) {
+        const double yuvBytes = pixels + 2.0 * tjPlaneWidth(1, w, subsampling) *
+                                         tjPlaneHeight(1, h, subsampling);
+        list.push_back({ "encode/EncodeJPEGFromYUV" + suffix + "/" + subsamplingName(subsampling),
+                         mp, yuvBytes, [&in, subsampling](Counters* c) {
+            const YuvImage image = in.yuv(subsampling);
+            JPEGData jpeg = EncodeJPEGFromYUV(&image, 90);
+            return consume(jpeg, c);
+        } });
+    }
+    list.push_back({ "encode/EncodeJPEGFromYUV" + suffix + "/NV12", mp, pixels * 1.5,
+                     [&in](Counters* c) {
+        const YuvImage image = in.nv12();
+        JPEGData jpeg = EncodeJPEGFromYUV(&image, 90);
+        return consume(jpeg, c);
+    } });
+
+    // Parallel encoders
+    for (int threads : options.threads) {
+        const std::string t = "/threads:" + std::to_string(threads);
+        for (int subsampling : SUBSAMPLINGS) {
+            list.push_back({ "encode/Strips" + suffix + "/" + subsamplingName(subsampling) + t,
+                             mp, pixels * 3, [&in, w, h, subsampling, threads](Counters* c) {
+                EncodeParams params = defaultEncodeParams(90);
+                params.subsampling = subsampling;
+                size_t size = 0;
+                unsigned char* jpeg = encodeStripsParallel(in.bgr(), w, h, 0, TJPF_BGR, params, 0,
+                                                           threads, &size);
+                c->outputBytes += (long long)size;
+                releaseJpegBuffer(jpeg);
+                return jpeg != nullptr;
+            } });
+        }
+        list.push_back({ "encode/EncodeJPEGBatch" + suffix + "/x8" + t, mp * 8, pixels * 3 * 8,
+                         [&in, w, h, threads](Counters* c) {
+            JPEGImage images[8];
+            for (int i = 0; i < 8; i++) {
+                images[i].pixels = in.bgr();
+                images[i].width = w;
+                images[i].height = h;
+                images[i].pitch = 0;
+                images[i].pixelFormat = 1;
+            }
+            JPEGBatchParams params = { 90, threads, 0 };
+            JPEGData results[8];
+            const int encoded = EncodeJPEGBatch(images, 8, &params, results);
+            for (int i = 0; i < 8; i++) {
+                if (results[i].data) {
+                    consume(results[i], c);
+                }
+            }
+            return encoded == 8;
+        } });
+        list.push_back({ "pyramid/CreateTilePyramid" + suffix + t, mp, pixels * 3,
+                         [&in, w, h, threads](Counters* c) {
+            void* pyramid = CreateTilePyramid(w, h, 254, 1, 1, nullptr, threads, countTileBytes, &c->outputBytes);
+            bool ok = pyramid != nullptr;
+            for (int y = 0; ok && y < h; y += STREAM_BATCH_ROWS) {
+                ok = WriteTilePyramidRows(pyramid, in.bgr() + (size_t)y * w * 3,
+                                          std::min(STREAM_BATCH_ROWS, h - y)) > 0;
+            }
+            ok = ok && FinishTilePyramid(pyramid) > 0;
+            DestroyTilePyramid(pyramid);
+            return ok;
+        } });
+    }
+    list.push_back({ "encode/EncodeParallelJPEG" + suffix, mp, pixels * 4, [&in, w, h](Counters* c) {
+        JPEGData jpeg = EncodeParallelJPEG(in.argb(), w, h, 90, 0);
+        return consume(jpeg, c);
+    } });
+    list.push_back({ "encode/EncodeParallelTiles" + suffix, mp, pixels * 4, [&in, w, h](Counters* c) {
+        int numTiles = 0;
+        TileJPEG* tiles = EncodeParallelTiles(in.argb(), w, h, 90, 1024, &numTiles);
+        if (!tiles) {
+            return false;
+        }
+        bool ok = true;
+        for (int i = 0; i < numTiles; i++) {
+            ok = ok && tiles[i].data;
+            c->outputBytes += (long long)tiles[i].size;
+        }
+        FreeTileArray(tiles, numTiles);
+        return ok;
+    } });
+
+    // Stream encoder: memory and sink output, byte, int and YUV rows
+    list.push_back({ "stream/memory/bytes" + suffix, mp, pixels * 3, [&in, w, h](Counters* c) {
+        void* encoder = CreateStreamEncoder(w, h, 90, 1);
+        bool ok = encoder != nullptr;
+        for (int y = 0; ok && y < h; y += STREAM_BATCH_ROWS) {
+            ok = WriteImageRows(encoder, in.bgr() + (size_t)y * w * 3,
+                                std::min(STREAM_BATCH_ROWS, h - y)) > 0;
+        }
+        if (ok) {
+            JPEGData jpeg = FinalizeStreamEncoder(encoder);
+            ok = consume(jpeg, c);
+        }
+        DestroyStreamEncoder(encoder);
+        return ok;
+    } });
+    list.push_back({ "stream/sink/bytes" + suffix, mp, pixels * 3, [&in, w, h](Counters* c) {
+        void* encoder = CreateStreamEncoderToSink(w, h, 90, 1, countBytes, &c->outputBytes);
+        bool ok = encoder != nullptr;
+        for (int y = 0; ok && y < h; y += STREAM_BATCH_ROWS) {
+            ok = WriteImageRows(encoder, in.bgr() + (size_t)y * w * 3,
+                                std::min(STREAM_BATCH_ROWS, h - y)) > 0;
+        }
+        ok = ok && FinalizeStreamEncoderToSink(encoder) > 0;
+        DestroyStreamEncoder(encoder);
+        return ok;
+    } });
+    list.push_back({ "stream/sink/int" + suffix, mp, pixels * 4, [&in, w, h](Counters* c) {
+        void* encoder = CreateStreamEncoderToSink(w, h, 90, 1, countBytes, &c->outputBytes);
+        bool ok = encoder != nullptr;
+        for (int y = 0; ok && y < h; y += STREAM_BATCH_ROWS) {
+            ok = WriteImageRowsInt(encoder, in.argb() + (size_t)y * w,
+                                   std::min(STREAM_BATCH_ROWS, h - y)) > 0;
+        }
+        ok = ok && FinalizeStreamEncoderToSink(encoder) > 0;
+        DestroyStreamEncoder(encoder);
+        return ok;
+    } });
+    list.push_back({ "stream/sink/yuv420" + suffix, mp, pixels * 1.5, [&in, w, h](Counters* c) {
+        const YuvImage frame = in.yuv(TJSAMP_420);
+        const int cw = tjPlaneWidth(1, w, TJSAMP_420);
+        void* encoder = CreateStreamEncoderToSink(w, h, 90, 1, countBytes, &c->outputBytes);
+        bool ok = encoder != nullptr;
+        for (int y = 0; ok && y < h; y += STREAM_BATCH_ROWS) {
+            YuvImage band = frame;
+            band.planes[0] += (size_t)y * w;
+            band.planes[1] += (size_t)(y / 2) * cw;
+            band.planes[2] += (size_t)(y / 2) * cw;
+            band.height = std::min(STREAM_BATCH_ROWS, h - y);
+            ok = WriteYUVRows(encoder, &band) > 0;
+        }
+        ok = ok && FinalizeStreamEncoderToSink(encoder) > 0;
+        DestroyStreamEncoder(encoder);
+        return ok;
+    } });
+
+    // Lossless transform
+    list.push_back({ "transform/TransformJPEG/rot90" + suffix, mp, 0, [&in](Counters* c) {
+        const std::vector<unsigned char>& source = in.jpeg(TJSAMP_420);
+        c->inputBytes += (long long)source.size();
+        JpegTransformOp op = { TJXOP_ROT90, TJXOPT_TRIM, 0, 0, 0, 0 };
+        JPEGData jpeg = TransformJPEG(source.data(), (int)source.size(), &op, 1);
+        return consume(jpeg, c);
+    } });
+
+    // Decoder core
+    {
+        std::shared_ptr<std::vector<uint8_t> > buffer(new std::vector<uint8_t>());
+        TurboJpegDecoder* dec = &decoder;
+        for (int subsampling : SUBSAMPLINGS) {
+            list.push_back({ "decode/decode_to_buffer" + suffix + "/" + subsamplingName(subsampling),
+                             mp, 0, [&in, dec, buffer, subsampling](Counters* c) {
+                const std::vector<unsigned char>& jpeg = in.jpeg(subsampling);
+                c->inputBytes += (long long)jpeg.size();
+                buffer->resize((size_t)in.width() * in.height() * 3);
+                int width = 0, height = 0, channels = 0;
+                const bool ok = dec->decode_to_buffer(jpeg.data(), jpeg.size(), buffer->data(),
+                                                      buffer->size(), 0, width, height, channels);
+                c->outputBytes += (long long)buffer->size();
+                return ok;
+            } });
+        }
+        for (int threads : options.threads) {
+            list.push_back({ "decode/decode_parallel" + suffix + "/420/threads:" + std::to_string(threads),
+                             mp, 0, [&in, dec, buffer, threads](Counters* c) {
+                const std::vector<unsigned char>& jpeg = in.jpeg(TJSAMP_420);
+                c->inputBytes += (long long)jpeg.size();
+                buffer->resize((size_t)in.width() * in.height() * 3);
+                int width = 0, height = 0, channels = 0, strips = 0;
+                const bool ok = dec->decode_parallel(jpeg.data(), jpeg.size(), buffer->data(),
+                                                     buffer->size(), 0, threads,
+                                                     width, height, channels, strips);
+                c->outputBytes += (long long)buffer->size();
+                return ok;
+            } });
+        }
+        list.push_back({ "decode/decode_scaled_to_buffer/quarter" + suffix + "/420", mp, 0,
+                         [&in, dec, buffer, w, h](Counters* c) {
+            const std::vector<unsigned char>& jpeg = in.jpeg(TJSAMP_420);
+            c->inputBytes += (long long)jpeg.size();
+            buffer->resize((size_t)in.width() * in.height() * 3);
+            int width = 0, height = 0, channels = 0;
+            const bool ok = dec->decode_scaled_to_buffer(jpeg.data(), jpeg.size(), w / 4, h / 4,
+                                                         buffer->data(), buffer->size(), 0,
+                                                         width, height, channels);
+            c->outputBytes += (long long)width * height * channels;
+            return ok;
+        } });
+        const int rw = std::min(w, 1024);
+        const int rh = std::min(h, 1024);
+        list.push_back({ "decode/decode_region_to_buffer/1024" + suffix + "/420",
+                         (double)rw * rh / 1e6, 0, [&in, dec, buffer, w, h, rw, rh](Counters* c) {
+            const std::vector<unsigned char>& jpeg = in.jpeg(TJSAMP_420);
+            c->inputBytes += (long long)jpeg.size();
+            buffer->resize((size_t)rw * rh * 3);
+            int channels = 0;
+            const bool ok = dec->decode_region_to_buffer(jpeg.data(), jpeg.size(), (w - rw) / 2,
+                                                         (h - rh) / 2, rw, rh, buffer->data(),
+                                                         buffer->size(), 0, channels);
+            c->outputBytes += (long long)rw * rh * channels;
+            return ok;
+        } });
+        list.push_back({ "decode/decode_yuv" + suffix + "/420", mp, 0, [&in, dec](Counters* c) {
+            const std::vector<unsigned char>& jpeg = in.jpeg(TJSAMP_420);
+            c->inputBytes += (long long)jpeg.size();
+            ArenaBlock* block = nullptr;
+            YuvPlanes planes;
+            const bool ok = dec->decode_yuv(jpeg.data(), jpeg.size(), block, planes);
+            if (ok) {
+                c->outputBytes += (long long)(planes.offset[planes.num_planes - 1] +
+                                    (size_t)planes.width[planes.num_planes - 1] *
+                                    planes.height[planes.num_planes - 1]);
+                ArenaBlock::release(block);
+            }
+            return ok;
+        } });
+    }
+
+    return list;
+}
+
+// ==================== Verification ====================
+
+// Odd sizes: partial MCUs on both edges, single-row and single-column images
+const ImageSize VERIFY_SIZES[] = {
+    { "1x1", 1, 1 },
+    { "7x5", 7, 5 },
+    { "33x17", 33, 17 },
+    { "250x131", 250, 131 },
+    { "641x479", 641, 479 },
+    { "1023x263", 1023, 263 },
+};
+
+const int VERIFY_SUBSAMPLINGS[] = { TJSAMP_444, TJSAMP_422, TJSAMP_420, TJSAMP_440, TJSAMP_GRAY };
+
+const char* verifySubsamplingName(int subsampling) {
+    return subsampling == TJSAMP_440 ? "440" : subsamplingName(subsampling);
+}
+
+class Verifier {
+public:
+    Verifier() : checks_(0), failures_(0) {}
+
+    void expect(bool ok, const std::string& what) {
+        checks_++;
+        if (!ok) {
+            failures_++;
+        }
+        std::fprintf(stderr, "%-72s %s\n", what.c_str(), ok ? "ok" : "FAILED");
+    }
+
+    int checks() const { return checks_; }
+    int failures() const { return failures_; }
+
+private:
+    int checks_;
+    int failures_;
+};
+
+// Copy a pooled JPEG into a vector and return the buffer; empty on failure
+std::vector<unsigned char> takeJpeg(unsigned char* data, size_t size) {
+    std::vector<unsigned char> jpeg;
+    if (data) {
+        jpeg.assign(data, data + size);
+        releaseJpegBuffer(data);
+    }
+    return jpeg;
+}
+
+// The encoders under test, each returning its JPEG as a vector (empty on failure)
+std::vector<unsigned char> serialJpeg(const unsigned char* pixels, int width, int height,
+                                      int pixelFormat, const EncodeParams& params) {
+    size_t size = 0;
+    unsigned char* data = encodeWithParams(pixels, width, height, 0, pixelFormat, params,
+                                           nullptr, 0, &size);
+    return takeJpeg(data, size);
+}
+
+std::vector<unsigned char> stripJpeg(const unsigned char* pixels, int width, int height,
+                                     int pixelFormat, const EncodeParams& params, int stripRows,
+                                     int numThreads) {
+    size_t size = 0;
+    unsigned char* data = encodeStripsParallel(pixels, width, height, 0, pixelFormat, params,
+                                               stripRows, numThreads, &size);
+    return takeJpeg(data, size);
+}
+
+std::vector<unsigned char> yuvJpeg(const YuvImage& image, const EncodeParams& params) {
+    size_t size = 0;
+    unsigned char* data = encodeYuv(image, params, &size);
+    return takeJpeg(data, size);
+}
+
+struct VerifyErrorManager {
+    jpeg_error_mgr pub;
+    jmp_buf jump;
+};
+
+void verifyErrorExit(j_common_ptr cinfo) {
+    longjmp(reinterpret_cast<VerifyErrorManager*>(cinfo->err)->jump, 1);
+}
+
+// Serial libjpeg encode with a restart marker every intervalMcus MCUs, which
+// need not line up with MCU rows (EncodeParams only expresses whole rows).
+// Only POD state lives here: longjmp skips destructors.
+// @return tjFree-compatible (malloc) buffer, nullptr on failure
+unsigned char* encodeRestartMcus(const unsigned char* bgr, int width, int height, int subsampling,
+                                 unsigned int intervalMcus, unsigned long* size) {
+    jpeg_compress_struct cinfo;
+    VerifyErrorManager err;
+    unsigned char* out = nullptr;
+    *size = 0;
+    cinfo.err = jpeg_std_error(&err.pub);
+    err.pub.error_exit = verifyErrorExit;
+    if (setjmp(err.jump)) {
+        jpeg_destroy_compress(&cinfo);
+        std::free(out);
+        return nullptr;
+    }
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &out, size);
+    EncodeParams params = defaultEncodeParams(90);
+    params.subsampling = subsampling;
+    setupCompressor(&cinfo, width, height, TJPF_BGR, params);
+    cinfo.restart_in_rows = 0;
+    cinfo.restart_interval = intervalMcus;
+    jpeg_start_compress(&cinfo, TRUE);
+    while (cinfo.next_scanline < cinfo.image_height) {
+        JSAMPROW row = const_cast<unsigned char*>(bgr) + (size_t)cinfo.next_scanline * width * 3;
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    return out;
+}
+
+// decode_parallel on numThreads threads against one tjDecompress2 call
+// @param needStrips Also fail if the parallel path was not taken
+void verifyParallelDecode(Verifier& verifier, TurboJpegDecoder& decoder, tjhandle tjDecoder,
+                          const std::vector<unsigned char>& jpeg, int numThreads, bool needStrips,
+                          const std::string& what) {
+    int width = 0, height = 0, subsampling = 0, colorspace = 0;
+    if (jpeg.empty() || !tjDecoder ||
+        tjDecompressHeader3(tjDecoder, jpeg.data(), (unsigned long)jpeg.size(),
+                            &width, &height, &subsampling, &colorspace) != 0) {
+        verifier.expect(false, what);
+        return;
+    }
+    const int channels = subsampling == TJSAMP_GRAY ? 1 : 3;
+    std::vector<unsigned char> expected((size_t)width * height * channels);
+    const bool serialOk =
+        tjDecompress2(tjDecoder, jpeg.data(), (unsigned long)jpeg.size(), expected.data(), width, 0,
+                      height, channels == 1 ? TJPF_GRAY : TJPF_BGR, TJFLAG_ACCURATEDCT) == 0;
+
+    std::vector<unsigned char> actual(expected.size(), 0xA5);
+    int outWidth = 0, outHeight = 0, outChannels = 0, strips = 0;
+    const bool parallelOk = decoder.decode_parallel(jpeg.data(), jpeg.size(), actual.data(),
+                                                    actual.size(), 0, numThreads,
+                                                    outWidth, outHeight, outChannels, strips);
+    verifier.expect(serialOk && parallelOk && outChannels == channels && actual == expected &&
+                        (!needStrips || strips > 1),
+                    what + " strips:" + std::to_string(strips));
+}
+
+int runVerify(TurboJpegDecoder& decoder) {
+    Verifier verifier;
+    tjhandle tjDecoder = tjInitDecompress();
+    decoder.set_pixel_format(PIXEL_FORMAT_AUTO);
+
+    for (const ImageSize& size : VERIFY_SIZES) {
+        Inputs in(size.width, size.height);
+        const int w = size.width;
+        const int h = size.height;
+        const std::string name = std::string("/") + size.name;
+
+        for (int subsampling : VERIFY_SUBSAMPLINGS) {
+            const std::string sub = std::string("/") + verifySubsamplingName(subsampling);
+            for (int restartRows : { 1, 3 }) {
+                EncodeParams params = defaultEncodeParams(90);
+                params.subsampling = subsampling;
+                params.restartRows = restartRows;
+                const int mcuHeight = encodeMcuHeight(params, TJPF_BGR);
+                const std::string rst = "/restart_rows:" + std::to_string(restartRows);
+
+                // Serial reference: restart markers force encodeWithParams onto compressLibjpeg
+                const std::vector<unsigned char> serial = serialJpeg(in.bgr(), w, h, TJPF_BGR, params);
+                verifier.expect(encodeNeedsLibjpeg(params) && !serial.empty(),
+                                "verify/serial_libjpeg" + name + sub + rst);
+
+                // One restart interval per strip, automatic strips, and strips of 5 intervals
+                for (int stripRows : { mcuHeight * restartRows, 0, 5 * mcuHeight * restartRows }) {
+                    for (int threads : { 1, 4 }) {
+                        const std::vector<unsigned char> strips =
+                            stripJpeg(in.bgr(), w, h, TJPF_BGR, params, stripRows, threads);
+                        verifier.expect(!strips.empty() && strips == serial,
+                                        "verify/encodeStripsParallel" + name + sub + rst +
+                                        "/strip_rows:" + std::to_string(stripRows) +
+                                        "/threads:" + std::to_string(threads));
+                    }
+                }
+
+                // The parallel decoder must split whenever there are two restart rows
+                const bool splittable = (h + mcuHeight - 1) / mcuHeight > restartRows;
+                verifyParallelDecode(verifier, decoder, tjDecoder, serial, 4, splittable,
+                                     "verify/decode_parallel" + name + sub + rst);
+            }
+
+            // Intervals that do not start MCU rows: only some boundaries are usable
+            for (unsigned int intervalMcus : { 3u, 7u }) {
+                unsigned long jpegSize = 0;
+                unsigned char* data = encodeRestartMcus(in.bgr(), w, h, subsampling, intervalMcus,
+                                                        &jpegSize);
+                std::vector<unsigned char> jpeg(data, data + (data ? jpegSize : 0));
+                std::free(data);
+                verifyParallelDecode(verifier, decoder, tjDecoder, jpeg, 4, false,
+                                     "verify/decode_parallel" + name + sub + "/restart_mcus:" +
+                                     std::to_string(intervalMcus));
+            }
+        }
+
+        // Grayscale pixels in, as opposed to color pixels encoded as gray above
+        {
+            const YuvImage planar = in.yuv(TJSAMP_420);
+            EncodeParams params = defaultEncodeParams(90);
+            params.restartRows = 1;
+            const std::vector<unsigned char> serial = serialJpeg(planar.planes[0], w, h, TJPF_GRAY, params);
+            const std::vector<unsigned char> strips = stripJpeg(planar.planes[0], w, h, TJPF_GRAY,
+                                                                params, 0, 4);
+            verifier.expect(!serial.empty() && strips == serial,
+                            "verify/encodeStripsParallel" + name + "/gray_input/restart_rows:1");
+        }
+
+        // Semi-planar input against the same frame as planar I420, default
+        // settings (TurboJPEG planar path) and restart markers (both on libjpeg)
+        {
+            const YuvImage planar = in.yuv(TJSAMP_420);
+            const YuvImage nv12 = in.nv12();
+            const size_t chromaSize = (size_t)tjPlaneWidth(1, w, TJSAMP_420) *
+                                      tjPlaneHeight(1, h, TJSAMP_420);
+            std::vector<unsigned char> vu(2 * chromaSize);
+            for (size_t i = 0; i < chromaSize; i++) {
+                vu[2 * i] = planar.planes[2][i];
+                vu[2 * i + 1] = planar.planes[1][i];
+            }
+            YuvImage nv21 = nv12;
+            nv21.planes[1] = vu.data();
+            nv21.layout = YUV_NV21;
+
+            for (int restartRows : { 0, 1 }) {
+                EncodeParams params = defaultEncodeParams(90);
+                params.restartRows = restartRows;
+                const std::string rst = "/restart_rows:" + std::to_string(restartRows);
+                const std::vector<unsigned char> expected = yuvJpeg(planar, params);
+                const std::vector<unsigned char> fromNv12 = yuvJpeg(nv12, params);
+                const std::vector<unsigned char> fromNv21 = yuvJpeg(nv21, params);
+                verifier.expect(!expected.empty() && fromNv12 == expected,
+                                "verify/encodeYuv/nv12_vs_i420" + name + rst);
+                verifier.expect(!expected.empty() && fromNv21 == expected,
+                                "verify/encodeYuv/nv21_vs_i420" + name + rst);
+            }
+        }
+    }
+
+    if (tjDecoder) {
+        tjDestroy(tjDecoder);
+    }
+    std::fprintf(stderr, "%d checks, %d failed\n", verifier.checks(), verifier.failures());
+    return verifier.failures() == 0 ? 0 : 1;
+}
+
+bool parseThreads(const char* text, std::vector<int>& threads) {
+    threads.clear();
+    while (*text) {
+        char* end = nullptr;
+        const long value = std::strtol(text, &end, 10);
+        if (end == text || value <= 0 || value > 1024) {
+            return false;
+        }
+        threads.push_back((int)value);
+        text = *end == ',' ? end + 1 : end;
+        if (*end && *end != ',') {
+            return false;
+        }
+    }
+    return !threads.empty();
+}
+
+bool parseOptions(int argc, char** argv, Options& options) {
+    options.maxMegapixels = 100;
+    options.minTime = 0.5;
+    options.list = false;
+    options.verify = false;
+    const int cores = (int)std::max(1u, std::thread::hardware_concurrency());
+    options.threads.push_back(1);
+    if (cores > 1) {
+        options.threads.push_back(cores);
+    }
+
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        const size_t eq = arg.find('=');
+        const std::string key = arg.substr(0, eq);
+        const std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+        if (key == "--filter") {
+            options.filter = value;
+        } else if (key == "--max_mp") {
+            options.maxMegapixels = std::atof(value.c_str());
+        } else if (key == "--min_time") {
+            options.minTime = std::atof(value.c_str());
+        } else if (key == "--threads") {
+            if (!parseThreads(value.c_str(), options.threads)) {
+                return false;
+            }
+        } else if (key == "--out") {
+            options.out = value;
+        } else if (key == "--list") {
+            options.list = true;
+        } else if (key == "--verify") {
+            options.verify = true;
+        } else {
+            return false;
+        }
+    }
+    return options.maxMegapixels > 0 && options.minTime >= 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        std::fprintf(stderr,
+                     "Usage: %s [--filter=SUBSTRING] [--max_mp=100] [--min_time=0.5]\n"
+                     "          [--threads=1,N] [--out=FILE] [--list] [--verify]\n", argv[0]);
+        return 2;
+    }
+
+    TurboJpegDecoder decoder;
+    if (!decoder.init()) {
+        std::fprintf(stderr, "TurboJpegDecoder init failed: decode benchmarks will report errors\n");
+    }
+    if (options.verify) {
+        return runVerify(decoder);
+    }
+
+    std::vector<Result> results;
+    for (const ImageSize& size : SIZES) {
+        if ((double)size.width * size.height / 1e6 > options.maxMegapixels) {
+            continue;
+        }
+        Inputs inputs(size.width, size.height);
+        std::vector<Benchmark> benchmarks = sizeBenchmarks(size, inputs, decoder, options);
+        for (Benchmark& benchmark : benchmarks) {
+            if (!options.filter.empty() && benchmark.name.find(options.filter) == std::string::npos) {
+                continue;
+            }
+            if (options.list) {
+                std::printf("%s\n", benchmark.name.c_str());
+                continue;
+            }
+            Result result = runBenchmark(benchmark, options);
+            std::fprintf(stderr, "%-60s %10.3f ms %10.1f MP/s%s\n", result.name.c_str(),
+                         result.realTimeMs,
+                         result.realTimeMs > 0 ? result.megapixels * 1000.0 / result.realTimeMs : 0.0,
+                         result.failed ? "  FAILED" : "");
+            results.push_back(result);
+        }
+        trimJpegBufferPool();
+    }
+    if (options.list) {
+        return 0;
+    }
+
+    FILE* out = options.out.empty() ? stdout : std::fopen(options.out.c_str(), "w");
+    if (!out) {
+        std::fprintf(stderr, "Cannot write %s\n", options.out.c_str());
+        return 1;
+    }
+    writeJson(out, results, options);
+    if (out != stdout) {
+        std::fclose(out);
+    }
+    return 0;
+}
@@ -1,151 +1,1818 @@
 #include <pybind11/pybind11.h>
 #include <pybind11/numpy.h>
+#include <pybind11/stl.h>
 #include "turbojpeg_decoder.h"
+#include "turbojpeg_encoder.h"
+#include "jpeg_info_index.h"
+#include "mapped_file.h"
+#include "scratch_arena.h"
+#include "decoded_image_cache.h"
+#include "native/WorkerPool.h"
+#include "native/JpegTransform.h"
+#include "native/EncoderStats.h"
+#include <turbojpeg.h>
+#include <climits>
+#include <cstring>
 #include <stdexcept>
+#include <string>
 #include <vector>
 #include <memory>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <deque>
 
 namespace py = pybind11;
 
 // 线程安全的解码器池
+// 每个解码器同一时刻只借给一个线程（tjhandle 不能被多个线程共享），
+// 空闲解码器不足时按需创建，因此池的大小等于峰值并发数
 class DecoderPool {
 public:
-    DecoderPool(int pool_size = 4) : pool_size_(pool_size) {
+    DecoderPool(int pool_size = 4, PixelFormat pixel_format = PIXEL_FORMAT_AUTO)
+        : pixel_format_(pixel_format) {
         decoders_.reserve(pool_size);
         for (int i = 0; i < pool_size; ++i) {
-            auto decoder = std::make_unique<TurboJpegDecoder>();
-            if (!decoder->init()) {
-                throw std::runtime_error("Failed to initialize decoder in pool");
-            }
-            decoders_.push_back(std::move(decoder));
+            free_.push_back(create());
         }
     }
 
+    // 独占借出一个解码器，用完必须 release()
     TurboJpegDecoder* acquire() {
-        // 简单的轮询策略
-        int idx = current_index_.fetch_add(1) % pool_size_;
-        return decoders_[idx].get();
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (free_.empty()) {
+            return create();
+        }
+        TurboJpegDecoder* decoder = free_.back();
+        free_.pop_back();
+        return decoder;
+    }
+
+    void release(TurboJpegDecoder* decoder) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_.push_back(decoder);
     }
 
 private:
+    // 调用方需持有 mutex_（构造函数除外）
+    TurboJpegDecoder* create() {
+        auto decoder = std::make_unique<TurboJpegDecoder>();
+        if (!decoder->init()) {
+            throw std::runtime_error("Failed to initialize decoder in pool");
+        }
+        decoder->set_pixel_format(pixel_format_);
+        decoders_.push_back(std::move(decoder));
+        return decoders_.back().get();
+    }
+
+    PixelFormat pixel_format_;
     std::vector<std::unique_ptr<TurboJpegDecoder>> decoders_;
-    std::atomic<int> current_index_{0};
-    int pool_size_;
+    std::vector<TurboJpegDecoder*> free_;
+    std::mutex mutex_;
+};
+
+// RAII：作用域内独占一个池中的解码器
+class PooledDecoder {
+public:
+    explicit PooledDecoder(DecoderPool& pool) : pool_(pool), decoder_(pool.acquire()) {}
+    ~PooledDecoder() { pool_.release(decoder_); }
+
+    PooledDecoder(const PooledDecoder&) = delete;
+    PooledDecoder& operator=(const PooledDecoder&) = delete;
+
+    TurboJpegDecoder* operator->() const { return decoder_; }
+
+private:
+    DecoderPool& pool_;
+    TurboJpegDecoder* decoder_;
+};
+
+// 把解码器 arena 中的块包装成 numpy array（零拷贝）
+// array 被回收时块归还给 arena，供下一次解码复用
+static py::array_t<uint8_t> adopt_block(ArenaBlock* block, int width, int height, int channels) {
+    py::capsule owner(block, [](void* p) {
+        ArenaBlock::release(static_cast<ArenaBlock*>(p));
+    });
+
+    if (channels == 1) {
+        return py::array_t<uint8_t>(
+            { height, width },
+            { width * sizeof(uint8_t), sizeof(uint8_t) },
+            block->data, owner);
+    }
+    return py::array_t<uint8_t>(
+        { height, width, channels },
+        { width * channels * sizeof(uint8_t),
+          channels * sizeof(uint8_t),
+          sizeof(uint8_t) },
+        block->data, owner);
+}
+
+// 把 DecodedImageCache 中的图像包装成只读 numpy array（零拷贝）
+// array 持有一份引用，图像被逐出缓存后仍然有效，最后一个引用释放时内存归还给 arena
+static py::array_t<uint8_t> adopt_cached(std::shared_ptr<const CachedImage> image) {
+    const int width = image->width();
+    const int height = image->height();
+    const int channels = image->channels();
+    uint8_t* data = const_cast<uint8_t*>(image->data());
+    py::capsule owner(new std::shared_ptr<const CachedImage>(std::move(image)), [](void* p) {
+        delete static_cast<std::shared_ptr<const CachedImage>*>(p);
+    });
+
+    py::array_t<uint8_t> array = channels == 1
+        ? py::array_t<uint8_t>({ height, width }, { width * sizeof(uint8_t), sizeof(uint8_t) }, data, owner)
+        : py::array_t<uint8_t>({ height, width, channels },
+                               { width * channels * sizeof(uint8_t), channels * sizeof(uint8_t), sizeof(uint8_t) },
+                               data, owner);
+    array.attr("setflags")(py::arg("write") = false);  // 缓存内容被所有命中共享
+    return array;
+}
+
+// pixel_format 参数的字符串名
+static const struct {
+    const char* name;
+    PixelFormat format;
+} PIXEL_FORMAT_NAMES[] = {
+    { "auto", PIXEL_FORMAT_AUTO },
+    { "bgr", PIXEL_FORMAT_BGR },
+    { "rgb", PIXEL_FORMAT_RGB },
+    { "bgrx", PIXEL_FORMAT_BGRX },
+    { "rgbx", PIXEL_FORMAT_RGBX },
+    { "bgra", PIXEL_FORMAT_BGRA },
+    { "rgba", PIXEL_FORMAT_RGBA },
+    { "gray", PIXEL_FORMAT_GRAY },
+};
+
+static PixelFormat parse_pixel_format(const std::string& name) {
+    for (const auto& entry : PIXEL_FORMAT_NAMES) {
+        if (name == entry.name) {
+            return entry.format;
+        }
+    }
+    throw py::value_error("Unknown pixel_format '" + name +
+                          "' (expected auto, bgr, rgb, bgrx, rgbx, bgra, rgba or gray)");
+}
+
+static const char* pixel_format_name(PixelFormat format) {
+    for (const auto& entry : PIXEL_FORMAT_NAMES) {
+        if (format == entry.format) {
+            return entry.name;
+        }
+    }
+    return "auto";
+}
+
+// 解码目标 buffer 的内存布局：行之间可以有间隔（pitch = 行 stride），
+// 但行内的像素和通道必须紧密排列，不满足时直接报错而不是拷贝到临时 buffer
+struct OutputView {
+    uint8_t* data;
+    size_t size;   // 从 data 开始解码会写到的字节数上限
+    size_t pitch;
+};
+
+// 只读取 buffer_info，不访问 Python 对象，可在释放 GIL 后调用
+static OutputView output_view(const py::buffer_info& buf, int width, int height, int channels) {
+    if (buf.itemsize != 1 || buf.format != py::format_descriptor<uint8_t>::format()) {
+        throw std::runtime_error("Output buffer must be a uint8 array");
+    }
+    if (buf.ndim != 2 && buf.ndim != 3) {
+        throw std::runtime_error("Output buffer must be 2D or 3D array");
+    }
+
+    const py::ssize_t buffer_channels = buf.ndim == 3 ? buf.shape[2] : 1;
+    if (buf.shape[0] != height || buf.shape[1] != width || buffer_channels != channels) {
+        throw std::runtime_error("Output buffer shape must be (" + std::to_string(height) + ", " +
+                                 std::to_string(width) + ", " + std::to_string(channels) + ")");
+    }
+    if ((buf.ndim == 3 && buf.strides[2] != 1) || buf.strides[1] != channels ||
+        buf.strides[0] < static_cast<py::ssize_t>(width) * channels) {
+        throw std::runtime_error("Output buffer pixels must be contiguous within each row");
+    }
+
+    OutputView view;
+    view.data = static_cast<uint8_t*>(buf.ptr);
+    view.pitch = static_cast<size_t>(buf.strides[0]);
+    view.size = view.pitch * (height - 1) + static_cast<size_t>(width) * channels;
+    return view;
+}
+
+// 缓存中的图像逐行拷贝到 buffer；可在释放 GIL 后调用
+static void copy_to_view(const CachedImage& image, const py::buffer_info& buf) {
+    OutputView out = output_view(buf, image.width(), image.height(), image.channels());
+    const size_t row_bytes = static_cast<size_t>(image.width()) * image.channels();
+    for (int y = 0; y < image.height(); ++y) {
+        std::memcpy(out.data + y * out.pitch, image.data() + y * row_bytes, row_bytes);
+    }
+}
+
+// 编码输入：与 OutputView 相同的布局规则（行之间可以有间隔，行内像素和通道紧密排列）
+struct InputImage {
+    const uint8_t* data;
+    int width;
+    int height;
+    size_t pitch;
+    PixelFormat format;
+};
+
+// 只读取 buffer_info，不访问 Python 对象，可在释放 GIL 后调用
+// format 为 PIXEL_FORMAT_AUTO 时按通道数推断：1 = gray，3 = bgr（与 OpenCV 一致），4 = bgrx
+static InputImage input_image(const py::buffer_info& buf, PixelFormat format) {
+    if (buf.itemsize != 1 || buf.format != py::format_descriptor<uint8_t>::format()) {
+        throw std::runtime_error("Image must be a uint8 array");
+    }
+    if (buf.ndim != 2 && buf.ndim != 3) {
+        throw std::runtime_error("Image must be 2D or 3D array");
+    }
+    if (buf.shape[0] <= 0 || buf.shape[1] <= 0 || buf.shape[0] > INT_MAX || buf.shape[1] > INT_MAX) {
+        throw std::runtime_error("Image size is out of range");
+    }
+
+    const py::ssize_t channels = buf.ndim == 3 ? buf.shape[2] : 1;
+    if (format == PIXEL_FORMAT_AUTO) {
+        switch (channels) {
+            case 1: format = PIXEL_FORMAT_GRAY; break;
+            case 3: format = PIXEL_FORMAT_BGR; break;
+            case 4: format = PIXEL_FORMAT_BGRX; break;
+            default: throw std::runtime_error("Image must have 1, 3 or 4 channels");
+        }
+    }
+    if (TurboJpegEncoder::bytes_per_pixel(format) != channels) {
+        throw std::runtime_error(std::string("Image with pixel_format '") + pixel_format_name(format) +
+                                 "' must have " +
+                                 std::to_string(TurboJpegEncoder::bytes_per_pixel(format)) + " channels");
+    }
+
+    const py::ssize_t width = buf.shape[1];
+    if ((buf.ndim == 3 && buf.strides[2] != 1) || buf.strides[1] != channels ||
+        buf.strides[0] < width * channels) {
+        throw std::runtime_error("Image pixels must be contiguous within each row");
+    }
+
+    InputImage image;
+    image.data = static_cast<const uint8_t*>(buf.ptr);
+    image.width = static_cast<int>(width);
+    image.height = static_cast<int>(buf.shape[0]);
+    image.pitch = static_cast<size_t>(buf.strides[0]);
+    image.format = format;
+    return image;
+}
+
+// 把编码结果（JPEG 缓冲池中的 buffer）包装成 1D uint8 array；可以直接交给解码器或写文件，需要 bytes 时用 bytes(array)
+// 缓冲按最坏情况分配（4K 4:2:0 约 32 MB，JPEG 通常只有 1 MB 左右），用不到一半时复制成实际大小
+// 并立即归还缓冲，否则调用方保留的每个结果都会占住整块缓冲；接近占满时才零拷贝包装，array 回收时归还
+static py::array_t<uint8_t> adopt_jpeg(uint8_t* jpeg, size_t size) {
+    if (size < TurboJpegEncoder::capacity(jpeg) / 2) {
+        py::array_t<uint8_t> copy;
+        try {
+            copy = py::array_t<uint8_t>(static_cast<py::ssize_t>(size));
+        } catch (...) {
+            TurboJpegEncoder::release(jpeg);
+            throw;
+        }
+        std::memcpy(copy.mutable_data(), jpeg, size);
+        TurboJpegEncoder::release(jpeg);
+        return copy;
+    }
+    py::capsule owner(jpeg, [](void* p) {
+        TurboJpegEncoder::release(static_cast<uint8_t*>(p));
+    });
+    return py::array_t<uint8_t>({ static_cast<py::ssize_t>(size) }, { sizeof(uint8_t) }, jpeg, owner);
+}
+
+// subsampling 参数的字符串名
+static int parse_subsampling(const std::string& name) {
+    static const struct {
+        const char* name;
+        int subsampling;
+    } SUBSAMPLING_NAMES[] = {
+        { "444", TJSAMP_444 },
+        { "422", TJSAMP_422 },
+        { "420", TJSAMP_420 },
+        { "440", TJSAMP_440 },
+        { "411", TJSAMP_411 },
+        { "gray", TJSAMP_GRAY },
+    };
+    for (const auto& entry : SUBSAMPLING_NAMES) {
+        if (name == entry.name) {
+            return entry.subsampling;
+        }
+    }
+    throw py::value_error("Unknown subsampling '" + name +
+                          "' (expected 444, 422, 420, 440, 411 or gray)");
+}
+
+// JpegInfoIndex.get() 返回的 subsampling / colorspace 名称
+static const char* subsampling_name(int subsampling) {
+    switch (subsampling) {
+        case TJSAMP_444: return "444";
+        case TJSAMP_422: return "422";
+        case TJSAMP_420: return "420";
+        case TJSAMP_440: return "440";
+        case TJSAMP_411: return "411";
+        case TJSAMP_441: return "441";
+        case TJSAMP_GRAY: return "gray";
+        default: return "unknown";
+    }
+}
+
+static const char* colorspace_name(int colorspace) {
+    switch (colorspace) {
+        case TJCS_RGB: return "rgb";
+        case TJCS_YCbCr: return "ycbcr";
+        case TJCS_GRAY: return "gray";
+        case TJCS_CMYK: return "cmyk";
+        case TJCS_YCCK: return "ycck";
+        default: return "unknown";
+    }
+}
+
+// transform() 的 ops：按顺序执行的步骤列表，每一步的输入是上一步的输出
+// "hflip" / "vflip" / "transpose" / "transverse" / "rot90" / "rot180" / "rot270"，
+// 或 ("crop", x, y, width, height)（在当前步骤的坐标系中，x/y 须对齐到 iMCU）
+// options（TJXOPT_* 组合）作用于每一步
+static std::vector<JpegTransformOp> parse_transform_ops(py::iterable ops, int options) {
+    static const struct {
+        const char* name;
+        int op;
+    } TRANSFORM_NAMES[] = {
+        { "hflip", TJXOP_HFLIP },
+        { "vflip", TJXOP_VFLIP },
+        { "transpose", TJXOP_TRANSPOSE },
+        { "transverse", TJXOP_TRANSVERSE },
+        { "rot90", TJXOP_ROT90 },
+        { "rot180", TJXOP_ROT180 },
+        { "rot270", TJXOP_ROT270 },
+    };
+
+    std::vector<JpegTransformOp> steps;
+    for (auto item : ops) {
+        JpegTransformOp step = { TJXOP_NONE, options, 0, 0, 0, 0 };
+        if (py::isinstance<py::str>(item)) {
+            const std::string name = item.cast<std::string>();
+            bool found = false;
+            for (const auto& entry : TRANSFORM_NAMES) {
+                if (name == entry.name) {
+                    step.op = entry.op;
+                    found = true;
+                    break;
+                }
+            }
+            if (!found) {
+                throw py::value_error("Unknown transform '" + name +
+                                      "' (expected hflip, vflip, transpose, transverse, rot90, rot180, "
+                                      "rot270 or ('crop', x, y, width, height))");
+            }
+        } else {
+            py::tuple crop = item.cast<py::tuple>();
+            if (crop.size() != 5 || crop[0].cast<std::string>() != "crop") {
+                throw py::value_error("Crop step must be ('crop', x, y, width, height)");
+            }
+            step.options |= TJXOPT_CROP;
+            step.x = crop[1].cast<int>();
+            step.y = crop[2].cast<int>();
+            step.width = crop[3].cast<int>();
+            step.height = crop[4].cast<int>();
+        }
+        steps.push_back(step);
+    }
+    return steps;
+}
+
+static int transform_options(bool perfect, bool trim, bool gray, bool progressive, bool copy_markers) {
+    return (perfect ? TJXOPT_PERFECT : 0) | (trim ? TJXOPT_TRIM : 0) | (gray ? TJXOPT_GRAY : 0) |
+           (progressive ? TJXOPT_PROGRESSIVE : 0) | (copy_markers ? 0 : TJXOPT_COPYNONE);
+}
+
+// 在 num_threads 个工作线程上并行执行 job(i), i in [0, count)
+// 每个线程从池中独占一个解码器；调用前必须已释放 GIL
+template <typename Job>
+static void run_batch(DecoderPool& pool, size_t count, int num_threads, Job job) {
+    if (num_threads <= 0) {
+        num_threads = static_cast<int>(std::thread::hardware_concurrency());
+        if (num_threads <= 0) num_threads = 4;
+    }
+    if (static_cast<size_t>(num_threads) > count) {
+        num_threads = static_cast<int>(count);
+    }
+
+    std::atomic<size_t> next_index(0);
+    std::atomic<bool> pool_failed(false);
+    auto worker = [&]() {
+        try {
+            PooledDecoder decoder(pool);
+            while (true) {
+                size_t idx = next_index.fetch_add(1);
+                if (idx >= count) break;
+                job(decoder.operator->(), idx);
+            }
+        } catch (...) {
+            pool_failed = true;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int t = 1; t < num_threads; ++t) {
+        threads.emplace_back(worker);
+    }
+    worker();  // 调用线程也参与解码
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    if (pool_failed) {
+        throw std::runtime_error("Failed to initialize decoder in pool");
+    }
+}
+
+// 解码输入：文件路径（str / os.PathLike）或任意支持 buffer protocol 的
+// 连续内存对象（bytes / bytearray / memoryview / numpy array），内存输入零拷贝；
+// 也可以是 open() 得到的已映射文件
+// 构造与析构都必须持有 GIL；data()/size() 可在释放 GIL 后使用
+class JpegSource {
+public:
+    JpegSource(std::shared_ptr<const MappedFile> mapped, const std::string& filename)
+        : filename_(filename), view_(), has_view_(false), mapped_(std::move(mapped)) {
+    }
+
+    explicit JpegSource(py::handle obj) : view_(), has_view_(false) {
+        if (py::hasattr(obj, "__fspath__")) {
+            filename_ = obj.attr("__fspath__")().cast<std::string>();
+            return;
+        }
+        if (py::isinstance<py::str>(obj)) {
+            filename_ = obj.cast<std::string>();
+            return;
+        }
+        if (PyObject_GetBuffer(obj.ptr(), &view_, PyBUF_SIMPLE) != 0) {
+            PyErr_Clear();
+            throw py::type_error("JPEG source must be a file path or a contiguous bytes-like object");
+        }
+        has_view_ = true;
+    }
+
+    JpegSource(JpegSource&& other) noexcept
+        : filename_(std::move(other.filename_)), view_(other.view_), has_view_(other.has_view_),
+          mapped_(std::move(other.mapped_)) {
+        other.has_view_ = false;
+    }
+
+    ~JpegSource() {
+        if (has_view_) {
+            PyBuffer_Release(&view_);
+        }
+    }
+
+    JpegSource(const JpegSource&) = delete;
+    JpegSource& operator=(const JpegSource&) = delete;
+
+    bool is_file() const { return !has_view_ && !mapped_; }
+    const std::string& filename() const { return filename_; }
+    const uint8_t* data() const {
+        return mapped_ ? mapped_->data() : static_cast<const uint8_t*>(view_.buf);
+    }
+    size_t size() const {
+        return mapped_ ? mapped_->size() : static_cast<size_t>(view_.len);
+    }
+
+    // 用于错误信息
+    std::string describe() const { return has_view_ ? std::string("<memory>") : filename_; }
+
+    // DecodedImageCache 中的来源标识：文件和 open() 映射的文件用路径 + mtime/大小（只 stat，
+    // 不读文件，命中时也不必扫一遍大图），内存数据用内容哈希；文件不存在时返回 false，
+    // 映射后被删除的文件退回内容哈希
+    bool cache_key(DecodedImageKey& key) const {
+        if (is_file()) {
+            return key.set_file(filename_);
+        }
+        if (mapped_ && key.set_file(filename_)) {
+            return true;
+        }
+        key.set_memory(data(), size());
+        return true;
+    }
+
+    bool decode_to_arena(TurboJpegDecoder& decoder, ArenaBlock*& block,
+                         int& width, int& height, int& channels, bool fast_dct) const {
+        return is_file() ? decoder.decode_to_arena(filename_, block, width, height, channels, fast_dct)
+                         : decoder.decode_to_arena(data(), size(), block, width, height, channels, fast_dct);
+    }
+
+    // 先读头得到（缩放后的）尺寸，按 buffer 的 strides 校验，再以行 stride 为 pitch 直接解码进去
+    // max_width/max_height 为 0 时按原尺寸解码
+    bool decode_to_view(TurboJpegDecoder& decoder, const py::buffer_info& buf,
+                        int max_width, int max_height) const {
+        int width, height, channels;
+        if (!get_image_info(decoder, max_width, max_height, width, height, channels)) {
+            return false;
+        }
+
+        OutputView out = output_view(buf, width, height, channels);
+        if (max_width <= 0 && max_height <= 0) {
+            return is_file() ? decoder.decode_to_buffer(filename_, out.data, out.size, out.pitch,
+                                                        width, height, channels)
+                             : decoder.decode_to_buffer(data(), size(), out.data, out.size, out.pitch,
+                                                        width, height, channels);
+        }
+        return is_file() ? decoder.decode_scaled_to_buffer(filename_, max_width, max_height,
+                                                           out.data, out.size, out.pitch,
+                                                           width, height, channels)
+                         : decoder.decode_scaled_to_buffer(data(), size(), max_width, max_height,
+                                                           out.data, out.size, out.pitch,
+                                                           width, height, channels);
+    }
+
+    bool get_image_info(TurboJpegDecoder& decoder, int max_width, int max_height,
+                        int& width, int& height, int& channels) const {
+        return is_file() ? decoder.get_image_info(filename_, max_width, max_height, width, height, channels)
+                         : decoder.get_image_info(data(), size(), max_width, max_height, width, height, channels);
+    }
+
+    bool decode_scaled(TurboJpegDecoder& decoder, int max_width, int max_height, ArenaBlock*& block,
+                       int& width, int& height, int& channels) const {
+        return is_file() ? decoder.decode_scaled(filename_, max_width, max_height, block, width, height, channels)
+                         : decoder.decode_scaled(data(), size(), max_width, max_height, block, width, height, channels);
+    }
+
+
+    // 与 decode_to_view 相同，但按 restart marker 分条带多线程解码
+    bool decode_parallel(TurboJpegDecoder& decoder, const py::buffer_info& buf,
+                         int num_threads, int& strips) const {
+        int width, height, channels;
+        if (!get_image_info(decoder, 0, 0, width, height, channels)) {
+            return false;
+        }
+
+        OutputView out = output_view(buf, width, height, channels);
+        return is_file() ? decoder.decode_parallel(filename_, out.data, out.size, out.pitch, num_threads,
+                                                   width, height, channels, strips)
+                         : decoder.decode_parallel(data(), size(), out.data, out.size, out.pitch, num_threads,
+                                                   width, height, channels, strips);
+    }
+
+    bool decode_yuv(TurboJpegDecoder& decoder, ArenaBlock*& block, YuvPlanes& planes) const {
+        return is_file() ? decoder.decode_yuv(filename_, block, planes)
+                         : decoder.decode_yuv(data(), size(), block, planes);
+    }
+
+    bool decode_region(TurboJpegDecoder& decoder, int x, int y, int width, int height,
+                       ArenaBlock*& block, int& channels) const {
+        return is_file() ? decoder.decode_region(filename_, x, y, width, height, block, channels)
+                         : decoder.decode_region(data(), size(), x, y, width, height, block, channels);
+    }
+
+    bool decode_region_to_buffer(TurboJpegDecoder& decoder, int x, int y, int width, int height,
+                                 const OutputView& out, int& channels) const {
+        return is_file() ? decoder.decode_region_to_buffer(filename_, x, y, width, height,
+                                                           out.data, out.size, out.pitch, channels)
+                         : decoder.decode_region_to_buffer(data(), size(), x, y, width, height,
+                                                           out.data, out.size, out.pitch, channels);
+    }
+
+private:
+    std::string filename_;
+    Py_buffer view_;
+    bool has_view_;
+    std::shared_ptr<const MappedFile> mapped_;
 };
 
+static std::vector<JpegSource> to_sources(py::iterable objs) {
+    std::vector<JpegSource> sources;
+    for (auto obj : objs) {
+        sources.emplace_back(obj);
+    }
+    return sources;
+}
+
 class TurboJpegDecoderWrapper {
 public:
-    TurboJpegDecoderWrapper() {
+    // pixel_format 对该实例的所有解码方法生效（包括批量解码用的解码器池）
+    // cache=True 时解码结果放入进程级 DecodedImageCache（需先 set_cache_budget），
+    // 命中时返回只读的共享 array，*_to_buffer 方法从缓存拷贝
+    explicit TurboJpegDecoderWrapper(const std::string& pixel_format = "auto", bool cache = false)
+        : cache_(cache) {
         if (!decoder_.init()) {
             throw std::runtime_error("Failed to initialize TurboJPEG decoder");
         }
+        decoder_.set_pixel_format(parse_pixel_format(pixel_format));
     }
 
-    // 方法1: 标准解码（有拷贝）
-    py::array_t<uint8_t> decode(const std::string& filename) {
-        std::vector<uint8_t> data;
-        int width, height, channels;
+    std::string pixel_format() const { return pixel_format_name(decoder_.pixel_format()); }
+    bool cache() const { return cache_; }
+
+    // 所有方法的 source 参数都可以是文件路径，也可以是 bytes 等内存对象
+    // 单图方法在解码期间释放 GIL；同一实例的调用由 mutex_ 串行化
+    // （先释放 GIL 再加锁，避免与持有 GIL 的线程互相等待）
 
-        if (!decoder_.decode(filename, data, width, height, channels)) {
-            throw std::runtime_error("Failed to decode image: " + filename);
+    // 方法1: 标准解码，返回的 array 直接使用解码器 arena 中的内存（无拷贝）
+    py::array_t<uint8_t> decode(py::object source) {
+        return decode_source(JpegSource(source), false);
+    }
+
+    py::array_t<uint8_t> decode_source(const JpegSource& src, bool fast) {
+        if (use_cache()) {
+            return decode_cached(src, cache_request(fast ? DECODED_FAST_DCT : DECODED_FULL),
+                                 [&](ArenaBlock*& block, int& width, int& height, int& channels) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                return src.decode_to_arena(decoder_, block, width, height, channels, fast);
+            });
         }
 
-        if (channels == 1) {
-            return py::array_t<uint8_t>(
-                py::buffer_info(
-                    data.data(), sizeof(uint8_t),
-                    py::format_descriptor<uint8_t>::format(),
-                    2, { height, width },
-                    { width * sizeof(uint8_t), sizeof(uint8_t) }
-                )
-            );
-        } else {
-            return py::array_t<uint8_t>(
-                py::buffer_info(
-                    data.data(), sizeof(uint8_t),
-                    py::format_descriptor<uint8_t>::format(),
-                    3, { height, width, channels },
-                    { width * channels * sizeof(uint8_t),
-                      channels * sizeof(uint8_t),
-                      sizeof(uint8_t) }
-                )
-            );
+        ArenaBlock* block = nullptr;
+        int width, height, channels;
+        bool ok;
+        {
+            py::gil_scoped_release release;
+            std::lock_guard<std::mutex> lock(mutex_);
+            ok = src.decode_to_arena(decoder_, block, width, height, channels, fast);
+        }
+
+        if (!ok) {
+            throw std::runtime_error("Failed to decode image: " + src.describe());
         }
+
+        return adopt_block(block, width, height, channels);
     }
 
-    // 方法2: 获取图像信息
-    py::tuple get_image_info(const std::string& filename) {
+    // 方法2: 获取图像信息；给出 max_width/max_height 时返回缩放解码后的尺寸
+    py::tuple get_image_info(py::object source, int max_width, int max_height) {
+        JpegSource src(source);
         int width, height, channels;
-        if (!decoder_.get_image_info(filename, width, height, channels)) {
-            throw std::runtime_error("Failed to get image info: " + filename);
+        bool ok;
+        {
+            py::gil_scoped_release release;
+            std::lock_guard<std::mutex> lock(mutex_);
+            ok = src.get_image_info(decoder_, max_width, max_height, width, height, channels);
+        }
+        if (!ok) {
+            throw std::runtime_error("Failed to get image info: " + src.describe());
         }
         return py::make_tuple(width, height, channels);
     }
 
     // 方法3: 零拷贝解码到预分配 buffer
-    void decode_to_buffer(const std::string& filename,
-                          py::array_t<uint8_t, py::array::c_style | py::array::forcecast> output_buffer) {
-        py::buffer_info buf = output_buffer.request();
-        if (buf.ndim != 2 && buf.ndim != 3) {
-            throw std::runtime_error("Output buffer must be 2D or 3D array");
+    // buffer 按 numpy strides 写入（行 stride 作为 pitch），可以是行带 padding 的 array
+    // 或 [N, H, W, C] batch tensor 的 batch[i]；行内像素不连续时报错，不会拷贝到临时 buffer
+    void decode_to_buffer(py::object source, py::array output_buffer) {
+        decode_source_to_buffer(JpegSource(source), output_buffer, 0, 0);
+    }
+
+    void decode_source_to_buffer(const JpegSource& src, py::array output_buffer,
+                                 int max_width, int max_height) {
+        py::buffer_info buf = output_buffer.request(true);
+        bool ok;
+        {
+            py::gil_scoped_release release;
+            if (use_cache()) {
+                ok = decode_to_view_cached(src, buf, max_width, max_height, [&](auto decode) {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    return decode(decoder_);
+                });
+            } else {
+                std::lock_guard<std::mutex> lock(mutex_);
+                ok = src.decode_to_view(decoder_, buf, max_width, max_height);
+            }
+        }
+
+        if (!ok) {
+            throw std::runtime_error("Failed to decode image: " + src.describe());
         }
+    }
+
+    // 方法4: 使用快速 DCT（牺牲一点质量换速度）
+    py::array_t<uint8_t> decode_fast(py::object source) {
+        return decode_source(JpegSource(source), true);
+    }
 
+    // 方法4b: DCT 域缩放解码（1/1 ~ 1/8），用于缩略图/预览，比解码后再缩放快得多
+    py::array_t<uint8_t> decode_scaled(py::object source, int max_width, int max_height) {
+        JpegSource src(source);
+        if (use_cache()) {
+            return decode_cached(src, cache_request(DECODED_SCALED, 0, 0, max_width, max_height),
+                                 [&](ArenaBlock*& block, int& width, int& height, int& channels) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                return src.decode_scaled(decoder_, max_width, max_height, block, width, height, channels);
+            });
+        }
+
+        ArenaBlock* block = nullptr;
         int width, height, channels;
-        uint8_t* data_ptr = static_cast<uint8_t*>(buf.ptr);
-        size_t buffer_size = buf.size * sizeof(uint8_t);
+        bool ok;
+        {
+            py::gil_scoped_release release;
+            std::lock_guard<std::mutex> lock(mutex_);
+            ok = src.decode_scaled(decoder_, max_width, max_height, block, width, height, channels);
+        }
 
-        if (!decoder_.decode_to_buffer(filename, data_ptr, buffer_size, width, height, channels)) {
-            throw std::runtime_error("Failed to decode image: " + filename);
+        if (!ok) {
+            throw std::runtime_error("Failed to decode image: " + src.describe());
         }
+
+        return adopt_block(block, width, height, channels);
     }
 
-    // 方法4: 使用快速 DCT（牺牲一点质量换速度）
-    py::array_t<uint8_t> decode_fast(const std::string& filename) {
-        std::vector<uint8_t> data;
+    // buffer 形状用 get_image_info(source, max_width, max_height) 得到
+    void decode_scaled_to_buffer(py::object source, py::array output_buffer,
+                                 int max_width, int max_height) {
+        decode_source_to_buffer(JpegSource(source), output_buffer, max_width, max_height);
+    }
+
+    // 方法4c: 解码为平面 YUV（不做颜色转换和色度上采样），返回 (Y, U, V) 三个 2D array
+    // 灰度图只返回 (Y,)；三个 array 共享同一块 arena 内存
+    py::tuple decode_yuv(py::object source) {
+        JpegSource src(source);
+        ArenaBlock* block = nullptr;
+        YuvPlanes planes;
+        bool ok;
+        {
+            py::gil_scoped_release release;
+            std::lock_guard<std::mutex> lock(mutex_);
+            ok = src.decode_yuv(decoder_, block, planes);
+        }
+
+        if (!ok) {
+            throw std::runtime_error("Failed to decode image to YUV: " + src.describe());
+        }
+
+        py::capsule owner(block, [](void* p) {
+            ArenaBlock::release(static_cast<ArenaBlock*>(p));
+        });
+        py::tuple result(planes.num_planes);
+        for (int i = 0; i < planes.num_planes; ++i) {
+            result[i] = py::array_t<uint8_t>(
+                { planes.height[i], planes.width[i] },
+                { planes.width[i] * sizeof(uint8_t), sizeof(uint8_t) },
+                block->data + planes.offset[i], owner);
+        }
+        return result;
+    }
+
+    // 方法4d: 只解码 (x, y, width, height) 窗口，内存占用与窗口大小成正比
+    py::array_t<uint8_t> decode_region(py::object source, int x, int y, int width, int height) {
+        JpegSource src(source);
+        if (use_cache()) {
+            return decode_cached(src, cache_request(DECODED_REGION, x, y, width, height),
+                                 [&](ArenaBlock*& block, int& out_width, int& out_height, int& channels) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                out_width = width;
+                out_height = height;
+                return src.decode_region(decoder_, x, y, width, height, block, channels);
+            }, "Failed to decode region of image: ");
+        }
+
+        ArenaBlock* block = nullptr;
+        int channels;
+        bool ok;
+        {
+            py::gil_scoped_release release;
+            std::lock_guard<std::mutex> lock(mutex_);
+            ok = src.decode_region(decoder_, x, y, width, height, block, channels);
+        }
+
+        if (!ok) {
+            throw std::runtime_error("Failed to decode region of image: " + src.describe());
+        }
+
+        return adopt_block(block, width, height, channels);
+    }
+
+    // buffer 可以是更大 array 的切片（例如 canvas[y0:y0+h, x0:x0+w]），按其行 stride 写入
+    void decode_region_to_buffer(py::object source, int x, int y, int width, int height,
+                                 py::array output_buffer) {
+        JpegSource src(source);
+        py::buffer_info buf = output_buffer.request(true);
+        int image_width, image_height, channels;
+        bool ok;
+        {
+            py::gil_scoped_release release;
+            if (use_cache()) {
+                std::shared_ptr<const CachedImage> image = find_or_decode(
+                    src, cache_request(DECODED_REGION, x, y, width, height),
+                    [&](ArenaBlock*& block, int& out_width, int& out_height, int& out_channels) {
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        out_width = width;
+                        out_height = height;
+                        return src.decode_region(decoder_, x, y, width, height, block, out_channels);
+                    });
+                ok = image != nullptr;
+                if (ok) {
+                    copy_to_view(*image, buf);
+                }
+            } else {
+                std::lock_guard<std::mutex> lock(mutex_);
+                ok = src.get_image_info(decoder_, 0, 0, image_width, image_height, channels);
+                if (ok) {
+                    OutputView out = output_view(buf, width, height, channels);
+                    ok = src.decode_region_to_buffer(decoder_, x, y, width, height, out, channels);
+                }
+            }
+        }
+
+        if (!ok) {
+            throw std::runtime_error("Failed to decode region of image: " + src.describe());
+        }
+    }
+
+    // 方法4e: 单张大图多线程解码（按 restart marker 切分条带），没有 restart marker 时退回单线程
+    // 返回实际走的路径："parallel" 或 "serial"
+    std::string decode_parallel(py::object source, py::array output_buffer, int num_threads) {
+        JpegSource src(source);
+        py::buffer_info buf = output_buffer.request(true);
+        int strips = 1;
+        bool ok;
+        {
+            py::gil_scoped_release release;
+            std::lock_guard<std::mutex> lock(mutex_);
+            ok = src.decode_parallel(decoder_, buf, num_threads, strips);
+        }
+
+        if (!ok) {
+            throw std::runtime_error("Failed to decode image: " + src.describe());
+        }
+        return strips > 1 ? "parallel" : "serial";
+    }
+
+    // 方法5: 多线程批量解码，返回 numpy array 列表（同样无拷贝）
+    py::list decode_batch(py::iterable sources, int num_threads) {
+        struct Decoded {
+            ArenaBlock* block = nullptr;
+            std::shared_ptr<const CachedImage> image;  // 使用缓存时
+            int width = 0, height = 0, channels = 0;
+            bool ok = false;
+        };
+        std::vector<JpegSource> srcs = to_sources(sources);
+        std::vector<Decoded> results(srcs.size());
+        const bool cached = use_cache();
+
+        {
+            py::gil_scoped_release release;
+            run_batch(pool(), srcs.size(), num_threads,
+                      [&](TurboJpegDecoder* decoder, size_t i) {
+                Decoded& r = results[i];
+                try {
+                    if (cached) {
+                        r.image = find_or_decode(srcs[i], cache_request(DECODED_FULL),
+                            [&](ArenaBlock*& block, int& width, int& height, int& channels) {
+                                return srcs[i].decode_to_arena(*decoder, block, width, height,
+                                                               channels, false);
+                            });
+                        r.ok = r.image != nullptr;
+                    } else {
+                        r.ok = srcs[i].decode_to_arena(*decoder, r.block, r.width, r.height,
+                                                       r.channels, false);
+                    }
+                } catch (...) {
+                    r.ok = false;
+                }
+            });
+        }
+
+        for (size_t i = 0; i < results.size(); ++i) {
+            if (!results[i].ok) {
+                for (auto& r : results) {
+                    ArenaBlock::release(r.block);
+                }
+                throw std::runtime_error("Failed to decode image: " + srcs[i].describe());
+            }
+        }
+
+        py::list arrays;
+        for (auto& r : results) {
+            arrays.append(r.image ? adopt_cached(std::move(r.image))
+                                  : adopt_block(r.block, r.width, r.height, r.channels));
+        }
+        return arrays;
+    }
+
+    // 方法6: 多线程批量零拷贝解码到预分配 buffer 列表
+    // output_buffers 可以是 array 列表，也可以直接是 [N, H, W, C] 的 batch tensor（逐个写入 batch[i]）
+    void decode_batch_to_buffers(py::iterable sources, py::iterable output_buffers, int num_threads) {
+        std::vector<JpegSource> srcs = to_sources(sources);
+
+        std::vector<py::array> arrays;
+        std::vector<py::buffer_info> bufs;
+        arrays.reserve(srcs.size());
+        bufs.reserve(srcs.size());
+        for (auto item : output_buffers) {
+            arrays.push_back(item.cast<py::array>());
+            bufs.push_back(arrays.back().request(true));
+        }
+        if (arrays.size() != srcs.size()) {
+            throw std::runtime_error("Number of buffers must match number of sources");
+        }
+
+        std::vector<char> ok(srcs.size(), 0);
+        std::vector<std::string> errors(srcs.size());
+        const bool cached = use_cache();
+        {
+            py::gil_scoped_release release;
+            run_batch(pool(), srcs.size(), num_threads,
+                      [&](TurboJpegDecoder* decoder, size_t i) {
+                try {
+                    ok[i] = cached ? decode_to_view_cached(srcs[i], bufs[i], 0, 0,
+                                                           [&](auto decode) { return decode(*decoder); })
+                                   : srcs[i].decode_to_view(*decoder, bufs[i], 0, 0);
+                } catch (const std::exception& e) {
+                    ok[i] = 0;
+                    errors[i] = e.what();
+                }
+            });
+        }
+
+        for (size_t i = 0; i < srcs.size(); ++i) {
+            if (!ok[i]) {
+                throw std::runtime_error("Failed to decode image: " + srcs[i].describe() +
+                                         (errors[i].empty() ? "" : " (" + errors[i] + ")"));
+            }
+        }
+    }
+
+    // 供 JpegImage 使用：映射文件并解析头（调用方已释放 GIL）
+    bool open(const std::string& filename, MappedFile& file,
+              int& width, int& height, int& channels) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return decoder_.open(filename, file, width, height, channels);
+    }
+
+private:
+    bool use_cache() const { return cache_ && DecodedImageCache::instance().enabled(); }
+
+    // 缓存键中的解码参数部分；来源部分由 JpegSource::cache_key 填写
+    DecodedImageKey cache_request(int variant, int x = 0, int y = 0, int width = 0, int height = 0) const {
+        DecodedImageKey key;
+        key.pixel_format = decoder_.pixel_format();
+        key.variant = variant;
+        key.x = x;
+        key.y = y;
+        key.width = width;
+        key.height = height;
+        return key;
+    }
+
+    // 先查缓存，未命中时 decode(block, width, height, channels) 解码到 arena 块后放入缓存
+    // 失败返回 nullptr；调用方已释放 GIL
+    template <typename Decode>
+    static std::shared_ptr<const CachedImage> find_or_decode(const JpegSource& src, DecodedImageKey key,
+                                                             Decode decode) {
+        DecodedImageCache& cache = DecodedImageCache::instance();
+        const bool keyed = src.cache_key(key);
+        if (keyed) {
+            std::shared_ptr<const CachedImage> image = cache.find(key);
+            if (image) {
+                return image;
+            }
+        }
+
+        ArenaBlock* block = nullptr;
         int width, height, channels;
+        if (!decode(block, width, height, channels)) {
+            return nullptr;
+        }
+        return keyed ? cache.insert(key, block, width, height, channels)
+                     : std::make_shared<CachedImage>(block, width, height, channels);
+    }
+
+    // 返回 array 的解码方法的缓存版本
+    template <typename Decode>
+    py::array_t<uint8_t> decode_cached(const JpegSource& src, const DecodedImageKey& key, Decode decode,
+                                       const char* error = "Failed to decode image: ") {
+        std::shared_ptr<const CachedImage> image;
+        {
+            py::gil_scoped_release release;
+            image = find_or_decode(src, key, decode);
+        }
+        if (!image) {
+            throw std::runtime_error(error + src.describe());
+        }
+        return adopt_cached(std::move(image));
+    }
+
+    // decode_to_view 的缓存版本：命中或解码进缓存后拷贝到 buffer
+    // with_decoder(f) 在可用的解码器上执行 f(decoder)（单图方法加锁，批量方法用池中的解码器）
+    template <typename WithDecoder>
+    bool decode_to_view_cached(const JpegSource& src, const py::buffer_info& buf,
+                               int max_width, int max_height, WithDecoder with_decoder) const {
+        const bool scaled = max_width > 0 || max_height > 0;
+        std::shared_ptr<const CachedImage> image = find_or_decode(
+            src, cache_request(scaled ? DECODED_SCALED : DECODED_FULL, 0, 0,
+                               scaled ? max_width : 0, scaled ? max_height : 0),
+            [&](ArenaBlock*& block, int& width, int& height, int& channels) {
+                return with_decoder([&](TurboJpegDecoder& decoder) {
+                    return scaled ? src.decode_scaled(decoder, max_width, max_height, block,
+                                                      width, height, channels)
+                                  : src.decode_to_arena(decoder, block, width, height, channels, false);
+                });
+            });
+        if (!image) {
+            return false;
+        }
+        copy_to_view(*image, buf);
+        return true;
+    }
+
+    // 批量解码用的解码器池，首次使用时创建（调用方已释放 GIL）
+    DecoderPool& pool() {
+        std::lock_guard<std::mutex> lock(pool_mutex_);
+        if (!pool_) {
+            int size = static_cast<int>(std::thread::hardware_concurrency());
+            pool_ = std::make_unique<DecoderPool>(size > 0 ? size : 4, decoder_.pixel_format());
+        }
+        return *pool_;
+    }
+
+    TurboJpegDecoder decoder_;
+    std::mutex mutex_;
+    std::unique_ptr<DecoderPool> pool_;
+    std::mutex pool_mutex_;
+    bool cache_;
+};
+
+// decoder.open() 的返回值：文件只映射一次、头只解析一次，之后可多次解码而不重新读文件
+class JpegImage {
+public:
+    JpegImage(py::object owner, const std::string& filename)
+        : owner_(owner), decoder_(owner.cast<TurboJpegDecoderWrapper*>()), filename_(filename) {
+        auto file = std::make_shared<MappedFile>();
+        bool ok;
+        {
+            py::gil_scoped_release release;
+            ok = decoder_->open(filename, *file, width_, height_, channels_);
+        }
+        if (!ok) {
+            throw std::runtime_error("Failed to open image: " + filename);
+        }
+        file_ = file;
+    }
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    int channels() const { return channels_; }
+
+    py::tuple shape() const {
+        if (channels_ == 1) {
+            return py::make_tuple(height_, width_);
+        }
+        return py::make_tuple(height_, width_, channels_);
+    }
+
+    py::array_t<uint8_t> decode(bool fast) {
+        return decoder_->decode_source(source(), fast);
+    }
+
+    void decode_to_buffer(py::array output_buffer) {
+        decoder_->decode_source_to_buffer(source(), output_buffer, 0, 0);
+    }
+
+    // 提前释放文件映射（之后不能再解码）
+    void close() { file_.reset(); }
+
+private:
+    JpegSource source() const {
+        if (!file_) {
+            throw std::runtime_error("Image is closed: " + filename_);
+        }
+        return JpegSource(file_, filename_);
+    }
+
+    py::object owner_;                     // 保持解码器存活
+    TurboJpegDecoderWrapper* decoder_;
+    std::string filename_;
+    std::shared_ptr<const MappedFile> file_;
+    int width_ = 0, height_ = 0, channels_ = 0;
+};
+
+// 连续帧的异步流水线：预读线程映射文件并预先读入页面，N 个解码线程各自独占一个解码器，
+// 按输入顺序产出结果。同时在途的帧数不超过 max_in_flight（背压），
+// 输出 array 使用解码器 arena 的内存，被回收后复用，稳态下没有新的大块分配。
+// 工作线程从不接触 Python 对象：输入的取出和 JpegSource 的构造、析构都在迭代线程上（持有 GIL）
+class DecodePipeline {
+public:
+    DecodePipeline(py::iterable sources, int num_workers, int max_in_flight,
+                   const std::string& pixel_format)
+        : sources_(py::iter(sources)) {
+        if (num_workers <= 0) {
+            num_workers = static_cast<int>(std::thread::hardware_concurrency());
+            if (num_workers <= 0) num_workers = 4;
+        }
+        max_in_flight_ = max_in_flight > 0 ? static_cast<size_t>(max_in_flight)
+                                           : static_cast<size_t>(num_workers) * 2;
+
+        const PixelFormat format = parse_pixel_format(pixel_format);
+        for (int i = 0; i < num_workers; ++i) {
+            auto decoder = std::make_unique<TurboJpegDecoder>();
+            if (!decoder->init()) {
+                throw std::runtime_error("Failed to initialize decoder in pipeline");
+            }
+            decoder->set_pixel_format(format);
+            decoders_.push_back(std::move(decoder));
+        }
+
+        io_thread_ = std::thread([this]() { io_loop(); });
+        for (auto& decoder : decoders_) {
+            TurboJpegDecoder* d = decoder.get();
+            workers_.emplace_back([this, d]() { decode_loop(d); });
+        }
+    }
+
+    ~DecodePipeline() { close(); }
 
-        if (!decoder_.decode_fast(filename, data, width, height, channels)) {
-            throw std::runtime_error("Failed to decode image: " + filename);
+    DecodePipeline(const DecodePipeline&) = delete;
+    DecodePipeline& operator=(const DecodePipeline&) = delete;
+
+    py::array_t<uint8_t> next() {
+        // 多个 Python 线程迭代同一个流水线时逐个取帧；先释放 GIL 再拿锁，
+        // 否则会和持有锁、正在等待解码结果的线程互相等待
+        std::unique_lock<std::mutex> consumer(consumer_mutex_, std::defer_lock);
+        {
+            py::gil_scoped_release release;
+            consumer.lock();
+        }
+
+        fill();
+        if (in_flight_.empty()) {
+            throw py::stop_iteration();
+        }
+
+        Job* job = in_flight_.front().get();
+        bool stopped;
+        {
+            py::gil_scoped_release release;
+            std::unique_lock<std::mutex> lock(mutex_);
+            done_cv_.wait(lock, [this, job]() { return stopping_ || job->done; });
+            stopped = stopping_;
+        }
+        if (stopped) {
+            // 其他线程调用了 close()，剩下的任务由它释放
+            throw std::runtime_error("DecodePipeline was closed");
+        }
+
+        std::unique_ptr<Job> finished = std::move(in_flight_.front());
+        in_flight_.pop_front();
+        fill();  // 调用方处理这一帧时，后面的帧继续解码
+
+        if (!finished->ok) {
+            throw std::runtime_error("Failed to decode image: " + finished->source.describe());
+        }
+        return adopt_block(finished->block, finished->width, finished->height, finished->channels);
+    }
+
+    // 停止所有线程并丢弃未取走的结果（析构时自动调用）
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (stopping_) {
+                return;
+            }
+            stopping_ = true;
         }
+        io_cv_.notify_all();
+        decode_cv_.notify_all();
+        done_cv_.notify_all();
+
+        // 等正在 next() 里的线程退出后才能释放 in_flight_
+        std::unique_lock<std::mutex> consumer(consumer_mutex_, std::defer_lock);
+        {
+            py::gil_scoped_release release;
+            consumer.lock();
+        }
+
+        // 工作线程不需要 GIL，持有 GIL 等待它们结束不会死锁
+        if (io_thread_.joinable()) {
+            io_thread_.join();
+        }
+        for (auto& worker : workers_) {
+            worker.join();
+        }
+        workers_.clear();
+
+        for (auto& job : in_flight_) {
+            ArenaBlock::release(job->block);
+        }
+        in_flight_.clear();
+        exhausted_ = true;
+    }
+
+private:
+    struct Job {
+        explicit Job(py::handle obj) : source(obj) {}
+
+        JpegSource source;
+        std::shared_ptr<MappedFile> mapped;  // 预读线程映射的文件
+        ArenaBlock* block = nullptr;
+        int width = 0, height = 0, channels = 0;
+        bool ok = false;
+        bool done = false;
+    };
+
+    // 从输入迭代器补充任务直到在途帧数达到上限（持有 GIL）
+    void fill() {
+        while (!exhausted_ && in_flight_.size() < max_in_flight_) {
+            PyObject* item = PyIter_Next(sources_.ptr());
+            if (!item) {
+                if (PyErr_Occurred()) {
+                    throw py::error_already_set();
+                }
+                exhausted_ = true;
+                break;
+            }
+            py::object obj = py::reinterpret_steal<py::object>(item);
+            in_flight_.push_back(std::make_unique<Job>(obj));
+
+            Job* job = in_flight_.back().get();
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                io_queue_.push_back(job);
+            }
+            io_cv_.notify_one();
+        }
+    }
+
+    // 预读：映射文件并逐页读一个字节，让缺页 I/O 发生在这里而不是解码线程上
+    void io_loop() {
+        while (true) {
+            Job* job;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                io_cv_.wait(lock, [this]() { return stopping_ || !io_queue_.empty(); });
+                if (stopping_) {
+                    return;
+                }
+                job = io_queue_.front();
+                io_queue_.pop_front();
+            }
+
+            bool ok = true;
+            if (job->source.is_file()) {
+                auto mapped = std::make_shared<MappedFile>();
+                ok = mapped->open(job->source.filename());
+                if (ok) {
+                    const uint8_t* data = mapped->data();
+                    volatile uint8_t sink = 0;
+                    for (size_t offset = 0; offset < mapped->size(); offset += 4096) {
+                        sink = sink ^ data[offset];
+                    }
+                    job->mapped = mapped;
+                }
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (ok) {
+                    decode_queue_.push_back(job);
+                } else {
+                    job->done = true;
+                }
+            }
+            if (ok) {
+                decode_cv_.notify_one();
+            } else {
+                done_cv_.notify_all();
+            }
+        }
+    }
 
-        if (channels == 1) {
-            return py::array_t<uint8_t>(
-                py::buffer_info(
-                    data.data(), sizeof(uint8_t),
-                    py::format_descriptor<uint8_t>::format(),
-                    2, { height, width },
-                    { width * sizeof(uint8_t), sizeof(uint8_t) }
-                )
-            );
+    void decode_loop(TurboJpegDecoder* decoder) {
+        while (true) {
+            Job* job;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                decode_cv_.wait(lock, [this]() { return stopping_ || !decode_queue_.empty(); });
+                if (stopping_) {
+                    return;
+                }
+                job = decode_queue_.front();
+                decode_queue_.pop_front();
+            }
+
+            const uint8_t* data = job->mapped ? job->mapped->data() : job->source.data();
+            const size_t size = job->mapped ? job->mapped->size() : job->source.size();
+            bool ok;
+            try {
+                ok = decoder->decode_to_arena(data, size, job->block,
+                                              job->width, job->height, job->channels);
+            } catch (...) {
+                ok = false;
+            }
+            // 映射在这里释放，不必等到迭代线程取走结果
+            job->mapped.reset();
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                job->ok = ok;
+                job->done = true;
+            }
+            done_cv_.notify_all();
+        }
+    }
+
+    py::iterator sources_;
+    size_t max_in_flight_ = 0;
+    bool exhausted_ = false;
+    std::mutex consumer_mutex_;  // 保护 in_flight_ 和 exhausted_；不持有 GIL 时才能去拿它
+    std::deque<std::unique_ptr<Job>> in_flight_;  // 按输入顺序
+
+    std::vector<std::unique_ptr<TurboJpegDecoder>> decoders_;
+    std::thread io_thread_;
+    std::vector<std::thread> workers_;
+
+    std::mutex mutex_;                 // 保护下面的队列、stopping_ 和 Job 的 ok/done
+    std::condition_variable io_cv_;
+    std::condition_variable decode_cv_;
+    std::condition_variable done_cv_;
+    std::deque<Job*> io_queue_;
+    std::deque<Job*> decode_queue_;
+    bool stopping_ = false;
+};
+
+// 编码器：与 JNI/JNA 编码器共用 native/ 中的编码核心（每线程缓存的压缩句柄、JPEG 缓冲池、共享线程池）
+// 参数在构造时固定，实例可以被多个 Python 线程同时使用，编码期间释放 GIL
+class TurboJpegEncoderWrapper {
+public:
+    TurboJpegEncoderWrapper(int quality, const std::string& subsampling, bool fast_dct,
+                            bool progressive, bool optimize, int restart_rows,
+                            py::object quant_table)
+        : encoder_(quality, parse_subsampling(subsampling), fast_dct, progressive, optimize,
+                   check_restart_rows(restart_rows), parse_quant_table(quant_table))
+        , subsampling_(subsampling) {
+    }
+
+    int quality() const { return encoder_.quality(); }
+    const std::string& subsampling() const { return subsampling_; }
+    bool fast_dct() const { return encoder_.fast_dct(); }
+    bool progressive() const { return encoder_.progressive(); }
+    bool optimize() const { return encoder_.optimize(); }
+    int restart_rows() const { return encoder_.restart_rows(); }
+
+    // 128 个值（亮度在前、色度在后），未设置时为 None
+    py::object quant_table() const {
+        const std::vector<uint16_t>& table = encoder_.quant_table();
+        if (table.empty()) {
+            return py::none();
+        }
+        py::array_t<uint16_t> result(static_cast<py::ssize_t>(table.size()));
+        std::memcpy(result.mutable_data(), table.data(), table.size() * sizeof(uint16_t));
+        return result;
+    }
+
+    // 编码一张图，输入可以是行带 padding 的 array 或更大 array 的切片（按行 stride 读取，无拷贝）
+    py::array_t<uint8_t> encode(py::array image, const std::string& pixel_format) {
+        py::buffer_info buf = image.request();
+        InputImage in = input_image(buf, parse_pixel_format(pixel_format));
+        uint8_t* jpeg = nullptr;
+        size_t size = 0;
+        bool ok;
+        {
+            py::gil_scoped_release release;
+            ok = encoder_.encode(in.data, in.width, in.height, in.pitch, in.format, jpeg, size);
+        }
+
+        if (!ok) {
+            throw std::runtime_error("Failed to encode image");
+        }
+        return adopt_jpeg(jpeg, size);
+    }
+
+    // 批量编码：提交到共享线程池（调用线程也参与），返回与输入顺序一致的 JPEG array 列表
+    py::list encode_batch(py::iterable images, const std::string& pixel_format, int num_threads) {
+        struct Encoded {
+            uint8_t* jpeg = nullptr;
+            size_t size = 0;
+            bool ok = false;
+        };
+        const PixelFormat format = parse_pixel_format(pixel_format);
+
+        std::vector<py::array> arrays;
+        std::vector<py::buffer_info> bufs;
+        std::vector<InputImage> inputs;
+        for (auto item : images) {
+            arrays.push_back(item.cast<py::array>());
+            bufs.push_back(arrays.back().request());
+            inputs.push_back(input_image(bufs.back(), format));
+        }
+        if (inputs.size() > static_cast<size_t>(INT_MAX)) {
+            throw std::runtime_error("Too many images in one batch");
+        }
+
+        std::vector<Encoded> results(inputs.size());
+        {
+            py::gil_scoped_release release;
+            parallelFor(static_cast<int>(inputs.size()), num_threads, [&](int i) {
+                const InputImage& in = inputs[i];
+                Encoded& r = results[i];
+                r.ok = encoder_.encode(in.data, in.width, in.height, in.pitch, in.format,
+                                       r.jpeg, r.size);
+            });
+        }
+
+        for (size_t i = 0; i < results.size(); ++i) {
+            if (!results[i].ok) {
+                for (auto& r : results) {
+                    TurboJpegEncoder::release(r.jpeg);
+                }
+                throw std::runtime_error("Failed to encode image " + std::to_string(i));
+            }
+        }
+
+        py::list jpegs;
+        for (auto& r : results) {
+            jpegs.append(adopt_jpeg(r.jpeg, r.size));
+        }
+        return jpegs;
+    }
+
+private:
+    static int check_restart_rows(int restart_rows) {
+        if (restart_rows < 0 || restart_rows > 65535) {
+            throw py::value_error("restart_rows must be 0-65535");
+        }
+        return restart_rows;
+    }
+
+    // quant_table：None，或 64 个（亮度，色度共用）/ 128 个（亮度 + 色度）1-255 的值，自然顺序（非 zigzag）
+    static std::vector<uint16_t> parse_quant_table(py::object quant_table) {
+        std::vector<uint16_t> table;
+        if (quant_table.is_none()) {
+            return table;
+        }
+        auto values = quant_table.cast<py::array_t<int, py::array::c_style | py::array::forcecast>>();
+        for (py::ssize_t i = 0; i < values.size(); ++i) {
+            const int value = values.data()[i];
+            if (value < 1 || value > 255) {
+                throw py::value_error("quant_table values must be 1-255");
+            }
+            table.push_back(static_cast<uint16_t>(value));
+        }
+        if (table.size() != 64 && table.size() != 128) {
+            throw py::value_error("quant_table must have 64 or 128 values");
+        }
+        return table;
+    }
+
+    TurboJpegEncoder encoder_;
+    std::string subsampling_;
+};
+
+// 头信息索引：扫描目录只读取 SOF/APPn 标记段，保存为可内存映射的二进制索引，
+// 之后按路径 O(1) 查询而不访问文件（计划一个 epoch 时按宽高比分桶等场景）
+class JpegInfoIndexWrapper {
+public:
+    explicit JpegInfoIndexWrapper(py::object path) {
+        if (!path.is_none()) {
+            load(path.cast<std::string>());
+        }
+    }
+
+    // roots 可以是单个路径或路径列表，返回本次解析的文件数（未变化的文件跳过）
+    size_t scan(py::object roots, int num_threads) {
+        std::vector<std::string> paths;
+        if (py::isinstance<py::str>(roots)) {
+            paths.push_back(roots.cast<std::string>());
         } else {
-            return py::array_t<uint8_t>(
-                py::buffer_info(
-                    data.data(), sizeof(uint8_t),
-                    py::format_descriptor<uint8_t>::format(),
-                    3, { height, width, channels },
-                    { width * channels * sizeof(uint8_t),
-                      channels * sizeof(uint8_t),
-                      sizeof(uint8_t) }
-                )
-            );
+            paths = roots.cast<std::vector<std::string>>();
         }
+        py::gil_scoped_release release;
+        return index_.scan(paths, num_threads);
     }
 
+    void add(const std::string& path) {
+        bool ok;
+        {
+            py::gil_scoped_release release;
+            ok = index_.add(path);
+        }
+        if (!ok) {
+            throw std::runtime_error("Failed to read JPEG header: " + path);
+        }
+    }
+
+    // 不访问文件系统；不在索引中时返回 None
+    py::object get(const std::string& path) const {
+        JpegInfo info;
+        JpegFileStamp stamp;
+        if (!index_.find(path, info, stamp)) {
+            return py::none();
+        }
+        py::dict result;
+        result["width"] = static_cast<int>(info.width);
+        result["height"] = static_cast<int>(info.height);
+        result["channels"] = info.components == 1 ? 1 : 3;
+        result["components"] = static_cast<int>(info.components);
+        result["subsampling"] = subsampling_name(info.subsampling);
+        result["colorspace"] = colorspace_name(info.colorspace);
+        result["orientation"] = static_cast<int>(info.orientation);
+        result["restart_interval"] = static_cast<int>(info.restart_interval);
+        result["progressive"] = info.progressive != 0;
+        result["arithmetic"] = info.arithmetic != 0;
+        result["file_size"] = stamp.size;
+        return std::move(result);
+    }
+
+    bool contains(const std::string& path) const {
+        JpegInfo info;
+        return index_.find(path, info);
+    }
+
+    size_t size() const { return index_.size(); }
+
+    void save(const std::string& path) {
+        bool ok;
+        {
+            py::gil_scoped_release release;
+            ok = index_.save(path);
+        }
+        if (!ok) {
+            throw std::runtime_error("Failed to save JPEG info index: " + path);
+        }
+    }
+
+    void load(const std::string& path) {
+        bool ok;
+        {
+            py::gil_scoped_release release;
+            ok = index_.load(path);
+        }
+        if (!ok) {
+            throw std::runtime_error("Failed to load JPEG info index: " + path);
+        }
+    }
+
+    void clear() { index_.clear(); }
+
 private:
-    TurboJpegDecoder decoder_;
+    JpegInfoIndex index_;
 };
 
+// 无损变换：在 DCT 域旋转 / 翻转 / 裁剪，不解码、不重新量化，结果在 JPEG 缓冲池中（调用前必须已释放 GIL）
+static uint8_t* transform_source(const JpegSource& src, const std::vector<JpegTransformOp>& ops,
+                                 size_t& size) {
+    MappedFile file;
+    const uint8_t* data = src.data();
+    size_t length = src.size();
+    if (src.is_file()) {
+        if (!file.open(src.filename())) {
+            return nullptr;
+        }
+        data = file.data();
+        length = file.size();
+    }
+    return transformJpeg(data, length, ops.data(), static_cast<int>(ops.size()), &size);
+}
+
+static py::array_t<uint8_t> transform(py::object source, py::iterable ops, bool perfect, bool trim,
+                                      bool gray, bool progressive, bool copy_markers) {
+    JpegSource src(source);
+    const std::vector<JpegTransformOp> steps =
+        parse_transform_ops(ops, transform_options(perfect, trim, gray, progressive, copy_markers));
+    uint8_t* jpeg;
+    size_t size = 0;
+    {
+        py::gil_scoped_release release;
+        jpeg = transform_source(src, steps, size);
+    }
+
+    if (!jpeg) {
+        throw std::runtime_error("Failed to transform image: " + src.describe());
+    }
+    return adopt_jpeg(jpeg, size);
+}
+
+// 同一组 ops 作用于多张图，提交到共享线程池并行执行
+static py::list transform_batch(py::iterable sources, py::iterable ops, int num_threads, bool perfect,
+                                bool trim, bool gray, bool progressive, bool copy_markers) {
+    struct Transformed {
+        uint8_t* jpeg = nullptr;
+        size_t size = 0;
+    };
+    std::vector<JpegSource> srcs = to_sources(sources);
+    const std::vector<JpegTransformOp> steps =
+        parse_transform_ops(ops, transform_options(perfect, trim, gray, progressive, copy_markers));
+    if (srcs.size() > static_cast<size_t>(INT_MAX)) {
+        throw std::runtime_error("Too many images in one batch");
+    }
+
+    std::vector<Transformed> results(srcs.size());
+    {
+        py::gil_scoped_release release;
+        parallelFor(static_cast<int>(srcs.size()), num_threads, [&](int i) {
+            results[i].jpeg = transform_source(srcs[i], steps, results[i].size);
+        });
+    }
+
+    for (size_t i = 0; i < results.size(); ++i) {
+        if (!results[i].jpeg) {
+            for (auto& r : results) {
+                TurboJpegEncoder::release(r.jpeg);
+            }
+            throw std::runtime_error("Failed to transform image: " + srcs[i].describe());
+        }
+    }
+
+    py::list jpegs;
+    for (auto& r : results) {
+        jpegs.append(adopt_jpeg(r.jpeg, r.size));
+    }
+    return jpegs;
+}
+
+// 进程级统计（解码器与编码器共用，见 native/EncoderStats.h）转成 dict：
+// 每个阶段 {count, total_ns, bytes, histogram}，histogram[i] 为耗时 < 2^i 微秒的调用数（最后一格不封顶）
+static py::dict stats_dict() {
+    static const char* const STAGE_NAMES[STATS_NUM_STAGES] = {
+        "io", "header", "coding", "copy_out"
+    };
+    EncoderStats stats;
+    getStats(&stats);
+
+    py::dict result;
+    for (int s = 0; s < STATS_NUM_STAGES; ++s) {
+        const StageStats& stage = stats.stages[s];
+        py::list histogram;
+        for (int b = 0; b < STATS_NUM_BUCKETS; ++b) {
+            histogram.append(stage.histogram[b]);
+        }
+        py::dict entry;
+        entry["count"] = stage.count;
+        entry["total_ns"] = stage.totalNanos;
+        entry["bytes"] = stage.bytes;
+        entry["histogram"] = histogram;
+        result[STAGE_NAMES[s]] = entry;
+    }
+    result["allocated_bytes"] = stats.allocatedBytes;
+    result["allocations"] = stats.allocations;
+    result["errors"] = stats.errors;
+    return result;
+}
+
 PYBIND11_MODULE(_decoder, m) {
     m.doc() = "TurboJPEG JPEG decoder plugin (optimized with zero-copy and fast DCT)";
 
     py::class_<TurboJpegDecoderWrapper>(m, "TurboJpegDecoder")
-        .def(py::init<>())
+        .def(py::init<const std::string&, bool>(), py::arg("pixel_format") = "auto", py::arg("cache") = false,
+             "pixel_format: auto (BGR, GRAY for grayscale JPEGs), bgr, rgb, bgrx, rgbx, bgra, rgba or gray; "
+             "cache: look up / store decoded images in the process-wide cache (see set_cache_budget); "
+             "cache hits are read-only arrays shared between callers")
+        .def_property_readonly("pixel_format", &TurboJpegDecoderWrapper::pixel_format)
+        .def_property_readonly("cache", &TurboJpegDecoderWrapper::cache)
         .def("decode", &TurboJpegDecoderWrapper::decode,
-             "Decode JPEG file to new numpy array (has copy)")
+             py::arg("source"),
+             "Decode JPEG file or bytes-like object to a numpy array backed by the decoder arena (no copy)")
         .def("get_image_info", &TurboJpegDecoderWrapper::get_image_info,
-             "Get image dimensions (width, height, channels)")
+             py::arg("source"), py::arg("max_width") = 0, py::arg("max_height") = 0,
+             "Get image dimensions (width, height, channels); with max_width/max_height, the size decode_scaled would produce")
         .def("decode_to_buffer", &TurboJpegDecoderWrapper::decode_to_buffer,
+             py::arg("source"), py::arg("buffer"),
              "Decode JPEG directly to pre-allocated numpy buffer (zero-copy)")
         .def("decode_fast", &TurboJpegDecoderWrapper::decode_fast,
-             "Decode JPEG with fast DCT algorithm (slightly lower quality, faster)");
+             py::arg("source"),
+             "Decode JPEG with fast DCT algorithm (slightly lower quality, faster)")
+        .def("decode_scaled", &TurboJpegDecoderWrapper::decode_scaled,
+             py::arg("source"), py::arg("max_width"), py::arg("max_height"),
+             "Decode at the largest DCT scaling factor (1/1 .. 1/8) that fits within max_width x max_height (0 = no limit)")
+        .def("decode_scaled_to_buffer", &TurboJpegDecoderWrapper::decode_scaled_to_buffer,
+             py::arg("source"), py::arg("buffer"), py::arg("max_width"), py::arg("max_height"),
+             "Scaled decode directly to pre-allocated numpy buffer (zero-copy)")
+        .def("decode_yuv", &TurboJpegDecoderWrapper::decode_yuv,
+             py::arg("source"),
+             "Decode to raw planar YUV (no color conversion / upsampling); returns (Y, U, V) or (Y,) for grayscale")
+        .def("decode_region", &TurboJpegDecoderWrapper::decode_region,
+             py::arg("source"), py::arg("x"), py::arg("y"), py::arg("width"), py::arg("height"),
+             "Decode only the width x height window at (x, y); skips MCU rows/columns outside it")
+        .def("decode_region_to_buffer", &TurboJpegDecoderWrapper::decode_region_to_buffer,
+             py::arg("source"), py::arg("x"), py::arg("y"), py::arg("width"), py::arg("height"),
+             py::arg("buffer"),
+             "Decode a window directly into a (possibly row-strided) uint8 numpy buffer")
+        .def("decode_parallel", &TurboJpegDecoderWrapper::decode_parallel,
+             py::arg("source"), py::arg("buffer"), py::arg("num_threads") = 0,
+             "Decode one JPEG on several threads by splitting at restart markers; "
+             "returns 'parallel', or 'serial' if the file has no usable restart markers")
+        .def("decode_batch", &TurboJpegDecoderWrapper::decode_batch,
+             py::arg("sources"), py::arg("num_threads") = 0,
+             "Decode many JPEG files / bytes in parallel (GIL released), returns list of numpy arrays")
+        .def("decode_batch_to_buffers", &TurboJpegDecoderWrapper::decode_batch_to_buffers,
+             py::arg("sources"), py::arg("buffers"), py::arg("num_threads") = 0,
+             "Decode many JPEG files / bytes in parallel directly into pre-allocated numpy buffers")
+        .def("open", [](py::object self, const std::string& filename) {
+                 return JpegImage(self, filename);
+             },
+             py::arg("filename"),
+             "Memory-map a JPEG file and parse its header once; returns a JpegImage that decodes without re-reading the file")
+        .def("stats", [](const TurboJpegDecoderWrapper&) { return stats_dict(); },
+             "Per-stage timings (io, header, coding, copy_out), allocation and error counts "
+             "since the last reset_stats(); process-wide, collected only after enable_stats()")
+        .def("reset_stats", [](const TurboJpegDecoderWrapper&) { resetStats(); },
+             "Restart the process-wide stats from zero");
+
+    py::class_<TurboJpegEncoderWrapper>(m, "TurboJpegEncoder")
+        .def(py::init<int, const std::string&, bool, bool, bool, int, py::object>(),
+             py::arg("quality") = 90, py::arg("subsampling") = "420", py::arg("fast_dct") = true,
+             py::arg("progressive") = false, py::arg("optimize") = false, py::arg("restart_rows") = 0,
+             py::arg("quant_table") = py::none(),
+             "quality: 1-100; subsampling: 444, 422, 420, 440, 411 or gray; fast_dct: TurboJPEG fast integer DCT; "
+             "progressive: progressive JPEG; optimize: optimized Huffman tables; restart_rows: MCU rows between "
+             "restart markers (0 = none); quant_table: 64 or 128 values 1-255 in natural order replacing the "
+             "quality-scaled tables")
+        .def_property_readonly("quality", &TurboJpegEncoderWrapper::quality)
+        .def_property_readonly("subsampling", &TurboJpegEncoderWrapper::subsampling)
+        .def_property_readonly("fast_dct", &TurboJpegEncoderWrapper::fast_dct)
+        .def_property_readonly("progressive", &TurboJpegEncoderWrapper::progressive)
+        .def_property_readonly("optimize", &TurboJpegEncoderWrapper::optimize)
+        .def_property_readonly("restart_rows", &TurboJpegEncoderWrapper::restart_rows)
+        .def_property_readonly("quant_table", &TurboJpegEncoderWrapper::quant_table)
+        .def("encode", &TurboJpegEncoderWrapper::encode,
+             py::arg("image"), py::arg("pixel_format") = "auto",
+             "Encode a uint8 (H, W[, C]) array (rows may be strided) to JPEG; returns a 1D uint8 array "
+             "backed by the native buffer pool (no copy)")
+        .def("encode_batch", &TurboJpegEncoderWrapper::encode_batch,
+             py::arg("images"), py::arg("pixel_format") = "auto", py::arg("num_threads") = 0,
+             "Encode many images on the shared native thread pool (GIL released), returns list of JPEG arrays");
+
+    py::class_<JpegInfoIndexWrapper>(m, "JpegInfoIndex")
+        .def(py::init<py::object>(), py::arg("path") = py::none(),
+             "Create an empty index, or map an index file written by save()")
+        .def("scan", &JpegInfoIndexWrapper::scan,
+             py::arg("roots"), py::arg("num_threads") = 0,
+             "Index the .jpg/.jpeg files below one or more directories in parallel (GIL released); "
+             "unchanged files (same mtime and size) are skipped. Returns the number of files parsed")
+        .def("add", &JpegInfoIndexWrapper::add, py::arg("path"),
+             "Parse a single file into the index")
+        .def("get", &JpegInfoIndexWrapper::get, py::arg("path"),
+             "Header info dict for path without touching the file, or None if not indexed")
+        .def("__contains__", &JpegInfoIndexWrapper::contains)
+        .def("__len__", &JpegInfoIndexWrapper::size)
+        .def("save", &JpegInfoIndexWrapper::save, py::arg("path"),
+             "Write the index (atomically replacing path) and map the new file")
+        .def("load", &JpegInfoIndexWrapper::load, py::arg("path"),
+             "Map an index file, dropping the current records")
+        .def("clear", &JpegInfoIndexWrapper::clear);
+
+    m.def("enable_stats", [](bool enabled) { setStatsEnabled(enabled); },
+          py::arg("enabled") = true,
+          "Turn the per-stage timing and allocation counters on or off (off by default, near-zero cost)");
+
+    m.def("set_cache_budget", [](size_t max_bytes) {
+              py::gil_scoped_release release;
+              DecodedImageCache::instance().set_budget(max_bytes);
+          },
+          py::arg("max_bytes"),
+          "Byte budget of the decoded image cache used by TurboJpegDecoder(cache=True); "
+          "0 (the default) disables it, a smaller budget evicts down to it");
+    m.def("cache_info", []() {
+              DecodedImageCacheStats stats = DecodedImageCache::instance().stats();
+              py::dict info;
+              info["budget"] = stats.budget;
+              info["bytes"] = stats.bytes;
+              info["entries"] = stats.entries;
+              info["hits"] = stats.hits;
+              info["misses"] = stats.misses;
+              info["evictions"] = stats.evictions;
+              return info;
+          },
+          "Decoded image cache state: budget, bytes, entries, hits, misses, evictions");
+    m.def("clear_cache", []() {
+              py::gil_scoped_release release;
+              DecodedImageCache::instance().clear();
+          },
+          "Drop every cached image (arrays already returned stay valid)");
+
+    m.def("transform", &transform,
+          py::arg("source"), py::arg("ops"), py::arg("perfect") = false, py::arg("trim") = false,
+          py::arg("gray") = false, py::arg("progressive") = false, py::arg("copy_markers") = true,
+          "Losslessly apply ops (hflip, vflip, transpose, transverse, rot90, rot180, rot270, "
+          "('crop', x, y, w, h)) in the DCT domain; returns the new JPEG as a uint8 array");
+    m.def("transform_batch", &transform_batch,
+          py::arg("sources"), py::arg("ops"), py::arg("num_threads") = 0, py::arg("perfect") = false,
+          py::arg("trim") = false, py::arg("gray") = false, py::arg("progressive") = false,
+          py::arg("copy_markers") = true,
+          "Apply the same lossless ops to many JPEG files / bytes on the shared thread pool");
+
+    py::class_<JpegImage>(m, "JpegImage")
+        .def_property_readonly("width", &JpegImage::width)
+        .def_property_readonly("height", &JpegImage::height)
+        .def_property_readonly("channels", &JpegImage::channels)
+        .def_property_readonly("shape", &JpegImage::shape,
+             "Shape of the decoded array: (height, width[, channels])")
+        .def("decode", [](JpegImage& self) { return self.decode(false); },
+             "Decode the mapped JPEG to a new numpy array")
+        .def("decode_fast", [](JpegImage& self) { return self.decode(true); },
+             "Decode the mapped JPEG with fast DCT algorithm")
+        .def("decode_to_buffer", &JpegImage::decode_to_buffer,
+             py::arg("buffer"),
+             "Decode the mapped JPEG directly to pre-allocated numpy buffer (zero-copy)")
+        .def("close", &JpegImage::close,
+             "Release the file mapping")
+        .def("__enter__", [](py::object self) { return self; })
+        .def("__exit__", [](JpegImage& self, py::args) { self.close(); });
+
+    py::class_<DecodePipeline>(m, "DecodePipeline")
+        .def(py::init<py::iterable, int, int, const std::string&>(),
+             py::arg("sources"), py::arg("num_workers") = 0, py::arg("max_in_flight") = 0,
+             py::arg("pixel_format") = "auto",
+             "Decode an iterable of file paths / bytes in the background and yield frames in order")
+        .def("__iter__", [](py::object self) { return self; })
+        .def("__next__", &DecodePipeline::next)
+        .def("close", &DecodePipeline::close,
+             "Stop the worker threads and drop frames not yet consumed")
+        .def("__enter__", [](py::object self) { return self; })
+        .def("__exit__", [](DecodePipeline& self, py::args) { self.close(); });
 }
@@ -0,0 +1,150 @@
+#include "restart_strips.h"
+#include "jpeg_header.h"
+#include <cstring>
+
+static size_t gcd(size_t a, size_t b) {
+    while (b != 0) {
+        size_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+bool RestartIndex::build(const uint8_t* data, size_t size, const JpegHeader& header) {
+    markers_.clear();
+    data_ = nullptr;
+
+    if (header.restart_interval <= 0 || header.progressive || header.arithmetic ||
+        header.scan_components != header.components || header.components > 4) {
+        return false;
+    }
+
+    // A single-component scan is non-interleaved: one 8x8 block per MCU
+    const int mcu_width = header.components == 1 ? 8 : 8 * header.max_h_samp;
+    mcu_height_ = header.components == 1 ? 8 : 8 * header.max_v_samp;
+    mcus_per_row_ = (header.width + mcu_width - 1) / mcu_width;
+    mcu_rows_ = (header.height + mcu_height_ - 1) / mcu_height_;
+    height_ = header.height;
+    restart_interval_ = header.restart_interval;
+
+    // Interval k starts at MCU k * R; it starts an MCU row when row * M is a
+    // multiple of R, i.e. every R / gcd(M, R) rows
+    row_step_ = static_cast<int>(restart_interval_ / gcd(mcus_per_row_, restart_interval_));
+    if (row_step_ * 2 > mcu_rows_) {
+        return false;
+    }
+
+    need_context_ = false;
+    for (int i = 0; i < header.components; ++i) {
+        if (header.v_samp[i] < header.max_v_samp) {
+            need_context_ = true;
+        }
+    }
+
+    // Walk the entropy-coded data for RSTn markers up to the EOI
+    size_t pos = header.scan_data_offset;
+    eoi_offset_ = 0;
+    while (pos + 1 < size) {
+        const void* hit = std::memchr(data + pos, 0xFF, size - pos - 1);
+        if (!hit) {
+            break;
+        }
+        pos = static_cast<const uint8_t*>(hit) - data;
+        const uint8_t code = data[pos + 1];
+        if (code == 0x00 || code == 0xFF) {
+            pos += 1;                  // stuffed zero, or fill byte before a marker
+        } else if (code >= 0xD0 && code <= 0xD7) {
+            if (code != 0xD0 + (markers_.size() & 7)) {
+                return false;          // out-of-sequence RST: corrupt stream
+            }
+            markers_.push_back(pos);
+            pos += 2;
+        } else if (code == 0xD9) {
+            eoi_offset_ = pos;
+            break;
+        } else {
+            return false;              // DNL, another scan, ...
+        }
+    }
+
+    const size_t total_mcus = static_cast<size_t>(mcus_per_row_) * mcu_rows_;
+    const size_t intervals = (total_mcus + restart_interval_ - 1) / restart_interval_;
+    if (eoi_offset_ == 0 || markers_.size() + 1 != intervals) {
+        markers_.clear();
+        return false;
+    }
+
+    data_ = data;
+    header_size_ = header.scan_data_offset;
+    sof_height_offset_ = header.sof_offset + 5;  // FF Cn Lh Ll P [Yh Yl]
+    return true;
+}
+
+void RestartIndex::plan(int max_strips, std::vector<RestartStrip>& strips) const {
+    strips.clear();
+    if (!data_ || max_strips < 1) {
+        return;
+    }
+
+    const int segments = (mcu_rows_ + row_step_ - 1) / row_step_;
+    const int count = max_strips < segments ? max_strips : segments;
+    const size_t total_intervals = markers_.size() + 1;
+
+    for (int i = 0; i < count; ++i) {
+        const int r0 = (segments * i / count) * row_step_;
+        const int r1 = i + 1 == count ? mcu_rows_ : (segments * (i + 1) / count) * row_step_;
+
+        const int c0 = (need_context_ && r0 > 0) ? r0 - row_step_ : r0;
+        int c1 = r1;
+        if (need_context_ && r1 < mcu_rows_) {
+            c1 = r1 + row_step_ < mcu_rows_ ? r1 + row_step_ : mcu_rows_;
+        }
+
+        RestartStrip strip;
+        strip.first_row = r0 * mcu_height_;
+        strip.rows = (r1 * mcu_height_ < height_ ? r1 * mcu_height_ : height_) - strip.first_row;
+        strip.context_rows = (r0 - c0) * mcu_height_;
+        strip.jpeg_height = (c1 * mcu_height_ < height_ ? c1 * mcu_height_ : height_) - c0 * mcu_height_;
+        strip.first_interval = static_cast<size_t>(c0) * mcus_per_row_ / restart_interval_;
+        strip.end_interval = c1 == mcu_rows_ ? total_intervals
+                                             : static_cast<size_t>(c1) * mcus_per_row_ / restart_interval_;
+        strips.push_back(strip);
+    }
+}
+
+size_t RestartIndex::interval_begin(size_t interval) const {
+    return interval == 0 ? header_size_ : markers_[interval - 1] + 2;
+}
+
+size_t RestartIndex::interval_end(size_t interval) const {
+    return interval < markers_.size() ? markers_[interval] : eoi_offset_;
+}
+
+void RestartIndex::build_strip_jpeg(const RestartStrip& strip, std::vector<uint8_t>& out) const {
+    const size_t scan_size = interval_end(strip.end_interval - 1) - interval_begin(strip.first_interval);
+    out.resize(header_size_ + scan_size + 2);
+
+    // Header up to and including SOS, with the strip's height
+    uint8_t* dst = out.data();
+    std::memcpy(dst, data_, header_size_);
+    dst[sof_height_offset_] = static_cast<uint8_t>(strip.jpeg_height >> 8);
+    dst[sof_height_offset_ + 1] = static_cast<uint8_t>(strip.jpeg_height & 0xFF);
+    dst += header_size_;
+
+    // Intervals with their RST markers renumbered from RST0 (same byte count)
+    for (size_t k = strip.first_interval; k < strip.end_interval; ++k) {
+        const size_t begin = interval_begin(k);
+        const size_t length = interval_end(k) - begin;
+        std::memcpy(dst, data_ + begin, length);
+        dst += length;
+        if (k + 1 < strip.end_interval) {
+            dst[0] = 0xFF;
+            dst[1] = static_cast<uint8_t>(0xD0 + ((k - strip.first_interval) & 7));
+            dst += 2;
+        }
+    }
+
+    dst[0] = 0xFF;
+    dst[1] = 0xD9;
+}
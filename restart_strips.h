@@ -0,0 +1,61 @@
+#ifndef RESTART_STRIPS_H
+#define RESTART_STRIPS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct JpegHeader;
+
+// Splitting a baseline JPEG with restart markers into horizontal strips that
+// can be decoded independently. Each strip is rebuilt as a standalone JPEG:
+// the original header with the SOF height patched, the restart intervals
+// covering the strip (RST markers renumbered from RST0) and an EOI.
+//
+// When chroma is vertically subsampled, the fancy upsampler needs the chroma
+// rows around each strip edge, so strips also carry the restart-aligned MCU
+// rows just above and below them; those context rows are decoded and
+// discarded, which makes the strip output identical to a serial decode.
+
+struct RestartStrip {
+    int first_row;           // first output row of the strip in the full image
+    int rows;                // output rows written by the strip
+    int context_rows;        // rows decoded above first_row and discarded
+    int jpeg_height;         // height of the rebuilt strip JPEG
+    size_t first_interval;   // restart intervals [first_interval, end_interval)
+    size_t end_interval;
+};
+
+class RestartIndex {
+public:
+    // Index the restart markers of data (whose header is already parsed).
+    // Returns false when the image cannot be split: no DRI, progressive or
+    // arithmetic coding, more than one scan, or intervals that don't line up
+    // with MCU row starts often enough.
+    bool build(const uint8_t* data, size_t size, const JpegHeader& header);
+
+    // Split into at most max_strips strips of roughly equal height
+    void plan(int max_strips, std::vector<RestartStrip>& strips) const;
+
+    // Write the standalone JPEG for strip into out (resized to fit)
+    void build_strip_jpeg(const RestartStrip& strip, std::vector<uint8_t>& out) const;
+
+private:
+    size_t interval_begin(size_t interval) const;
+    size_t interval_end(size_t interval) const;
+
+    const uint8_t* data_ = nullptr;
+    size_t header_size_ = 0;           // bytes before the entropy-coded data
+    size_t sof_height_offset_ = 0;     // offset of the 16-bit SOF height field
+    size_t eoi_offset_ = 0;            // offset of the EOI marker ending the scan
+    std::vector<size_t> markers_;      // offset of each RSTn marker's 0xFF byte
+    int height_ = 0;
+    int mcu_height_ = 0;               // pixel rows per MCU row
+    int mcu_rows_ = 0;
+    int row_step_ = 0;                 // MCU rows between interval-aligned row starts
+    int mcus_per_row_ = 0;
+    int restart_interval_ = 0;
+    bool need_context_ = false;
+};
+
+#endif // RESTART_STRIPS_H
@@ -0,0 +1,76 @@
+#include "scratch_arena.h"
+#include "native/EncoderStats.h"
+#include <algorithm>
+#include <new>
+
+static void destroy_block(ArenaBlock* block) {
+    delete[] block->data;
+    delete block;
+}
+
+void ArenaBlock::release(ArenaBlock* block) {
+    if (!block) {
+        return;
+    }
+    // Hold the arena locally: recycle() may drop the last other reference
+    std::shared_ptr<ScratchArena> arena = std::move(block->arena);
+    arena->recycle(block);
+}
+
+std::shared_ptr<ScratchArena> ScratchArena::create() {
+    return std::shared_ptr<ScratchArena>(new ScratchArena());
+}
+
+ScratchArena::~ScratchArena() {
+    for (ArenaBlock* block : free_) {
+        destroy_block(block);
+    }
+}
+
+ArenaBlock* ScratchArena::acquire(size_t size) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto best = free_.end();
+        for (auto it = free_.begin(); it != free_.end(); ++it) {
+            if ((*it)->capacity >= size &&
+                (best == free_.end() || (*it)->capacity < (*best)->capacity)) {
+                best = it;
+            }
+        }
+        if (best != free_.end()) {
+            ArenaBlock* block = *best;
+            free_.erase(best);
+            block->arena = shared_from_this();
+            return block;
+        }
+    }
+
+    // No free block fits: allocate outside the lock (no zero fill)
+    uint8_t* data = new (std::nothrow) uint8_t[size > 0 ? size : 1];
+    if (!data) {
+        return nullptr;
+    }
+    recordAllocation(size);
+    ArenaBlock* block = new ArenaBlock();
+    block->data = data;
+    block->capacity = size;
+    block->arena = shared_from_this();
+    return block;
+}
+
+void ScratchArena::recycle(ArenaBlock* block) {
+    ArenaBlock* evicted = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_.push_back(block);
+        if (free_.size() > MAX_FREE_BLOCKS) {
+            auto smallest = std::min_element(free_.begin(), free_.end(),
+                [](const ArenaBlock* a, const ArenaBlock* b) { return a->capacity < b->capacity; });
+            evicted = *smallest;
+            free_.erase(smallest);
+        }
+    }
+    if (evicted) {
+        destroy_block(evicted);
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef SCRATCH_ARENA_H
+#define SCRATCH_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class ScratchArena;
+
+// Uninitialized block handed out by ScratchArena::acquire().
+// Keeps its arena alive until released, so blocks may outlive their decoder.
+struct ArenaBlock {
+    uint8_t* data;
+    size_t capacity;
+    std::shared_ptr<ScratchArena> arena;
+
+    // Return block to its arena's free list (thread-safe; block may not be used afterwards)
+    static void release(ArenaBlock* block);
+};
+
+// Grow-only pool of large output blocks. Released blocks are kept and reused
+// by later acquire() calls, so a steady decode loop that drops each frame
+// before decoding the next one performs no heap allocation per frame.
+class ScratchArena : public std::enable_shared_from_this<ScratchArena> {
+public:
+    static std::shared_ptr<ScratchArena> create();
+    ~ScratchArena();
+
+    ScratchArena(const ScratchArena&) = delete;
+    ScratchArena& operator=(const ScratchArena&) = delete;
+
+    // Block with capacity >= size: reuses the smallest free block that fits,
+    // otherwise allocates a new one. Returns nullptr when out of memory.
+    ArenaBlock* acquire(size_t size);
+
+private:
+    ScratchArena() {}
+    void recycle(ArenaBlock* block);
+
+    // Free blocks kept for reuse; beyond this the smallest ones are freed
+    static const size_t MAX_FREE_BLOCKS = 4;
+
+    std::mutex mutex_;
+    std::vector<ArenaBlock*> free_;
+
+    friend struct ArenaBlock;
+};
+
+#endif // SCRATCH_ARENA_H
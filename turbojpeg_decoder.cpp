@@ -1,13 +1,24 @@
 #include "turbojpeg_decoder.h"
+#include "jpeg_header.h"
+#include "libjpeg_decode.h"
+#include "restart_strips.h"
+#include "mapped_file.h"
+#include "scratch_arena.h"
+#include "native/EncoderStats.h"
 #include <turbojpeg.h>
 #include <fstream>
 #include <iostream>
+#include <climits>
 #include <cstring>
 #include <algorithm>
+#include <atomic>
+#include <thread>
 
 TurboJpegDecoder::TurboJpegDecoder()
     : handle_(nullptr)
-    , initialized_(false) {
+    , initialized_(false)
+    , pixel_format_(PIXEL_FORMAT_AUTO)
+    , output_arena_(ScratchArena::create()) {
 }
 
 TurboJpegDecoder::~TurboJpegDecoder() {
@@ -30,44 +41,120 @@ bool TurboJpegDecoder::init() {
     return true;
 }
 
-bool TurboJpegDecoder::decode(const std::string& filename,
-                              std::vector<uint8_t>& output,
-                              int& width, int& height, int& channels) {
-    if (!initialized_) {
-        std::cerr << "Decoder not initialized" << std::endl;
-        return false;
-    }
+// Initial read size for header-only probes; grown on demand when APPn
+// segments (EXIF thumbnails, ICC profiles) push SOF/SOS further out
+static const size_t PROBE_CHUNK = 16 * 1024;
 
-    // 1. Read JPEG file into memory
+// Read just enough of the file for the marker parser to reach the first SOS
+static bool probe_header(const std::string& filename, std::vector<uint8_t>& buffer,
+                         JpegHeader& header) {
+    StatsTimer timer(STATS_HEADER);  // file reads included: only the header is read
     std::ifstream file(filename, std::ios::binary | std::ios::ate);
     if (!file.is_open()) {
         std::cerr << "Failed to open file: " << filename << std::endl;
         return false;
     }
 
-    std::streamsize size = file.tellg();
+    const size_t file_size = static_cast<size_t>(file.tellg());
     file.seekg(0, std::ios::beg);
 
-    std::vector<uint8_t> jpeg_buffer(size);
-    if (!file.read(reinterpret_cast<char*>(jpeg_buffer.data()), size)) {
-        std::cerr << "Failed to read file" << std::endl;
+    size_t have = 0;
+    size_t want = std::min(file_size, PROBE_CHUNK);
+    while (true) {
+        buffer.resize(want);
+        if (!file.read(reinterpret_cast<char*>(buffer.data() + have),
+                       static_cast<std::streamsize>(want - have))) {
+            std::cerr << "Failed to read file" << std::endl;
+            return false;
+        }
+        have = want;
+
+        size_t needed = 0;
+        JpegHeaderStatus status = parse_jpeg_header(buffer.data(), have, header, needed);
+        if (status == JPEG_HEADER_OK) {
+            timer.setBytes(static_cast<long long>(have));
+            return true;
+        }
+        if (status == JPEG_HEADER_INVALID || have == file_size) {
+            std::cerr << "Failed to read JPEG header: " << filename << std::endl;
+            recordError();
+            return false;
+        }
+        want = std::min(file_size, std::max(needed, have * 2));
+    }
+}
+
+// Shrink width/height to the largest scaling factor whose output fits in
+// max_width x max_height (0 = unbounded), or the smallest factor if none fits
+static void scale_to_fit(int& width, int& height, int max_width, int max_height) {
+    int num_factors = 0;
+    const tjscalingfactor* factors = tjGetScalingFactors(&num_factors);
+    if (!factors || num_factors <= 0) {
+        return;
+    }
+
+    tjscalingfactor best = { 0, 1 };
+    tjscalingfactor smallest = { 1, 1 };
+    for (int i = 0; i < num_factors; ++i) {
+        const tjscalingfactor& f = factors[i];
+        if (f.num > f.denom) {
+            continue;  // never upscale
+        }
+        if (f.num * smallest.denom < smallest.num * f.denom) {
+            smallest = f;
+        }
+        const bool fits = (max_width <= 0 || TJSCALED(width, f) <= max_width) &&
+                          (max_height <= 0 || TJSCALED(height, f) <= max_height);
+        if (fits && f.num * best.denom > best.num * f.denom) {
+            best = f;
+        }
+    }
+
+    const tjscalingfactor& chosen = best.num > 0 ? best : smallest;
+    width = TJSCALED(width, chosen);
+    height = TJSCALED(height, chosen);
+}
+
+// TJPF_* value for each PixelFormat (PIXEL_FORMAT_BGR .. PIXEL_FORMAT_GRAY)
+static const int TJ_PIXEL_FORMATS[] = {
+    TJPF_BGR, TJPF_RGB, TJPF_BGRX, TJPF_RGBX, TJPF_BGRA, TJPF_RGBA, TJPF_GRAY
+};
+
+int TurboJpegDecoder::output_channels(bool grayscale) const {
+    if (pixel_format_ == PIXEL_FORMAT_AUTO) {
+        return grayscale ? 1 : 3;
+    }
+    return tjPixelSize[TJ_PIXEL_FORMATS[pixel_format_]];
+}
+
+int TurboJpegDecoder::tj_pixel_format(int channels) const {
+    if (pixel_format_ == PIXEL_FORMAT_AUTO) {
+        return (channels == 1) ? TJPF_GRAY : TJPF_BGR;
+    }
+    return TJ_PIXEL_FORMATS[pixel_format_];
+}
+
+bool TurboJpegDecoder::read_header(const uint8_t* jpeg_data, size_t jpeg_size,
+                                   int& width, int& height, int& channels) {
+    if (!jpeg_data || jpeg_size == 0) {
+        std::cerr << "JPEG data is empty" << std::endl;
         return false;
     }
-    file.close();
 
-    // 2. Get JPEG image information
     int jpeg_subsocks = 0;
     int jpeg_width = 0;
     int jpeg_height = 0;
+    int jpeg_colorspace = 0;
 
+    StatsTimer timer(STATS_HEADER);
     int retval = tjDecompressHeader3(
         handle_,
-        jpeg_buffer.data(),
-        static_cast<unsigned long>(size),
+        jpeg_data,
+        static_cast<unsigned long>(jpeg_size),
         &jpeg_width,
         &jpeg_height,
         &jpeg_subsocks,
-        &channels
+        &jpeg_colorspace
     );
 
     if (retval < 0) {
@@ -76,6 +163,7 @@ bool TurboJpegDecoder::decode(const std::string& filename,
                 "Failed to read JPEG header: %s",
                 tjGetErrorStr());
         std::cerr << error_msg << std::endl;
+        recordError();
         return false;
     }
 
@@ -83,36 +171,30 @@ bool TurboJpegDecoder::decode(const std::string& filename,
     height = jpeg_height;
 
     // Determine channels based on chrominance subsampling
-    // TJSAMP_GRAY = 4 means grayscale image
-    // Other values (0, 1, 2, 3, 5) mean color images
-    if (jpeg_subsocks == 4) {  // TJSAMP_GRAY
-        channels = 1;
-    } else {
-        channels = 3;  // Color image
-    }
+    // TJSAMP_GRAY (3) means grayscale image, everything else is color
+    channels = output_channels(jpeg_subsocks == TJSAMP_GRAY);
 
-    // 3. Allocate output buffer
-    // TurboJPEG uses TJPF_BGR which is BGR, bytes per pixel = 3
-    const int bytes_per_pixel = (channels == 1) ? 1 : 3;
-    const int pitch = width * bytes_per_pixel;  // No padding between rows
-    const size_t buffer_size = pitch * height;
-
-    output.resize(buffer_size);
+    return true;
+}
 
-    // 4. Decode JPEG directly to BGR format
-    // TJPF_BGR = 2 (BGR byte order)
-    // TJFLAG_ACCURATEDCT = 16 (Use accurate DCT/IDCT algorithms)
-    // TJFLAG_FASTDCT = 8 (Use fast DCT/IDCT algorithms)
-    const int pixel_format = (channels == 1) ? TJPF_GRAY : TJPF_BGR;
-    const int flags = TJFLAG_ACCURATEDCT;  // High quality
+bool TurboJpegDecoder::decompress(const uint8_t* jpeg_data, size_t jpeg_size,
+                                  uint8_t* output, int width, int height,
+                                  int channels, int flags, size_t pitch) {
+    // Default TJPF_BGR: B, G, R byte order (OpenCV compatible), bytes per pixel = 3
+    const int pixel_format = tj_pixel_format(channels);
+    if (pitch == 0) {
+        pitch = static_cast<size_t>(width) * tjPixelSize[pixel_format];  // No padding between rows
+    }
 
-    retval = tjDecompress2(
+    StatsTimer timer(STATS_CODING);
+    timer.setBytes(static_cast<long long>(jpeg_size));
+    int retval = tjDecompress2(
         handle_,
-        jpeg_buffer.data(),
-        static_cast<unsigned long>(size),
-        output.data(),
+        jpeg_data,
+        static_cast<unsigned long>(jpeg_size),
+        output,
         width,
-        pitch,
+        static_cast<int>(pitch),
         height,
         pixel_format,
         flags
@@ -124,15 +206,96 @@ bool TurboJpegDecoder::decode(const std::string& filename,
                 "Failed to decompress JPEG: %s",
                 tjGetErrorStr());
         std::cerr << error_msg << std::endl;
+        recordError();
         return false;
     }
 
     return true;
 }
 
+bool TurboJpegDecoder::check_output(size_t buffer_size, size_t& pitch,
+                                    int width, int height, int channels) {
+    const size_t row_bytes = static_cast<size_t>(width) * channels;
+    if (pitch == 0) {
+        pitch = row_bytes;
+    }
+    if (pitch < row_bytes || pitch > static_cast<size_t>(INT_MAX)) {
+        std::cerr << "Invalid output pitch: need >= " << row_bytes << ", got " << pitch << std::endl;
+        return false;
+    }
+
+    const size_t required_size = pitch * (height - 1) + row_bytes;
+    if (buffer_size < required_size) {
+        std::cerr << "Output buffer too small: need " << required_size
+                  << ", got " << buffer_size << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool TurboJpegDecoder::decode(const std::string& filename,
+                              std::vector<uint8_t>& output,
+                              int& width, int& height, int& channels) {
+    if (!initialized_) {
+        std::cerr << "Decoder not initialized" << std::endl;
+        return false;
+    }
+
+    // Map the file instead of copying it; pages are read lazily while decoding
+    MappedFile file;
+    if (!file.open(filename)) {
+        return false;
+    }
+
+    return decode(file.data(), file.size(), output, width, height, channels);
+}
+
+bool TurboJpegDecoder::decode(const uint8_t* jpeg_data, size_t jpeg_size,
+                              std::vector<uint8_t>& output,
+                              int& width, int& height, int& channels) {
+    if (!initialized_) {
+        std::cerr << "Decoder not initialized" << std::endl;
+        return false;
+    }
+
+    // 1. Get JPEG image information
+    if (!read_header(jpeg_data, jpeg_size, width, height, channels)) {
+        return false;
+    }
+
+    // 2. Allocate output buffer
+    const size_t buffer_size = static_cast<size_t>(width) * height * channels;
+    output.resize(buffer_size);
+
+    // 3. Decode JPEG directly to BGR format
+    // TJFLAG_ACCURATEDCT = 16 (Use accurate DCT/IDCT algorithms)
+    // TJFLAG_FASTDCT = 8 (Use fast DCT/IDCT algorithms)
+    return decompress(jpeg_data, jpeg_size, output.data(), width, height, channels,
+                      TJFLAG_ACCURATEDCT);  // High quality
+}
+
 bool TurboJpegDecoder::decode_to_buffer(const std::string& filename,
                                        uint8_t* output_buffer,
-                                       size_t buffer_size,
+                                       size_t buffer_size, size_t pitch,
+                                       int& width, int& height, int& channels) {
+    if (!initialized_) {
+        std::cerr << "Decoder not initialized" << std::endl;
+        return false;
+    }
+
+    // Map the file instead of copying it; pages are read lazily while decoding
+    MappedFile file;
+    if (!file.open(filename)) {
+        return false;
+    }
+
+    return decode_to_buffer(file.data(), file.size(),
+                            output_buffer, buffer_size, pitch, width, height, channels);
+}
+
+bool TurboJpegDecoder::decode_to_buffer(const uint8_t* jpeg_data, size_t jpeg_size,
+                                       uint8_t* output_buffer,
+                                       size_t buffer_size, size_t pitch,
                                        int& width, int& height, int& channels) {
     if (!initialized_) {
         std::cerr << "Decoder not initialized" << std::endl;
@@ -144,232 +307,580 @@ bool TurboJpegDecoder::decode_to_buffer(const std::string& filename,
         return false;
     }
 
-    // 1. Read JPEG file
-    std::ifstream file(filename, std::ios::binary | std::ios::ate);
-    if (!file.is_open()) {
-        std::cerr << "Failed to open file: " << filename << std::endl;
+    // 1. Get JPEG info
+    if (!read_header(jpeg_data, jpeg_size, width, height, channels)) {
         return false;
     }
 
-    std::streamsize size = file.tellg();
-    file.seekg(0, std::ios::beg);
+    // 2. Check the buffer holds height rows of pitch bytes
+    if (!check_output(buffer_size, pitch, width, height, channels)) {
+        return false;
+    }
+
+    // 3. Decode directly to output buffer (zero-copy from decoder perspective)
+    return decompress(jpeg_data, jpeg_size, output_buffer, width, height, channels,
+                      TJFLAG_ACCURATEDCT, pitch);
+}
 
-    std::vector<uint8_t> jpeg_buffer(size);
-    if (!file.read(reinterpret_cast<char*>(jpeg_buffer.data()), size)) {
-        std::cerr << "Failed to read file" << std::endl;
+bool TurboJpegDecoder::get_image_info(const std::string& filename,
+                                      int& width, int& height, int& channels) {
+    if (!initialized_) {
+        std::cerr << "Decoder not initialized" << std::endl;
         return false;
     }
-    file.close();
 
-    // 2. Get JPEG info
-    int jpeg_subsocks = 0;
-    int jpeg_width = 0;
-    int jpeg_height = 0;
+    // Header-only probe: reads the first few KB instead of the whole file
+    JpegHeader header;
+    if (!probe_header(filename, input_arena_, header)) {
+        return false;
+    }
 
-    int retval = tjDecompressHeader3(
-        handle_,
-        jpeg_buffer.data(),
-        static_cast<unsigned long>(size),
-        &jpeg_width,
-        &jpeg_height,
-        &jpeg_subsocks,
-        &channels
-    );
+    width = header.width;
+    height = header.height;
+    channels = output_channels(header.components == 1);
+    return true;
+}
 
-    if (retval < 0) {
-        std::cerr << "Failed to read JPEG header" << std::endl;
+bool TurboJpegDecoder::get_image_info(const uint8_t* jpeg_data, size_t jpeg_size,
+                                      int& width, int& height, int& channels) {
+    if (!initialized_) {
+        std::cerr << "Decoder not initialized" << std::endl;
         return false;
     }
 
-    width = jpeg_width;
-    height = jpeg_height;
+    return read_header(jpeg_data, jpeg_size, width, height, channels);
+}
 
-    // Determine channels from subsampling
-    if (jpeg_subsocks == 4) {  // TJSAMP_GRAY
-        channels = 1;
-    } else {
-        channels = 3;
+bool TurboJpegDecoder::decode_to_arena(const std::string& filename,
+                                      ArenaBlock*& block,
+                                      int& width, int& height, int& channels,
+                                      bool fast_dct) {
+    if (!initialized_) {
+        std::cerr << "Decoder not initialized" << std::endl;
+        return false;
     }
 
-    // 3. Calculate required buffer size
-    const int bytes_per_pixel = (channels == 1) ? 1 : 3;
-    const size_t required_size = width * height * bytes_per_pixel;
+    MappedFile file;
+    if (!file.open(filename)) {
+        return false;
+    }
 
-    if (buffer_size < required_size) {
-        std::cerr << "Output buffer too small: need " << required_size
-                  << ", got " << buffer_size << std::endl;
+    return decode_to_arena(file.data(), file.size(), block, width, height, channels, fast_dct);
+}
+
+bool TurboJpegDecoder::decode_to_arena(const uint8_t* jpeg_data, size_t jpeg_size,
+                                      ArenaBlock*& block,
+                                      int& width, int& height, int& channels,
+                                      bool fast_dct) {
+    block = nullptr;
+    if (!initialized_) {
+        std::cerr << "Decoder not initialized" << std::endl;
         return false;
     }
 
-    // 4. Decode directly to output buffer (zero-copy from decoder perspective)
-    const int pitch = width * bytes_per_pixel;
-    const int pixel_format = (channels == 1) ? TJPF_GRAY : TJPF_BGR;
-    const int flags = TJFLAG_ACCURATEDCT;
+    if (!read_header(jpeg_data, jpeg_size, width, height, channels)) {
+        return false;
+    }
 
-    retval = tjDecompress2(
-        handle_,
-        jpeg_buffer.data(),
-        static_cast<unsigned long>(size),
-        output_buffer,  // 直接解码到用户提供的 buffer
-        width,
-        pitch,
-        height,
-        pixel_format,
-        flags
-    );
+    const size_t buffer_size = static_cast<size_t>(width) * height * channels;
+    ArenaBlock* output = output_arena_->acquire(buffer_size);
+    if (!output) {
+        std::cerr << "Failed to allocate output buffer: " << buffer_size << " bytes" << std::endl;
+        return false;
+    }
 
-    if (retval < 0) {
-        std::cerr << "Failed to decompress JPEG" << std::endl;
+    if (!decompress(jpeg_data, jpeg_size, output->data, width, height, channels,
+                    fast_dct ? TJFLAG_FASTDCT : TJFLAG_ACCURATEDCT)) {
+        ArenaBlock::release(output);
         return false;
     }
 
+    block = output;
     return true;
 }
 
-bool TurboJpegDecoder::get_image_info(const std::string& filename,
-                                      int& width, int& height, int& channels) {
+bool TurboJpegDecoder::decode_parallel(const std::string& filename,
+                                       uint8_t* output_buffer, size_t buffer_size, size_t pitch,
+                                       int num_threads,
+                                       int& width, int& height, int& channels, int& strips) {
     if (!initialized_) {
         std::cerr << "Decoder not initialized" << std::endl;
         return false;
     }
 
-    // Read JPEG file
-    std::ifstream file(filename, std::ios::binary | std::ios::ate);
-    if (!file.is_open()) {
-        std::cerr << "Failed to open file: " << filename << std::endl;
+    MappedFile file;
+    if (!file.open(filename)) {
         return false;
     }
 
-    std::streamsize size = file.tellg();
-    file.seekg(0, std::ios::beg);
+    return decode_parallel(file.data(), file.size(), output_buffer, buffer_size, pitch,
+                           num_threads, width, height, channels, strips);
+}
 
-    std::vector<uint8_t> jpeg_buffer(size);
-    if (!file.read(reinterpret_cast<char*>(jpeg_buffer.data()), size)) {
-        std::cerr << "Failed to read file" << std::endl;
+bool TurboJpegDecoder::decode_parallel(const uint8_t* jpeg_data, size_t jpeg_size,
+                                       uint8_t* output_buffer, size_t buffer_size, size_t pitch,
+                                       int num_threads,
+                                       int& width, int& height, int& channels, int& strips) {
+    strips = 1;
+    if (!initialized_) {
+        std::cerr << "Decoder not initialized" << std::endl;
         return false;
     }
-    file.close();
 
-    // Get info
-    int jpeg_subsocks = 0;
-    int jpeg_width = 0;
-    int jpeg_height = 0;
+    if (!output_buffer) {
+        std::cerr << "Output buffer is null" << std::endl;
+        return false;
+    }
 
-    int retval = tjDecompressHeader3(
-        handle_,
-        jpeg_buffer.data(),
-        static_cast<unsigned long>(size),
-        &jpeg_width,
-        &jpeg_height,
-        &jpeg_subsocks,
-        &channels
-    );
+    if (!read_header(jpeg_data, jpeg_size, width, height, channels)) {
+        return false;
+    }
 
-    if (retval < 0) {
-        std::cerr << "Failed to read JPEG header" << std::endl;
+    if (!check_output(buffer_size, pitch, width, height, channels)) {
         return false;
     }
 
-    width = jpeg_width;
-    height = jpeg_height;
+    if (num_threads <= 0) {
+        num_threads = static_cast<int>(std::thread::hardware_concurrency());
+        if (num_threads <= 0) num_threads = 4;
+    }
+
+    // Split at restart markers when the stream allows it
+    std::vector<RestartStrip> plan;
+    RestartIndex index;
+    JpegHeader header;
+    size_t bytes_needed = 0;
+    if (num_threads > 1 &&
+        parse_jpeg_header(jpeg_data, jpeg_size, header, bytes_needed) == JPEG_HEADER_OK &&
+        index.build(jpeg_data, jpeg_size, header)) {
+        index.plan(num_threads, plan);
+    }
+
+    if (plan.size() > 1) {
+        const int pixel_format = tj_pixel_format(channels);
+        std::atomic<size_t> next_strip(0);
+        std::atomic<bool> failed(false);
+        auto worker = [&]() {
+            std::vector<uint8_t> strip_jpeg, scratch;
+            while (!failed) {
+                const size_t i = next_strip.fetch_add(1);
+                if (i >= plan.size()) break;
+                const RestartStrip& strip = plan[i];
+                try {
+                    index.build_strip_jpeg(strip, strip_jpeg);
+                    if (!libjpeg_decode_rows(strip_jpeg.data(), strip_jpeg.size(),
+                                             strip.context_rows, strip.rows, pixel_format,
+                                             output_buffer + static_cast<size_t>(strip.first_row) * pitch,
+                                             pitch, scratch)) {
+                        failed = true;
+                    }
+                } catch (...) {
+                    failed = true;  // allocation failure
+                }
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (size_t t = 1; t < plan.size(); ++t) {
+            threads.emplace_back(worker);
+        }
+        worker();  // the calling thread decodes a strip too
+
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        if (!failed) {
+            strips = static_cast<int>(plan.size());
+            return true;
+        }
+        std::cerr << "Parallel decode failed, retrying serially" << std::endl;
+    }
+
+    return decompress(jpeg_data, jpeg_size, output_buffer, width, height, channels,
+                      TJFLAG_ACCURATEDCT, pitch);
+}
+
+bool TurboJpegDecoder::decode_yuv(const std::string& filename, ArenaBlock*& block, YuvPlanes& planes) {
+    block = nullptr;
+    if (!initialized_) {
+        std::cerr << "Decoder not initialized" << std::endl;
+        return false;
+    }
+
+    MappedFile file;
+    if (!file.open(filename)) {
+        return false;
+    }
+
+    return decode_yuv(file.data(), file.size(), block, planes);
+}
+
+bool TurboJpegDecoder::decode_yuv(const uint8_t* jpeg_data, size_t jpeg_size,
+                                  ArenaBlock*& block, YuvPlanes& planes) {
+    block = nullptr;
+    if (!initialized_) {
+        std::cerr << "Decoder not initialized" << std::endl;
+        return false;
+    }
 
-    // Determine channels from subsampling
-    if (jpeg_subsocks == 4) {  // TJSAMP_GRAY
-        channels = 1;
-    } else {
-        channels = 3;
+    if (!jpeg_data || jpeg_size == 0) {
+        std::cerr << "JPEG data is empty" << std::endl;
+        return false;
+    }
+
+    int width = 0, height = 0, subsamp = 0, colorspace = 0;
+    const long long header_start = statsClock();
+    const int header_ret = tjDecompressHeader3(handle_, jpeg_data, static_cast<unsigned long>(jpeg_size),
+                                               &width, &height, &subsamp, &colorspace);
+    recordStage(STATS_HEADER, header_start, static_cast<long long>(jpeg_size));
+    if (header_ret < 0) {
+        std::cerr << "Failed to read JPEG header: " << tjGetErrorStr() << std::endl;
+        recordError();
+        return false;
+    }
+
+    if (subsamp < 0 || (colorspace != TJCS_YCbCr && colorspace != TJCS_GRAY)) {
+        std::cerr << "JPEG is not YCbCr with standard subsampling; cannot decode to YUV planes" << std::endl;
+        return false;
+    }
+
+    // Plane geometry from TurboJPEG so it matches what tjDecompressToYUVPlanes writes
+    planes.num_planes = (subsamp == TJSAMP_GRAY) ? 1 : 3;
+    planes.subsampling = subsamp;
+    size_t total_size = 0;
+    for (int i = 0; i < 3; ++i) {
+        if (i < planes.num_planes) {
+            planes.width[i] = tjPlaneWidth(i, width, subsamp);
+            planes.height[i] = tjPlaneHeight(i, height, subsamp);
+        } else {
+            planes.width[i] = planes.height[i] = 0;
+        }
+        planes.offset[i] = total_size;
+        total_size += static_cast<size_t>(planes.width[i]) * planes.height[i];
+    }
+
+    ArenaBlock* output = output_arena_->acquire(total_size);
+    if (!output) {
+        std::cerr << "Failed to allocate output buffer: " << total_size << " bytes" << std::endl;
+        return false;
     }
 
+    unsigned char* dst[3] = { nullptr, nullptr, nullptr };
+    for (int i = 0; i < planes.num_planes; ++i) {
+        dst[i] = output->data + planes.offset[i];
+    }
+
+    // strides = NULL: each plane is tightly packed (stride = plane width)
+    const long long start = statsClock();
+    const int ret = tjDecompressToYUVPlanes(handle_, jpeg_data, static_cast<unsigned long>(jpeg_size),
+                                            dst, width, nullptr, height, TJFLAG_ACCURATEDCT);
+    recordStage(STATS_CODING, start, static_cast<long long>(jpeg_size));
+    if (ret < 0) {
+        std::cerr << "Failed to decompress JPEG to YUV: " << tjGetErrorStr() << std::endl;
+        recordError();
+        ArenaBlock::release(output);
+        return false;
+    }
+
+    block = output;
     return true;
 }
 
-bool TurboJpegDecoder::decode_fast(const std::string& filename,
-                                  std::vector<uint8_t>& output,
-                                  int& width, int& height, int& channels) {
+bool TurboJpegDecoder::open(const std::string& filename, MappedFile& file,
+                            int& width, int& height, int& channels) {
     if (!initialized_) {
         std::cerr << "Decoder not initialized" << std::endl;
         return false;
     }
 
-    // 1. Read JPEG file
-    std::ifstream file(filename, std::ios::binary | std::ios::ate);
-    if (!file.is_open()) {
-        std::cerr << "Failed to open file: " << filename << std::endl;
+    if (!file.open(filename)) {
         return false;
     }
 
-    std::streamsize size = file.tellg();
-    file.seekg(0, std::ios::beg);
+    // Parse the header straight from the mapping: only the header pages are read
+    JpegHeader header;
+    size_t needed = 0;
+    const long long start = statsClock();
+    const JpegHeaderStatus status = parse_jpeg_header(file.data(), file.size(), header, needed);
+    recordStage(STATS_HEADER, start, 0);
+    if (status != JPEG_HEADER_OK) {
+        std::cerr << "Failed to read JPEG header: " << filename << std::endl;
+        recordError();
+        file.close();
+        return false;
+    }
+
+    width = header.width;
+    height = header.height;
+    channels = output_channels(header.components == 1);
+    return true;
+}
 
-    std::vector<uint8_t> jpeg_buffer(size);
-    if (!file.read(reinterpret_cast<char*>(jpeg_buffer.data()), size)) {
-        std::cerr << "Failed to read file" << std::endl;
+bool TurboJpegDecoder::get_image_info(const std::string& filename,
+                                      int max_width, int max_height,
+                                      int& width, int& height, int& channels) {
+    if (!get_image_info(filename, width, height, channels)) {
         return false;
     }
-    file.close();
 
-    // 2. Get JPEG info
-    int jpeg_subsocks = 0;
-    int jpeg_width = 0;
-    int jpeg_height = 0;
+    scale_to_fit(width, height, max_width, max_height);
+    return true;
+}
 
-    int retval = tjDecompressHeader3(
-        handle_,
-        jpeg_buffer.data(),
-        static_cast<unsigned long>(size),
-        &jpeg_width,
-        &jpeg_height,
-        &jpeg_subsocks,
-        &channels
-    );
+bool TurboJpegDecoder::get_image_info(const uint8_t* jpeg_data, size_t jpeg_size,
+                                      int max_width, int max_height,
+                                      int& width, int& height, int& channels) {
+    if (!get_image_info(jpeg_data, jpeg_size, width, height, channels)) {
+        return false;
+    }
 
-    if (retval < 0) {
-        std::cerr << "Failed to read JPEG header" << std::endl;
+    scale_to_fit(width, height, max_width, max_height);
+    return true;
+}
+
+bool TurboJpegDecoder::decode_scaled(const std::string& filename,
+                                     int max_width, int max_height,
+                                     ArenaBlock*& block,
+                                     int& width, int& height, int& channels) {
+    block = nullptr;
+    if (!initialized_) {
+        std::cerr << "Decoder not initialized" << std::endl;
         return false;
     }
 
-    width = jpeg_width;
-    height = jpeg_height;
+    MappedFile file;
+    if (!file.open(filename)) {
+        return false;
+    }
+
+    return decode_scaled(file.data(), file.size(), max_width, max_height,
+                         block, width, height, channels);
+}
 
-    // Determine channels from subsampling
-    if (jpeg_subsocks == 4) {  // TJSAMP_GRAY
-        channels = 1;
-    } else {
-        channels = 3;
+bool TurboJpegDecoder::decode_scaled(const uint8_t* jpeg_data, size_t jpeg_size,
+                                     int max_width, int max_height,
+                                     ArenaBlock*& block,
+                                     int& width, int& height, int& channels) {
+    block = nullptr;
+    if (!initialized_) {
+        std::cerr << "Decoder not initialized" << std::endl;
+        return false;
     }
 
-    // 3. Allocate output buffer
-    const int bytes_per_pixel = (channels == 1) ? 1 : 3;
-    const int pitch = width * bytes_per_pixel;
-    const size_t buffer_size = pitch * height;
+    if (!read_header(jpeg_data, jpeg_size, width, height, channels)) {
+        return false;
+    }
+    scale_to_fit(width, height, max_width, max_height);
 
-    output.resize(buffer_size);
+    const size_t buffer_size = static_cast<size_t>(width) * height * channels;
+    ArenaBlock* output = output_arena_->acquire(buffer_size);
+    if (!output) {
+        std::cerr << "Failed to allocate output buffer: " << buffer_size << " bytes" << std::endl;
+        return false;
+    }
 
-    // 4. Decode with FAST DCT algorithm (TJFLAG_FASTDCT)
-    // Faster but slightly lower quality
-    const int pixel_format = (channels == 1) ? TJPF_GRAY : TJPF_BGR;
-    const int flags = TJFLAG_FASTDCT;  // Fast DCT algorithm
+    // tjDecompress2 picks the scaling factor that produces exactly width x height
+    if (!decompress(jpeg_data, jpeg_size, output->data, width, height, channels,
+                    TJFLAG_ACCURATEDCT)) {
+        ArenaBlock::release(output);
+        return false;
+    }
 
-    retval = tjDecompress2(
-        handle_,
-        jpeg_buffer.data(),
-        static_cast<unsigned long>(size),
-        output.data(),
-        width,
-        pitch,
-        height,
-        pixel_format,
-        flags
-    );
+    block = output;
+    return true;
+}
 
-    if (retval < 0) {
-        std::cerr << "Failed to decompress JPEG (fast)" << std::endl;
+bool TurboJpegDecoder::decode_scaled_to_buffer(const std::string& filename,
+                                               int max_width, int max_height,
+                                               uint8_t* output_buffer, size_t buffer_size, size_t pitch,
+                                               int& width, int& height, int& channels) {
+    if (!initialized_) {
+        std::cerr << "Decoder not initialized" << std::endl;
+        return false;
+    }
+
+    MappedFile file;
+    if (!file.open(filename)) {
+        return false;
+    }
+
+    return decode_scaled_to_buffer(file.data(), file.size(), max_width, max_height,
+                                   output_buffer, buffer_size, pitch, width, height, channels);
+}
+
+bool TurboJpegDecoder::decode_scaled_to_buffer(const uint8_t* jpeg_data, size_t jpeg_size,
+                                               int max_width, int max_height,
+                                               uint8_t* output_buffer, size_t buffer_size, size_t pitch,
+                                               int& width, int& height, int& channels) {
+    if (!initialized_) {
+        std::cerr << "Decoder not initialized" << std::endl;
+        return false;
+    }
+
+    if (!output_buffer) {
+        std::cerr << "Output buffer is null" << std::endl;
         return false;
     }
 
+    if (!read_header(jpeg_data, jpeg_size, width, height, channels)) {
+        return false;
+    }
+    scale_to_fit(width, height, max_width, max_height);
+
+    if (!check_output(buffer_size, pitch, width, height, channels)) {
+        return false;
+    }
+
+    return decompress(jpeg_data, jpeg_size, output_buffer, width, height, channels,
+                      TJFLAG_ACCURATEDCT, pitch);
+}
+
+bool TurboJpegDecoder::decode_region(const std::string& filename, int x, int y,
+                                     int region_width, int region_height,
+                                     ArenaBlock*& block, int& channels) {
+    block = nullptr;
+    if (!initialized_) {
+        std::cerr << "Decoder not initialized" << std::endl;
+        return false;
+    }
+
+    MappedFile file;
+    if (!file.open(filename)) {
+        return false;
+    }
+
+    return decode_region(file.data(), file.size(), x, y, region_width, region_height,
+                         block, channels);
+}
+
+bool TurboJpegDecoder::decode_region(const uint8_t* jpeg_data, size_t jpeg_size, int x, int y,
+                                     int region_width, int region_height,
+                                     ArenaBlock*& block, int& channels) {
+    block = nullptr;
+    if (!initialized_) {
+        std::cerr << "Decoder not initialized" << std::endl;
+        return false;
+    }
+
+    int width, height;
+    if (!read_header(jpeg_data, jpeg_size, width, height, channels)) {
+        return false;
+    }
+
+    if (region_width <= 0 || region_height <= 0) {
+        std::cerr << "Region is empty" << std::endl;
+        return false;
+    }
+
+    const size_t pitch = static_cast<size_t>(region_width) * channels;
+    const size_t buffer_size = pitch * region_height;
+    ArenaBlock* output = output_arena_->acquire(buffer_size);
+    if (!output) {
+        std::cerr << "Failed to allocate output buffer: " << buffer_size << " bytes" << std::endl;
+        return false;
+    }
+
+    if (!libjpeg_decode_region(jpeg_data, jpeg_size, x, y, region_width, region_height,
+                               tj_pixel_format(channels), output->data, pitch, region_scratch_)) {
+        ArenaBlock::release(output);
+        return false;
+    }
+
+    block = output;
     return true;
 }
 
+bool TurboJpegDecoder::decode_region_to_buffer(const std::string& filename, int x, int y,
+                                               int region_width, int region_height,
+                                               uint8_t* output_buffer, size_t buffer_size, size_t pitch,
+                                               int& channels) {
+    if (!initialized_) {
+        std::cerr << "Decoder not initialized" << std::endl;
+        return false;
+    }
+
+    MappedFile file;
+    if (!file.open(filename)) {
+        return false;
+    }
+
+    return decode_region_to_buffer(file.data(), file.size(), x, y, region_width, region_height,
+                                   output_buffer, buffer_size, pitch, channels);
+}
+
+bool TurboJpegDecoder::decode_region_to_buffer(const uint8_t* jpeg_data, size_t jpeg_size, int x, int y,
+                                               int region_width, int region_height,
+                                               uint8_t* output_buffer, size_t buffer_size, size_t pitch,
+                                               int& channels) {
+    if (!initialized_) {
+        std::cerr << "Decoder not initialized" << std::endl;
+        return false;
+    }
+
+    if (!output_buffer) {
+        std::cerr << "Output buffer is null" << std::endl;
+        return false;
+    }
+
+    int width, height;
+    if (!read_header(jpeg_data, jpeg_size, width, height, channels)) {
+        return false;
+    }
+
+    if (region_width <= 0 || region_height <= 0) {
+        std::cerr << "Region is empty" << std::endl;
+        return false;
+    }
+
+    if (!check_output(buffer_size, pitch, region_width, region_height, channels)) {
+        return false;
+    }
+
+    return libjpeg_decode_region(jpeg_data, jpeg_size, x, y, region_width, region_height,
+                                 tj_pixel_format(channels), output_buffer, pitch, region_scratch_);
+}
+
+bool TurboJpegDecoder::decode_fast(const std::string& filename,
+                                  std::vector<uint8_t>& output,
+                                  int& width, int& height, int& channels) {
+    if (!initialized_) {
+        std::cerr << "Decoder not initialized" << std::endl;
+        return false;
+    }
+
+    // Map the file instead of copying it; pages are read lazily while decoding
+    MappedFile file;
+    if (!file.open(filename)) {
+        return false;
+    }
+
+    return decode_fast(file.data(), file.size(), output, width, height, channels);
+}
+
+bool TurboJpegDecoder::decode_fast(const uint8_t* jpeg_data, size_t jpeg_size,
+                                  std::vector<uint8_t>& output,
+                                  int& width, int& height, int& channels) {
+    if (!initialized_) {
+        std::cerr << "Decoder not initialized" << std::endl;
+        return false;
+    }
+
+    // 1. Get JPEG info
+    if (!read_header(jpeg_data, jpeg_size, width, height, channels)) {
+        return false;
+    }
+
+    // 2. Allocate output buffer
+    const size_t buffer_size = static_cast<size_t>(width) * height * channels;
+    output.resize(buffer_size);
+
+    // 3. Decode with FAST DCT algorithm (TJFLAG_FASTDCT)
+    // Faster but slightly lower quality
+    return decompress(jpeg_data, jpeg_size, output.data(), width, height, channels,
+                      TJFLAG_FASTDCT);  // Fast DCT algorithm
+}
+
 void TurboJpegDecoder::cleanup() {
     if (handle_) {
         tjDestroy(handle_);
@@ -1,13 +1,45 @@
 #ifndef TURBOJPEG_DECODER_H
 #define TURBOJPEG_DECODER_H
 
+#include <cstddef>
 #include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 
 // Forward declaration for TurboJPEG handle
 typedef void* tjhandle;
 
+class MappedFile;
+class ScratchArena;
+struct ArenaBlock;
+
+// Output pixel layout of the decode methods.
+// PIXEL_FORMAT_AUTO: GRAY for grayscale JPEGs, BGR (OpenCV order) otherwise.
+// The other formats apply to every image (grayscale JPEGs are expanded, color
+// JPEGs reduced to luminance for GRAY); X/A bytes are filled with 0xFF.
+enum PixelFormat {
+    PIXEL_FORMAT_AUTO = -1,
+    PIXEL_FORMAT_BGR = 0,
+    PIXEL_FORMAT_RGB,
+    PIXEL_FORMAT_BGRX,
+    PIXEL_FORMAT_RGBX,
+    PIXEL_FORMAT_BGRA,
+    PIXEL_FORMAT_RGBA,
+    PIXEL_FORMAT_GRAY
+};
+
+// Raw planar YCbCr as stored in the JPEG (no color conversion or upsampling).
+// Plane i starts at offset[i] of the output block and is width[i] x height[i]
+// bytes with no row padding. Grayscale JPEGs have a single (Y) plane.
+struct YuvPlanes {
+    int num_planes;
+    int subsampling;   // TJSAMP_* value
+    int width[3];
+    int height[3];
+    size_t offset[3];
+};
+
 class TurboJpegDecoder {
 public:
     TurboJpegDecoder();
@@ -16,36 +48,181 @@ public:
     // Initialize decoder
     bool init();
 
+    // Output pixel format for all decode methods (default PIXEL_FORMAT_AUTO);
+    // the channels out-parameters report its bytes per pixel
+    void set_pixel_format(PixelFormat format) { pixel_format_ = format; }
+    PixelFormat pixel_format() const { return pixel_format_; }
+
     // Decode JPEG file to BGR format (OpenCV compatible)
     // Output format: HWC, BGR, uint8
     bool decode(const std::string& filename,
                 std::vector<uint8_t>& output,
                 int& width, int& height, int& channels);
 
+    // Decode JPEG data already in memory (jpeg_data is not copied)
+    bool decode(const uint8_t* jpeg_data, size_t jpeg_size,
+                std::vector<uint8_t>& output,
+                int& width, int& height, int& channels);
+
     // Decode JPEG directly to pre-allocated buffer (zero-copy optimization)
-    // buffer_size must be >= width * height * channels
+    // Rows are written pitch bytes apart (0 = width * channels, no padding), so
+    // the buffer can be a row-padded image or a slot of a larger batch tensor.
+    // buffer_size must be >= (height - 1) * pitch + width * channels
     bool decode_to_buffer(const std::string& filename,
                          uint8_t* output_buffer,
-                         size_t buffer_size,
+                         size_t buffer_size, size_t pitch,
+                         int& width, int& height, int& channels);
+
+    bool decode_to_buffer(const uint8_t* jpeg_data, size_t jpeg_size,
+                         uint8_t* output_buffer,
+                         size_t buffer_size, size_t pitch,
                          int& width, int& height, int& channels);
 
     // Get image info without decoding
+    // The filename variant only reads the header (first few KB of the file)
     bool get_image_info(const std::string& filename,
                        int& width, int& height, int& channels);
 
+    bool get_image_info(const uint8_t* jpeg_data, size_t jpeg_size,
+                       int& width, int& height, int& channels);
+
+    // Decode into a block taken from the decoder's output arena instead of a
+    // fresh allocation. The block holds width * height * channels bytes and must
+    // be returned with ArenaBlock::release(); once released it is reused by the
+    // next call, so a steady decode loop does not allocate per frame.
+    bool decode_to_arena(const std::string& filename,
+                         ArenaBlock*& block,
+                         int& width, int& height, int& channels,
+                         bool fast_dct = false);
+
+    bool decode_to_arena(const uint8_t* jpeg_data, size_t jpeg_size,
+                         ArenaBlock*& block,
+                         int& width, int& height, int& channels,
+                         bool fast_dct = false);
+
+    // Scaled (DCT-domain) decoding for thumbnails and previews.
+    // Uses the largest TurboJPEG scaling factor (1/1, 7/8, ... 1/8) whose output
+    // fits within max_width x max_height (0 = no limit on that side); when even
+    // 1/8 is too big, 1/8 is used. width/height return the scaled output size.
+    bool get_image_info(const std::string& filename, int max_width, int max_height,
+                       int& width, int& height, int& channels);
+
+    bool get_image_info(const uint8_t* jpeg_data, size_t jpeg_size,
+                       int max_width, int max_height,
+                       int& width, int& height, int& channels);
+
+    bool decode_scaled(const std::string& filename, int max_width, int max_height,
+                       ArenaBlock*& block,
+                       int& width, int& height, int& channels);
+
+    bool decode_scaled(const uint8_t* jpeg_data, size_t jpeg_size,
+                       int max_width, int max_height,
+                       ArenaBlock*& block,
+                       int& width, int& height, int& channels);
+
+    // Same pitch / buffer_size rules as decode_to_buffer, for the scaled size
+    bool decode_scaled_to_buffer(const std::string& filename, int max_width, int max_height,
+                                 uint8_t* output_buffer, size_t buffer_size, size_t pitch,
+                                 int& width, int& height, int& channels);
+
+    bool decode_scaled_to_buffer(const uint8_t* jpeg_data, size_t jpeg_size,
+                                 int max_width, int max_height,
+                                 uint8_t* output_buffer, size_t buffer_size, size_t pitch,
+                                 int& width, int& height, int& channels);
+
+    // Region-of-interest decode of the region_width x region_height window at (x, y).
+    // Only the MCU columns covering the window are decoded and decoding stops
+    // after its last row, so memory is proportional to the window, not the image.
+    bool decode_region(const std::string& filename, int x, int y,
+                       int region_width, int region_height,
+                       ArenaBlock*& block, int& channels);
+
+    bool decode_region(const uint8_t* jpeg_data, size_t jpeg_size, int x, int y,
+                       int region_width, int region_height,
+                       ArenaBlock*& block, int& channels);
+
+    // Rows are written pitch bytes apart (0 = region_width * channels);
+    // buffer_size must cover (region_height - 1) * pitch + region_width * channels
+    bool decode_region_to_buffer(const std::string& filename, int x, int y,
+                                 int region_width, int region_height,
+                                 uint8_t* output_buffer, size_t buffer_size, size_t pitch,
+                                 int& channels);
+
+    bool decode_region_to_buffer(const uint8_t* jpeg_data, size_t jpeg_size, int x, int y,
+                                 int region_width, int region_height,
+                                 uint8_t* output_buffer, size_t buffer_size, size_t pitch,
+                                 int& channels);
+
+    // Multi-threaded decode of a single image. Baseline JPEGs with restart
+    // markers are split into strips at RST boundaries and the strips are decoded
+    // on num_threads threads (0 = all cores), producing the same pixels as a
+    // serial decode. Without usable restart markers this falls back to the
+    // serial path. strips reports how many strips were decoded (1 = serial).
+    // Same pitch / buffer_size rules as decode_to_buffer.
+    bool decode_parallel(const std::string& filename,
+                         uint8_t* output_buffer, size_t buffer_size, size_t pitch,
+                         int num_threads,
+                         int& width, int& height, int& channels, int& strips);
+
+    bool decode_parallel(const uint8_t* jpeg_data, size_t jpeg_size,
+                         uint8_t* output_buffer, size_t buffer_size, size_t pitch,
+                         int num_threads,
+                         int& width, int& height, int& channels, int& strips);
+
+    // Decode to planar YUV with tjDecompressToYUVPlanes, skipping color conversion
+    // and chroma upsampling; ignores the pixel format. Planes are laid out
+    // back to back in block as described by planes.
+    bool decode_yuv(const std::string& filename, ArenaBlock*& block, YuvPlanes& planes);
+
+    bool decode_yuv(const uint8_t* jpeg_data, size_t jpeg_size,
+                    ArenaBlock*& block, YuvPlanes& planes);
+
+    // Map file and parse its header once. The mapped data can then be decoded
+    // any number of times with the in-memory overloads (file.data(), file.size())
+    // without re-reading the file.
+    bool open(const std::string& filename, MappedFile& file,
+              int& width, int& height, int& channels);
+
     // Decode with fast DCT algorithm (faster but slightly lower quality)
     bool decode_fast(const std::string& filename,
                      std::vector<uint8_t>& output,
                      int& width, int& height, int& channels);
 
+    bool decode_fast(const uint8_t* jpeg_data, size_t jpeg_size,
+                     std::vector<uint8_t>& output,
+                     int& width, int& height, int& channels);
+
     // Check if initialized
     bool isInitialized() const { return initialized_; }
 
 private:
     void cleanup();
 
+    // Bytes per output pixel, and the TJPF_* value to decode with
+    int output_channels(bool grayscale) const;
+    int tj_pixel_format(int channels) const;
+
+    // Parse JPEG header; channels is output_channels() for the image
+    bool read_header(const uint8_t* jpeg_data, size_t jpeg_size,
+                     int& width, int& height, int& channels);
+
+    // Decompress to pixel_format_ rows pitch bytes apart (0 = tightly packed)
+    bool decompress(const uint8_t* jpeg_data, size_t jpeg_size,
+                    uint8_t* output, int width, int height,
+                    int channels, int flags, size_t pitch = 0);
+
+    // Resolve pitch 0 and check that a width x height x channels image fits
+    static bool check_output(size_t buffer_size, size_t& pitch,
+                             int width, int height, int channels);
+
     tjhandle handle_;
     bool initialized_;
+    PixelFormat pixel_format_;
+
+    // Grow-only scratch memory reused across calls
+    std::vector<uint8_t> input_arena_;           // header probe reads
+    std::shared_ptr<ScratchArena> output_arena_; // decode_to_arena() outputs
+    std::vector<uint8_t> region_scratch_;        // cropped rows in decode_region()
 };
 
 #endif // TURBOJPEG_DECODER_H
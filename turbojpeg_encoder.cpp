@@ -0,0 +1,80 @@
+#include "turbojpeg_encoder.h"
+#include "native/JpegBufferPool.h"
+#include <turbojpeg.h>
+#include <climits>
+#include <iostream>
+
+// TJPF_* value for each PixelFormat (PIXEL_FORMAT_BGR .. PIXEL_FORMAT_GRAY)
+static const int TJ_PIXEL_FORMATS[] = {
+    TJPF_BGR, TJPF_RGB, TJPF_BGRX, TJPF_RGBX, TJPF_BGRA, TJPF_RGBA, TJPF_GRAY
+};
+
+TurboJpegEncoder::TurboJpegEncoder(int quality, int subsampling, bool fast_dct, bool progressive,
+                                   bool optimize, int restart_rows,
+                                   const std::vector<uint16_t>& quant_table)
+    : params_(defaultEncodeParams(quality < 1 ? 1 : (quality > 100 ? 100 : quality)))
+    , quant_table_(quant_table) {
+    params_.subsampling = subsampling;
+    params_.fastDct = fast_dct ? 1 : 0;
+    params_.progressive = progressive ? 1 : 0;
+    params_.optimizeCoding = optimize ? 1 : 0;
+    params_.restartRows = restart_rows;
+    if (quant_table_.size() == 64) {
+        quant_table_.insert(quant_table_.end(), quant_table.begin(), quant_table.end());
+    }
+}
+
+int TurboJpegEncoder::bytes_per_pixel(PixelFormat format) {
+    if (format < PIXEL_FORMAT_BGR || format > PIXEL_FORMAT_GRAY) {
+        return 0;
+    }
+    return tjPixelSize[TJ_PIXEL_FORMATS[format]];
+}
+
+bool TurboJpegEncoder::encode(const uint8_t* pixels, int width, int height, size_t pitch,
+                              PixelFormat format, uint8_t*& jpeg, size_t& jpeg_size) const {
+    jpeg = nullptr;
+    jpeg_size = 0;
+    if (!pixels || width <= 0 || height <= 0 || bytes_per_pixel(format) == 0) {
+        std::cerr << "Invalid image to encode" << std::endl;
+        return false;
+    }
+    if (!validEncodeParams(params_)) {
+        std::cerr << "Invalid chroma subsampling or restart interval" << std::endl;
+        return false;
+    }
+    if (!quant_table_.empty() && quant_table_.size() != 128) {
+        std::cerr << "Quantization table must have 64 or 128 values" << std::endl;
+        return false;
+    }
+
+    const int pixel_format = TJ_PIXEL_FORMATS[format];
+    if (pitch == 0) {
+        pitch = static_cast<size_t>(width) * tjPixelSize[pixel_format];
+    }
+    if (pitch > INT_MAX) {
+        std::cerr << "Row pitch too large for TurboJPEG" << std::endl;
+        return false;
+    }
+
+    EncodeParams params = params_;
+    params.quantTable = quant_table_.empty() ? nullptr : quant_table_.data();
+
+    // Compressed into a pooled worst-case-size buffer, handed out without a copy
+    jpeg = encodeWithParams(pixels, width, height, static_cast<int>(pitch), pixel_format, params,
+                            nullptr, 0, &jpeg_size);
+    if (!jpeg) {
+        std::cerr << "Failed to compress JPEG" << std::endl;
+        jpeg_size = 0;
+        return false;
+    }
+    return true;
+}
+
+void TurboJpegEncoder::release(uint8_t* jpeg) {
+    releaseJpegBuffer(jpeg);
+}
+
+size_t TurboJpegEncoder::capacity(const uint8_t* jpeg) {
+    return jpegBufferCapacity(jpeg);
+}
@@ -0,0 +1,58 @@
+#ifndef TURBOJPEG_ENCODER_H
+#define TURBOJPEG_ENCODER_H
+
+#include "turbojpeg_decoder.h"
+#include "native/EncodeParams.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// JPEG encoder on the same native core as the JNI/JNA encoders (native/):
+// each calling thread compresses on its own cached TurboJPEG handle, and the
+// output goes straight into a buffer rented from the shared JPEG buffer pool.
+// Optimized Huffman tables, restart markers and custom quantization tables
+// go through libjpeg instead (native/EncodeParams.h).
+// The settings are fixed at construction, so one instance can be used from
+// any number of threads at once.
+class TurboJpegEncoder {
+public:
+    // quality 1..100 (clamped); subsampling is a TJSAMP_* value, ignored for
+    // GRAY input (always TJSAMP_GRAY); fast_dct selects TJFLAG_FASTDCT.
+    // restart_rows: MCU rows between restart markers (0 = none).
+    // quant_table: empty, or 64 (luminance, also used for chrominance) or 128
+    // values 1..255 in natural order; replaces the quality-scaled tables
+    TurboJpegEncoder(int quality, int subsampling, bool fast_dct, bool progressive = false,
+                     bool optimize = false, int restart_rows = 0,
+                     const std::vector<uint16_t>& quant_table = std::vector<uint16_t>());
+
+    int quality() const { return params_.quality; }
+    int subsampling() const { return params_.subsampling; }
+    bool fast_dct() const { return params_.fastDct != 0; }
+    bool progressive() const { return params_.progressive != 0; }
+    bool optimize() const { return params_.optimizeCoding != 0; }
+    int restart_rows() const { return params_.restartRows; }
+    const std::vector<uint16_t>& quant_table() const { return quant_table_; }
+
+    // Compress width x height pixels in format (PIXEL_FORMAT_AUTO is not
+    // accepted), rows pitch bytes apart (0 = width * bytes per pixel).
+    // X/A bytes are ignored. On success jpeg holds jpeg_size bytes and must be
+    // freed with release().
+    bool encode(const uint8_t* pixels, int width, int height, size_t pitch, PixelFormat format,
+                uint8_t*& jpeg, size_t& jpeg_size) const;
+
+    // Return a buffer from encode() to the buffer pool (nullptr is ignored)
+    static void release(uint8_t* jpeg);
+
+    // Bytes allocated for a buffer from encode(): its pool size class, sized
+    // for the worst case and usually many times jpeg_size
+    static size_t capacity(const uint8_t* jpeg);
+
+    // Bytes per pixel of format (0 for PIXEL_FORMAT_AUTO)
+    static int bytes_per_pixel(PixelFormat format);
+
+private:
+    EncodeParams params_;                // quantTable is set per encode from quant_table_
+    std::vector<uint16_t> quant_table_;  // 128 values, or empty
+};
+
+#endif // TURBOJPEG_ENCODER_H